@@ -0,0 +1,596 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+// Benchmarks for indexing, searching, formatting, and scanning directories.
+//
+// Synthetic corpora are generated into a temp directory (deterministically,
+// so results are comparable between builds), plus any files named on the
+// command line, such as the files in testsamples.  Results are written one
+// JSON object per line, for comparing runs with a script.
+//
+//      bench [--size MB] [--frames N] [--files N] [--dir DIR] [--keep] [file ...]
+
+#include "pch.h"
+
+#include "contentcache.h"
+#include "searcher.h"
+#include "vieweroptions.h"
+#include "fileinfo.h"
+#include "scan.h"
+#include "sorting.h"
+#include "encodings.h"
+#include "wcwidth.h"
+#include "output.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// Allocation counting.
+
+static std::atomic<uint64> s_allocs = 0;
+
+void* operator new(size_t size)
+{
+    ++s_allocs;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+//------------------------------------------------------------------------------
+// Timing and reporting.
+
+class Stopwatch
+{
+public:
+                    Stopwatch() { Restart(); }
+    void            Restart() { QueryPerformanceCounter(&m_start); m_allocs = CountAllocs(); }
+    double          Seconds() const;
+    uint64          Allocs() const { return CountAllocs() - m_allocs; }
+    // Str allocates with realloc rather than new, so it's counted separately.
+    static uint64   CountAllocs() { return s_allocs + CountStrAllocations(); }
+private:
+    LARGE_INTEGER   m_start;
+    uint64          m_allocs;
+};
+
+double Stopwatch::Seconds() const
+{
+    LARGE_INTEGER now;
+    LARGE_INTEGER freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    return double(now.QuadPart - m_start.QuadPart) / double(freq.QuadPart);
+}
+
+static void AppendJsonString(StrW& s, const WCHAR* p)
+{
+    s.Append(L"\"");
+    for (; *p; ++p)
+    {
+        if (*p == '"' || *p == '\\')
+            s.Printf(L"\\%c", *p);
+        else if (*p < ' ')
+            s.Printf(L"\\u%04x", *p);
+        else
+            s.Append(p, 1);
+    }
+    s.Append(L"\"");
+}
+
+// Reports one result.  Rates are omitted when their count is zero.
+static void Report(const WCHAR* bench, const WCHAR* corpus, const WCHAR* variant, const Stopwatch& sw,
+                   uint64 bytes, uint64 lines, uint64 frames=0, uint64 hits=0)
+{
+    const double seconds = max(sw.Seconds(), 1e-9);
+    const uint64 allocs = sw.Allocs();
+
+    StrW s;
+    s.Append(L"{\"bench\":");
+    AppendJsonString(s, bench);
+    s.Append(L",\"corpus\":");
+    AppendJsonString(s, corpus);
+    if (variant)
+    {
+        s.Append(L",\"variant\":");
+        AppendJsonString(s, variant);
+    }
+    s.Printf(L",\"seconds\":%.6f", seconds);
+    if (bytes)
+        s.Printf(L",\"bytes\":%I64u,\"mb_per_s\":%.2f", bytes, double(bytes) / seconds / (1024 * 1024));
+    if (lines)
+        s.Printf(L",\"lines\":%I64u,\"lines_per_s\":%.0f", lines, double(lines) / seconds);
+    if (frames)
+        s.Printf(L",\"frames\":%I64u,\"frames_per_s\":%.1f", frames, double(frames) / seconds);
+    if (hits)
+        s.Printf(L",\"hits\":%I64u", hits);
+    s.Printf(L",\"allocs\":%I64u}\n", allocs);
+
+    // Use narrow output, so the results can be redirected to a file.
+    StrUtf8 tmp;
+    tmp.SetW(s);
+    fputs(tmp.Text(), stdout);
+    fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+// Synthetic corpora.
+
+class Random
+{
+public:
+                    Random(uint64 seed) : m_state(seed) {}
+    uint32          Next();
+    uint32          Next(uint32 limit) { return Next() % limit; }
+private:
+    uint64          m_state;
+};
+
+uint32 Random::Next()
+{
+    // xorshift64*
+    m_state ^= m_state >> 12;
+    m_state ^= m_state << 25;
+    m_state ^= m_state >> 27;
+    return uint32((m_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static const WCHAR* const c_ascii_words[] =
+{
+    L"alpha", L"bravo", L"charlie", L"delta", L"echo", L"foxtrot", L"golf",
+    L"hotel", L"india", L"juliet", L"kilo", L"lima", L"mike", L"november",
+    L"oscar", L"papa", L"quebec", L"romeo", L"sierra", L"tango", L"uniform",
+    L"victor", L"whiskey", L"xray", L"yankee", L"zulu", L"needle", L"0x1234",
+    L"{", L"}", L"=", L"\t",
+};
+
+static const WCHAR* const c_unicode_words[] =
+{
+    L"\u00e9t\u00e9", L"na\u00efve", L"\u00fcber", L"stra\u00dfe", L"\u03b1\u03b2\u03b3",
+    L"\u043f\u0440\u0438\u0432\u0435\u0442", L"\u65e5\u672c\u8a9e", L"\u6f22\u5b57",
+    L"\u3072\u3089\u304c\u306a", L"\u30ab\u30bf\u30ab\u30ca", L"\U0001F600", L"needle",
+    L"alpha", L"omega", L"\u2192", L"\u00bd",
+};
+
+static const WCHAR* const c_dbcs_words[] =
+{
+    L"\u65e5\u672c\u8a9e", L"\u6f22\u5b57", L"\u3072\u3089\u304c\u306a",
+    L"\u30ab\u30bf\u30ab\u30ca", L"\u6771\u4eac", L"\u5927\u962a", L"needle",
+    L"alpha", L"omega", L"\u30c6\u30b9\u30c8",
+};
+
+enum class CorpusKind { ASCII, UTF8, UTF16, DBCS, LongLines, Binary };
+
+struct Corpus
+{
+    const WCHAR*    name;
+    CorpusKind      kind;
+};
+
+static const Corpus c_corpora[] =
+{
+    { L"ascii.txt",         CorpusKind::ASCII },
+    { L"utf8.txt",          CorpusKind::UTF8 },
+    { L"utf16.txt",         CorpusKind::UTF16 },
+    { L"dbcs932.txt",       CorpusKind::DBCS },
+    { L"longlines.txt",     CorpusKind::LongLines },
+    { L"binary.bin",        CorpusKind::Binary },
+};
+
+// Makes a line of random words, ending with a newline.
+template <size_t N>
+static void MakeLine(Random& rand, const WCHAR* const (&words)[N], unsigned max_words, StrW& line)
+{
+    line.Clear();
+    const unsigned count = 1 + rand.Next(max_words);
+    for (unsigned ii = 0; ii < count; ++ii)
+    {
+        if (ii)
+            line.Append(L" ");
+        line.Append(words[rand.Next(uint32(N))]);
+    }
+    line.Append(L"\r\n");
+}
+
+static void AppendEncoded(std::vector<BYTE>& buffer, UINT codepage, const WCHAR* p, unsigned len)
+{
+    const int needed = WideCharToMultiByte(codepage, 0, p, int(len), nullptr, 0, nullptr, nullptr);
+    if (needed > 0)
+    {
+        const size_t old_size = buffer.size();
+        buffer.resize(old_size + needed);
+        WideCharToMultiByte(codepage, 0, p, int(len), reinterpret_cast<char*>(buffer.data() + old_size), needed, nullptr, nullptr);
+    }
+}
+
+static bool WriteAll(HANDLE h, const void* p, DWORD len, Error& e)
+{
+    DWORD written;
+    if (!WriteFile(h, p, len, &written, nullptr) || written != len)
+    {
+        e.Sys();
+        return false;
+    }
+    return true;
+}
+
+static bool GenerateCorpus(const WCHAR* path, CorpusKind kind, uint64 size, Error& e)
+{
+    SHFile h = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h.Empty())
+    {
+        e.Sys();
+        return false;
+    }
+
+    Random rand(0x4c495354 + uint64(kind));
+    std::vector<BYTE> buffer;
+    StrW line;
+    uint64 written = 0;
+
+    if (kind == CorpusKind::UTF16)
+    {
+        static const BYTE c_bom[] = { 0xff, 0xfe };
+        buffer.insert(buffer.end(), c_bom, c_bom + sizeof(c_bom));
+    }
+
+    while (written < size)
+    {
+        switch (kind)
+        {
+        case CorpusKind::ASCII:
+            MakeLine(rand, c_ascii_words, 16, line);
+            AppendEncoded(buffer, CP_UTF8, line.Text(), line.Length());
+            break;
+        case CorpusKind::UTF8:
+            MakeLine(rand, c_unicode_words, 16, line);
+            AppendEncoded(buffer, CP_UTF8, line.Text(), line.Length());
+            break;
+        case CorpusKind::UTF16:
+            MakeLine(rand, c_unicode_words, 16, line);
+            buffer.insert(buffer.end(), reinterpret_cast<const BYTE*>(line.Text()), reinterpret_cast<const BYTE*>(line.Text() + line.Length()));
+            break;
+        case CorpusKind::DBCS:
+            MakeLine(rand, c_dbcs_words, 16, line);
+            AppendEncoded(buffer, 932, line.Text(), line.Length());
+            break;
+        case CorpusKind::LongLines:
+            // Lines up to 1MB, longer than the max line length, so that
+            // processing has to split them.
+            for (size_t end = buffer.size() + 1 + rand.Next(1024 * 1024); buffer.size() < end;)
+            {
+                const WCHAR* const word = c_ascii_words[rand.Next(uint32(_countof(c_ascii_words)))];
+                AppendEncoded(buffer, CP_UTF8, word, unsigned(wcslen(word)));
+                buffer.push_back(' ');
+            }
+            buffer.push_back('\n');
+            break;
+        case CorpusKind::Binary:
+            for (unsigned ii = 0; ii < 4096; ++ii)
+                buffer.push_back(BYTE(rand.Next()));
+            break;
+        }
+
+        if (buffer.size() >= 1024 * 1024)
+        {
+            if (!WriteAll(h, buffer.data(), DWORD(buffer.size()), e))
+                return false;
+            written += buffer.size();
+            buffer.clear();
+        }
+    }
+
+    return buffer.empty() || WriteAll(h, buffer.data(), DWORD(buffer.size()), e);
+}
+
+static bool GenerateDirectory(const WCHAR* dir, unsigned count, Error& e)
+{
+    if (!CreateDirectoryW(dir, nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        e.Sys();
+        return false;
+    }
+
+    Random rand(0x444952);
+    PathW path;
+    StrW name;
+    for (unsigned ii = 0; ii < count; ++ii)
+    {
+        name.Clear();
+        name.Printf(L"%s_%u.%s", c_ascii_words[rand.Next(26)], rand.Next(100000), (ii % 3) ? L"txt" : L"log");
+        path.Set(dir);
+        path.JoinComponent(name.Text());
+        SHFile h = CreateFileW(path.Text(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h.Empty())
+        {
+            e.Sys();
+            return false;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Benchmarks.
+
+struct BenchOptions
+{
+    uint64          size = 64 * 1024 * 1024;
+    unsigned        frames = 500;
+    unsigned        files = 5000;
+    unsigned        width = 120;
+    unsigned        height = 50;
+};
+
+static bool BenchProcess(const WCHAR* corpus, const WCHAR* path, Error& e)
+{
+    ContentCache cache(g_options);
+    Stopwatch sw;
+    if (!cache.Open(path, e) || !cache.ProcessToEnd(e))
+        return false;
+    Report(L"process", corpus, nullptr, sw, cache.GetFileSize(), cache.CountFriendlyLines());
+    return true;
+}
+
+static bool BenchFind(const WCHAR* corpus, const WCHAR* path, const BenchOptions& bo, Error& e)
+{
+    struct Search
+    {
+        const WCHAR* variant;
+        SearcherType type;
+        const WCHAR* text;
+    };
+    static const Search c_searches[] =
+    {
+        { L"literal",       SearcherType::Literal,      L"needle" },
+        { L"literal_nocase", SearcherType::Literal,     L"NEEDLE" },
+        { L"multi",         SearcherType::MultiLiteral, L"needle omega" },
+#ifdef INCLUDE_RE2
+        { L"regex_re2",     SearcherType::Regex,        L"ne+dle\\s+[a-z]+" },
+        { L"regex_re2_literals", SearcherType::Regex,   L"needle.*omega" },
+#else
+        { L"regex_ecma",    SearcherType::Regex,        L"ne+dle\\s+[a-z]+" },
+        { L"regex_ecma_literals", SearcherType::Regex,  L"needle.*omega" },
+#endif
+        { L"bytes",         SearcherType::Bytes,        L"6e 65 ?? 64 6c 65" },
+    };
+
+    ContentCache cache(g_options);
+    if (!cache.Open(path, e) || !cache.ProcessToEnd(e))
+        return false;
+
+    for (const auto& search : c_searches)
+    {
+        const bool caseless = (search.text[0] == 'N');
+        std::shared_ptr<Searcher> searcher = Searcher::Create(search.type, search.text, caseless, e);
+        if (!searcher)
+            return false;
+
+        FoundOffset found;
+        unsigned left_offset = 0;
+        uint64 hits = 0;
+        Stopwatch sw;
+        while (cache.Find(true/*next*/, searcher, bo.width, found, left_offset, e, found.Empty()/*first*/))
+            ++hits;
+        if (e.Test())
+            return false;
+        Report(L"find", corpus, search.variant, sw, cache.GetFileSize(), 0, 0, hits);
+    }
+    return true;
+}
+
+static bool BenchFormat(const WCHAR* corpus, const WCHAR* path, const BenchOptions& bo, Error& e)
+{
+    ContentCache cache(g_options);
+    if (!cache.Open(path, e) || !cache.ProcessToEnd(e))
+        return false;
+
+    StrW s;
+    const size_t count = cache.Count();
+    if (count)
+    {
+        Stopwatch sw;
+        uint64 rows = 0;
+        for (unsigned frame = 0; frame < bo.frames; ++frame)
+        {
+            const size_t top = size_t(uint64(count) * frame / bo.frames);
+            for (unsigned row = 0; row < bo.height && top + row < count; ++row, ++rows)
+            {
+                s.Clear();
+                cache.FormatLineData(top + row, false/*middle*/, 0, s, bo.width, e);
+                if (e.Test())
+                    return false;
+            }
+        }
+        Report(L"format_text", corpus, nullptr, sw, 0, rows, bo.frames);
+    }
+
+    const unsigned hex_bytes = 32;
+    const FileOffset hex_rows = (cache.GetFileSize() + hex_bytes - 1) / hex_bytes;
+    if (hex_rows)
+    {
+        Stopwatch sw;
+        uint64 bytes = 0;
+        for (unsigned frame = 0; frame < bo.frames; ++frame)
+        {
+            const FileOffset top = hex_rows * frame / bo.frames * hex_bytes;
+            for (unsigned row = 0; row < bo.height && top + row * hex_bytes < cache.GetFileSize(); ++row)
+            {
+                s.Clear();
+                if (!cache.FormatHexData(top, false/*middle*/, row, hex_bytes, s, e))
+                    return false;
+                bytes += hex_bytes;
+            }
+        }
+        Report(L"format_hex", corpus, nullptr, sw, bytes, 0, bo.frames);
+    }
+    return true;
+}
+
+static bool BenchScan(const WCHAR* dir, unsigned count, Error& e)
+{
+    PathW pattern;
+    pattern.Set(dir);
+    pattern.JoinComponent(L"*");
+    const WCHAR* argv[] = { pattern.Text() };
+
+    std::vector<FileInfo> files;
+    StrW dir_out;
+    StrW variant;
+    variant.Printf(L"%u_files", count);
+
+    Stopwatch sw;
+    ScanFiles(int(_countof(argv)), argv, files, dir_out, e);
+    if (e.Test())
+        return false;
+    Report(L"scan", dir, variant.Text(), sw, 0, files.size());
+
+    sw.Restart();
+    SortFileInfos(files);
+    Report(L"sort", dir, variant.Text(), sw, 0, files.size());
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Main.
+
+static bool RunCorpus(const WCHAR* corpus, const WCHAR* path, const BenchOptions& bo, Error& e)
+{
+    return (BenchProcess(corpus, path, e) &&
+            BenchFind(corpus, path, bo, e) &&
+            BenchFormat(corpus, path, bo, e));
+}
+
+static void DeleteTree(const WCHAR* dir)
+{
+    PathW pattern;
+    pattern.Set(dir);
+    pattern.JoinComponent(L"*");
+
+    WIN32_FIND_DATAW fd;
+    SHFind h = FindFirstFileW(pattern.Text(), &fd);
+    if (!h.Empty())
+    {
+        PathW path;
+        do
+        {
+            if (!wcscmp(fd.cFileName, L".") || !wcscmp(fd.cFileName, L".."))
+                continue;
+            path.Set(dir);
+            path.JoinComponent(fd.cFileName);
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                DeleteTree(path.Text());
+            else
+                DeleteFileW(path.Text());
+        }
+        while (FindNextFileW(h, &fd));
+    }
+    h.Close();
+    RemoveDirectoryW(dir);
+}
+
+int __cdecl wmain(int argc, const WCHAR** argv)
+{
+    Error e;
+    BenchOptions bo;
+    PathW root;
+    bool keep = false;
+    std::vector<const WCHAR*> extra;
+
+    for (int ii = 1; ii < argc; ++ii)
+    {
+        const WCHAR* const arg = argv[ii];
+        const bool has_value = (ii + 1 < argc);
+        if (!wcscmp(arg, L"--size") && has_value)
+            bo.size = uint64(max(1, _wtoi(argv[++ii]))) * 1024 * 1024;
+        else if (!wcscmp(arg, L"--frames") && has_value)
+            bo.frames = max(1, _wtoi(argv[++ii]));
+        else if (!wcscmp(arg, L"--files") && has_value)
+            bo.files = max(1, _wtoi(argv[++ii]));
+        else if (!wcscmp(arg, L"--dir") && has_value)
+            root.Set(argv[++ii]);
+        else if (!wcscmp(arg, L"--keep"))
+            keep = true;
+        else if (arg[0] == '-')
+        {
+            fputs("usage: bench [--size MB] [--frames N] [--files N] [--dir DIR] [--keep] [file ...]\n", stderr);
+            return 1;
+        }
+        else
+            extra.push_back(arg);
+    }
+
+    initialize_wcwidth();
+    TryCoInitialize();
+
+    if (root.Empty())
+    {
+        WCHAR temp[MAX_PATH + 1];
+        if (!GetTempPathW(_countof(temp), temp))
+        {
+            e.Sys();
+            e.Report();
+            return 1;
+        }
+        root.Set(temp);
+        root.JoinComponent(L"list-bench");
+    }
+    if (!CreateDirectoryW(root.Text(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        e.Sys();
+        e.Report();
+        return 1;
+    }
+
+    // The generated corpora are reused if they're already the right size.
+    PathW path;
+    for (const auto& corpus : c_corpora)
+    {
+        path.Set(root);
+        path.JoinComponent(corpus.name);
+
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        const bool exists = (GetFileAttributesExW(path.Text(), GetFileExInfoStandard, &fad) &&
+                             ((uint64(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow) >= bo.size);
+        if (!exists && !GenerateCorpus(path.Text(), corpus.kind, bo.size, e))
+            break;
+        if (!RunCorpus(corpus.name, path.Text(), bo, e))
+            break;
+    }
+
+    for (size_t ii = 0; !e.Test() && ii < extra.size(); ++ii)
+        RunCorpus(extra[ii], extra[ii], bo, e);
+
+    if (!e.Test())
+    {
+        path.Set(root);
+        path.JoinComponent(L"dir");
+        if (GenerateDirectory(path.Text(), bo.files, e))
+            BenchScan(path.Text(), bo.files, e);
+        DeleteTree(path.Text());
+    }
+
+    if (!keep)
+        DeleteTree(root.Text());
+
+    if (e.Test())
+    {
+        e.Report();
+        return 1;
+    }
+    return 0;
+}
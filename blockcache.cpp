@@ -0,0 +1,192 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "blockcache.h"
+#include "memorybudget.h"
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+struct BlockKey
+{
+    bool            operator==(const BlockKey& other) const
+                    {
+                        return (volume_serial == other.volume_serial &&
+                                file_index_high == other.file_index_high &&
+                                file_index_low == other.file_index_low &&
+                                last_write == other.last_write &&
+                                block == other.block);
+                    }
+
+    DWORD           volume_serial;
+    DWORD           file_index_high;
+    DWORD           file_index_low;
+    uint64          last_write;
+    uint64          block;
+};
+
+struct BlockKeyHash
+{
+    size_t          operator()(const BlockKey& key) const
+                    {
+                        uint64 h = key.block * 0x9e3779b97f4a7c15;
+                        h ^= (uint64(key.file_index_high) << 32 | key.file_index_low) + (h << 6) + (h >> 2);
+                        h ^= key.last_write + (h << 6) + (h >> 2);
+                        h ^= key.volume_serial;
+                        return size_t(h);
+                    }
+};
+
+struct CachedBlock
+{
+    BlockKey        key;
+    std::vector<BYTE> bytes;                // Shorter than a block only at EOF.
+};
+
+typedef std::list<CachedBlock> BlockList;
+
+class BlockCache
+{
+public:
+                    BlockCache() { InitializeCriticalSection(&m_cs); }
+                    ~BlockCache() { DeleteCriticalSection(&m_cs); }
+
+    bool            Read(const IndexCacheKey& key, uint64 offset, DWORD length, BYTE* dest, DWORD& bytes_read);
+    void            Store(const IndexCacheKey& key, uint64 offset, DWORD length, const BYTE* src, bool eof, size_t limit);
+    size_t          Trim(size_t excess);
+
+private:
+    static BlockKey MakeKey(const IndexCacheKey& key, uint64 block);
+    void            EvictWhile(const std::function<bool()>& more);
+
+private:
+    CRITICAL_SECTION m_cs;
+    BlockList       m_lru;                  // Most recently used first.
+    std::unordered_map<BlockKey, BlockList::iterator, BlockKeyHash> m_map;
+    size_t          m_total = 0;
+    MemoryCharge    m_memory = MemoryCharge(MemoryUse::BlockCache);
+};
+
+static BlockCache s_block_cache;
+
+BlockKey BlockCache::MakeKey(const IndexCacheKey& key, uint64 block)
+{
+    BlockKey k;
+    k.volume_serial = key.volume_serial;
+    k.file_index_high = key.file_index_high;
+    k.file_index_low = key.file_index_low;
+    k.last_write = (uint64(key.last_write.dwHighDateTime) << 32) | key.last_write.dwLowDateTime;
+    k.block = block;
+    return k;
+}
+
+bool BlockCache::Read(const IndexCacheKey& key, uint64 offset, DWORD length, BYTE* dest, DWORD& bytes_read)
+{
+    bytes_read = 0;
+
+    EnterCriticalSection(&m_cs);
+    bool ok = !m_map.empty();
+    while (ok && bytes_read < length)
+    {
+        const uint64 pos = offset + bytes_read;
+        const auto found = m_map.find(MakeKey(key, pos / c_block_cache_block_size));
+        if (found == m_map.end())
+        {
+            ok = false;
+            break;
+        }
+
+        const auto& bytes = found->second->bytes;
+        const DWORD within = DWORD(pos % c_block_cache_block_size);
+        const DWORD avail = (bytes.size() > within) ? DWORD(bytes.size() - within) : 0;
+        const DWORD len = std::min<DWORD>(avail, length - bytes_read);
+        memcpy(dest + bytes_read, bytes.data() + within, len);
+        bytes_read += len;
+
+        m_lru.splice(m_lru.begin(), m_lru, found->second);
+
+        if (bytes.size() < c_block_cache_block_size)
+            break;                          // EOF.
+    }
+    LeaveCriticalSection(&m_cs);
+
+    return ok;
+}
+
+void BlockCache::Store(const IndexCacheKey& key, uint64 offset, DWORD length, const BYTE* src, bool eof, size_t limit)
+{
+    if (limit < c_block_cache_block_size)
+        return;
+
+    const uint64 end = offset + length;
+    uint64 block = (offset + c_block_cache_block_size - 1) / c_block_cache_block_size;
+
+    EnterCriticalSection(&m_cs);
+    while (true)
+    {
+        const uint64 begin = block * c_block_cache_block_size;
+        if (begin >= end)
+            break;
+        const DWORD len = DWORD(std::min<uint64>(c_block_cache_block_size, end - begin));
+        if (len < c_block_cache_block_size && !eof)
+            break;
+
+        const BlockKey k = MakeKey(key, block++);
+        const auto found = m_map.find(k);
+        if (found != m_map.end())
+        {
+            m_total -= found->second->bytes.size();
+            m_lru.erase(found->second);
+            m_map.erase(found);
+        }
+
+        m_lru.emplace_front();
+        CachedBlock& cached = m_lru.front();
+        cached.key = k;
+        cached.bytes.assign(src + (begin - offset), src + (begin - offset) + len);
+        m_map.emplace(k, m_lru.begin());
+        m_total += len;
+    }
+
+    EvictWhile([&](){ return m_total > limit; });
+    LeaveCriticalSection(&m_cs);
+}
+
+size_t BlockCache::Trim(size_t excess)
+{
+    EnterCriticalSection(&m_cs);
+    const size_t before = m_total;
+    EvictWhile([&](){ return before - m_total < excess; });
+    LeaveCriticalSection(&m_cs);
+    return before - m_total;
+}
+
+void BlockCache::EvictWhile(const std::function<bool()>& more)
+{
+    while (!m_lru.empty() && more())
+    {
+        m_total -= m_lru.back().bytes.size();
+        m_map.erase(m_lru.back().key);
+        m_lru.pop_back();
+    }
+    m_memory.Set(m_total);
+}
+
+bool ReadCachedBlocks(const IndexCacheKey& key, uint64 offset, DWORD length, BYTE* dest, DWORD& bytes_read)
+{
+    return s_block_cache.Read(key, offset, length, dest, bytes_read);
+}
+
+void StoreCachedBlocks(const IndexCacheKey& key, uint64 offset, DWORD length, const BYTE* src, bool eof, size_t limit)
+{
+    s_block_cache.Store(key, offset, length, src, eof, limit);
+}
+
+size_t TrimCachedBlocks(size_t excess)
+{
+    return s_block_cache.Trim(excess);
+}
@@ -0,0 +1,32 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "indexcache.h"
+
+// Process-wide cache of file blocks read with ReadFile, so that revisiting
+// part of a file, or switching back to a file, doesn't read it again.  This
+// matters most on network shares; memory mapped files don't use it, since
+// the OS file cache already covers them.  Blocks are identified by the
+// file's identity and last write time, so a modified file never sees stale
+// blocks.  All functions are thread safe.
+
+const DWORD c_block_cache_block_size = 16 * 1024;
+
+// Copies length bytes at offset into dest if all of the blocks covering
+// them are cached.  bytes_read may be less than length if a cached block
+// ends at EOF.
+bool ReadCachedBlocks(const IndexCacheKey& key, uint64 offset, DWORD length, BYTE* dest, DWORD& bytes_read);
+
+// Stores the whole blocks contained in the bytes at offset.  If eof is
+// true, the bytes end at EOF and a partial last block is stored as well.
+// Evicts least recently used blocks to stay within limit bytes.
+void StoreCachedBlocks(const IndexCacheKey& key, uint64 offset, DWORD length, const BYTE* src, bool eof, size_t limit);
+
+// Evicts least recently used blocks until at least excess bytes are freed or
+// the cache is empty.  Returns the number of bytes freed.
+size_t TrimCachedBlocks(size_t excess);
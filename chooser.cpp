@@ -20,12 +20,21 @@
 #include "sorting.h"
 #include "help.h"
 #include "os.h"
+#include "encodings.h"
+#include "perf.h"
+#include "treesearch.h"
+#include "viewer.h"
 
 #include <algorithm>
+#include <atomic>
+#include <intrin.h>
+#include <thread>
+#include <unordered_map>
 #include <shlwapi.h>
 
 constexpr bool c_floating = true;
 constexpr scroll_bar_style c_sbstyle = scroll_bar_style::half_line_chars;
+constexpr DWORD c_scan_refresh = 100;   // Milliseconds between showing arriving files.
 
 static const WCHAR c_no_files_tagged[] = L"*** No Files Tagged ***";
 static const WCHAR c_text_not_found[] = L"*** Text Not Found ***";
@@ -185,6 +194,9 @@ bool __ShellExecuteEx(const WCHAR* file, const WCHAR* dir, AdaptiveWait* adapt,
         sei.fMask |= SEE_MASK_NOCLOSEPROCESS;
     }
 
+    // ShellExecuteEx can load shell extensions, which may need COM.
+    TryCoInitialize();
+
     if (!ShellExecuteExW(&sei))
         e.Sys();
 
@@ -265,8 +277,29 @@ static bool RunProgram(const WCHAR* commandline)
     return (_wsystem(commandline) >= 0 || !errno);
 }
 
+static unsigned PopCount(uint64 bits)
+{
+    bits = bits - ((bits >> 1) & 0x5555555555555555);
+    bits = (bits & 0x3333333333333333) + ((bits >> 2) & 0x3333333333333333);
+    bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0f;
+    return unsigned((bits * 0x0101010101010101) >> 56);
+}
+
+// Returns a mask of the bits in word that are in the range [begin, end).
+static uint64 RangeMask(size_t word, size_t begin, size_t end)
+{
+    const size_t first = word * 64;
+    uint64 mask = ~uint64(0);
+    if (begin > first)
+        mask &= ~uint64(0) << (begin - first);
+    if (end < first + 64)
+        mask &= ~(~uint64(0) << (end - first));
+    return mask;
+}
+
 void MarkedList::Mark(intptr_t index, int tag)
 {
+    assert(index >= 0);
     if (tag > 0)
         tag = true;
     else if (tag < 0)
@@ -277,45 +310,101 @@ void MarkedList::Mark(intptr_t index, int tag)
     if (m_reverse)
         tag = !tag;
 
+    const size_t word = size_t(index) / 64;
+    const uint64 bit = uint64(1) << (size_t(index) % 64);
     if (tag)
     {
-        m_set.insert(index);
+        if (word >= m_bits.size())
+            m_bits.resize(word + 1);
+        if (!(m_bits[word] & bit))
+        {
+            m_bits[word] |= bit;
+            ++m_count;
+        }
     }
-    else
+    else if (word < m_bits.size() && (m_bits[word] & bit))
     {
-        const auto iter = m_set.find(index);
-        if (iter != m_set.end())
-            m_set.erase(iter);
+        m_bits[word] &= ~bit;
+        --m_count;
     }
 }
 
 bool MarkedList::IsMarked(intptr_t index) const
 {
-    const auto iter = m_set.find(index);
-    bool tag = (iter != m_set.end());
+    bool tag = !!(Word(size_t(index) / 64) & (uint64(1) << (size_t(index) % 64)));
     if (m_reverse)
         tag = !tag;
     return tag;
 }
 
+void MarkedList::Remap(const std::vector<intptr_t>& moved)
+{
+    // Indices past the end of moved, or that moved to -1, are for files that
+    // no longer exist.
+    std::vector<uint64> bits;
+    size_t count = 0;
+    for (size_t word = 0; word < m_bits.size(); ++word)
+    {
+        for (uint64 w = m_bits[word]; w; w &= w - 1)
+        {
+            unsigned long bit;
+            _BitScanForward64(&bit, w);
+            const size_t index = word * 64 + bit;
+            if (index >= moved.size() || moved[index] < 0)
+                continue;
+            const size_t to = size_t(moved[index]);
+            if (to / 64 >= bits.size())
+                bits.resize(to / 64 + 1);
+            bits[to / 64] |= uint64(1) << (to % 64);
+            ++count;
+        }
+    }
+    m_bits.swap(bits);
+    m_count = count;
+}
+
 bool MarkedList::AnyMarked() const
 {
-    return (m_set.size() || m_reverse);
+    return (m_count || m_reverse);
 }
 
 bool MarkedList::AllMarked() const
 {
-    return (!m_set.size() && m_reverse);
+    return (!m_count && m_reverse);
 }
 
-size_t MarkedList::CountMarked(size_t total) const
+size_t MarkedList::CountMarked(size_t begin, size_t end) const
 {
-    size_t n = min(m_set.size(), total);
+    if (begin >= end)
+        return 0;
+
+    size_t n = 0;
+    for (size_t word = begin / 64; word * 64 < end && word < m_bits.size(); ++word)
+        n += PopCount(m_bits[word] & RangeMask(word, begin, end));
     if (m_reverse)
-        n = total - n;
+        n = (end - begin) - n;
     return n;
 }
 
+intptr_t MarkedList::NextMarked(size_t index, size_t end) const
+{
+    const uint64 flip = m_reverse ? ~uint64(0) : 0;
+    for (size_t word = index / 64; word * 64 < end; ++word)
+    {
+        const uint64 w = (Word(word) ^ flip) & RangeMask(word, index, end);
+        if (w)
+        {
+            unsigned long bit;
+            _BitScanForward64(&bit, w);
+            return intptr_t(word * 64 + bit);
+        }
+        // When not reversed, there's nothing marked past the end of m_bits.
+        if (!m_reverse && word + 1 >= m_bits.size())
+            break;
+    }
+    return -1;
+}
+
 Chooser::Chooser(const Interactive* interactive)
 : m_interactive(interactive)
 {
@@ -327,34 +416,405 @@ void Chooser::Navigate(const WCHAR* dir, std::vector<FileInfo>&& files)
     m_dir.Set(dir);
     m_files = std::move(files);
     m_count = intptr_t(m_files.size());
+    m_item_widths.Clear();
+    SizeDirectories(m_files);
+    UpdateFilesMemory();
 }
 
 void Chooser::Navigate(const WCHAR* dir, Error& e, const WCHAR* up_from)
 {
     StrW dir_out;
+    auto scan = std::make_unique<DirectoryScan>();
+    if (!scan->Start(dir, dir_out, e))
+        return;
+
+    // Wait until the scan finishes or enough files arrive to fill the
+    // screen, whichever is first; the rest of a huge directory can keep
+    // arriving while the chooser is interactive.  If the scan fails before
+    // anything is shown, the current listing stays.
+    const size_t c_first_screen = HIWORD(GetConsoleColsRows());
     std::vector<FileInfo> fileinfos;
+    bool done;
+    while (!(done = scan->TakeArrived(fileinfos, e)) && fileinfos.size() < c_first_screen)
+        WaitForSingleObject(scan->GetThread(), 10);
+    if (done && e.Test())
+        return;
+    e.Clear();
 
-    ScanFiles(1, &dir, fileinfos, dir_out, e);
-    if (e.Test())
+    Navigate(dir_out.Text(), std::vector<FileInfo>());
+    if (!done)
+        m_scan = std::move(scan);
+    if (up_from)
+        m_scan_select.Set(up_from);
+    MergeFiles(std::move(fileinfos));
+    if (!m_scan)
+        m_scan_select.Clear();
+    StartWatching();
+}
+
+// Gets the full path of the listed directory, and the file mask (empty if
+// it's just "*"), the same way the scan does.
+bool Chooser::GetListingDirectory(StrW& dir, StrW& mask) const
+{
+    dir.Clear();
+    mask.Clear();
+    if (m_dir.Empty())
+        return false;
+
+    StrW tmp;
+    Error e;
+    const WCHAR* name = FindName(m_dir.Text());
+    if (name && name > m_dir.Text())
+        tmp.Set(m_dir.Text(), name - m_dir.Text());
+    else
+        tmp.Set(L".\\");
+    dir.ReserveMaxPath();
+    if (!OS::GetFullPathName(tmp.Text(), dir, e))
+        return false;
+    if (name && (name[0] != '*' || name[1]))
+        mask.Set(name);
+    return true;
+}
+
+void Chooser::StartWatching()
+{
+    // Watch the directory so that changes (including ones made by the
+    // chooser itself) can update the listing in place, instead of scanning
+    // the whole directory again.  Changes that happen while the scan is
+    // still running are applied once it finishes; applying a change is
+    // idempotent, so it doesn't matter if the scan already saw it.
+    m_watcher.reset();
+    if (!GetListingDirectory(m_watch_dir, m_watch_mask))
+        return;
+
+    auto watcher = std::make_unique<DirectoryWatcher>();
+    if (watcher->Start(m_watch_dir.Text()))
+        m_watcher = std::move(watcher);
+}
+
+void Chooser::PollDirectoryChanges()
+{
+    std::unordered_set<std::wstring> names;
+    if (!m_watcher->TakeChanges(names))
+    {
+        // Some changes were lost, so only a rescan can tell what's there.
+        Error e;
+        RefreshDirectoryListing(e);
+        if (e.Test())
+        {
+            ReportError(e);
+            ForceUpdateAll();
+        }
+        return;
+    }
+
+    if (!names.empty())
+        ApplyDirectoryChanges(names);
+}
+
+void Chooser::ApplyDirectoryChanges(const std::unordered_set<std::wstring>& names)
+{
+    // A changed name may have been added, removed, renamed, or modified, so
+    // drop whatever is listed under that name, and list whatever is there
+    // now.  Remember the tag and selection of a dropped name so they stay
+    // with a file that's merely been modified.
+    struct Carry { bool tagged; bool selected; };
+    std::unordered_map<std::wstring, Carry> carry;
+    std::vector<bool> removed(m_files.size());
+    std::wstring lower;
+    for (size_t i = 0; i < m_files.size(); ++i)
+    {
+        const FileInfo& info = m_files[i];
+        if (info.IsPseudoDirectory())
+            continue;
+        lower.assign(info.GetName(), info.GetNameLength());
+        CharLowerBuffW(&lower[0], DWORD(lower.length()));
+        if (names.find(lower) == names.end())
+            continue;
+        removed[i] = true;
+        carry.emplace(std::move(lower), Carry { m_tagged.IsMarked(i), intptr_t(i) == m_index });
+    }
+
+    const int dir = FileInfo::InternDirectory(m_watch_dir.Text());
+    std::vector<FileInfo> arrived;
+    std::vector<size_t> unmatched;
+    PathW path;
+    for (const auto& name : names)
+    {
+        path.Set(m_watch_dir);
+        path.JoinComponent(name.c_str());
+
+        WIN32_FIND_DATA fd;
+        SHFind shFind = FindFirstFileExW(path.Text(), FindExInfoBasic, &fd, FindExSearchNameMatch, nullptr, 0);
+        if (shFind.Empty())
+            continue;
+
+        // Same as the scan:  directories are always listed, but files only
+        // if they match the mask.
+        const bool is_dir = !!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+        if (!is_dir && !m_watch_mask.Empty())
+            unmatched.emplace_back(arrived.size());
+
+        FileInfo info;
+        info.Init(&fd);
+        info.SetDirectory(dir);
+        arrived.emplace_back(std::move(info));
+    }
+
+    if (!unmatched.empty())
+    {
+        // The scan lets the file system match the mask, which also matches
+        // short names and the DOS wildcards, so enumerate the mask the same
+        // way, once for all the changed files.
+        std::unordered_set<std::wstring> matched;
+        path.Set(m_watch_dir);
+        path.JoinComponent(m_watch_mask.Text());
+        WIN32_FIND_DATA fd;
+        SHFind shFind = FindFirstFileExW(path.Text(), FindExInfoBasic, &fd, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+        if (!shFind.Empty())
+        {
+            do
+            {
+                lower.assign(fd.cFileName);
+                CharLowerBuffW(&lower[0], DWORD(lower.length()));
+                if (names.find(lower) != names.end())
+                    matched.emplace(std::move(lower));
+            }
+            while (FindNextFile(shFind, &fd));
+        }
+
+        std::vector<bool> drop(arrived.size());
+        for (const size_t i : unmatched)
+        {
+            lower.assign(arrived[i].GetName(), arrived[i].GetNameLength());
+            CharLowerBuffW(&lower[0], DWORD(lower.length()));
+            drop[i] = (matched.find(lower) == matched.end());
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < arrived.size(); ++i)
+        {
+            if (!drop[i])
+                arrived[kept++] = std::move(arrived[i]);
+        }
+        arrived.resize(kept);
+    }
+
+    MergeFiles(std::move(arrived), &removed);
+
+    if (!carry.empty())
+    {
+        for (size_t i = 0; i < m_files.size(); ++i)
+        {
+            const FileInfo& info = m_files[i];
+            lower.assign(info.GetName(), info.GetNameLength());
+            CharLowerBuffW(&lower[0], DWORD(lower.length()));
+            const auto it = carry.find(lower);
+            if (it == carry.end())
+                continue;
+            if (it->second.tagged)
+                m_tagged.Mark(i, 1);
+            if (it->second.selected)
+                m_index = intptr_t(i);
+        }
+    }
+
+    m_dirty_header = true;
+    m_dirty_footer = true;
+}
+
+void Chooser::PollDirectoryScan()
+{
+    Error e;
+    std::vector<FileInfo> arrived;
+    const bool done = m_scan->TakeArrived(arrived, e);
+    MergeFiles(std::move(arrived));
+    if (done)
+    {
+        m_scan.reset();
+        m_scan_select.Clear();
+        m_dirty_header = true;
+        m_dirty_footer = true;
+        if (e.Test())
+        {
+            ReportError(e);
+            ForceUpdateAll();
+        }
+    }
+}
+
+void Chooser::MergeFiles(std::vector<FileInfo>&& arrived, const std::vector<bool>* removed)
+{
+    if (arrived.empty() && !removed)
         return;
 
-    std::stable_sort(fileinfos.begin(), fileinfos.end(), CmpFileInfo);
-    Navigate(dir_out.Text(), std::move(fileinfos));
+    SizeDirectories(arrived);
+    SortFileInfos(arrived);
+
+    // Let the columns stay as they are if every file fits in every column;
+    // then only the number of rows changes.
+    bool relayout = (!m_scroll_layout || m_col_widths.empty() || m_files.empty());
+    if (!relayout)
+    {
+        const auto minmax = std::minmax_element(m_col_widths.begin(), m_col_widths.end());
+        unsigned widest = *minmax.second;
+        for (const auto& info : arrived)
+        {
+            if (g_options.details >= 3 && WidthForFileInfoSize(&info, g_options.details, -1) > m_max_size_width)
+            {
+                relayout = true;
+                break;
+            }
+            widest = std::max<unsigned>(widest, WidthForFileInfo(&info, g_options.details, m_max_size_width));
+        }
+        relayout |= (widest > *minmax.first);
+    }
+
+    // A stable merge gives the same order as sorting all of the files at
+    // once.  Remember where the existing files move to, so the selection and
+    // the tags stay with the same files.  Removed files move to -1.
+    std::vector<FileInfo> merged;
+    std::vector<intptr_t> moved;
+    merged.reserve(m_files.size() + arrived.size());
+    moved.reserve(m_files.size());
+    size_t next = 0;
+    for (size_t i = 0; i < m_files.size(); ++i)
+    {
+        auto& info = m_files[i];
+        if (removed && (*removed)[i])
+        {
+            moved.emplace_back(-1);
+            continue;
+        }
+        while (next < arrived.size() && CmpFileInfo(arrived[next], info))
+            merged.emplace_back(std::move(arrived[next++]));
+        moved.emplace_back(intptr_t(merged.size()));
+        merged.emplace_back(std::move(info));
+    }
+    while (next < arrived.size())
+        merged.emplace_back(std::move(arrived[next++]));
+
+    if (size_t(m_index) < moved.size())
+    {
+        // If the selected file was removed, select the next one that remains.
+        intptr_t index = -1;
+        for (size_t i = m_index; i < moved.size() && index < 0; ++i)
+            index = moved[i];
+        m_index = (index >= 0) ? index : std::max<intptr_t>(0, intptr_t(merged.size()) - 1);
+    }
+    m_tagged.Remap(moved);
+    m_files = std::move(merged);
+    m_count = intptr_t(m_files.size());
+    m_item_widths.Clear();
+    UpdateFilesMemory();
 
-    if (up_from && *up_from)
+    if (!m_scan_select.Empty())
     {
         for (size_t i = 0; i < m_files.size(); ++i)
         {
             if (!m_files[i].IsDirectory())
                 break;
-            const WCHAR* name = FindName(m_files[i].GetName().Text());
-            if (wcsicmp(up_from, name) == 0)
+            const WCHAR* name = FindName(m_files[i].GetName());
+            if (wcsicmp(m_scan_select.Text(), name) == 0)
             {
-                SetIndex(i);
+                m_index = intptr_t(i);
+                m_scan_select.Clear();
                 break;
             }
         }
     }
+
+    if (relayout)
+    {
+        m_num_per_row = 0;
+    }
+    else
+    {
+        const bool can_show_content = (m_terminal_height > m_content_height);
+        m_num_rows = (m_count + m_num_per_row - 1) / m_num_per_row;
+        m_visible_rows = int32(std::min<intptr_t>(m_num_rows, can_show_content ? m_content_height : 0));
+    }
+    ForceUpdateAll();
+}
+
+void Chooser::UpdateFilesMemory()
+{
+    size_t bytes = m_files.capacity() * sizeof(m_files[0]);
+    for (const auto& info : m_files)
+        bytes += (wcslen(info.GetName()) + 1) * sizeof(WCHAR);
+    m_files_memory.Set(bytes);
+}
+
+void Chooser::SizeDirectories(std::vector<FileInfo>& files)
+{
+    if (!g_options.directory_sizes)
+        return;
+
+    // Use cached sizes right away, and queue the rest to be sized.
+    StrW path;
+    unsigned __int64 size;
+    for (auto& info : files)
+    {
+        if (!info.IsDirectory() || info.IsPseudoDirectory())
+            continue;
+        info.GetPathName(path);
+        if (m_dir_sizes.Lookup(path.Text(), info.GetModifiedTime(), size))
+            info.SetDirectorySize(size);
+        else
+            m_dir_sizes.Queue(path.Text(), info.GetModifiedTime());
+    }
+}
+
+void Chooser::PollDirectorySizes()
+{
+    const uint32 completed = m_dir_sizes.GetCompleted();
+    if (completed == m_dir_sizes_completed)
+        return;
+    m_dir_sizes_completed = completed;
+    if (!g_options.directory_sizes)
+        return;
+
+    StrW path;
+    unsigned __int64 size;
+    bool changed = false;
+    bool relayout = false;
+    for (auto& info : m_files)
+    {
+        if (!info.IsDirectory() || info.HasDirectorySize() || info.IsPseudoDirectory())
+            continue;
+        info.GetPathName(path);
+        if (!m_dir_sizes.Lookup(path.Text(), info.GetModifiedTime(), size))
+            continue;
+        info.SetDirectorySize(size);
+        changed = true;
+        if (g_options.details >= 3 && WidthForFileInfoSize(&info, g_options.details, -1) > m_max_size_width)
+            relayout = true;
+    }
+
+    // The layout only changes if a size is wider than the size column.
+    if (relayout)
+    {
+        m_item_widths.Clear();
+        m_num_per_row = 0;
+    }
+    if (changed)
+        ForceUpdateAll();
+}
+
+void Chooser::ToggleDirectorySizes()
+{
+    g_options.directory_sizes = !g_options.directory_sizes;
+    if (g_options.directory_sizes)
+    {
+        SizeDirectories(m_files);
+    }
+    else
+    {
+        m_dir_sizes.CancelPending();
+        for (auto& info : m_files)
+            info.ClearDirectorySize();
+    }
+    m_item_widths.Clear();
+    Relayout();
 }
 
 ChooserOutcome Chooser::Go(Error& e, bool do_search)
@@ -368,6 +828,13 @@ ChooserOutcome Chooser::Go(Error& e, bool do_search)
         e.Clear();
         ClearSignaled();
 
+        if (m_scan)
+            PollDirectoryScan();
+        if (!m_scan && m_watcher && m_watcher->IsWatching())
+            PollDirectoryChanges();
+        PollDirectorySizes();
+        TrimToMemoryBudget();
+
 #ifdef INCLUDE_MENU_ROW
         m_command_mode = true;
 #endif
@@ -388,7 +855,19 @@ ChooserOutcome Chooser::Go(Error& e, bool do_search)
             }
         }
 
-        const InputRecord input = SelectInput(INFINITE, &mouse);
+        // While files are still arriving or directories are being sized,
+        // wake up periodically to show them.  Sizes are counted as completed
+        // before they stop being busy, so checking both can't miss the last.
+        // Directory changes aren't applied until the scan finishes.
+        HANDLE wake[1];
+        uint32 wake_count = 0;
+        if (m_scan)
+            wake[wake_count++] = m_scan->GetThread();
+        else if (m_watcher && m_watcher->IsWatching())
+            wake[wake_count++] = m_watcher->GetEvent();
+        const bool sizing = (m_dir_sizes.IsBusy() || m_dir_sizes.GetCompleted() != m_dir_sizes_completed);
+        const DWORD timeout = (m_scan || sizing) ? c_scan_refresh : INFINITE;
+        const InputRecord input = SelectInput(timeout, &mouse, wake, wake_count);
         switch (input.type)
         {
         case InputType::None:
@@ -404,6 +883,7 @@ ChooserOutcome Chooser::Go(Error& e, bool do_search)
         case InputType::Mouse:
             {
                 e.Clear();
+                m_scan_select.Clear();  // The user is choosing now.
 #ifdef INCLUDE_MENU_ROW
                 m_command_mode = false;
 #endif
@@ -441,8 +921,18 @@ void Chooser::Reset()
 
     m_dir.Clear();
     m_files.clear();
+    m_files_memory.Set(m_files.capacity() * sizeof(m_files[0]));
+    m_scan.reset();
+    m_scan_select.Clear();
+    m_watcher.reset();
+    m_watch_dir.Clear();
+    m_watch_mask.Clear();
+    m_dir_sizes.CancelPending();
     m_col_widths.clear();
+    m_scroll_layout = false;
     m_max_size_width = 0;
+    m_item_widths.Clear();
+    m_item_widths_details = -1;
     m_count = 0;
     m_num_rows = 0;
     m_num_per_row = 0;
@@ -479,6 +969,7 @@ void Chooser::UpdateDisplay(StrW* last_screen)
         m_dirty_footer = true;
 
     EnsureColumnWidths();
+    m_screen.SetSize(m_terminal_width, m_terminal_height);
 
 #ifdef INCLUDE_MENU_ROW
     StrW menu;
@@ -747,11 +1238,11 @@ void Chooser::UpdateDisplay(StrW* last_screen)
         }
 
         s.Printf(L"\x1b[%u;%uH", y, x);
-        s.Append(c_show_cursor);
-        OutputConsole(c_hide_cursor);
-        OutputConsole(s.Text(), s.Length());
+        m_screen.Present(s.Text(), s.Length());
     }
 
+    MarkFirstFrame();
+
     m_prev_visible_rows = m_visible_rows;
     m_last_feedback = std::move(m_feedback);
 #ifdef INCLUDE_MENU_ROW
@@ -765,6 +1256,7 @@ void Chooser::Relayout()
     m_terminal_height = 0;
     m_content_height = 0;
     m_vert_scroll_column = 0;
+    m_screen.Invalidate();
     ForceUpdateAll();
 }
 
@@ -788,43 +1280,26 @@ void Chooser::EnsureColumnWidths()
 
         const bool can_show_content = (terminal_height > m_content_height);
 
-        m_max_size_width = 0;
-        if (g_options.details >= 3 && m_files.size())
-        {
-            if (m_files[0].IsDirectory())
-                m_max_size_width = WidthForDirectorySize(g_options.details);
-
-            for (size_t index = 0; index < m_files.size(); ++index)
-            {
-                const FileInfo* pfi = &m_files[index];
-                const unsigned size_width = WidthForFileInfoSize(pfi, g_options.details, -1);
-                m_max_size_width = std::max<unsigned>(m_max_size_width, size_width);
-            }
-        }
+        EnsureItemWidths();
 
         // First try columns that are the height of the terminal and don't
         // need to scroll.
+        m_scroll_layout = false;
+        if (m_content_height)
         {
-            size_t rows = m_content_height;
-            unsigned width = 0;
             unsigned total_width = 0;
-            const size_t last = m_files.size() - 1;
 
             m_col_widths.clear();
-            for (size_t index = 0; index < m_files.size(); ++index)
+            for (size_t index = 0; index < m_files.size(); index += m_content_height)
             {
-                width = max<unsigned>(width, WidthForFileInfo(&m_files[index], g_options.details, m_max_size_width));
-                if (!--rows || index == last)
+                const size_t end = std::min<size_t>(index + m_content_height, m_files.size());
+                const unsigned width = m_item_widths.MaxWidth(index, end);
+                m_col_widths.emplace_back(width);
+                total_width += width + m_padding;
+                if (total_width > target_width)
                 {
-                    rows = m_content_height;
-                    m_col_widths.emplace_back(width);
-                    total_width += width + m_padding;
-                    width = 0;
-                    if (total_width > target_width)
-                    {
-                        m_col_widths.clear();
-                        break;
-                    }
+                    m_col_widths.clear();
+                    break;
                 }
             }
 
@@ -841,9 +1316,8 @@ void Chooser::EnsureColumnWidths()
         if (m_col_widths.empty())
         {
             target_width -= 2; // Reserve space for scrollbar.
-            m_col_widths = CalculateColumns([this](size_t index){
-                return WidthForFileInfo(&m_files[index], g_options.details, m_max_size_width);
-            }, m_files.size(), true, m_padding, target_width, target_width / 4);
+            m_scroll_layout = true;
+            m_col_widths = CalculateColumns(m_item_widths, true, m_padding, target_width, target_width / 4);
 
             m_num_per_row = int32(std::max<intptr_t>(1, m_col_widths.size()));
             m_num_rows = (m_count + m_num_per_row - 1) / m_num_per_row;
@@ -857,6 +1331,34 @@ void Chooser::EnsureColumnWidths()
     }
 }
 
+void Chooser::EnsureItemWidths()
+{
+    // The widths only depend on the files and the details level, so
+    // resizing the terminal doesn't need to measure the files again.
+    if (!m_item_widths.Empty() && m_item_widths_details == g_options.details)
+        return;
+
+    m_max_size_width = 0;
+    if (g_options.details >= 3 && m_files.size())
+    {
+        if (m_files[0].IsDirectory())
+            m_max_size_width = WidthForDirectorySize(g_options.details);
+
+        for (size_t index = 0; index < m_files.size(); ++index)
+        {
+            const FileInfo* pfi = &m_files[index];
+            const unsigned size_width = WidthForFileInfoSize(pfi, g_options.details, -1);
+            m_max_size_width = std::max<unsigned>(m_max_size_width, size_width);
+        }
+    }
+
+    std::vector<unsigned> widths(m_files.size());
+    for (size_t index = 0; index < m_files.size(); ++index)
+        widths[index] = WidthForFileInfo(&m_files[index], g_options.details, m_max_size_width);
+    m_item_widths.Init(std::move(widths));
+    m_item_widths_details = g_options.details;
+}
+
 ChooserOutcome Chooser::HandleInput(const InputRecord& input, Error& e)
 {
     const InputRecord prev_input = m_prev_input;
@@ -1103,6 +1605,10 @@ LNext:
             {
                 SearchAndTag(e, input.modifier == Modifier::None/*caseless*/);
             }
+            else if (!HasModifier(input.modifier, ~(Modifier::ALT|Modifier::SHIFT)))
+            {
+                return SearchTree(e, input.modifier == Modifier::ALT/*caseless*/);
+            }
             break;
         case '/':
         case '\\':
@@ -1174,9 +1680,17 @@ LNext:
             }
             break;
         case 'w':
-            if (input.modifier == Modifier::None)
+        case 'W':
+            if (!HasModifier(input.modifier, ~Modifier::SHIFT))
+            {
+                SweepFiles(e, HasModifier(input.modifier, Modifier::SHIFT));
+            }
+            break;
+        case 'z':
+        case 'Z':
+            if (!HasModifier(input.modifier, ~Modifier::SHIFT))
             {
-                SweepFiles(e);
+                ToggleDirectorySizes();
             }
             break;
         case 'x':
@@ -1294,18 +1808,15 @@ std::vector<StrW> Chooser::GetTaggedFiles(intptr_t* num_before_index) const
         (*num_before_index) = 0;
     if (m_index < 0)
         num_before_index = nullptr;
-    for (size_t i = 0; i < m_files.size(); ++i)
+    for (intptr_t i = m_tagged.NextMarked(0, m_files.size()); i >= 0; i = m_tagged.NextMarked(i + 1, m_files.size()))
     {
-        if (m_tagged.IsMarked(i))
+        const auto& file = m_files[i];
+        if (!file.IsDirectory())
         {
-            const auto& file = m_files[i];
-            if (!file.IsDirectory())
-            {
-                m_files[i].GetPathName(s);
-                files.emplace_back(std::move(s));
-                if (num_before_index && i < size_t(m_index))
-                    ++(*num_before_index);
-            }
+            file.GetPathName(s);
+            files.emplace_back(std::move(s));
+            if (num_before_index && i < m_index)
+                ++(*num_before_index);
         }
     }
     return files;
@@ -1319,17 +1830,14 @@ std::vector<intptr_t> Chooser::GetTaggedIndices(intptr_t* num_before_index) cons
         (*num_before_index) = 0;
     if (m_index < 0)
         num_before_index = nullptr;
-    for (size_t i = 0; i < m_files.size(); ++i)
+    for (intptr_t i = m_tagged.NextMarked(0, m_files.size()); i >= 0; i = m_tagged.NextMarked(i + 1, m_files.size()))
     {
-        if (m_tagged.IsMarked(i))
+        const auto& file = m_files[i];
+        if (!file.IsDirectory())
         {
-            const auto& file = m_files[i];
-            if (!file.IsDirectory())
-            {
-                indices.emplace_back(i);
-                if (num_before_index && i < size_t(m_index))
-                    ++(*num_before_index);
-            }
+            indices.emplace_back(i);
+            if (num_before_index && i < m_index)
+                ++(*num_before_index);
         }
     }
     return indices;
@@ -1346,7 +1854,7 @@ intptr_t Chooser::NumTaggedFiles()
         ++dirs;
     }
 
-    return m_tagged.CountMarked(m_files.size() - dirs);
+    return m_tagged.CountMarked(dirs, m_files.size());
 }
 
 void Chooser::SetIndex(intptr_t index)
@@ -1421,10 +1929,28 @@ void Chooser::EnsureTop()
 
 void Chooser::RefreshDirectoryListing(Error& e)
 {
+    // Changes deeper down don't update the timestamps of the directories
+    // listed here, so refreshing sizes them again.
+    m_dir_sizes.ClearCache();
+
     StrW dir(m_dir);
     Navigate(dir.Text(), e);
 }
 
+bool Chooser::UpdateDirectoryListing()
+{
+    // After the chooser itself changes something in the directory, wait
+    // briefly for the notifications and apply just those changes.  Any that
+    // arrive later are applied as they come.  Returns false if the directory
+    // isn't being watched, so the caller needs to refresh the listing.
+    const DWORD c_notify_wait = 100;
+    if (m_scan || !m_watcher || !m_watcher->IsWatching())
+        return false;
+    WaitForSingleObject(m_watcher->GetEvent(), c_notify_wait);
+    PollDirectoryChanges();
+    return true;
+}
+
 bool Chooser::AskForConfirmation(const WCHAR* msg)
 {
     const WCHAR* const directive = L"Press Y to confirm, or any other key to cancel...";
@@ -1897,7 +2423,8 @@ void Chooser::NewDirectory(Error& e)
     if (!MkDir(dir.Text(), e))
         return;
 
-    RefreshDirectoryListing(e);
+    if (!UpdateDirectoryListing())
+        RefreshDirectoryListing(e);
 }
 
 void Chooser::RenameEntry(Error& e)
@@ -1945,7 +2472,8 @@ void Chooser::RenameEntry(Error& e)
         return;
     }
 
-    RefreshDirectoryListing(e);
+    if (!UpdateDirectoryListing())
+        RefreshDirectoryListing(e);
 }
 
 void Chooser::DeleteEntries(Error& e, bool recycle)
@@ -2021,13 +2549,18 @@ void Chooser::DeleteEntries(Error& e, bool recycle)
 
     if (any)
     {
-        Error dummy;
-        Error* err = e.Test() ? &dummy : &e; // Don't overwrite e!
-        const auto top = m_top;
-        const auto index = m_index;
-        RefreshDirectoryListing(*err);
-        m_top = top;
-        m_index = index - num_before_index;
+        // Applying just the changes keeps the selection and the remaining
+        // tags; a full refresh can only approximate the position.
+        if (!UpdateDirectoryListing())
+        {
+            Error dummy;
+            Error* err = e.Test() ? &dummy : &e; // Don't overwrite e!
+            const auto top = m_top;
+            const auto index = m_index;
+            RefreshDirectoryListing(*err);
+            m_top = top;
+            m_index = index - num_before_index;
+        }
     }
 }
 
@@ -2238,7 +2771,7 @@ LShellExecute:
     e.Clear();
 }
 
-void Chooser::SweepFiles(Error& e)
+void Chooser::SweepFiles(Error& e, bool parallel)
 {
     std::vector<StrW> files;
     StrW name;
@@ -2322,20 +2855,11 @@ void Chooser::SweepFiles(Error& e)
     s.Printf(L"\r\n%s---- Sweep %zu File(s) ----%s\r\n", c_div, files.size(), c_norm);
     OutputConsole(s.Text(), s.Length());
 
-    bool completed = true;
-    size_t errors = 0;
+    // Build the command line for each file.
+    std::vector<StrW> commands;
+    commands.reserve(files.size());
     for (const auto& file : files)
     {
-        // Report each file.
-        s.Clear();
-        s.Printf(L"%s%s%s\r\n", sweepfile.Text(), file.Text(), c_norm);
-        OutputConsole(s.Text(), s.Length());
-
-        bool ok = false;
-#ifdef DISALLOW_DESTRUCTIVE_OPERATIONS
-        SetLastError(ERROR_ACCESS_DENIED);
-        e.Sys(L"(Destructive operations are disallowed.)");
-#else
         s.Clear();
         s.AppendMaybeQuoted(program.Text());
         if (args_before.Length() > 0)
@@ -2350,19 +2874,106 @@ void Chooser::SweepFiles(Error& e)
             s.Append(L" ");
             s.Append(args_after.Text());
         }
-        ok = RunProgram(s.Text());
+        commands.emplace_back(std::move(s));
+    }
+
+#ifdef DISALLOW_DESTRUCTIVE_OPERATIONS
+    parallel = false;
 #endif
-        if (!ok)
+
+    bool completed = true;
+    size_t errors = 0;
+    if (parallel)
+    {
+        // Run several at once, capturing each one's output and reporting it
+        // in order, with a progress line at the bottom.
+        const unsigned concurrency = g_options.sweep_jobs ? g_options.sweep_jobs : max<unsigned>(1, std::thread::hardware_concurrency());
+        const UINT cp = GetConsoleOutputCP();
+        size_t finished = 0;
+        size_t running = 0;
+        const auto progress_line = [&]()
         {
-            ++errors;
-            e.Set(L"Error running program for '%1'.") << file.Text();
-            ok = ReportError(e, ReportErrorFlags::CANABORT|ReportErrorFlags::INLINE);
-            e.Clear();
-            OutputConsole(L"\r\n");
+            s.Clear();
+            s.Printf(L"\r%s%zu of %zu finished, %zu running, %zu error(s)%s\x1b[K", c_div, finished, files.size(), running, errors, c_norm);
+            OutputConsole(s.Text(), s.Length());
+        };
+
+        const auto report = [&](size_t index, SweepResult& result)
+        {
+            s.Clear();
+            s.Printf(L"\r\x1b[K%s%s%s\r\n", sweepfile.Text(), files[index].Text(), c_norm);
+            OutputConsole(s.Text(), s.Length());
+
+            // Stream the output, so a command that writes a lot doesn't need
+            // it all in memory.
+            WCHAR last = '\n';
+            StreamSweepOutput(result, cp, [&](const WCHAR* text, unsigned len)
+            {
+                OutputConsole(text, len);
+                last = text[len - 1];
+            });
+
+            s.Clear();
+            if (last != '\n')
+                s.Append(L"\r\n");
+            if (result.canceled)
+            {
+                s.Append(L"(Canceled.)\r\n");
+            }
+            else if (!result.started)
+            {
+                ++errors;
+                s.Printf(L"Error running program for '%s'.  %s\r\n", files[index].Text(), result.error.Text());
+            }
+            else if (result.exit_code)
+            {
+                ++errors;
+                s.Printf(L"Exit code %d.\r\n", int(result.exit_code));
+            }
+            OutputConsole(s.Text(), s.Length());
+            progress_line();
+        };
+
+        const auto progress = [&](size_t done, size_t active)
+        {
+            finished = done;
+            running = active;
+            progress_line();
+        };
+
+        completed = RunSweepCommands(commands, concurrency, report, progress);
+        OutputConsole(L"\r\x1b[K");
+    }
+    else
+    {
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            const auto& file = files[i];
+
+            // Report each file.
+            s.Clear();
+            s.Printf(L"%s%s%s\r\n", sweepfile.Text(), file.Text(), c_norm);
+            OutputConsole(s.Text(), s.Length());
+
+            bool ok = false;
+#ifdef DISALLOW_DESTRUCTIVE_OPERATIONS
+            SetLastError(ERROR_ACCESS_DENIED);
+            e.Sys(L"(Destructive operations are disallowed.)");
+#else
+            ok = RunProgram(commands[i].Text());
+#endif
             if (!ok)
             {
-                completed = false;
-                break;
+                ++errors;
+                e.Set(L"Error running program for '%1'.") << file.Text();
+                ok = ReportError(e, ReportErrorFlags::CANABORT|ReportErrorFlags::INLINE);
+                e.Clear();
+                OutputConsole(L"\r\n");
+                if (!ok)
+                {
+                    completed = false;
+                    break;
+                }
             }
         }
     }
@@ -2397,7 +3008,7 @@ void Chooser::ShowFileList()
         files.emplace_back(std::move(tmp));
     }
 
-    const PopupResult result = ShowPopupList(files, L"Jump to Chosen File", m_index);
+    const PopupResult result = ShowPopupList(files, L"Jump to Chosen File", m_index, PopupListFlags::FuzzyFilter);
     ForceUpdateAll();
     if (!result.canceled)
         SetIndex(result.selected);
@@ -2431,51 +3042,162 @@ void Chooser::SearchAndTag(Error& e, bool caseless)
         SearchAndTag(searcher, e);
 }
 
-void Chooser::SearchAndTag(std::shared_ptr<Searcher> searcher, Error& e)
+struct SearchAndTagShared
 {
-    g_options.searcher = searcher;
+    enum : BYTE { Pending, NotFound, Found, Merged };
 
-    assert(!m_searching);
-    m_searching = true;
+                    SearchAndTagShared(const std::vector<FileInfo>& files) : files(files), results(files.size()) {}
+
+    const std::vector<FileInfo>& files;
+    std::vector<std::atomic<BYTE>> results;
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> current = 0;        // Most recently started file.
+    std::atomic<bool> stop = false;
+    std::atomic<bool> canceled = false;
+};
+
+struct SearchAndTagWorker
+{
+    SearchAndTagShared* shared = nullptr;
+    std::shared_ptr<Searcher> searcher;
+    size_t          error_index = size_t(-1);
+    DWORD           error_code = 0;
+    SHBasic         thread;
+};
+
+static DWORD WINAPI SearchAndTagProc(void* param)
+{
+    SearchAndTagWorker* const worker = static_cast<SearchAndTagWorker*>(param);
+    SearchAndTagShared& shared = *worker->shared;
 
     StrW s;
-    bool canceled = false;
-    size_t num_found = 0;
-    FoundOffset found_line;
     ContentCache ctx(g_options);
-    for (size_t index = 0; index < m_files.size(); ++index)
+    BulkReadScope bulk(ctx);
+    while (!shared.stop)
     {
-        if (m_files[index].IsDirectory())
+        const size_t index = shared.next++;
+        if (index >= shared.files.size())
+            break;
+        if (shared.files[index].IsDirectory())
             continue;
 
-        m_files[index].GetPathName(s);
-        m_searching_file = s.Text();
-        m_dirty_footer = true;
-        m_feedback.Set(L"*** Ctrl-Break to cancel ***");
-        UpdateDisplay();
-
-        ctx.Open(s.Text(), e);
+        shared.current = index;
+        shared.files[index].GetPathName(s);
 
-        if (e.Test())
+        Error e;
+        if (!ctx.Open(s.Text(), e))
         {
-            ReportError(e);
-            ForceUpdateAll();
+            // The UI thread reports the error, and stops the search.
+            worker->error_index = index;
+            worker->error_code = e.Code();
+            shared.stop = true;
             break;
         }
 
+        FoundOffset found_line;
         unsigned left_offset = 0;
-        const bool found = ctx.Find(true, searcher, 999, found_line, left_offset, e, true/*first*/);
+        const bool found = ctx.Find(true, worker->searcher, 999, found_line, left_offset, e, true/*first*/);
         if (e.Code() == E_ABORT)
         {
-            canceled = true;
+            shared.canceled = true;
+            shared.stop = true;
             break;
         }
 
-        if (found)
+        shared.results[index] = found ? SearchAndTagShared::Found : SearchAndTagShared::NotFound;
+    }
+
+    ctx.Close();
+    return 0;
+}
+
+void Chooser::SearchAndTag(std::shared_ptr<Searcher> searcher, Error& e)
+{
+    // How often to refresh the display while searching.
+    const DWORD c_search_refresh = 100;
+    const DWORD c_max_search_threads = 16;
+
+    g_options.searcher = searcher;
+
+    assert(!m_searching);
+    m_searching = true;
+
+    // Each worker thread opens its own ContentCache and uses its own clone
+    // of the searcher.  Workers pull files from a shared queue, and this
+    // thread merges the results and refreshes the display periodically.
+    SearchAndTagShared shared(m_files);
+    std::vector<std::unique_ptr<SearchAndTagWorker>> workers;
+    const DWORD num_cpus = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    const size_t num_threads = std::min<size_t>(std::min<size_t>(std::max<DWORD>(1, num_cpus), c_max_search_threads), std::max<size_t>(1, m_files.size()));
+    for (size_t ii = 0; ii < num_threads; ++ii)
+    {
+        auto worker = std::make_unique<SearchAndTagWorker>();
+        worker->shared = &shared;
+        worker->searcher = ii ? searcher->Clone(e) : searcher;
+        if (!worker->searcher)
+            break;
+        worker->thread = CreateThread(nullptr, 0, SearchAndTagProc, worker.get(), 0, nullptr);
+        if (worker->thread.Empty())
+            break;
+        workers.emplace_back(std::move(worker));
+    }
+    e.Clear();
+
+    StrW s;
+    size_t num_found = 0;
+    std::vector<HANDLE> handles;
+    for (const auto& worker : workers)
+        handles.emplace_back(worker->thread);
+
+    auto merge_results = [&]()
+    {
+        for (size_t index = 0; index < shared.results.size(); ++index)
+        {
+            if (shared.results[index] == SearchAndTagShared::Found)
+            {
+                shared.results[index] = SearchAndTagShared::Merged;
+                ++num_found;
+                m_tagged.Mark(index, 1);
+                m_dirty.Mark(index % m_num_rows, 1);
+            }
+        }
+    };
+
+    m_feedback.Set(L"*** Ctrl-Break to cancel ***");
+    bool done = handles.empty();
+    while (!done)
+    {
+        done = (WaitForMultipleObjects(DWORD(handles.size()), handles.data(), true, c_search_refresh) != WAIT_TIMEOUT);
+        if (IsSignaled())
         {
-            ++num_found;
-            m_tagged.Mark(index, 1);
-            m_dirty.Mark(index % m_num_rows, 1);
+            shared.canceled = true;
+            shared.stop = true;
+        }
+
+        merge_results();
+
+        if (!done)
+        {
+            const size_t current = shared.current;
+            if (current < m_files.size())
+            {
+                m_files[current].GetPathName(s);
+                m_searching_file = s.Text();
+            }
+            m_dirty_footer = true;
+            UpdateDisplay();
+        }
+    }
+
+    // Report the error for the earliest file that couldn't be opened.
+    size_t error_index = size_t(-1);
+    DWORD error_code = 0;
+    for (const auto& worker : workers)
+    {
+        if (worker->error_index < error_index)
+        {
+            error_index = worker->error_index;
+            error_code = worker->error_code;
         }
     }
 
@@ -2483,8 +3205,15 @@ void Chooser::SearchAndTag(std::shared_ptr<Searcher> searcher, Error& e)
     m_searching_file.Clear();
     m_dirty_footer = true;
 
+    if (error_index != size_t(-1))
+    {
+        e.Sys(error_code);
+        ReportError(e);
+        ForceUpdateAll();
+    }
+
     m_feedback.Clear();
-    if (canceled)
+    if (shared.canceled)
         m_feedback = c_canceled;
     else if (e.Test())
         return;
@@ -2496,3 +3225,107 @@ void Chooser::SearchAndTag(std::shared_ptr<Searcher> searcher, Error& e)
         ForceUpdateAll();
     }
 }
+
+ChooserOutcome Chooser::SearchTree(Error& e, bool caseless)
+{
+    // How often to refresh the display while searching.
+    const DWORD c_search_refresh = 100;
+
+    StrW dir;
+    StrW mask;
+    if (!GetListingDirectory(dir, mask))
+        return ChooserOutcome::CONTINUE;
+
+#ifdef INCLUDE_MENU_ROW
+    UpdateDisplay();
+#endif
+
+    StrW s;
+    s.Printf(L"\x1b[%uH", m_terminal_height);
+    s.AppendColor(GetColor(ColorElement::Footer));
+    s.Printf(L"\r\x1b[KSearch tree%s ", c_prompt_char);
+    OutputConsole(s.Text(), s.Length());
+
+    auto searcher = ReadSearchInput(m_terminal_height - 1, m_terminal_width, caseless, e);
+
+    OutputConsole(c_norm);
+    m_dirty_footer = true;
+
+    if (e.Test() || !searcher)
+        return ChooserOutcome::CONTINUE;
+
+    g_options.searcher = searcher;
+
+    TreeSearch search;
+    if (!search.Start(dir.Text(), mask.Text(), searcher, e))
+        return ChooserOutcome::CONTINUE;
+
+    // The hits stream in while the tree is searched.  Ctrl-Break stops the
+    // search, and the hits found so far can still be chosen.
+    assert(!m_searching);
+    m_searching = true;
+
+    std::vector<TreeSearch::Hit> hits;
+    bool done = false;
+    while (!done)
+    {
+        done = search.TakeHits(hits);
+        if (IsSignaled())
+            search.Cancel();
+        if (!done)
+        {
+            search.GetCurrentFile(m_searching_file);
+            m_feedback.Clear();
+            m_feedback.Printf(L"*** %zu hit(s) in %zu file(s); Ctrl-Break to stop ***", hits.size(), search.CountSearched());
+            m_dirty_footer = true;
+            UpdateDisplay();
+            Sleep(c_search_refresh);
+        }
+    }
+    search.Stop();
+
+    m_searching = false;
+    m_searching_file.Clear();
+    m_dirty_footer = true;
+    ForceUpdateAll();
+
+    m_feedback.Clear();
+    if (hits.empty())
+    {
+        m_feedback = search.IsCanceled() ? c_canceled : c_text_not_found;
+        return ChooserOutcome::CONTINUE;
+    }
+
+    // Show paths relative to the root of the search, to leave room for the
+    // text.
+    const size_t root_len = wcslen(search.GetDirectory());
+    std::vector<StrW> items;
+    items.reserve(hits.size());
+    for (const auto& hit : hits)
+    {
+        const WCHAR* file = hit.file.Text();
+        if (hit.file.Length() > root_len)
+            file += root_len + (hit.file.Text()[root_len] == '\\');
+        const WCHAR* text = hit.text.Text();
+        while (*text == ' ' || *text == '\t')
+            ++text;
+        s.Clear();
+        s.Printf(L"%s(%s%zu):  %s", file, hit.approx_line ? L"~" : L"", hit.line, text);
+        items.emplace_back(std::move(s));
+    }
+
+    StrW title;
+    title.Printf(L"%zu Hit(s)%s", hits.size(), search.IsTruncated() ? L" (Stopped at Limit)" : search.IsCanceled() ? L" (Canceled)" : L"");
+    if (search.CountSkipped())
+        title.Printf(L", %zu Unreadable", search.CountSkipped());
+
+    const PopupResult result = ShowPopupList(items, title.Text(), 0, PopupListFlags::FuzzyFilter);
+    ForceUpdateAll();
+    if (result.canceled || size_t(result.selected) >= hits.size())
+        return ChooserOutcome::CONTINUE;
+
+    const auto& hit = hits[result.selected];
+    m_found_file.Set(hit.file);
+    SetViewerGotoOffset(hit.offset);
+    return ChooserOutcome::VIEWFOUND;
+}
@@ -13,30 +13,42 @@
 #include "output.h"
 #include "scroll_car.h"
 #include "searcher.h"
+#include "screenbuffer.h"
+#include "scan.h"
+#include "dirwatch.h"
+#include "dirsize.h"
+#include "memorybudget.h"
 
 #include <vector>
-#include <unordered_set>
 
+// A bitset of marked indices.  Marking all or reversing the marks only flips
+// m_reverse, so they're instant regardless of the number of indices.
 class MarkedList
 {
 public:
                     MarkedList() = default;
 
-    void            Clear() { m_set.clear(); m_reverse = false; }
-    void            MarkAll() { m_set.clear(); m_reverse = true; }
+    void            Clear() { m_bits.clear(); m_count = 0; m_reverse = false; }
+    void            MarkAll() { m_bits.clear(); m_count = 0; m_reverse = true; }
     void            Reverse() { m_reverse = !m_reverse; }
     void            Mark(intptr_t index, int tag);  // -1=unmark, 0=toggle, 1=mark
     bool            IsMarked(intptr_t index) const;
     bool            AnyMarked() const;
     bool            AllMarked() const;
-    size_t          CountMarked(size_t total) const;
+    size_t          CountMarked(size_t begin, size_t end) const;
+    intptr_t        NextMarked(size_t index, size_t end) const;   // -1 if none.
+    void            Remap(const std::vector<intptr_t>& moved);
 
 private:
-    std::unordered_set<intptr_t> m_set;
+    uint64          Word(size_t word) const { return (word < m_bits.size()) ? m_bits[word] : 0; }
+
+private:
+    std::vector<uint64> m_bits;             // Indices whose mark differs from m_reverse.
+    size_t          m_count = 0;            // Number of bits set in m_bits.
     bool            m_reverse = false;
 };
 
-enum class ChooserOutcome { CONTINUE, VIEWONE, VIEWTAGGED, EXITAPP };
+enum class ChooserOutcome { CONTINUE, VIEWONE, VIEWTAGGED, VIEWFOUND, EXITAPP };
 
 class Chooser
 {
@@ -50,6 +62,7 @@ public:
     StrW            GetSelectedFile(bool only_files=false) const;
     std::vector<StrW> GetTaggedFiles(intptr_t* num_before_index=nullptr) const;
     std::vector<intptr_t> GetTaggedIndices(intptr_t* num_before_index=nullptr) const;
+    const StrW&     GetFoundFile() const { return m_found_file; }
 
 private:
     void            Reset();
@@ -57,11 +70,23 @@ private:
     void            UpdateDisplay(StrW* last_screen=nullptr);
     void            Relayout();
     void            EnsureColumnWidths();
+    void            EnsureItemWidths();
+    void            PollDirectoryScan();
+    void            MergeFiles(std::vector<FileInfo>&& arrived, const std::vector<bool>* removed=nullptr);
+    bool            GetListingDirectory(StrW& dir, StrW& mask) const;
+    void            StartWatching();
+    void            PollDirectoryChanges();
+    void            ApplyDirectoryChanges(const std::unordered_set<std::wstring>& names);
+    void            UpdateFilesMemory();
+    void            SizeDirectories(std::vector<FileInfo>& files);
+    void            PollDirectorySizes();
+    void            ToggleDirectorySizes();
     ChooserOutcome  HandleInput(const InputRecord& input, Error &e);
     void            SetIndex(intptr_t index);
     void            SetTop(intptr_t top);
     void            EnsureTop();
     void            RefreshDirectoryListing(Error& e);
+    bool            UpdateDirectoryListing();
     bool            HasSelectedFile(bool only_files=false) const;
     intptr_t        NumTaggedFiles();
 
@@ -80,10 +105,11 @@ private:
     void            RenameEntry(Error& e);
     void            DeleteEntries(Error& e, bool recycle);
     void            RunFile(bool edit, Error& e, bool new_console=false);
-    void            SweepFiles(Error& e);
+    void            SweepFiles(Error& e, bool parallel=false);
     void            ShowFileList();
     void            SearchAndTag(Error& e, bool caseless);
     void            SearchAndTag(std::shared_ptr<Searcher> searcher, Error& e);
+    ChooserOutcome  SearchTree(Error& e, bool caseless);
 
 private:
     const Interactive* const m_interactive;
@@ -94,8 +120,19 @@ private:
 
     StrW            m_dir;
     std::vector<FileInfo> m_files;
+    MemoryCharge    m_files_memory = MemoryCharge(MemoryUse::FileLists);
+    std::unique_ptr<DirectoryScan> m_scan;  // While the files are still arriving.
+    StrW            m_scan_select;          // Directory to select once it arrives.
+    std::unique_ptr<DirectoryWatcher> m_watcher; // Changes after the scan.
+    StrW            m_watch_dir;            // Full path of the watched directory.
+    StrW            m_watch_mask;           // File mask, or empty for all files.
+    DirectorySizes  m_dir_sizes;            // Kept across navigations, to reuse sizes.
+    uint32          m_dir_sizes_completed = 0;
     ColumnWidths    m_col_widths;
+    bool            m_scroll_layout = false; // Whether the columns scroll.
     unsigned        m_max_size_width = 0;
+    ColumnItemWidths m_item_widths;         // Width of each file, for the layout.
+    int32           m_item_widths_details = -1; // Details level of m_item_widths.
     intptr_t        m_count = 0;
     intptr_t        m_num_rows = 0;
     int32           m_num_per_row = 0;
@@ -107,6 +144,7 @@ private:
     ClickableRow    m_clickable_menu;
 #endif
     ClickableRow    m_clickable_footer;
+    ScreenBuffer    m_screen;
     MouseHelper     m_mouse;
     StrW            m_feedback;
 
@@ -129,6 +167,7 @@ private:
     bool            m_dirty_footer = false;
     bool            m_searching = false;
     StrW            m_searching_file;
+    StrW            m_found_file;           // File to view for VIEWFOUND.
     intptr_t        m_prev_visible_rows = 0;
 
     StrW            m_last_feedback;
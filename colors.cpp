@@ -17,7 +17,9 @@
 #include "palette.h"
 
 #include <math.h>
+#include <string>
 #include <unordered_map>
+#include <vector>
 #include <cmath>
 #include <strsafe.h>
 
@@ -79,7 +81,9 @@ static const WCHAR* c_default_colors[] =
     L"7",               // EndOfFileLine
     L"30;47",           // MarkedLine
     L"30;43",           // BookmarkedLine
+    L"30;46",           // DifferentLine
     L"7;36",            // SearchFound
+    L"4;36",            // SearchMatch
     L"97;45",           // EditedByte
     L"97;42",           // SavedByte
 };
@@ -673,42 +677,96 @@ COLORREF Oklab::to_rgb() const
 
 }; // namespace colorspace
 
+// Drawing with color scales calls ApplyGradient, StripLineStyles, and
+// BlendColors for each file or row, so their results are cached.  The caches
+// are reset whenever the colors are read.
+
+static const unsigned c_gradient_steps = 256;
+static float s_gradient_luminance[c_gradient_steps];
+static bool s_gradient_luminance_inited = false;
+static std::unordered_map<std::wstring, std::vector<std::wstring>> s_gradient_cache;
+
+static void EnsureGradientLuminance()
+{
+    if (s_gradient_luminance_inited)
+        return;
+    s_gradient_luminance_inited = true;
+
+    // This formula for applying a gradient effect is borrowed from eza.
+    // https://github.com/eza-community/eza/blob/626eb34df26376fc36758894424676ffa4363785/src/output/color_scale.rs#L201-L213
+    for (unsigned i = 0; i < c_gradient_steps; ++i)
+    {
+        const double ratio = double(i) / double(c_gradient_steps - 1);
+        s_gradient_luminance[i] = float(clamp(s_min_luminance + (1.0 - s_min_luminance) * exp(-4.0 * (1.0 - ratio)), 0.0, 1.0));
+    }
+}
+
+static unsigned GradientStep(ULONGLONG value, ULONGLONG min, ULONGLONG max)
+{
+    assert(min <= max);
+    if (value >= max || min == max)
+        return c_gradient_steps - 1;
+    if (value <= min)
+        return 0;
+
+    ULONGLONG range = max - min;
+    ULONGLONG offset = value - min;
+    while (range > ULLONG_MAX / c_gradient_steps)
+    {
+        range >>= 1;
+        offset >>= 1;
+    }
+    return unsigned((offset * (c_gradient_steps - 1) + range / 2) / range);
+}
+
 const WCHAR* ApplyGradient(const WCHAR* color, ULONGLONG value, ULONGLONG min, ULONGLONG max)
 {
     assert(color);
 
-    COLORREF rgb = RgbFromColor(color);
-    if (rgb == 0xffffffff || min > max)
+    if (min > max)
         return color;
 
-    // This formula for applying a gradient effect is borrowed from eza.
-    // https://github.com/eza-community/eza/blob/626eb34df26376fc36758894424676ffa4363785/src/output/color_scale.rs#L201-L213
+    std::vector<std::wstring>& steps = s_gradient_cache[color];
+    if (steps.empty())
     {
-        colorspace::Oklab oklab(rgb);
-
-        double ratio = double(value - min) / double(max - min);
-        if (std::isnan(ratio))
-            ratio = 1.0;
-        oklab.L = float(clamp(s_min_luminance + (1.0 - s_min_luminance) * exp(-4.0 * (1.0 - ratio)), 0.0, 1.0));
+        const COLORREF rgb = RgbFromColor(color);
+        if (rgb == 0xffffffff)
+        {
+            steps.emplace_back(color);      // Marks it as not a gradient.
+        }
+        else
+        {
+            EnsureGradientLuminance();
 
-        rgb = oklab.to_rgb();
+            const colorspace::Oklab base(rgb);
+            StrW tmp;
+            steps.resize(c_gradient_steps);
+            for (unsigned i = 0; i < c_gradient_steps; ++i)
+            {
+                colorspace::Oklab oklab(base);
+                oklab.L = s_gradient_luminance[i];
+                const COLORREF step_rgb = oklab.to_rgb();
+
+                tmp.Set(color);
+                if (*color)
+                    tmp.Append(';');
+                tmp.Printf(L"38;2;%u;%u;%u", GetRValue(step_rgb), GetGValue(step_rgb), GetBValue(step_rgb));
+                steps[i] = tmp.Text();
+            }
+        }
     }
 
-    static StrW s_color;
-    s_color.Set(color);
-    if (*color)
-        s_color.Append(';');
-    s_color.Printf(L"38;2;%u;%u;%u", GetRValue(rgb), GetGValue(rgb), GetBValue(rgb));
-    return s_color.Text();
+    if (steps.size() < c_gradient_steps)
+        return color;
+    return steps[GradientStep(value, min, max)].c_str();
 }
 
-const WCHAR* StripLineStyles(const WCHAR* color)
+static const WCHAR* StripLineStyles(const WCHAR* color, StrW& tmp)
 {
     if (!color)
         return color;
 
-    static StrW s_tmp;
-    s_tmp.Clear();
+    tmp.Clear();
 
     const WCHAR* start = color;
     unsigned num = 0;
@@ -754,7 +812,7 @@ const WCHAR* StripLineStyles(const WCHAR* color)
             if (strip)
                 any_stripped = true;
             else
-                s_tmp.Append(start, unsigned(p - start));
+                tmp.Append(start, unsigned(p - start));
 
             if (!*p)
                 break;
@@ -773,7 +831,39 @@ const WCHAR* StripLineStyles(const WCHAR* color)
             return L"";
     }
 
-    return any_stripped ? s_tmp.Text() : color;
+    return any_stripped ? tmp.Text() : color;
+}
+
+static const WCHAR* s_colors_nolines[_countof(s_colors)];
+static StrW s_colors_nolines_storage[_countof(s_colors)];
+
+static void InitColorsNoLines()
+{
+    for (size_t i = 0; i < _countof(s_colors); ++i)
+    {
+        StrW tmp;
+        const WCHAR* nolines = StripLineStyles(s_colors[i], tmp);
+        if (nolines != s_colors[i])
+        {
+            s_colors_nolines_storage[i].Set(nolines);
+            nolines = s_colors_nolines_storage[i].Text();
+        }
+        s_colors_nolines[i] = nolines;
+    }
+}
+
+const WCHAR* StripLineStyles(const WCHAR* color)
+{
+    // The colors from GetColor() are stripped in advance.
+    if (color >= s_colors[0] && color < s_colors[_countof(s_colors) - 1] + _countof(s_colors[0]))
+    {
+        const size_t i = (color - s_colors[0]) / _countof(s_colors[0]);
+        if (color == s_colors[i] && s_colors_nolines[i])
+            return s_colors_nolines[i];
+    }
+
+    static StrW s_tmp;
+    return StripLineStyles(color, s_tmp);
 }
 
 inline BYTE BlendValue(BYTE a, BYTE b, BYTE alpha)
@@ -781,7 +871,7 @@ inline BYTE BlendValue(BYTE a, BYTE b, BYTE alpha)
     return ((WORD(a) * alpha) + (WORD(b) * (255 - alpha))) / 255;
 }
 
-const WCHAR* BlendColors(const WCHAR* a, const WCHAR* b, BYTE alpha, bool back, bool opposite_a, bool opposite_b)
+static const WCHAR* BlendColorsUncached(const WCHAR* a, const WCHAR* b, BYTE alpha, bool back, bool opposite_a, bool opposite_b)
 {
     const COLORREF rgb_a = RgbFromColor(a, (back ^ opposite_a) ? RgbFromColorMode::Background : RgbFromColorMode::Foreground);
     const COLORREF rgb_b = RgbFromColor(b, (back ^ opposite_b) ? RgbFromColorMode::Background : RgbFromColorMode::Foreground);
@@ -800,6 +890,24 @@ const WCHAR* BlendColors(const WCHAR* a, const WCHAR* b, BYTE alpha, bool back,
     return s_color.Text();
 }
 
+static std::unordered_map<std::wstring, std::wstring> s_blend_cache;
+
+const WCHAR* BlendColors(const WCHAR* a, const WCHAR* b, BYTE alpha, bool back, bool opposite_a, bool opposite_b)
+{
+    std::wstring key;
+    key.append(a);
+    key.push_back('|');
+    key.append(b);
+    key.push_back('|');
+    key.push_back(WCHAR(0x100 | alpha));
+    key.push_back(WCHAR(0x100 | (back ? 1 : 0) | (opposite_a ? 2 : 0) | (opposite_b ? 4 : 0)));
+
+    auto iter = s_blend_cache.find(key);
+    if (iter == s_blend_cache.end())
+        iter = s_blend_cache.emplace(std::move(key), BlendColorsUncached(a, b, alpha, back, opposite_a, opposite_b)).first;
+    return iter->second.c_str();
+}
+
 void ReportColorlessError(Error& e)
 {
     if (e.Test())
@@ -864,7 +972,9 @@ static const WCHAR* const c_reg_color_name[] =
     L"EndOfFileLine",
     L"MarkedLine",
     L"BookmarkedLine",
+    L"DifferentLine",
     L"SearchFound",
+    L"SearchMatch",
     L"EditedByte",
     L"SavedByte",
 };
@@ -884,6 +994,15 @@ static void InitColors()
     }
 }
 
+static void ResetColorCaches()
+{
+    // The gradient is only computed when a color scale is first drawn.
+    s_gradient_luminance_inited = false;
+    InitColorsNoLines();
+    s_gradient_cache.clear();
+    s_blend_cache.clear();
+}
+
 #ifdef USE_REGISTRY_FOR_COLORS
 void ReadColors(HKEY hkeyApp)
 {
@@ -891,6 +1010,8 @@ void ReadColors(HKEY hkeyApp)
 
     for (uint32 i = 0; i < _countof(c_reg_color_name); ++i)
         ReadConfigString(hkeyApp, c_reg_color_name[i], _countof(s_colors[i]), c_default_colors[i]);
+
+    ResetColorCaches();
 }
 #else
 void ReadColors(const WCHAR* ini_filename)
@@ -899,6 +1020,8 @@ void ReadColors(const WCHAR* ini_filename)
 
     for (uint32 i = 0; i < _countof(c_reg_color_name); ++i)
         ReadConfigString(ini_filename, L"Colors", c_reg_color_name[i], s_colors[i], _countof(s_colors[i]), c_default_colors[i]);
+
+    ResetColorCaches();
 }
 
 bool WriteColors(const WCHAR* ini_filename)
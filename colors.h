@@ -72,7 +72,9 @@ enum class ColorElement
     EndOfFileLine,
     MarkedLine,
     BookmarkedLine,
+    DifferentLine,
     SearchFound,
+    SearchMatch,
     EditedByte,
     SavedByte,
 
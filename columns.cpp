@@ -7,114 +7,198 @@
 #include "columns.h"
 
 #include <assert.h>
+#include <intrin.h>
 
-ColumnWidths CalculateColumns(const std::function<unsigned(size_t)>&& item_width_callback, const size_t count, const bool vertical, const unsigned padding, unsigned max_width, unsigned max_columns)
+void ColumnItemWidths::Init(std::vector<unsigned>&& widths)
 {
-    ColumnWidths out;
+    Clear();
+    m_widths = std::move(widths);
 
-    if (count > 0 && max_columns && max_width)
+    // Sparse table of range maxima.
+    const std::vector<unsigned>* prev = &m_widths;
+    for (size_t span = 2; span <= m_widths.size(); span *= 2)
     {
-        if (max_columns > count)
-            max_columns = unsigned(count);
-        if (max_columns > 50)
-            max_columns = 50;
-        if (max_width > 1024)
-            max_width = 1024;
-
-#if 0
-        const unsigned orig_max_columns = max_columns;
-#endif
+        std::vector<unsigned> level(m_widths.size() - span + 1);
+        const size_t half = span / 2;
+        for (size_t i = 0; i < level.size(); ++i)
+            level[i] = max<unsigned>((*prev)[i], (*prev)[i + half]);
+        m_max.emplace_back(std::move(level));
+        prev = &m_max.back();
+    }
+}
 
-        // Memory layout:
-        //
-        //      NUM_COLS    COL_1       COL_2       COL_3   ...
-        //      --------    -----       -----       -----
-        //      VALID  1       61
-        //        -    2       61          45
-        //      VALID  3       12          61           5
-        //       ...
+void ColumnItemWidths::Clear()
+{
+    m_widths.clear();
+    m_max.clear();
+}
 
-        struct CandidateColumns
-        {
-            bool            valid;
-            unsigned        line_width;
-            unsigned*       column_widths;
-            size_t          vertical_stride;
-        };
+unsigned ColumnItemWidths::MaxWidth(size_t begin, size_t end) const
+{
+    assert(begin < end);
+    assert(end <= m_widths.size());
+
+    const size_t len = end - begin;
+    if (len == 1)
+        return m_widths[begin];
+
+    unsigned long level;
+#ifdef _WIN64
+    _BitScanReverse64(&level, len);
+#else
+    _BitScanReverse(&level, DWORD(len));
+#endif
+    const size_t span = size_t(1) << level;
+    const std::vector<unsigned>& table = m_max[level - 1];
+    return max<unsigned>(table[begin], table[end - span]);
+}
 
-        const unsigned storage_capacity = (max_columns * (max_columns + 1)) / 2;
-        CandidateColumns* candidates = new CandidateColumns[max_columns];
-        unsigned* width_storage = new unsigned[storage_capacity];
+static ColumnWidths CalculateHorizontalColumns(const ColumnItemWidths& items, const unsigned padding, const unsigned max_width, unsigned max_columns)
+{
+    ColumnWidths out;
+    const size_t count = items.Count();
+
+    // Memory layout:
+    //
+    //      NUM_COLS    COL_1       COL_2       COL_3   ...
+    //      --------    -----       -----       -----
+    //      VALID  1       61
+    //        -    2       61          45
+    //      VALID  3       12          61           5
+    //       ...
+
+    struct CandidateColumns
+    {
+        bool            valid;
+        unsigned        line_width;
+        unsigned*       column_widths;
+    };
+
+    const unsigned storage_capacity = (max_columns * (max_columns + 1)) / 2;
+    std::vector<CandidateColumns> candidates(max_columns);
+    std::vector<unsigned> width_storage(storage_capacity);
+
+    // Initialize the data structures.
+    unsigned* storage = width_storage.data();
+    for (unsigned y = 0; y < max_columns; ++y)
+    {
+        auto& candidate = candidates[y];
+        candidate.valid = true;
+        candidate.line_width = (y * (1 + padding)) + 1;
+        candidate.column_widths = storage;
+        for (unsigned x = 0; x <= y; ++x)
+            *(storage++) = 1; // Empty columns aren't supported.
+    }
+    assert(storage == width_storage.data() + storage_capacity);
 
-        if (candidates && width_storage)
+    // Evaluate the item widths.
+    for (size_t i = 0; i < count; ++i)
+    {
+        const unsigned item_width = items.Width(i);
+
+        // For each candidate number of columns...
+        unsigned new_max = 0;
+        for (unsigned n = 0; n < max_columns; ++n)
         {
-            // Initialize the data structures.
-            unsigned* storage = width_storage;
-            for (unsigned y = 0; y < max_columns; ++y)
-            {
-                auto& candidate = candidates[y];
-                candidate.valid = true;
-                candidate.line_width = (y * (1 + padding)) + 1;
-                candidate.column_widths = storage;
-                for (unsigned x = 0; x <= y; ++x)
-                    *(storage++) = 1; // Empty columns aren't supported.
-                candidate.vertical_stride = (count + y) / (y + 1);
-            }
-            assert(storage == width_storage + storage_capacity);
+            // Skip invalid candidates.
+            auto& candidate = candidates[n];
+            if (!candidate.valid)
+                continue;
 
-            // Evaluate the item widths.
-            for (size_t i = 0; i < count; ++i)
+            // Compute the item's column index in this candidate.
+            const unsigned c = unsigned(i % (n + 1));
+
+            // Update the column's width.
+            const unsigned col_width = candidate.column_widths[c];
+            if (col_width < item_width)
             {
-                // For each candidate number of columns...
-                unsigned new_max = 0;
-                for (unsigned n = 0; n < max_columns; ++n)
+                const unsigned line_width = candidate.line_width - col_width + item_width;
+                if (line_width > max_width && n)
                 {
-                    // Skip invalid candidates.
-                    auto& candidate = candidates[n];
-                    if (!candidate.valid)
-                        continue;
-
-                    // Compute the item's column index in this candidate.
-                    unsigned c;
-                    if (vertical)
-                        c = unsigned(i / candidate.vertical_stride);
-                    else
-                        c = unsigned(i % (n + 1));
-                    assert(c <= n);
-
-                    // Update the column's width.
-                    const unsigned col_width = candidate.column_widths[c];
-                    const unsigned item_width = item_width_callback(i);
-                    if (col_width < item_width)
-                    {
-                        const unsigned line_width = candidate.line_width - col_width + item_width;
-                        if (line_width > max_width && n)
-                        {
-                            candidate.valid = false;
-                            continue;
-                        }
-                        candidate.line_width = line_width;
-                        candidate.column_widths[c] = item_width;
-                    }
-
-                    new_max = n + 1;
+                    candidate.valid = false;
+                    continue;
                 }
-
-                max_columns = new_max;
+                candidate.line_width = line_width;
+                candidate.column_widths[c] = item_width;
             }
 
-            assert(max_columns > 0);
-            assert(candidates[max_columns - 1].valid);
-            assert(max_columns == 1 || candidates[max_columns - 1].line_width <= max_width);
-
-            for (const unsigned* col_widths = candidates[max_columns - 1].column_widths; max_columns--;)
-                out.emplace_back(*(col_widths++));
+            new_max = n + 1;
         }
 
-        delete [] candidates;
-        delete [] width_storage;
+        max_columns = new_max;
     }
 
+    assert(max_columns > 0);
+    assert(candidates[max_columns - 1].valid);
+    assert(max_columns == 1 || candidates[max_columns - 1].line_width <= max_width);
+
+    for (const unsigned* col_widths = candidates[max_columns - 1].column_widths; max_columns--;)
+        out.emplace_back(*(col_widths++));
     return out;
 }
 
+static ColumnWidths CalculateVerticalColumns(const ColumnItemWidths& items, const unsigned padding, const unsigned max_width, const unsigned max_columns)
+{
+    ColumnWidths out;
+    const size_t count = items.Count();
+
+    // In a vertical layout each column is a contiguous range of items, so
+    // each column's width is a range max.  Try the most columns first; the
+    // first candidate that fits is the answer, and evaluating a candidate
+    // costs only one range max per column.
+    for (unsigned num = max_columns; num > 1; --num)
+    {
+        const size_t stride = (count + num - 1) / num;
+        unsigned line_width = (num - 1) * padding;
+        out.clear();
+        for (size_t begin = 0; begin < count && line_width <= max_width; begin += stride)
+        {
+            const unsigned width = max<unsigned>(1, items.MaxWidth(begin, min<size_t>(begin + stride, count)));
+            out.emplace_back(width);
+            line_width += width;
+        }
+        // Like the candidates in the horizontal layout, a candidate has
+        // exactly num columns, even if the last ones are empty.
+        while (out.size() < num && line_width <= max_width)
+        {
+            out.emplace_back(1);
+            line_width += 1;
+        }
+        if (line_width <= max_width)
+            return out;
+    }
+
+    out.clear();
+    out.emplace_back(max<unsigned>(1, items.MaxWidth(0, count)));
+    return out;
+}
+
+ColumnWidths CalculateColumns(const ColumnItemWidths& items, const bool vertical, const unsigned padding, unsigned max_width, unsigned max_columns)
+{
+    const size_t count = items.Count();
+    if (!count || !max_columns || !max_width)
+        return ColumnWidths();
+
+    if (max_columns > count)
+        max_columns = unsigned(count);
+    if (max_columns > 50)
+        max_columns = 50;
+    if (max_width > 1024)
+        max_width = 1024;
+
+    if (vertical)
+        return CalculateVerticalColumns(items, padding, max_width, max_columns);
+    return CalculateHorizontalColumns(items, padding, max_width, max_columns);
+}
+
+ColumnWidths CalculateColumns(const std::function<unsigned(size_t)>&& item_width_callback, const size_t count, const bool vertical, const unsigned padding, unsigned max_width, unsigned max_columns)
+{
+    // Evaluate each item's width once.
+    std::vector<unsigned> widths(count);
+    for (size_t i = 0; i < count; ++i)
+        widths[i] = item_width_callback(i);
+
+    ColumnItemWidths items;
+    items.Init(std::move(widths));
+    return CalculateColumns(items, vertical, padding, max_width, max_columns);
+}
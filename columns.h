@@ -10,5 +10,25 @@
 
 typedef std::vector<unsigned> ColumnWidths;
 
+// Item widths for laying out columns, with a table for finding the widest
+// item in any contiguous range in constant time.  Building it is the only
+// part that depends on the number of items, so laying out the same items
+// again (e.g. after resizing the terminal) is quick.
+class ColumnItemWidths
+{
+public:
+                    ColumnItemWidths() = default;
+    void            Init(std::vector<unsigned>&& widths);
+    void            Clear();
+    bool            Empty() const { return m_widths.empty(); }
+    size_t          Count() const { return m_widths.size(); }
+    unsigned        Width(size_t index) const { return m_widths[index]; }
+    unsigned        MaxWidth(size_t begin, size_t end) const;
+private:
+    std::vector<unsigned> m_widths;
+    std::vector<std::vector<unsigned>> m_max; // m_max[k][i] is the max of [i, i + 2^(k+1)).
+};
+
+ColumnWidths CalculateColumns(const ColumnItemWidths& items, bool vertical, unsigned padding=2, unsigned max_width=79, unsigned max_columns=0xff);
 ColumnWidths CalculateColumns(const std::function<unsigned(size_t)>&& item_width_callback, size_t count, bool vertical, unsigned padding=2, unsigned max_width=79, unsigned max_columns=0xff);
 
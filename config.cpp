@@ -149,6 +149,97 @@ static void SetShowRuler(const WCHAR* value)
     g_options.show_ruler = ParseBoolean(value);
 }
 
+static void GetMemoryMapFiles(StrW& out)
+{
+    out = BooleanValue(g_options.memory_map_files);
+}
+static void SetMemoryMapFiles(const WCHAR* value)
+{
+    g_options.memory_map_files = ParseBoolean(value);
+}
+
+static void GetIndexCache(StrW& out)
+{
+    out = BooleanValue(g_options.index_cache);
+}
+static void SetIndexCache(const WCHAR* value)
+{
+    g_options.index_cache = ParseBoolean(value);
+}
+
+static void GetDirectorySizes(StrW& out)
+{
+    out = BooleanValue(g_options.directory_sizes);
+}
+static void SetDirectorySizes(const WCHAR* value)
+{
+    g_options.directory_sizes = ParseBoolean(value);
+}
+
+static void GetPreloadFiles(StrW& out)
+{
+    out = BooleanValue(g_options.preload_files);
+}
+static void SetPreloadFiles(const WCHAR* value)
+{
+    g_options.preload_files = ParseBoolean(value);
+}
+
+static void GetBlockCacheLimit(StrW& out)
+{
+    out.Printf(L"%u", g_options.block_cache_limit);
+}
+static void SetBlockCacheLimit(const WCHAR* value)
+{
+    ULONGLONG n;
+    if (ParseULongLong(value, n) && n <= 1024 * 1024)
+        g_options.block_cache_limit = unsigned(n);
+}
+
+static void GetRecentFilesLimit(StrW& out)
+{
+    out.Printf(L"%u", g_options.recent_files_limit);
+}
+static void SetRecentFilesLimit(const WCHAR* value)
+{
+    ULONGLONG n;
+    if (ParseULongLong(value, n) && n <= 1024 * 1024)
+        g_options.recent_files_limit = unsigned(n);
+}
+
+static void GetPipeMemoryLimit(StrW& out)
+{
+    out.Printf(L"%u", g_options.pipe_memory_limit);
+}
+static void SetPipeMemoryLimit(const WCHAR* value)
+{
+    ULONGLONG n;
+    if (ParseULongLong(value, n) && n <= 1024 * 1024)
+        g_options.pipe_memory_limit = unsigned(n);
+}
+
+static void GetMemoryBudget(StrW& out)
+{
+    out.Printf(L"%u", g_options.memory_budget);
+}
+static void SetMemoryBudget(const WCHAR* value)
+{
+    ULONGLONG n;
+    if (ParseULongLong(value, n) && n <= 1024 * 1024)
+        g_options.memory_budget = unsigned(n);
+}
+
+static void GetSweepJobs(StrW& out)
+{
+    out.Printf(L"%u", g_options.sweep_jobs);
+}
+static void SetSweepJobs(const WCHAR* value)
+{
+    ULONGLONG n;
+    if (ParseULongLong(value, n) && n <= MAXIMUM_WAIT_OBJECTS)
+        g_options.sweep_jobs = unsigned(n);
+}
+
 static void GetHexMode(StrW& out)
 {
     out = BooleanValue(g_options.hex_mode);
@@ -213,6 +304,15 @@ static const OptionDefinition c_option_defs[] =
 #endif
     { L"Scrollbar",             GetScrollbar, SetScrollbar },
     { L"RestoreScreenOnExit",   GetRestoreScreenOnExit, SetRestoreScreenOnExit },
+    { L"MemoryMapFiles",        GetMemoryMapFiles, SetMemoryMapFiles },
+    { L"IndexCache",            GetIndexCache, SetIndexCache },
+    { L"DirectorySizes",        GetDirectorySizes, SetDirectorySizes },
+    { L"PreloadFiles",          GetPreloadFiles, SetPreloadFiles },
+    { L"BlockCacheLimit",       GetBlockCacheLimit, SetBlockCacheLimit },
+    { L"RecentFilesLimit",      GetRecentFilesLimit, SetRecentFilesLimit },
+    { L"PipeMemoryLimit",       GetPipeMemoryLimit, SetPipeMemoryLimit },
+    { L"MemoryBudget",          GetMemoryBudget, SetMemoryBudget },
+    { L"SweepJobs",             GetSweepJobs, SetSweepJobs },
     { L"Emulate",               GetEmulation, SetEmulation },
 };
 
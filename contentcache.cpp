@@ -11,8 +11,14 @@
 #include "wcwidth.h"
 #include "wcwidth_iter.h"
 #include "signaled.h"
+#include "indexcache.h"
+#include "blockcache.h"
+#include "perf.h"
+#include "exporter.h"
 
 #include <algorithm>
+#include <intrin.h>
+#include <emmintrin.h>
 
 #ifdef DEBUG
 #define DEBUG_LINE_PARSING
@@ -34,8 +40,14 @@ const unsigned c_min_num_width = 6;
 #endif
 const unsigned c_min_hexofs_width = 6;
 const unsigned c_margin_padding = 2;
+const unsigned c_checkpoint_cells = 256;
 
 constexpr unsigned c_find_horiz_scroll_threshold = 10;
+constexpr DWORD c_pipe_initial_wait = 200;          // Milliseconds to wait for enough piped input to detect the encoding.
+constexpr size_t c_min_resident_chunks = 64;        // Piped input chunks to keep in memory regardless of the budget.
+constexpr DWORD c_detect_head_size = 4096 * 24;     // Bytes from the beginning of a file for detecting the encoding.
+constexpr DWORD c_detect_region_size = 4096 * 4;    // Bytes per sampled region elsewhere in the file.
+constexpr unsigned c_detect_regions = 7;            // Number of sampled regions elsewhere in the file.
 
 static HANDLE s_piped_stdin = 0;
 void SetPipedInput()
@@ -49,6 +61,13 @@ void SetPipedInput()
     AutoMouseConsoleMode::SetStdInputHandle(hin);
 }
 
+// Share delete access so that log rotation can rename or delete the file
+// while it's being viewed.
+static HANDLE OpenFileForViewing(const WCHAR* name)
+{
+    return CreateFileW(name, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, 0);
+}
+
 const WCHAR* MakeOverlayColor(const WCHAR* color, const WCHAR* overlay)
 {
     static StrW s_tmp;
@@ -104,6 +123,182 @@ inline bool IsWhiteSpace(uint32 c)
     return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
 }
 
+// Returns the number of leading bytes (up to limit) that are plain characters.
+// In text mode that's printable ASCII excluding space; in binary mode that's
+// anything except C0 control characters.
+static size_t ScanPlainRun(const BYTE* p, size_t limit, bool binary)
+{
+    size_t run = 0;
+
+    const __m128i lo = _mm_set1_epi8(binary ? 0x00 : 0x20);
+    const __m128i hi = _mm_set1_epi8(binary ? 0x20 : 0x7f);
+    while (run + 16 <= limit)
+    {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + run));
+        // Signed compares; bytes >= 0x80 are negative.
+        const __m128i in_range = _mm_and_si128(_mm_cmpgt_epi8(x, lo), _mm_cmplt_epi8(x, hi));
+        uint32 mask = uint32(_mm_movemask_epi8(in_range));
+        if (!binary)
+            mask = ~mask & 0xffff;
+        if (mask)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return run + bit;
+        }
+        run += 16;
+    }
+
+    for (; run < limit; ++run)
+    {
+        const BYTE c = p[run];
+        if (binary ? (c > 0 && c < ' ') : (c <= ' ' || c >= 0x7f))
+            break;
+    }
+    return run;
+}
+
+// Loads eight UTF16 characters, swapping the bytes for big endian.
+static inline __m128i LoadUtf16(const BYTE* p, bool byte_swap)
+{
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return byte_swap ? _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)) : x;
+}
+
+static inline WCHAR ReadUtf16(const BYTE* p, bool byte_swap)
+{
+    return byte_swap ? (WCHAR(p[0]) << 8) | p[1] : WCHAR(p[0]) | (WCHAR(p[1]) << 8);
+}
+
+// Same as ScanPlainRun, but for UTF16 text; limit and the result count
+// characters, not bytes.
+static size_t ScanPlainRun16(const BYTE* p, size_t limit, bool byte_swap)
+{
+    size_t run = 0;
+
+    const __m128i lo = _mm_set1_epi16(0x20);
+    const __m128i hi = _mm_set1_epi16(0x7f);
+    while (run + 8 <= limit)
+    {
+        const __m128i x = LoadUtf16(p + run * 2, byte_swap);
+        // Signed compares; characters >= 0x8000 are negative.
+        const __m128i in_range = _mm_and_si128(_mm_cmpgt_epi16(x, lo), _mm_cmplt_epi16(x, hi));
+        const uint32 mask = ~uint32(_mm_movemask_epi8(in_range)) & 0xffff;
+        if (mask)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return run + bit / 2;
+        }
+        run += 8;
+    }
+
+    for (; run < limit; ++run)
+    {
+        const WCHAR c = ReadUtf16(p + run * 2, byte_swap);
+        if (c <= ' ' || c >= 0x7f)
+            break;
+    }
+    return run;
+}
+
+// Returns the index of the first '\n' in count UTF16 characters, or count if
+// there is none.  Big endian doesn't need swapping; it just looks for the
+// bytes in the other order.
+static size_t FindNewline16(const BYTE* p, size_t count, bool byte_swap)
+{
+    size_t ii = 0;
+
+    const __m128i nl = _mm_set1_epi16(byte_swap ? 0x0a00 : 0x000a);
+    for (; ii + 8 <= count; ii += 8)
+    {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + ii * 2));
+        const uint32 mask = uint32(_mm_movemask_epi8(_mm_cmpeq_epi16(x, nl)));
+        if (mask)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return ii + bit / 2;
+        }
+    }
+
+    for (; ii < count; ++ii)
+    {
+        if (ReadUtf16(p + ii * 2, byte_swap) == '\n')
+            break;
+    }
+    return ii;
+}
+
+// Converts UTF8 text to UTF16.  Runs of ASCII are widened 16 bytes at a
+// time, and only the rest after the first non-ASCII byte goes through the
+// OS converter.  Most lines in most UTF8 files are entirely ASCII.
+static void SetFromUtf8(StrW& out, const BYTE* p, size_t num_bytes)
+{
+    // UTF16 never needs more characters than the number of UTF8 bytes; each
+    // invalid byte becomes one U+FFFD, and only 4 byte sequences need a
+    // surrogate pair.
+    WCHAR* const o = out.Reserve(num_bytes + 1);
+
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= num_bytes)
+    {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        if (_mm_movemask_epi8(x))
+            break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(o + i), _mm_unpacklo_epi8(x, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(o + i + 8), _mm_unpackhi_epi8(x, zero));
+        i += 16;
+    }
+    for (; i < num_bytes && p[i] < 0x80; ++i)
+        o[i] = p[i];
+
+    size_t len = i;
+    if (i < num_bytes)
+    {
+        const int used = MultiByteToWideChar(CP_UTF8, 0, reinterpret_cast<const char*>(p + i), int(num_bytes - i), o + i, int(num_bytes - i));
+        if (used > 0)
+            len += used;
+    }
+    out.OverrideLength(len);
+}
+
+// Formats bytes as pairs of uppercase hex digits, 16 bytes at a time.  The
+// output must have room for 2 * len characters; it isn't nul terminated.
+static void FormatHexDigits(const BYTE* p, unsigned len, WCHAR* out)
+{
+    unsigned ii = 0;
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low_nibble = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i digit_0 = _mm_set1_epi8('0');
+    const __m128i letter_adjust = _mm_set1_epi8('A' - '0' - 10);
+    for (; ii + 16 <= len; ii += 16)
+    {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + ii));
+        const __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), low_nibble);
+        const __m128i lo = _mm_and_si128(x, low_nibble);
+        const __m128i hi_digits = _mm_add_epi8(_mm_add_epi8(hi, digit_0), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter_adjust));
+        const __m128i lo_digits = _mm_add_epi8(_mm_add_epi8(lo, digit_0), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter_adjust));
+        const __m128i first = _mm_unpacklo_epi8(hi_digits, lo_digits);
+        const __m128i second = _mm_unpackhi_epi8(hi_digits, lo_digits);
+        __m128i* const o = reinterpret_cast<__m128i*>(out + ii * 2);
+        _mm_storeu_si128(o + 0, _mm_unpacklo_epi8(first, zero));
+        _mm_storeu_si128(o + 1, _mm_unpackhi_epi8(first, zero));
+        _mm_storeu_si128(o + 2, _mm_unpacklo_epi8(second, zero));
+        _mm_storeu_si128(o + 3, _mm_unpackhi_epi8(second, zero));
+    }
+
+    static const WCHAR c_hex_digits[] = L"0123456789ABCDEF";
+    for (; ii < len; ++ii)
+    {
+        out[ii * 2] = c_hex_digits[p[ii] >> 4];
+        out[ii * 2 + 1] = c_hex_digits[p[ii] & 0x0f];
+    }
+}
+
 static DWORD GetSystemPageSize()
 {
     SYSTEM_INFO sysinfo;
@@ -113,6 +308,82 @@ static DWORD GetSystemPageSize()
 
 static const DWORD s_page_size = GetSystemPageSize();
 
+// Size of the sliding view when memory mapping a file.  A bounded view keeps
+// the mapped pages (and the exposure to the file shrinking underneath them)
+// near what's actually being read.
+#ifdef _WIN64
+static const FileOffset c_mapped_view_size = 64 * 1024 * 1024;
+#else
+static const FileOffset c_mapped_view_size = 32 * 1024 * 1024;
+#endif
+
+// Sparse checkpoints.
+static const FileOffset c_sparse_min_distance = 16 * 1024 * 1024;   // Closer than this just processes the map.
+static const FileOffset c_sparse_window = 1024 * 1024;              // Bytes to look back for a line start.
+static const FileOffset c_sparse_max_resync = 16 * 1024 * 1024;     // Give up looking for a line start.
+
+// Sampling the newline density across the file, for estimating the line
+// count before it's been indexed.  Smaller files index quickly enough that
+// the estimate isn't needed.
+static const FileOffset c_density_min_size = 16 * 1024 * 1024;
+static const unsigned c_density_samples = 16;
+static const DWORD c_density_sample_size = 64 * 1024;
+
+// Smaller files are quick enough to index that caching isn't worthwhile.
+static const FileOffset c_index_cache_min_size = 4 * 1024 * 1024;
+static const DWORD c_index_cache_magic = 0x5844494c;     // 'LIDX'
+static const DWORD c_index_cache_version = 1;
+static const size_t c_index_cache_max_backtrack = 1024;             // Rows to search for a newline boundary.
+
+// Processing state checkpoints, for restarting partway through the map.
+static const size_t c_checkpoint_rows = 1024;
+static const FileOffset c_checkpoint_margin = 16;                   // Bytes the line iterator may peek ahead.
+
+struct IndexCacheHeader
+{
+    DWORD           magic;
+    DWORD           version;
+    IndexCacheKey   key;
+    // Settings that affect where rows break.
+    UINT            codepage;
+    uint32          binary;
+    uint32          wrap;
+    uint32          max_line_length;
+    uint32          tab_width;
+    uint32          expand_tabs;
+    uint32          ctrl_mode;
+    uint32          hanging_extra;
+    // Where indexing resumes, and a hash of the bytes preceding it, which
+    // verify that content was only appended.
+    uint32          tail_length;
+    uint32          tail_hash;
+    FileOffset      resume_offset;
+};
+
+static void GetIndexCacheSettings(IndexCacheHeader& hdr, const FileLineMap& map, const ViewerOptions& options)
+{
+    hdr.codepage = map.GetCodePage();
+    hdr.binary = map.IsBinaryFile();
+    hdr.wrap = map.GetWrapWidth();
+    hdr.max_line_length = options.max_line_length;
+    hdr.tab_width = options.tab_width;
+    hdr.expand_tabs = options.expand_tabs;
+    hdr.ctrl_mode = uint32(options.ctrl_mode);
+    hdr.hanging_extra = options.hanging_extra;
+}
+
+static bool SameIndexCacheSettings(const IndexCacheHeader& a, const IndexCacheHeader& b)
+{
+    return (a.codepage == b.codepage &&
+            a.binary == b.binary &&
+            a.wrap == b.wrap &&
+            a.max_line_length == b.max_line_length &&
+            a.tab_width == b.tab_width &&
+            a.expand_tabs == b.expand_tabs &&
+            a.ctrl_mode == b.ctrl_mode &&
+            a.hanging_extra == b.hanging_extra);
+}
+
 #pragma region // FoundOffset
 
 void FoundOffset::Clear()
@@ -149,110 +420,6 @@ void FoundOffset::Found(FileOffset found_offset, unsigned found_len)
 }
 
 #pragma endregion // FoundOffset
-#pragma region // PatchBlock
-
-PatchBlock::PatchBlock(FileOffset offset)
-: m_offset(offset)
-, m_mask(0)
-{
-    assert((offset % sizeof(m_bytes)) == 0);
-    ZeroMemory(m_bytes, sizeof(m_bytes));
-}
-
-bool PatchBlock::IsSet(FileOffset offset) const
-{
-    assert(offset >= m_offset);
-    assert(offset < m_offset + sizeof(m_bytes));
-    const unsigned index = unsigned(offset - m_offset);
-    const unsigned mask = 1 << index;
-    return !!(m_mask & mask);
-}
-
-BYTE PatchBlock::GetByte(FileOffset offset) const
-{
-    assert(IsSet(offset));
-    const unsigned index = unsigned(offset - m_offset);
-    return m_bytes[index];
-}
-
-void PatchBlock::SetByte(FileOffset offset, BYTE value, const BYTE* original)
-{
-    assert(offset >= m_offset);
-    assert(offset < m_offset + sizeof(m_bytes));
-    assert(implies(original, !IsSet(offset)));
-    const unsigned index = unsigned(offset - m_offset);
-    m_bytes[index] = value;
-    if (original)
-        m_original[index] = *original;
-    m_mask |= 1 << index;
-}
-
-void PatchBlock::RevertByte(FileOffset offset)
-{
-    assert(IsSet(offset));
-    const unsigned index = unsigned(offset - m_offset);
-    m_mask &= ~(1 << index);
-}
-
-void PatchBlock::MergeFrom(const PatchBlock& other)
-{
-    for (unsigned i = 0; i < c_size; ++i)
-    {
-        const unsigned mask = (1 << i);
-        if (other.m_mask & mask)
-        {
-            if (!(m_mask & mask))
-                m_original[i] = other.m_original[i];
-            m_bytes[i] = other.m_bytes[i];
-        }
-    }
-
-    m_mask |= other.m_mask;
-}
-
-bool PatchBlock::Save(HANDLE hfile, bool original, Error& e)
-{
-    FileOffset offset;
-    BYTE bytes[c_size];
-    unsigned len = 0;
-
-    bool past_end = false;
-    for (unsigned index = 0; !past_end; ++index)
-    {
-        past_end = (index >= c_size);
-        if (!past_end && IsSet(m_offset + index))
-        {
-            if (!len)
-                offset = m_offset + index;
-            bytes[len++] = original ? m_original[index] : m_bytes[index];
-        }
-        else if (len)
-        {
-            DWORD num_io;
-            LARGE_INTEGER liSeek;
-            liSeek.QuadPart = offset;
-            // IMPORTANT:  It's tempting to want to read the current values
-            // first, to improve accuracy of UndoSave in case concurrent file
-            // writes might be happening.  BUT IT'S A TRAP!  It risks reading
-            // values that were already previously written, if a previous save
-            // fails partway through and the user retries the save.
-            if (!SetFilePointerEx(hfile, liSeek, nullptr, FILE_BEGIN) ||
-                !WriteFile(hfile, bytes, len, &num_io, nullptr))
-            {
-                e.Sys();
-                StrW msg;
-                msg.Printf(L"Error writing %u byte(s) at offset %08.8lx.", len, offset);
-                e.Set(msg.Text());
-                return false;
-            }
-            len = 0;
-        }
-    }
-
-    return true;
-}
-
-#pragma endregion // PatchBlock
 #pragma region // PipeChunk
 
 PipeChunk::PipeChunk()
@@ -289,119 +456,691 @@ void PipeChunk::Wrote(DWORD wrote)
     assert(Used() <= Capacity());
 }
 
+bool PipeChunk::Spill(HANDLE file, FileOffset offset, Error& e)
+{
+    assert(IsResident());
+    assert(!Available());
+
+    // Full chunks never change, so a chunk that was spilled before and read
+    // back already has an identical copy in the file.
+    if (!m_on_disk)
+    {
+        LARGE_INTEGER liMove;
+        liMove.QuadPart = offset;
+        DWORD written;
+        if (!SetFilePointerEx(file, liMove, nullptr, FILE_BEGIN) ||
+            !WriteFile(file, m_bytes, Capacity(), &written, nullptr))
+        {
+            e.Sys();
+            return false;
+        }
+        if (written != Capacity())
+        {
+            e.Sys(ERROR_HANDLE_DISK_FULL);
+            return false;
+        }
+        m_on_disk = true;
+    }
+
+    VirtualFree(m_bytes, 0, MEM_RELEASE);
+    m_bytes = nullptr;
+    return true;
+}
+
+bool PipeChunk::Restore(HANDLE file, FileOffset offset, Error& e)
+{
+    assert(!IsResident());
+    assert(m_on_disk);
+
+    m_bytes = static_cast<BYTE*>(VirtualAlloc(nullptr, s_page_size, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE));
+    if (!m_bytes)
+    {
+        e.Sys();
+        return false;
+    }
+
+    LARGE_INTEGER liMove;
+    liMove.QuadPart = offset;
+    DWORD bytes_read;
+    if (!SetFilePointerEx(file, liMove, nullptr, FILE_BEGIN) ||
+        !ReadFile(file, m_bytes, Capacity(), &bytes_read, nullptr) ||
+        bytes_read != Capacity())
+    {
+        e.Sys();
+        VirtualFree(m_bytes, 0, MEM_RELEASE);
+        m_bytes = nullptr;
+        return false;
+    }
+    return true;
+}
+
 void PipeChunk::Move(PipeChunk&& other)
 {
     m_bytes = other.m_bytes;
     other.m_bytes = nullptr;
     m_used = other.m_used;
     other.m_used = 0;
+    m_referenced = other.m_referenced;
+    m_on_disk = other.m_on_disk;
+    other.m_on_disk = false;
 }
 
 #pragma endregion // PipeChunk
-#pragma region // FileLineIter
+#pragma region // PipeReader
 
-FileLineIter::FileLineIter(const ViewerOptions& options)
-: m_options(options)
+PipeReader::PipeReader(HANDLE pipe)
+: m_pipe(pipe)
 {
+    InitializeCriticalSection(&m_cs);
+    m_arrived = CreateEvent(nullptr, false, false, nullptr);
 }
 
-FileLineIter::~FileLineIter()
+PipeReader::~PipeReader()
 {
+    if (!m_thread.Empty())
+    {
+        // The reader is usually blocked in ReadFile, so keep canceling the
+        // read until the thread exits (it may not have started reading yet
+        // when the first cancel happens).
+        m_stop = true;
+        while (WaitForSingleObject(m_thread, 10) == WAIT_TIMEOUT)
+            CancelSynchronousIo(m_thread);
+    }
+    DeleteCriticalSection(&m_cs);
 }
 
-FileLineIter& FileLineIter::operator=(FileLineIter&& other)
+bool PipeReader::Start()
 {
-    // m_options can't be updated, and it doesn't need to be.
-    m_wrap = other.m_wrap;
-    m_explicit_wrap = other.m_explicit_wrap;
+    assert(m_thread.Empty());
+    if (m_arrived.Empty())
+        return false;
+    m_thread = CreateThread(nullptr, 0, ReaderProc, this, 0, nullptr);
+    return !m_thread.Empty();
+}
 
-    m_codepage = other.m_codepage;
-    m_binary_file = other.m_binary_file;
-    m_decoder = std::move(other.m_decoder);
+bool PipeReader::Wait(DWORD timeout) const
+{
+    return WaitForSingleObject(m_arrived, timeout) == WAIT_OBJECT_0;
+}
 
-    m_offset = other.m_offset;
-    m_bytes = other.m_bytes;
-    m_count = other.m_count;
-    m_available = other.m_available;
-    m_width_state.reset(); // Does not carry over.
-    m_pending_length = other.m_pending_length;
-    m_pending_width = other.m_pending_width;
-    m_pending_wrap_length = other.m_pending_wrap_length;
-    m_pending_wrap_width = other.m_pending_wrap_width;
-    m_pending_wrap_indent = other.m_pending_wrap_indent;
-    m_consecutive_spaces = other.m_consecutive_spaces;
-    m_hanging_indent = other.m_hanging_indent;
-    m_any_nonspace = other.m_any_nonspace;
+bool PipeReader::Take(PipeChunks& chunks, FileOffset& size, bool& done, DWORD& err)
+{
+    PipeChunks pending;
+
+    EnterCriticalSection(&m_cs);
+    pending.swap(m_pending);
+    done = m_done;
+    err = m_error;
+    LeaveCriticalSection(&m_cs);
+
+    // LoadData() finds offsets by dividing by the page size, so every chunk
+    // except the last must be full.  Whole chunks can be moved when the last
+    // chunk is full; otherwise the bytes are copied to fill it first.
+    for (auto& piece : pending)
+    {
+        const BYTE* bytes = piece.Bytes();
+        DWORD used = piece.Used();
+        size += used;
+        if (chunks.empty() || !chunks.back().Available())
+        {
+            chunks.emplace_back(std::move(piece));
+            continue;
+        }
 
-#ifdef DEBUG
-    m_line_index = other.m_line_index;
-#endif
+        while (used)
+        {
+            if (!chunks.back().Available())
+                chunks.emplace_back();
+            PipeChunk& chunk = chunks.back();
+            const DWORD len = std::min<DWORD>(used, chunk.Available());
+            memcpy(chunk.WritePtr(), bytes, len);
+            chunk.Wrote(len);
+            bytes += len;
+            used -= len;
+        }
+    }
 
-    other.Reset();
-    return *this;
+    return !pending.empty() || done;
 }
 
-void FileLineIter::Reset()
+DWORD WINAPI PipeReader::ReaderProc(void* param)
 {
-    // m_wrap and m_explicit_wrap carry over.
+    PipeReader* const reader = static_cast<PipeReader*>(param);
 
-    m_codepage = 0;
-    m_binary_file = true;
-    m_decoder = nullptr;
+    // A successful zero byte read is EOF for a redirected file, but a pipe
+    // can deliver zero byte writes.
+    const bool is_pipe = (GetFileType(reader->m_pipe) == FILE_TYPE_PIPE);
 
-    ClearProcessed();
-}
+    std::vector<BYTE> buffer(s_page_size);
+    DWORD err = 0;
+    while (!reader->m_stop)
+    {
+        DWORD bytes_read;
+        if (!ReadFile(reader->m_pipe, buffer.data(), DWORD(buffer.size()), &bytes_read, nullptr))
+        {
+            err = GetLastError();
+            if (err == ERROR_HANDLE_EOF || err == ERROR_BROKEN_PIPE || (err == ERROR_OPERATION_ABORTED && reader->m_stop))
+                err = 0;
+            break;
+        }
+        if (!bytes_read)
+        {
+            if (is_pipe)
+                continue;
+            break;
+        }
 
-void FileLineIter::ClearProcessed()
-{
-    m_offset = 0;
-    m_bytes = nullptr;
-    m_count = 0;
-    m_available = 0;
-    m_width_state.reset();
-    m_pending_length = 0;
-    m_pending_width = 0;
-    m_pending_wrap_length = 0;
-    m_pending_wrap_width = 0;
-    m_pending_wrap_indent = 0;
-    m_consecutive_spaces = m_options.internal_help_mode ? 0 : -1;
-    m_hanging_indent = 0;
-    m_any_nonspace = false;
+        EnterCriticalSection(&reader->m_cs);
+        const BYTE* bytes = buffer.data();
+        while (bytes_read)
+        {
+            if (reader->m_pending.empty() || !reader->m_pending.back().Available())
+                reader->m_pending.emplace_back();
+            PipeChunk& chunk = reader->m_pending.back();
+            const DWORD len = std::min<DWORD>(bytes_read, chunk.Available());
+            memcpy(chunk.WritePtr(), bytes, len);
+            chunk.Wrote(len);
+            bytes += len;
+            bytes_read -= len;
+        }
+        LeaveCriticalSection(&reader->m_cs);
+        SetEvent(reader->m_arrived);
+    }
 
-#ifdef DEBUG
-    m_line_index = 0;
-#endif
+    EnterCriticalSection(&reader->m_cs);
+    reader->m_done = true;
+    reader->m_error = err;
+    LeaveCriticalSection(&reader->m_cs);
+    SetEvent(reader->m_arrived);
+    return 0;
 }
 
-void FileLineIter::SetEncoding(FileDataType type, UINT codepage)
+#pragma endregion // PipeReader
+#pragma region // ReadAhead
+
+// Big enough to hold the windows LoadData() reads while scrolling.  Bulk
+// reads grow the buffer as needed.
+static const DWORD c_read_ahead_size = c_data_buffer_slop + c_data_buffer_main + c_data_buffer_slop;
+
+ReadAhead::~ReadAhead()
 {
-    m_binary_file = (type == FileDataType::Binary);
-    m_codepage = codepage;
-    m_decoder = CreateDecoder(m_codepage);
+    Cancel();
+    if (m_buffer)
+        VirtualFree(m_buffer, 0, MEM_RELEASE);
 }
 
-void FileLineIter::SetWrapWidth(uint32 wrap)
+bool ReadAhead::Open(const WCHAR* name)
 {
-    m_explicit_wrap = !!wrap;
-    m_wrap = wrap ? wrap : m_options.max_line_length;
+    assert(m_file.Empty());
+
+    m_event = CreateEvent(nullptr, true, false, nullptr);
+    // Plus a page for aligning the offset down to a page boundary.
+    m_buffer = static_cast<BYTE*>(VirtualAlloc(nullptr, c_read_ahead_size + s_page_size, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE));
+    if (m_event.Empty() || !m_buffer)
+        return false;
+    m_capacity = c_read_ahead_size;
+
+    // Read-ahead is mostly for one-pass scans (indexing and searching), so
+    // hint sequential access.
+    m_file = CreateFileW(name, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED|FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    return !m_file.Empty();
 }
 
-void FileLineIter::SetBytes(FileOffset offset, const BYTE* bytes, const size_t available)
+void ReadAhead::Start(FileOffset offset, DWORD length)
 {
-    assert(!m_count);
+    if (m_file.Empty())
+        return;
+
+    // The buffer is page aligned; aligning the offset as well keeps the
+    // reads aligned to sectors.
+    offset &= ~FileOffset(s_page_size - 1);
+    if ((m_pending || m_valid) && m_offset == offset)
+        return;
+
+    Cancel();
+
+    if (length > m_capacity)
+    {
+        BYTE* const buffer = static_cast<BYTE*>(VirtualAlloc(nullptr, length + s_page_size, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE));
+        if (!buffer)
+            return;
+        VirtualFree(m_buffer, 0, MEM_RELEASE);
+        m_buffer = buffer;
+        m_capacity = length;
+    }
+
     m_offset = offset;
-    m_bytes = bytes;
-    m_count = min<size_t>(available, c_data_buffer_main);
-    m_available = available;
-// REVIEW:  Does the width state need to span across adjacent buffers?
-    m_width_state.reset();
+    m_requested = length + s_page_size;
+    ZeroMemory(&m_overlapped, sizeof(m_overlapped));
+    m_overlapped.Offset = DWORD(offset);
+    m_overlapped.OffsetHigh = DWORD(offset >> 32);
+    m_overlapped.hEvent = m_event;
+    if (ReadFile(m_file, m_buffer, m_requested, nullptr, &m_overlapped) || GetLastError() == ERROR_IO_PENDING)
+        m_pending = true;
 }
 
-FileLineIter::Outcome FileLineIter::Next(const BYTE*& out_bytes, uint32& out_length, uint32& out_width)
+void ReadAhead::Cancel()
 {
-    out_bytes = m_bytes;
-
-    if (!m_bytes)
+    if (m_pending)
+    {
+        CancelIoEx(m_file, &m_overlapped);
+        DWORD bytes_read;
+        GetOverlappedResult(m_file, &m_overlapped, &bytes_read, true);
+        m_pending = false;
+    }
+    m_valid = false;
+}
+
+bool ReadAhead::Finish()
+{
+    if (m_pending)
+    {
+        DWORD bytes_read;
+        m_pending = false;
+        m_valid = !!GetOverlappedResult(m_file, &m_overlapped, &bytes_read, true);
+        m_length = m_valid ? bytes_read : 0;
+    }
+    return m_valid;
+}
+
+bool ReadAhead::Take(FileOffset offset, DWORD length, BYTE* dest)
+{
+    // Don't wait for a read that can't satisfy the request.
+    if (!m_pending && !m_valid)
+        return false;
+    if (offset < m_offset || offset + length > m_offset + m_requested)
+        return false;
+
+    if (!Finish() || offset + length > m_offset + m_length)
+        return false;
+
+    memcpy(dest, m_buffer + (offset - m_offset), length);
+    return true;
+}
+
+#pragma endregion // ReadAhead
+#pragma region // LineIndex
+
+void LineIndex::Clear()
+{
+    m_bases.clear();
+    m_deltas.clear();
+    m_overflow.clear();
+    m_continuations.clear();
+    m_formatting.clear();
+    m_continued = 0;
+}
+
+void LineIndex::Append(FileOffset offset, bool continuation, const FormattingInfo& fmt)
+{
+    const size_t index = Count();
+    assert(!index || offset > GetOffset(index - 1));
+
+    if (!(index % c_block_rows))
+        m_bases.emplace_back(offset);
+
+    const FileOffset delta = offset - m_bases.back();
+    if (delta < c_delta_overflow)
+    {
+        m_deltas.emplace_back(uint16(delta));
+    }
+    else
+    {
+        // Rows are capped at max_line_length, so this is rare; it can only
+        // happen when a block includes lots of skipped whitespace.
+        m_deltas.emplace_back(c_delta_overflow);
+        m_overflow.push_back({ index, offset });
+    }
+
+    if (continuation)
+    {
+        ++m_continued;
+        if (m_continuations.size() && RunEnd(m_continuations.size() - 1) == index)
+            m_continuations.back().total = m_continued;
+        else
+            m_continuations.push_back({ index, m_continued });
+    }
+
+    const FormattingInfo prev = m_formatting.size() ? m_formatting.back().fmt : FormattingInfo();
+    if (!fmt.Equals(prev))
+        m_formatting.push_back({ index, fmt });
+}
+
+void LineIndex::AppendFrom(const LineIndex& other, size_t first)
+{
+    if (other.m_continuations.empty() && other.m_formatting.empty())
+    {
+        for (size_t index = first; index < other.Count(); ++index)
+            Append(other.GetOffset(index));
+        return;
+    }
+
+    // The first row must begin a line, so it doesn't continue this index's
+    // last row.
+    assert(!first || first >= other.Count() || other.GetLineNumber(first) != other.GetLineNumber(first - 1));
+
+    size_t prev_line = 0;
+    for (size_t index = first; index < other.Count(); ++index)
+    {
+        const size_t line = other.GetLineNumber(index);
+        const bool continuation = (index > first && line == prev_line);
+        Append(other.GetOffset(index), continuation, other.GetFormattingInfo(index));
+        prev_line = line;
+    }
+}
+
+FileOffset LineIndex::GetOffset(size_t index) const
+{
+    assert(index < Count());
+    const uint16 delta = m_deltas[index];
+    if (delta != c_delta_overflow)
+        return m_bases[index / c_block_rows] + delta;
+
+    const auto iter = std::lower_bound(m_overflow.begin(), m_overflow.end(), index, [](const Overflow& o, size_t i) {
+        return o.index < i;
+    });
+    assert(iter != m_overflow.end() && iter->index == index);
+    return iter->offset;
+}
+
+size_t LineIndex::RunEnd(size_t run) const
+{
+    const ContinuationRun& r = m_continuations[run];
+    return r.begin + (r.total - RunTotalBefore(run));
+}
+
+size_t LineIndex::GetLineNumber(size_t index) const
+{
+    // Find the last run that begins at or before index.
+    const auto iter = std::upper_bound(m_continuations.begin(), m_continuations.end(), index, [](size_t i, const ContinuationRun& r) {
+        return i < r.begin;
+    });
+    if (iter == m_continuations.begin())
+        return index + 1;
+
+    const size_t run = (iter - m_continuations.begin()) - 1;
+    const size_t before = RunTotalBefore(run);
+    const size_t continued = before + min<size_t>(index - m_continuations[run].begin + 1, m_continuations[run].total - before);
+    return index + 1 - continued;
+}
+
+FormattingInfo LineIndex::GetFormattingInfo(size_t index) const
+{
+    const auto iter = std::upper_bound(m_formatting.begin(), m_formatting.end(), index, [](size_t i, const FormattingRun& r) {
+        return i < r.begin;
+    });
+    if (iter == m_formatting.begin())
+        return {};
+    return (iter - 1)->fmt;
+}
+
+size_t LineIndex::FriendlyLineNumberToIndex(size_t line) const
+{
+    // The rows in a continuation run all belong to the same line, and each
+    // row between runs starts a new line.  So the first row of a line is
+    // (line - 1) plus the number of continuation rows in runs that belong
+    // to earlier lines.
+    if (!line)
+        return 0;
+    const auto iter = std::partition_point(m_continuations.begin(), m_continuations.end(), [this, line](const ContinuationRun& r) {
+        const size_t run = &r - m_continuations.data();
+        return r.begin - RunTotalBefore(run) < line;
+    });
+    const size_t continued = (iter == m_continuations.begin()) ? 0 : (iter - 1)->total;
+    return min<size_t>(line - 1 + continued, Count());
+}
+
+size_t LineIndex::LowerBound(FileOffset offset) const
+{
+    // Find the first block whose base is not less than offset; the answer
+    // is either in the preceding block or is the first row of that block.
+    const size_t block = std::lower_bound(m_bases.begin(), m_bases.end(), offset) - m_bases.begin();
+    if (!block)
+        return 0;
+    size_t index = (block - 1) * c_block_rows;
+    const size_t end = min<size_t>(block * c_block_rows, Count());
+    while (index < end && GetOffset(index) < offset)
+        ++index;
+    return index;
+}
+
+size_t LineIndex::UpperBound(FileOffset offset) const
+{
+    const size_t block = std::upper_bound(m_bases.begin(), m_bases.end(), offset) - m_bases.begin();
+    if (!block)
+        return 0;
+    size_t index = (block - 1) * c_block_rows;
+    const size_t end = min<size_t>(block * c_block_rows, Count());
+    while (index < end && GetOffset(index) <= offset)
+        ++index;
+    return index;
+}
+
+size_t LineIndex::MemoryUsage() const
+{
+    return (m_bases.capacity() * sizeof(m_bases[0]) +
+            m_deltas.capacity() * sizeof(m_deltas[0]) +
+            m_overflow.capacity() * sizeof(m_overflow[0]) +
+            m_continuations.capacity() * sizeof(m_continuations[0]) +
+            m_formatting.capacity() * sizeof(m_formatting[0]));
+}
+
+void LineIndex::Truncate(size_t count)
+{
+    if (count >= Count())
+        return;
+
+    m_deltas.resize(count);
+    m_bases.resize((count + c_block_rows - 1) / c_block_rows);
+    while (m_overflow.size() && m_overflow.back().index >= count)
+        m_overflow.pop_back();
+    while (m_continuations.size() && m_continuations.back().begin >= count)
+        m_continuations.pop_back();
+    if (m_continuations.size())
+    {
+        const size_t end = RunEnd(m_continuations.size() - 1);
+        if (end > count)
+            m_continuations.back().total -= end - count;
+    }
+    m_continued = m_continuations.size() ? m_continuations.back().total : 0;
+    while (m_formatting.size() && m_formatting.back().begin >= count)
+        m_formatting.pop_back();
+}
+
+template <typename T>
+static void AppendVector(std::vector<BYTE>& out, const std::vector<T>& v)
+{
+    const uint64 count = v.size();
+    const BYTE* const p = reinterpret_cast<const BYTE*>(&count);
+    out.insert(out.end(), p, p + sizeof(count));
+    if (count)
+    {
+        const BYTE* const data = reinterpret_cast<const BYTE*>(v.data());
+        out.insert(out.end(), data, data + v.size() * sizeof(T));
+    }
+}
+
+template <typename T>
+static bool ReadVector(const BYTE*& p, const BYTE* end, std::vector<T>& v)
+{
+    uint64 count;
+    if (size_t(end - p) < sizeof(count))
+        return false;
+    memcpy(&count, p, sizeof(count));
+    p += sizeof(count);
+    if (count > size_t(end - p) / sizeof(T))
+        return false;
+    v.resize(size_t(count));
+    if (count)
+        memcpy(v.data(), p, size_t(count) * sizeof(T));
+    p += size_t(count) * sizeof(T);
+    return true;
+}
+
+void LineIndex::Serialize(std::vector<BYTE>& out) const
+{
+    AppendVector(out, m_bases);
+    AppendVector(out, m_deltas);
+    AppendVector(out, m_overflow);
+    AppendVector(out, m_continuations);
+    AppendVector(out, m_formatting);
+}
+
+bool LineIndex::Deserialize(const BYTE* p, const BYTE* end)
+{
+    Clear();
+
+    if (!ReadVector(p, end, m_bases) ||
+        !ReadVector(p, end, m_deltas) ||
+        !ReadVector(p, end, m_overflow) ||
+        !ReadVector(p, end, m_continuations) ||
+        !ReadVector(p, end, m_formatting) ||
+        p != end ||
+        m_bases.size() != (m_deltas.size() + c_block_rows - 1) / c_block_rows)
+    {
+        Clear();
+        return false;
+    }
+
+    m_continued = m_continuations.size() ? m_continuations.back().total : 0;
+    if (m_continued > Count())
+    {
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+#pragma endregion // LineIndex
+#pragma region // FileLineIter
+
+FileLineIter::FileLineIter(const ViewerOptions& options)
+: m_options(options)
+{
+}
+
+FileLineIter::~FileLineIter()
+{
+}
+
+FileLineIter& FileLineIter::operator=(FileLineIter&& other)
+{
+    // m_options can't be updated, and it doesn't need to be.
+    m_wrap = other.m_wrap;
+    m_explicit_wrap = other.m_explicit_wrap;
+
+    m_codepage = other.m_codepage;
+    m_binary_file = other.m_binary_file;
+    m_decoder = std::move(other.m_decoder);
+    m_ascii_runs = other.m_ascii_runs;
+    m_utf16_runs = other.m_utf16_runs;
+    m_byte_swap = other.m_byte_swap;
+
+    m_offset = other.m_offset;
+    m_bytes = other.m_bytes;
+    m_count = other.m_count;
+    m_available = other.m_available;
+    m_width_state.reset(); // Does not carry over.
+    m_pending_length = other.m_pending_length;
+    m_pending_width = other.m_pending_width;
+    m_pending_wrap_length = other.m_pending_wrap_length;
+    m_pending_wrap_width = other.m_pending_wrap_width;
+    m_pending_wrap_indent = other.m_pending_wrap_indent;
+    m_consecutive_spaces = other.m_consecutive_spaces;
+    m_hanging_indent = other.m_hanging_indent;
+    m_any_nonspace = other.m_any_nonspace;
+
+#ifdef DEBUG
+    m_line_index = other.m_line_index;
+#endif
+
+    other.Reset();
+    return *this;
+}
+
+void FileLineIter::Reset()
+{
+    // m_wrap and m_explicit_wrap carry over.
+
+    m_codepage = 0;
+    m_binary_file = true;
+    m_decoder = nullptr;
+    m_ascii_runs = false;
+    m_utf16_runs = false;
+    m_byte_swap = false;
+
+    ClearProcessed();
+}
+
+void FileLineIter::ClearProcessed()
+{
+    m_offset = 0;
+    m_bytes = nullptr;
+    m_count = 0;
+    m_available = 0;
+    m_width_state.reset();
+    m_pending_length = 0;
+    m_pending_width = 0;
+    m_pending_wrap_length = 0;
+    m_pending_wrap_width = 0;
+    m_pending_wrap_indent = 0;
+    m_consecutive_spaces = m_options.internal_help_mode ? 0 : -1;
+    m_hanging_indent = 0;
+    m_any_nonspace = false;
+
+#ifdef DEBUG
+    m_line_index = 0;
+#endif
+}
+
+void FileLineIter::SetEncoding(FileDataType type, UINT codepage)
+{
+    m_binary_file = (type == FileDataType::Binary);
+    m_codepage = codepage;
+    m_decoder = CreateDecoder(m_codepage);
+
+    // Plain runs can only skip decoding if every printable ASCII byte
+    // decodes to itself as a single byte.
+    m_ascii_runs = (m_decoder->CharSize() == 1);
+    for (BYTE b = 0x21; m_ascii_runs && b < 0x7f; ++b)
+    {
+        uint32 num_bytes;
+        m_ascii_runs = (m_decoder->Decode(&b, 1, num_bytes) == b && num_bytes == 1);
+    }
+
+    // UTF16 text can be scanned directly, without decoding each WCHAR.
+    m_utf16_runs = (!m_binary_file && m_decoder->CharSize() == 2);
+    m_byte_swap = (m_utf16_runs && m_codepage == 1201);
+}
+
+void FileLineIter::SetWrapWidth(uint32 wrap)
+{
+    m_explicit_wrap = !!wrap;
+    m_wrap = wrap ? wrap : m_options.max_line_length;
+}
+
+void FileLineIter::SetBytes(FileOffset offset, const BYTE* bytes, const size_t available)
+{
+    assert(!m_count);
+    m_offset = offset;
+    m_bytes = bytes;
+    // Consume up to the main window, or everything but the slop when bulk
+    // reads supply more than that.  Either way the slop is left for peeking
+    // past the end of the consumed bytes.
+    if (available > c_data_buffer_main + c_data_buffer_slop)
+        m_count = available - c_data_buffer_slop;
+    else
+        m_count = min<size_t>(available, c_data_buffer_main);
+    m_available = available;
+// REVIEW:  Does the width state need to span across adjacent buffers?
+    m_width_state.reset();
+}
+
+FileLineIter::Outcome FileLineIter::Next(const BYTE*& out_bytes, uint32& out_length, uint32& out_width)
+{
+    out_bytes = m_bytes;
+
+    if (!m_bytes)
     {
         out_length = m_pending_length;
         out_width = m_pending_width;
@@ -426,54 +1165,51 @@ FileLineIter::Outcome FileLineIter::Next(const BYTE*& out_bytes, uint32& out_len
     const size_t max_consume = min<size_t>(m_count, remaining);
     if (m_decoder->CharSize() == 1)
     {
-        for (const BYTE* walk = m_bytes; can_consume < max_consume; ++walk)
+        // The CRT's memchr is vectorized.  A "\r\n" pair ends at the same
+        // place as a lone "\n", so only a "\r" at the very end of the range
+        // needs to peek past it.
+        const BYTE* nl = max_consume ? static_cast<const BYTE*>(memchr(m_bytes, '\n', max_consume)) : nullptr;
+        if (nl)
         {
-            const BYTE c = walk[0];
-            if (c == '\r' && can_consume + 1 <= m_available && walk[1] == '\n')
-            {
-                can_consume += 2;
-                newline = true;
-                break;
-            }
-            else if (c == '\n')
+            can_consume = uint32(nl - m_bytes) + 1;
+            newline = true;
+        }
+        else
+        {
+            can_consume = uint32(max_consume);
+            if (can_consume && m_bytes[can_consume - 1] == '\r' &&
+                can_consume <= m_available && m_bytes[can_consume] == '\n')
             {
                 ++can_consume;
                 newline = true;
-                break;
-            }
-            else
-            {
-                ++can_consume;
             }
         }
     }
     else
     {
         assert(m_decoder->CharSize() == 2);
-        for (const BYTE* walk = m_bytes; can_consume < max_consume;)
+        // Only whole WCHARs are scanned; a trailing odd byte is consumed
+        // only when the data ends there.
+        const size_t want = (max_consume + 1) / 2;
+        const size_t units = min<size_t>(want, m_available / 2);
+        const size_t nl = FindNewline16(m_bytes, units, m_byte_swap);
+        if (nl < units)
         {
-            if (can_consume + 2 > m_available)
-            {
-                can_consume = uint32(m_available);
-                break;
-            }
-            const WCHAR c = m_decoder->NextChar(walk);
-            if (c == '\r' && can_consume + 4 <= m_available && m_decoder->NextChar(walk + 2) == '\n')
-            {
-                can_consume += 4;
-                newline = true;
-                break;
-            }
-            else if (c == '\n')
+            can_consume = uint32(nl * 2 + 2);
+            newline = true;
+        }
+        else if (units < want)
+        {
+            can_consume = uint32(m_available);
+        }
+        else
+        {
+            can_consume = uint32(units * 2);
+            if (units && m_decoder->NextChar(m_bytes + can_consume - 2) == '\r' &&
+                can_consume + 2 <= m_available && m_decoder->NextChar(m_bytes + can_consume) == '\n')
             {
                 can_consume += 2;
                 newline = true;
-                break;
-            }
-            else
-            {
-                can_consume += 2;
-                walk += 2;
             }
         }
     }
@@ -490,6 +1226,7 @@ FileLineIter::Outcome FileLineIter::Next(const BYTE*& out_bytes, uint32& out_len
         uint32 pending_wrap_length = m_pending_wrap_length;
         uint32 pending_wrap_width = m_pending_wrap_width;
         const BYTE* walk = m_bytes;
+        bool prev_plain = false;
         while (true)
         {
             assert(index <= m_count + !!newline);
@@ -515,6 +1252,35 @@ FileLineIter::Outcome FileLineIter::Next(const BYTE*& out_bytes, uint32& out_len
                 break;
             }
 
+            // Fast path for runs of plain characters that each take one
+            // byte and one cell and don't affect word wrap, hanging indent,
+            // or the width state.  This covers most of a typical text file.
+            if (m_any_nonspace && m_consecutive_spaces < 0 && (m_binary_file || ((m_ascii_runs || m_utf16_runs) && prev_plain)))
+            {
+                const uint32 char_size = m_utf16_runs ? 2 : 1;
+                uint32 limit = min<uint32>(can_consume - index, m_options.max_line_length - m_pending_length) / char_size;
+                if (m_wrap > 1)
+                    limit = min<uint32>(limit, (m_wrap > m_pending_width) ? m_wrap - m_pending_width : 0);
+                uint32 run = uint32(m_utf16_runs ? ScanPlainRun16(walk, limit, m_byte_swap) : ScanPlainRun(walk, limit, m_binary_file));
+                // In text mode the last character of the run goes through the
+                // normal path so the width state reflects it.
+                if (run && !m_binary_file)
+                    --run;
+                if (run)
+                {
+                    m_pending_length += run * char_size;
+                    m_pending_width += run;
+                    if (!m_binary_file)
+                    {
+                        pending_wrap_length = m_pending_length;
+                        pending_wrap_width = m_pending_width;
+                    }
+                    index += run * char_size;
+                    walk += run * char_size;
+                    continue;
+                }
+            }
+
             uint32 c;
             uint32 clen;
             uint32 blen;
@@ -666,6 +1432,8 @@ calc_width:
                 }
             }
 
+            prev_plain = (!m_binary_file && c > ' ' && c < 0x7f);
+
             m_pending_length += blen;
             m_pending_width += clen;
 
@@ -763,19 +1531,48 @@ bool FileLineIter::SkipWhitespace(uint32 curr_len, uint32& skipped)
     return done;
 }
 
+void FileLineIter::SaveState(State& state) const
+{
+    assert(!m_count);
+    state.pending_length = m_pending_length;
+    state.pending_width = m_pending_width;
+    state.pending_wrap_length = m_pending_wrap_length;
+    state.pending_wrap_width = m_pending_wrap_width;
+    state.pending_wrap_indent = m_pending_wrap_indent;
+    state.consecutive_spaces = m_consecutive_spaces;
+    state.hanging_indent = m_hanging_indent;
+    state.any_nonspace = m_any_nonspace;
+}
+
+void FileLineIter::RestoreState(const State& state)
+{
+    ClearProcessed();
+    m_pending_length = state.pending_length;
+    m_pending_width = state.pending_width;
+    m_pending_wrap_length = state.pending_wrap_length;
+    m_pending_wrap_width = state.pending_wrap_width;
+    m_pending_wrap_indent = state.pending_wrap_indent;
+    m_consecutive_spaces = state.consecutive_spaces;
+    m_hanging_indent = state.hanging_indent;
+    m_any_nonspace = state.any_nonspace;
+}
+
 #pragma endregion // FileLineIter
 #pragma region // FileLineMap
 
 FileLineMap::FileLineMap(const ViewerOptions& options)
 : m_line_iter(options)
 {
+    m_newlines.Append(0);
 }
 
 FileLineMap& FileLineMap::operator=(FileLineMap&& other)
 {
-    m_lines = std::move(other.m_lines);
-    m_formatting = std::move(other.m_formatting);
-    m_line_numbers = std::move(other.m_line_numbers);
+    m_index = std::move(other.m_index);
+    m_newlines = std::move(other.m_newlines);
+    m_newlines_begin = other.m_newlines_begin;
+    m_newlines_end = other.m_newlines_end;
+    m_checkpoints = std::move(other.m_checkpoints);
 
     m_current_line_number = other.m_current_line_number;
     m_processed = other.m_processed;
@@ -803,7 +1600,7 @@ bool FileLineMap::SetWrapWidth(unsigned wrap)
     if (m_wrap != wrap)
     {
         m_wrap = wrap;
-        ClearProcessed();
+        ClearRows();
         return true;
     }
     return false;
@@ -827,9 +1624,18 @@ void FileLineMap::Reset()
 
 void FileLineMap::ClearProcessed()
 {
-    m_lines.clear();
-    m_formatting.clear();
-    m_line_numbers.clear();
+    ClearRows();
+
+    m_newlines.Clear();
+    m_newlines.Append(0);
+    m_newlines_begin = 0;
+    m_newlines_end = 0;
+}
+
+void FileLineMap::ClearRows()
+{
+    m_index.Clear();
+    m_checkpoints.clear();
 
     m_current_line_number = 1;
     m_processed = 0;
@@ -873,6 +1679,144 @@ void FileLineMap::SetFileType(FileDataType type, UINT codepage, const WCHAR* enc
 }
 
 void FileLineMap::Next(const BYTE* bytes, size_t available)
+{
+    PerfScope perf(PerfTimer::ProcessLines);
+    const FileOffset begin = m_processed;
+    NextRows(bytes, available);
+    if (bytes && !IsBinaryFile())
+        IndexNewlines(bytes, begin);
+
+    // Between calls is the only time the iterator's state is complete.  The
+    // final call (without bytes) finishes the last row, which may continue
+    // if the file grows, so it doesn't get a checkpoint.
+    if (bytes && m_index.Count() >= (m_checkpoints.empty() ? 0 : m_checkpoints.back().rows) + c_checkpoint_rows)
+        AddCheckpoint();
+}
+
+void FileLineMap::AddCheckpoint()
+{
+    Checkpoint cp;
+    cp.rows = m_index.Count();
+    cp.processed = m_processed;
+    cp.pending_begin = m_pending_begin;
+    m_line_iter.SaveState(cp.iter);
+    cp.skip_whitespace = m_skip_whitespace;
+    cp.wrapped_current_line = m_wrapped_current_line;
+    cp.continues = (m_current_line_number == m_index.CountFriendlyLines());
+    m_checkpoints.emplace_back(cp);
+}
+
+bool FileLineMap::RestoreCheckpoint(const FileOffset offset)
+{
+    // The iterator can peek a little past what it consumed (e.g. for CRLF or
+    // the rest of a multibyte character), so the checkpoint must be far
+    // enough before offset that changes there can't have affected it.
+    size_t ii = m_checkpoints.size();
+    while (ii && m_checkpoints[ii - 1].processed + c_checkpoint_margin > offset)
+        --ii;
+    m_checkpoints.resize(ii);
+    if (!ii)
+        return false;
+
+    const Checkpoint& cp = m_checkpoints.back();
+    m_index.Truncate(cp.rows);
+    if (m_newlines_end > cp.processed && cp.processed >= m_newlines_begin)
+    {
+        m_newlines.Truncate(m_newlines.UpperBound(cp.processed));
+        m_newlines_end = cp.processed;
+    }
+    m_current_line_number = m_index.CountFriendlyLines() + (cp.continues ? 0 : 1);
+    m_processed = cp.processed;
+    m_pending_begin = cp.pending_begin;
+    m_line_iter.RestoreState(cp.iter);
+    m_skip_whitespace = cp.skip_whitespace;
+    m_wrapped_current_line = cp.wrapped_current_line;
+#ifdef DEBUG
+    m_line_iter.SetProcessedLineCount(m_index.Count());
+#endif
+    return true;
+}
+
+void FileLineMap::CopyFrom(const FileLineMap& other)
+{
+    InitForRange(other, other.m_processed);
+
+    m_index = other.m_index;
+    m_newlines = other.m_newlines;
+    m_newlines_begin = other.m_newlines_begin;
+    m_newlines_end = other.m_newlines_end;
+    m_checkpoints = other.m_checkpoints;
+
+    m_current_line_number = other.m_current_line_number;
+    m_pending_begin = other.m_pending_begin;
+    FileLineIter::State state;
+    other.m_line_iter.SaveState(state);
+    m_line_iter.RestoreState(state);
+    m_skip_whitespace = other.m_skip_whitespace;
+    m_wrapped_current_line = other.m_wrapped_current_line;
+#ifdef DEBUG
+    m_line_iter.SetProcessedLineCount(m_index.Count());
+#endif
+}
+
+void FileLineMap::IndexNewlines(const BYTE* bytes, const FileOffset begin)
+{
+    // bytes is at begin, and has been consumed through m_processed.  The
+    // newline index can only grow if it already reaches bytes.
+    if (begin > m_newlines_end || m_processed <= m_newlines_end)
+        return;
+
+    const BYTE* const first = bytes + (m_newlines_end - begin);
+    const BYTE* const end = bytes + (m_processed - begin);
+    if (CharSize() == 1)
+    {
+        for (const BYTE* p = first; p < end; ++p)
+        {
+            p = static_cast<const BYTE*>(memchr(p, '\n', end - p));
+            if (!p)
+                break;
+            m_newlines.Append(begin + (p + 1 - bytes));
+        }
+    }
+    else
+    {
+        const unsigned lo_byte = (m_codepage == 1201) ? 1 : 0;
+        for (const BYTE* p = first; p + 2 <= end; p += 2)
+        {
+            if (p[lo_byte] == '\n' && p[1 - lo_byte] == 0)
+                m_newlines.Append(begin + (p + 2 - bytes));
+        }
+    }
+
+    m_newlines_end = m_processed;
+}
+
+bool FileLineMap::FindLineStart(FileOffset offset, FileOffset& start) const
+{
+    if (offset < m_newlines_begin || offset > m_newlines_end)
+        return false;
+    const size_t index = m_newlines.UpperBound(offset);
+    if (!index)
+        return false;
+    start = m_newlines.GetOffset(index - 1);
+    return true;
+}
+
+bool FileLineMap::NewlineNumberToOffset(size_t line, FileOffset& offset) const
+{
+    if (m_newlines_begin || !line || line > m_newlines.Count())
+        return false;
+    offset = m_newlines.GetOffset(line - 1);
+    return true;
+}
+
+size_t FileLineMap::CountNewlinesBefore(FileOffset offset) const
+{
+    assert(!m_newlines_begin && offset <= m_newlines_end);
+    return m_newlines.LowerBound(offset);
+}
+
+void FileLineMap::NextRows(const BYTE* bytes, size_t available)
 {
     if (!m_processed)
     {
@@ -951,15 +1895,22 @@ do_skip_whitespace:
             break;
 
         assert(line_length);
-        m_lines.emplace_back(m_pending_begin);
-        if (m_wrap && !IsBinaryFile())
-            m_line_numbers.emplace_back(m_current_line_number);
         if (m_wrap)
-            m_formatting.emplace_back(std::move(fmt));
-        assert(m_lines.size() == m_line_iter.GetProcessedLineCount() ||
-               m_lines.size() == m_line_iter.GetProcessedLineCount() + 1);
+        {
+            // A row continues the previous row's line if the line number
+            // didn't advance.
+            const bool continuation = (!IsBinaryFile() && m_index.Count() &&
+                                       m_current_line_number == m_index.CountFriendlyLines());
+            m_index.Append(m_pending_begin, continuation, fmt);
+        }
+        else
+        {
+            m_index.Append(m_pending_begin);
+        }
+        assert(m_index.Count() == m_line_iter.GetProcessedLineCount() ||
+               m_index.Count() == m_line_iter.GetProcessedLineCount() + 1);
 #ifdef DEBUG_LINE_PARSING
-        dbgprintf(L"finished line %lu; offset %lu (%lx), length %lu, width %lu, leading indent %u", m_lines.size(), m_pending_begin, m_pending_begin, line_length, line_width, fmt.m_leading_indent);
+        dbgprintf(L"finished line %lu; offset %lu (%lx), length %lu, width %lu, leading indent %u", m_index.Count(), m_pending_begin, m_pending_begin, line_length, line_width, fmt.m_leading_indent);
 #endif
 #ifdef DEBUG
         consumed += line_length;
@@ -993,40 +1944,161 @@ do_skip_whitespace:
     m_processed = m_pending_begin + line_length;
 }
 
+void FileLineMap::InitForRange(const FileLineMap& other, FileOffset offset)
+{
+    assert(!other.m_need_type);
+
+    ClearProcessed();
+
+    m_wrap = other.m_wrap;
+
+    m_detected_type = other.m_detected_type;
+    m_detected_codepage = other.m_detected_codepage;
+    m_codepage = other.m_codepage;
+    m_detected_encoding_name = other.m_detected_encoding_name;
+    m_encoding_name = other.m_encoding_name;
+    m_is_unicode_encoding = other.m_is_unicode_encoding;
+    m_need_type = false;
+
+    m_line_iter.SetEncoding(other.IsBinaryFile() ? FileDataType::Binary : FileDataType::Text, m_codepage);
+    m_line_iter.SetWrapWidth(m_wrap);
+
+    m_processed = offset;
+    m_pending_begin = offset;
+
+    // A range always begins after a newline.
+    m_newlines.Clear();
+    m_newlines.Append(offset);
+    m_newlines_begin = offset;
+    m_newlines_end = offset;
+}
+
+bool FileLineMap::AdoptFrom(FileLineMap&& other, bool next_is_whitespace)
+{
+    // Line breaks only depend on where a line begins and whether whitespace
+    // is being skipped there.  When wrapping, they also depend on the hanging
+    // indent carried over from the previous row, so rows only line up where
+    // a new line begins in both maps.
+    // So if other has a line that begins exactly where the next line in this
+    // map begins, then every line after that is identical to what this map
+    // would have produced.
+    assert(m_wrap == other.m_wrap);
+
+    if (m_skip_whitespace && next_is_whitespace)
+        return false;
+
+    const size_t first = other.m_index.LowerBound(m_pending_begin);
+    if (first >= other.m_index.Count() || other.m_index.GetOffset(first) != m_pending_begin)
+        return false;
+
+    if (m_wrap)
+    {
+        const size_t first_line = other.m_index.GetLineNumber(first);
+        if (m_wrapped_current_line || (first && first_line == other.m_index.GetLineNumber(first - 1)))
+            return false;
+
+        // m_current_line_number is only used for line number breakpoints,
+        // which are only recorded when wrapping.
+        m_current_line_number += other.m_current_line_number - first_line;
+    }
+
+    // Other's checkpoints after the seam apply here too, once their rows are
+    // renumbered.
+    const size_t rows_before = m_index.Count();
+    for (const auto& cp : other.m_checkpoints)
+    {
+        if (cp.rows > first)
+        {
+            m_checkpoints.emplace_back(cp);
+            m_checkpoints.back().rows = rows_before + (cp.rows - first);
+        }
+    }
+
+    m_index.AppendFrom(other.m_index, first);
+
+    // Extend the newline index with other's, if they're contiguous.
+    if (other.m_newlines_begin <= m_newlines_end && other.m_newlines_end > m_newlines_end)
+    {
+        for (size_t ii = other.m_newlines.UpperBound(m_newlines_end); ii < other.m_newlines.Count(); ++ii)
+            m_newlines.Append(other.m_newlines.GetOffset(ii));
+        m_newlines_end = other.m_newlines_end;
+    }
+
+    m_processed = other.m_processed;
+    m_pending_begin = other.m_pending_begin;
+    m_line_iter = std::move(other.m_line_iter);
+    m_skip_whitespace = other.m_skip_whitespace;
+    m_wrapped_current_line = other.m_wrapped_current_line;
+#ifdef DEBUG
+    m_line_iter.SetProcessedLineCount(m_index.Count());
+#endif
+
+    other.Reset();
+    return true;
+}
+
+bool FileLineMap::ResumeFromIndex(const BYTE* p, const BYTE* end, FileOffset offset)
+{
+    // The cached rows must end where a newline ends, so that processing can
+    // resume there with a fresh line iterator.
+    LineIndex index;
+    if (!index.Deserialize(p, end) || !index.Count() || index.GetOffset(index.Count() - 1) >= offset)
+        return false;
+
+    m_index = std::move(index);
+    m_checkpoints.clear();
+    ResumeAt(m_index.Count(), offset);
+    return true;
+}
+
+void FileLineMap::ResumeAt(size_t rows, FileOffset offset)
+{
+    // Like ResumeFromIndex(), offset must be where a newline ends.
+    m_index.Truncate(rows);
+    while (!m_checkpoints.empty() && (m_checkpoints.back().rows > rows || m_checkpoints.back().processed > offset))
+        m_checkpoints.pop_back();
+    if (m_newlines_end > offset && offset >= m_newlines_begin)
+    {
+        m_newlines.Truncate(m_newlines.UpperBound(offset));
+        m_newlines_end = offset;
+    }
+    m_current_line_number = m_index.CountFriendlyLines() + 1;
+    m_processed = offset;
+    m_pending_begin = offset;
+    m_line_iter.ClearProcessed();
+    m_skip_whitespace = 0;
+    m_wrapped_current_line = false;
+#ifdef DEBUG
+    m_line_iter.SetProcessedLineCount(m_index.Count());
+#endif
+}
+
 size_t FileLineMap::CountFriendlyLines() const
 {
-    if (m_line_numbers.size())
-        return m_line_numbers.back();
-    return m_lines.size();
+    return m_index.CountFriendlyLines();
 }
 
 FileOffset FileLineMap::GetOffset(size_t index) const
 {
-    assert(!index || index < m_lines.size());
-    return index ? m_lines[index] : 0;  // Uses 0 when m_lines is empty.
+    assert(!index || index < m_index.Count());
+    return m_index.Count() ? m_index.GetOffset(index) : 0;  // Uses 0 when m_index is empty.
 }
 
 FormattingInfo FileLineMap::GetFormattingInfo(size_t index) const
 {
     if (m_wrap)
     {
-        assert(!index || index < m_formatting.size());
-        assert(m_formatting.size() == m_lines.size());
-        if (index < m_formatting.size())
-            return m_formatting[index];
+        assert(!index || index < m_index.Count());
+        if (index < m_index.Count())
+            return m_index.GetFormattingInfo(index);
     }
     return {};
 }
 
 size_t FileLineMap::GetLineNumber(size_t index) const
 {
-    assert(!index || index < m_lines.size());
-    if (m_line_numbers.size())
-    {
-        assert(m_line_numbers.size() == m_lines.size());
-        return m_line_numbers[index];
-    }
-    return index + 1;
+    assert(!index || index < m_index.Count());
+    return m_index.GetLineNumber(index);
 }
 
 void FileLineMap::GetLineText(const BYTE* p, size_t num_bytes, StrW& out, bool hex_mode) const
@@ -1047,9 +2119,13 @@ void FileLineMap::GetLineText(const BYTE* p, size_t num_bytes, StrW& out, bool h
             }
             if (cp == 1201)
             {
-                for (size_t i = num_bytes & ~1; i;)
+                // Swap the bytes in place, eight characters at a time.
+                const size_t num_even = num_bytes & ~1;
+                size_t i = 0;
+                for (; i + 16 <= num_even; i += 16)
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(o + i), LoadUtf16(o + i, true));
+                for (; i < num_even; i += 2)
                 {
-                    i -= 2;
                     const BYTE t = o[i];
                     o[i] = o[i+1];
                     o[i+1] = t;
@@ -1058,6 +2134,9 @@ void FileLineMap::GetLineText(const BYTE* p, size_t num_bytes, StrW& out, bool h
             out.OverrideLength(num_chars);
         }
         break;
+    case CP_UTF8:
+        SetFromUtf8(out, p, num_bytes);
+        break;
     default:
         out.SetFromCodepage(cp, reinterpret_cast<const char*>(p), num_bytes);
         break;
@@ -1066,13 +2145,9 @@ void FileLineMap::GetLineText(const BYTE* p, size_t num_bytes, StrW& out, bool h
 
 size_t FileLineMap::FriendlyLineNumberToIndex(size_t line) const
 {
-    if (m_line_numbers.size())
+    if (m_wrap && !IsBinaryFile() && m_index.Count())
     {
-        const auto iter = std::lower_bound(m_line_numbers.begin(), m_line_numbers.end(), line);
-        if (iter == m_line_numbers.end())
-            line = m_lines.size();
-        else
-            line = iter - m_line_numbers.begin();
+        line = m_index.FriendlyLineNumberToIndex(line);
     }
     else
     {
@@ -1084,8 +2159,7 @@ size_t FileLineMap::FriendlyLineNumberToIndex(size_t line) const
 
 size_t FileLineMap::OffsetToIndex(FileOffset offset) const
 {
-    auto iter = std::upper_bound(m_lines.begin(), m_lines.end(), offset);
-    size_t index = (iter == m_lines.end()) ? m_lines.size() : (iter - m_lines.begin());
+    size_t index = m_index.UpperBound(offset);
     if (index)
         --index;
     return index;
@@ -1093,18 +2167,11 @@ size_t FileLineMap::OffsetToIndex(FileOffset offset) const
 
 size_t FileLineMap::FirstLineNumberInHexRow(FileOffset offset, unsigned hex_width) const
 {
-    const size_t begin_line = OffsetToIndex(offset) + 1;
-    const size_t end_line = OffsetToIndex(offset + hex_width - 1) + 1;
-    if (begin_line < end_line)
-    {
-        for (FileOffset o = offset + 1; o < offset + hex_width; ++o)
-        {
-            const size_t l = OffsetToIndex(o) + 1;
-            if (begin_line < l)
-                return l;
-        }
-    }
-    return begin_line;
+    // The line containing offset, unless a later line starts in the row.
+    const size_t index = OffsetToIndex(offset);
+    if (index + 1 < m_index.Count() && m_index.GetOffset(index + 1) < offset + hex_width)
+        return index + 2;
+    return index + 1;
 }
 
 bool FileLineMap::IsUTF8Compatible() const
@@ -1154,12 +2221,23 @@ const WCHAR* FileLineMap::GetDetectedEncodingName() const
 ContentCache::ContentCache(const ViewerOptions& options)
 : m_options(options)
 , m_map(options)
+, m_sparse(options)
+, m_stale(options)
 {
     SetSize(0);
 }
 
+ContentCache::~ContentCache()
+{
+    Close();
+    free(m_buffer);
+}
+
 ContentCache& ContentCache::operator=(ContentCache&& other)
 {
+    StopBackgroundIndexing();
+    other.StopBackgroundIndexing();
+
     // m_options can't be updated, and it doesn't need to be.
     m_name = std::move(other.m_name);
     m_file = std::move(other.m_file);
@@ -1169,19 +2247,66 @@ ContentCache& ContentCache::operator=(ContentCache&& other)
     m_line_count_width = other.m_line_count_width;
     m_redirected = other.m_redirected;
     m_chunks = std::move(other.m_chunks);
+    m_pipe_reader = std::move(other.m_pipe_reader);
+    m_read_ahead = std::move(other.m_read_ahead);
+    m_compressed = std::move(other.m_compressed);
+    m_file_key = other.m_file_key;
+    m_file_key_valid = other.m_file_key_valid;
+    m_reopen = other.m_reopen;
+    m_last_read_begin = other.m_last_read_begin;
+    m_spill_file = std::move(other.m_spill_file);
+    m_resident_chunks = other.m_resident_chunks;
+    m_clock_hand = other.m_clock_hand;
+    m_spill_disabled = other.m_spill_disabled;
     m_text = other.m_text;
     m_map = std::move(other.m_map);
     m_completed = other.m_completed;
     m_eof = other.m_eof;
+    m_sparse = std::move(other.m_sparse);
+    m_sparse_begin = other.m_sparse_begin;
+    m_sparse_base = other.m_sparse_base;
+    m_sparse_line_base = other.m_sparse_line_base;
+    m_sparse_active = other.m_sparse_active;
+    m_sparse_eof = other.m_sparse_eof;
+    m_stale = std::move(other.m_stale);
+    m_stale_end = other.m_stale_end;
+    ++m_generation;
+    m_sync_generation = m_generation;
+    m_sync_index = 0;
+    m_sync_offset = 0;
+    m_rewrap_pending = false;
+    m_rewrap_rows_per_byte = other.m_rewrap_rows_per_byte;
+    m_rewrap_lines_per_byte = other.m_rewrap_lines_per_byte;
+    m_sampled_lines_per_byte = other.m_sampled_lines_per_byte;
+    other.m_sparse_active = false;
+    m_index_cache_name = std::move(other.m_index_cache_name);
+    m_index_cache = std::move(other.m_index_cache);
+    m_index_cache_resumed = other.m_index_cache_resumed;
+    other.m_index_cache_resumed = 0;
+    UnmapFile();
+    free(m_buffer);
+    m_buffer = other.m_buffer;
+    m_buffer_size = other.m_buffer_size;
+    m_bulk_window = c_data_buffer_main;
     m_data = other.m_data;
     m_data_offset = other.m_data_offset;
     m_data_length = other.m_data_length;
     m_data_slop = other.m_data_slop;
+    m_mapping = std::move(other.m_mapping);
+    m_view = other.m_view;
+    m_view_offset = other.m_view_offset;
+    m_view_length = other.m_view_length;
+    m_mapped_size = other.m_mapped_size;
+    m_remap = other.m_remap;
 
     other.m_file = INVALID_HANDLE_VALUE;
+    other.m_buffer = nullptr;
+    other.m_buffer_size = 0;
     other.m_data = nullptr;
+    other.m_view = nullptr;
     other.Close();
 
+    UpdateMemoryCharges();
     return *this;
 }
 
@@ -1203,18 +2328,240 @@ void ContentCache::SetSize(FileOffset size)
 
 bool ContentCache::EnsureDataBuffer(Error& e)
 {
-    if (!m_data)
+    if (!m_buffer)
     {
-        m_data = static_cast<BYTE*>(malloc(c_data_buffer_slop + c_data_buffer_main + c_data_buffer_slop));
-        if (!m_data)
+        m_buffer = static_cast<BYTE*>(malloc(c_data_buffer_slop + c_data_buffer_main + c_data_buffer_slop));
+        if (!m_buffer)
         {
             e.Sys(ERROR_NOT_ENOUGH_MEMORY);
             return false;
         }
+        m_buffer_size = c_data_buffer_slop + c_data_buffer_main + c_data_buffer_slop;
+    }
+    return true;
+}
+
+bool ContentCache::GrowDataBuffer(DWORD window)
+{
+    const DWORD size = c_data_buffer_slop + window + c_data_buffer_slop;
+    if (m_buffer_size >= size)
+        return true;
+
+    // Reallocating keeps the loaded data, so LoadData() can still reuse it.
+    const bool in_buffer = (m_buffer && m_data >= m_buffer && m_data < m_buffer + m_buffer_size);
+    const size_t data_index = in_buffer ? m_data - m_buffer : 0;
+    BYTE* const buffer = static_cast<BYTE*>(realloc(m_buffer, size));
+    if (!buffer)
+        return false;
+
+    if (in_buffer || m_data == m_buffer)
+        m_data = buffer + data_index;
+    m_buffer = buffer;
+    m_buffer_size = size;
+    return true;
+}
+
+void ContentCache::ShrinkDataBuffer()
+{
+    m_bulk_window = c_data_buffer_main;
+
+    const DWORD size = c_data_buffer_slop + c_data_buffer_main + c_data_buffer_slop;
+    if (m_buffer_size > size)
+    {
+        BYTE* const buffer = static_cast<BYTE*>(malloc(size));
+        if (buffer)
+        {
+            if (m_data >= m_buffer && m_data < m_buffer + m_buffer_size)
+            {
+                m_data = buffer;
+                m_data_offset = 0;
+                m_data_length = 0;
+                m_data_slop = 0;
+            }
+            free(m_buffer);
+            m_buffer = buffer;
+            m_buffer_size = size;
+        }
+    }
+
+    // Reopening it on demand is cheaper than keeping a big buffer around.
+    if (m_read_ahead && m_read_ahead->Capacity() > c_read_ahead_size)
+        m_read_ahead.reset();
+
+    UpdateMemoryCharges();
+}
+
+bool ContentCache::SetBulkReads(bool bulk)
+{
+    const bool prev = m_bulk_reads;
+    m_bulk_reads = bulk;
+    if (prev && !bulk)
+        ShrinkDataBuffer();
+    return prev;
+}
+
+bool ContentCache::MapFile()
+{
+    assert(IsOpen());
+    assert(!m_mapping);
+
+    if (!m_options.memory_map_files || !m_size)
+        return false;
+
+    // Reading from a mapped view raises an in-page exception if an I/O error
+    // happens, so only map local files.  Network files always go through
+    // ReadFile, where errors can be reported normally.
+    FILE_REMOTE_PROTOCOL_INFO remote;
+    if (GetFileInformationByHandleEx(m_file, FileRemoteProtocolInfo, &remote, sizeof(remote)))
+        return false;
+
+    // A size of zero maps the file at its current size.
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+        return false;
+
+    LARGE_INTEGER liSize;
+    if (!GetFileSizeEx(m_file, &liSize) || !liSize.QuadPart)
+    {
+        m_mapping.Close();
+        return false;
+    }
+
+    m_mapped_size = liSize.QuadPart;
+    return true;
+}
+
+void ContentCache::UnmapFile()
+{
+    if (m_view)
+    {
+        if (m_data >= m_view && m_data < m_view + m_view_length)
+        {
+            m_data = m_buffer;
+            m_data_offset = 0;
+            m_data_length = 0;
+            m_data_slop = 0;
+        }
+        UnmapViewOfFile(m_view);
+        m_view = nullptr;
+    }
+    m_view_offset = 0;
+    m_view_length = 0;
+    m_mapped_size = 0;
+    m_mapping.Close();
+}
+
+void ContentCache::ReleaseMapping()
+{
+    assert(!IsBackgroundIndexing());
+    if (m_mapping)
+    {
+        UnmapFile();
+        m_remap = true;
+    }
+}
+
+bool ContentCache::EnsureMapping()
+{
+    if (m_remap)
+    {
+        m_remap = false;
+        if (IsOpen())
+            MapFile();
+    }
+    return !!m_mapping;
+}
+
+bool ContentCache::ReadAt(FileOffset offset, BYTE* dest, DWORD length, DWORD& bytes_read, Error& e)
+{
+    // Reads the content, which is the uncompressed data for a compressed
+    // file.
+    if (m_compressed)
+        return m_compressed->Read(offset, dest, length, bytes_read, e);
+
+    LARGE_INTEGER liMove;
+    liMove.QuadPart = offset;
+    bytes_read = 0;
+    if (!SetFilePointerEx(m_file, liMove, nullptr, FILE_BEGIN) ||
+        !ReadFile(m_file, dest, length, &bytes_read, nullptr))
+    {
+        e.Sys();
+        return false;
     }
     return true;
 }
 
+void ContentCache::SampleDensity()
+{
+    // Counts newlines in blocks spread evenly across the file.  The estimate
+    // is only a guide, so errors just mean there's no estimate.
+    m_sampled_lines_per_byte = 0;
+    if (m_size < c_density_min_size)
+        return;
+
+    std::vector<BYTE> buffer(c_density_sample_size);
+    uint64 newlines = 0;
+    uint64 sampled = 0;
+    for (unsigned ii = 0; ii < c_density_samples; ++ii)
+    {
+        Error e;
+        DWORD bytes_read;
+        const FileOffset offset = (m_size - c_density_sample_size) / (c_density_samples - 1) * ii;
+        if (!ReadAt(offset, buffer.data(), c_density_sample_size, bytes_read, e))
+            return;
+        newlines += std::count(buffer.begin(), buffer.begin() + bytes_read, BYTE('\n'));
+        sampled += bytes_read;
+    }
+
+    if (sampled)
+        m_sampled_lines_per_byte = double(std::max<uint64>(newlines, 1)) / double(sampled);
+}
+
+void ContentCache::GetDensity(double& rows_per_byte, double& lines_per_byte) const
+{
+    rows_per_byte = m_rewrap_rows_per_byte;
+    lines_per_byte = m_rewrap_lines_per_byte;
+    if (m_map.Processed())
+    {
+        rows_per_byte = double(m_map.Count()) / double(m_map.Processed());
+        lines_per_byte = double(m_map.CountFriendlyLines()) / double(m_map.Processed());
+    }
+
+    // The processed rows are all near the beginning of the file, so prefer
+    // the density sampled across the whole file.  Wrapping and the max line
+    // length make more rows than lines; assume the same ratio as so far.
+    if (m_sampled_lines_per_byte > 0)
+    {
+        const double rows_per_line = (lines_per_byte > 0) ? std::max(1.0, rows_per_byte / lines_per_byte) : 1.0;
+        lines_per_byte = m_sampled_lines_per_byte;
+        rows_per_byte = std::max(lines_per_byte * rows_per_line, 1.0 / m_options.max_line_length);
+    }
+}
+
+size_t ContentCache::EstimateRowCount() const
+{
+    if (m_completed || m_redirected || m_text)
+        return Count();
+
+    double rows_per_byte;
+    double lines_per_byte;
+    GetDensity(rows_per_byte, lines_per_byte);
+    const double remaining = double(m_size - std::min(m_size, m_map.Processed()));
+    return std::max<size_t>(Count(), m_map.Count() + size_t(remaining * rows_per_byte));
+}
+
+size_t ContentCache::EstimateLineCount() const
+{
+    if (m_completed || m_redirected || m_text)
+        return CountFriendlyLines();
+
+    double rows_per_byte;
+    double lines_per_byte;
+    GetDensity(rows_per_byte, lines_per_byte);
+    const double remaining = double(m_size - std::min(m_size, m_map.Processed()));
+    return std::max<size_t>(CountFriendlyLines(), m_map.CountFriendlyLines() + size_t(remaining * lines_per_byte));
+}
+
 bool ContentCache::HasContent() const
 {
     return (IsOpen() || IsPipe() || m_text);
@@ -1251,43 +2598,48 @@ bool ContentCache::Open(const WCHAR* name, Error& e)
     if (!m_redirected)
     {
         // Open for write as well, in case the file is edited in hex mode.
-        m_file = CreateFileW(name, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, 0);
+        m_file = OpenFileForViewing(name);
         if (m_file == INVALID_HANDLE_VALUE)
         {
             e.Sys();
             return false;
         }
         m_name.Set(name);
+        m_file_key_valid = m_file_key.Read(m_file);
 
         LARGE_INTEGER liSize;
         if (GetFileSizeEx(m_file, &liSize))
             SetSize(liSize.QuadPart);
 
-#ifdef USE_SMALL_DATA_BUFFER
-        // Debug builds use a very small read chunk size, which greatly
-        // degrades the accuracy of file type and encoding detection.
-        // Compensate by pre-reading and analyzing a big chunk.
-        const DWORD to_read = 4096 * 24;
-        DWORD bytes_read;
-        BYTE* buffer = new BYTE[to_read];
-        if (buffer)
+        // A compressed file is read by decompressing it, so the size is the
+        // uncompressed size, and the file isn't mapped.
+        m_compressed = OpenCompressedFile(m_file, m_size, e);
+        if (m_compressed)
         {
-            if (ReadFile(m_file, buffer, to_read, &bytes_read, nullptr))
-            {
-                UINT codepage;
-                StrW encoding_name;
-                FileDataType type = AnalyzeFileType(buffer, bytes_read, &codepage, &encoding_name);
-                m_map.SetFileType(type, codepage, encoding_name.Text());
-            }
-            delete [] buffer;
+            SetSize(m_compressed->GetSize());
         }
-#endif
-
-        return true;
+        else if (e.Test())
+        {
+            Close();
+            return false;
+        }
+        else
+        {
+            // Failure is not an error; it just means falling back to ReadFile.
+            MapFile();
+
+            if (m_options.index_cache && m_size >= c_index_cache_min_size)
+                LoadIndexCache();
+
+            // Seeking around in a compressed file is too slow for sampling.
+            SampleDensity();
+        }
+
+        DetectFileType();
+        return true;
     }
     else
     {
-        FileOffset size = 0;
         const HANDLE hin = s_piped_stdin;
         s_piped_stdin = 0;
         if (!hin || hin == INVALID_HANDLE_VALUE)
@@ -1295,61 +2647,466 @@ bool ContentCache::Open(const WCHAR* name, Error& e)
             e.Sys(ERROR_NO_DATA);
             return false;
         }
-        while (true)
+
+        // Read the pipe in the background, so the viewer can show the input
+        // as it arrives instead of waiting for EOF.
+        m_pipe_reader = std::make_unique<PipeReader>(hin);
+        if (!m_pipe_reader->Start())
         {
-            if (m_chunks.empty() || !m_chunks.back().Available())
-                m_chunks.emplace_back();
+            e.Sys();
+            m_pipe_reader.reset();
+            return false;
+        }
 
-            PipeChunk& chunk = m_chunks.back();
-            const DWORD to_read = chunk.Available();
-            DWORD bytes_read;
-            if (!ReadFile(hin, chunk.WritePtr(), to_read, &bytes_read, nullptr))
-            {
-                const DWORD err = GetLastError();
-                if (err && err != ERROR_HANDLE_EOF && err != ERROR_BROKEN_PIPE)
-                    e.Sys(err);
-                m_eof = true;
-                SetSize(size);
-                return !e.Test();
-            }
-            chunk.Wrote(bytes_read);
-            size += bytes_read;
+        // Give the producer a moment to deliver enough input to detect the
+        // file type and encoding.
+        const DWORD start = GetTickCount();
+        while (m_pipe_reader && m_size < c_data_buffer_main)
+        {
+            const DWORD elapsed = GetTickCount() - start;
+            if (elapsed >= c_pipe_initial_wait)
+                break;
+            m_pipe_reader->Wait(c_pipe_initial_wait - elapsed);
+            PollPipe(e);
+        }
+        return !e.Test();
+    }
+}
+
+bool ContentCache::PollPipe(Error& e)
+{
+    assert(!IsBackgroundIndexing());
+    if (!m_pipe_reader)
+        return false;
+
+    bool done;
+    DWORD err;
+    FileOffset size = m_size;
+    const size_t chunks = m_chunks.size();
+    const bool changed = m_pipe_reader->Take(m_chunks, size, done, err);
+    m_resident_chunks += m_chunks.size() - chunks;
+    if (size != m_size)
+        SetSize(size);
+    TrimPipeChunks();
+
+    if (done)
+    {
+        m_pipe_reader.reset();
+        m_eof = true;
+        if (err)
+            e.Sys(err);
+        CompleteIfProcessed();
+    }
+
+    return changed;
+}
+
+size_t ContentCache::GetPipeChunkBudget() const
+{
+    if (!m_options.pipe_memory_limit)
+        return size_t(-1);
+    const uint64 budget = uint64(m_options.pipe_memory_limit) * 1024 * 1024 / s_page_size;
+    return size_t(max<uint64>(budget, c_min_resident_chunks));
+}
+
+bool ContentCache::EnsurePipeChunk(size_t index, Error& e)
+{
+    PipeChunk& chunk = m_chunks[index];
+    chunk.Touch();
+    if (!chunk.IsResident())
+    {
+        if (!chunk.Restore(m_spill_file, FileOffset(index) * s_page_size, e))
+            return false;
+        ++m_resident_chunks;
+        // The caller is about to use the chunk, so it mustn't be the one
+        // that gets spilled to make room for it.
+        TrimPipeChunks(index);
+    }
+    return true;
+}
+
+void ContentCache::TrimPipeChunks(size_t pinned)
+{
+    const size_t budget = GetPipeChunkBudget();
+    while (m_resident_chunks > budget && SpillPipeChunk(pinned))
+    {
+    }
+    UpdateMemoryCharges();
+}
+
+size_t ContentCache::ReclaimMemory(size_t excess)
+{
+    assert(!IsBackgroundIndexing());
+    size_t freed = 0;
+    while (freed < excess && m_resident_chunks > c_min_resident_chunks && SpillPipeChunk())
+        freed += s_page_size;
+    UpdateMemoryCharges();
+    return freed;
+}
+
+void ContentCache::UpdateMemoryCharges()
+{
+    m_line_map_memory.Set(m_map.MemoryUsage() + m_sparse.MemoryUsage() + m_stale.MemoryUsage() + m_index_cache.capacity());
+    m_buffer_memory.Set(m_buffer_size +
+                        (m_compressed ? m_compressed->MemoryUsage() : 0));
+    m_pipe_memory.Set(m_resident_chunks * s_page_size);
+}
+
+bool ContentCache::SpillPipeChunk(size_t pinned)
+{
+    if (m_spill_disabled || m_chunks.size() < 2)
+        return false;
+
+    if (m_spill_file.Empty())
+    {
+        // The temp file is deleted automatically when it's closed.  Chunks
+        // are page sized and page aligned, so unbuffered I/O works and
+        // keeps the spilled data from crowding the file cache.
+        WCHAR dir[MAX_PATH];
+        WCHAR name[MAX_PATH];
+        const DWORD len = GetTempPathW(_countof(dir), dir);
+        if (len && len < _countof(dir) && GetTempFileNameW(dir, L"lst", 0, name))
+        {
+            m_spill_file = CreateFileW(name, GENERIC_READ|GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                       FILE_ATTRIBUTE_TEMPORARY|FILE_FLAG_DELETE_ON_CLOSE|FILE_FLAG_NO_BUFFERING, 0);
+            if (m_spill_file.Empty())
+                DeleteFileW(name);
+        }
+        if (m_spill_file.Empty())
+        {
+            m_spill_disabled = true;
+            return false;
+        }
+    }
+
+    // Approximate LRU with the clock algorithm:  sweep the chunks, giving
+    // recently used ones a second chance.  The last chunk is skipped because
+    // it may still be filling up.
+    const size_t last = m_chunks.size() - 1;
+    for (size_t sweep = 0; sweep < 2 * last; ++sweep)
+    {
+        if (m_clock_hand >= last)
+            m_clock_hand = 0;
+        const size_t index = m_clock_hand++;
+        PipeChunk& chunk = m_chunks[index];
+        if (index == pinned || !chunk.IsResident() || chunk.Age())
+            continue;
+
+        // If the disk is full, the chunks already spilled stay readable, but
+        // everything else has to stay in memory.
+        Error e;
+        if (!chunk.Spill(m_spill_file, FileOffset(index) * s_page_size, e))
+        {
+            m_spill_disabled = true;
+            return false;
         }
+        --m_resident_chunks;
+        return true;
+    }
+
+    return false;
+}
+
+bool ContentCache::CheckForGrowth(bool& replaced, Error& e)
+{
+    assert(!IsBackgroundIndexing());
+    replaced = false;
+
+    if (!IsOpen() || IsPipe() || IsDirty())
+        return false;
+
+    IndexCacheKey key;
+    if (!key.Read(m_file))
+        return false;
+
+    // A compressed file is only indexed when it's opened, so any change
+    // means reloading it.
+    if (m_compressed)
+    {
+        replaced = (key.size != m_compressed->GetRawSize() || IsReplaced(key));
+        return false;
+    }
+
+    if (IsReplaced(key) || key.size < m_size)
+    {
+        replaced = true;
+        return false;
+    }
+    if (key.size == m_size)
+        return false;
+
+    // The mapping only covers the size at the time it was created.
+    if (m_mapping)
+    {
+        UnmapFile();
+        MapFile();
+    }
+
+    // A sparse window may have finalized its last row at the old end of
+    // the file; a new one is cheap to build near the new end.  The same goes
+    // for stale rows.
+    DiscardSparse();
+    m_stale.Reset();
+
+    // Completing the map finalized the last row, which may continue now, so
+    // resume processing from the last row that follows a newline.  Only the
+    // bytes after that need to be processed.
+    if (m_completed)
+    {
+        size_t rows;
+        FileOffset resume_offset;
+        if (FindResumeRow(rows, resume_offset))
+            m_map.ResumeAt(rows, resume_offset);
+        else if (!m_map.RestoreCheckpoint(m_size))
+            m_map.ClearProcessed();
+        m_completed = false;
+        m_line_count_width = 0;
+    }
+
+    SetSize(key.size);
+    m_eof = false;
+    ++m_content_generation;
+    // A block cached at the old EOF is partial, so the key must change.
+    m_file_key_valid = (m_file_key_valid && CompareFileTime(&key.last_write, &m_file_key.last_write) != 0);
+    m_file_key = key;
+    return true;
+}
+
+bool ContentCache::IsReplaced(const IndexCacheKey& key) const
+{
+    // Log rotation renames or deletes the file and creates a new one in its
+    // place, so compare against whatever the name refers to now.  While the
+    // name doesn't exist, keep using the old file.
+    IndexCacheKey current;
+    SHFile h = CreateFileW(m_name.Text(), 0, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, 0);
+    return (!h.Empty() && current.Read(h) && !current.SameFile(key));
+}
+
+void ContentCache::ProcessingOptions::Capture(const ViewerOptions& options)
+{
+    max_line_length = options.max_line_length;
+    tab_width = options.tab_width;
+    hanging_extra = options.hanging_extra;
+    ctrl_mode = options.ctrl_mode;
+    expand_tabs = options.expand_tabs;
+}
+
+bool ContentCache::ProcessingOptions::Equals(const ProcessingOptions& other) const
+{
+    return (max_line_length == other.max_line_length &&
+            tab_width == other.tab_width &&
+            hanging_extra == other.hanging_extra &&
+            ctrl_mode == other.ctrl_mode &&
+            expand_tabs == other.expand_tabs);
+}
+
+void ContentCache::Suspend()
+{
+    StopBackgroundIndexing();
+    m_suspended_options.Capture(m_options);
+    // Don't keep a suspended file mapped or open; Resume() reopens it.  A
+    // compressed file keeps its handle, since decompressing reads from it.
+    ReleaseMapping();
+    if (IsOpen() && !IsPipe() && !IsCompressed() && !IsDirty())
+    {
+        m_read_ahead.reset();
+        m_file.Close();
+        m_reopen = true;
     }
 }
 
+bool ContentCache::ReopenSuspended()
+{
+    if (!m_reopen)
+        return true;
+    m_reopen = false;
+
+    assert(!IsOpen());
+    m_file = OpenFileForViewing(m_name.Text());
+    return IsOpen();
+}
+
+bool ContentCache::Resume()
+{
+    assert(!IsBackgroundIndexing());
+    if (!ReopenSuspended() || !IsOpen() || IsPipe() || !m_file_key_valid)
+        return false;
+
+    // The processed state is only usable if the file is unchanged.
+    IndexCacheKey key;
+    if (!key.Read(m_file) || key.size != m_file_key.size ||
+        CompareFileTime(&key.last_write, &m_file_key.last_write) != 0 ||
+        IsReplaced(key))
+        return false;
+
+    // The encoding and wrap width are kept, but the rows depend on some of
+    // the options.
+    ProcessingOptions current;
+    current.Capture(m_options);
+    if (!current.Equals(m_suspended_options))
+        ClearProcessed();
+    return true;
+}
+
+size_t ContentCache::GetMemoryUsage() const
+{
+    return (m_map.MemoryUsage() + m_sparse.MemoryUsage() + m_stale.MemoryUsage() +
+            m_buffer_size +
+            (m_compressed ? m_compressed->MemoryUsage() : 0));
+}
+
 void ContentCache::Close()
 {
+    StopBackgroundIndexing();
+    if (!m_index_cache_name.Empty())
+        ReopenSuspended();
+    SaveIndexCache();
+    m_index_cache_name.Clear();
+    std::vector<BYTE>().swap(m_index_cache);
+    m_index_cache_resumed = 0;
+    UnmapFile();
+    m_remap = false;
+    m_read_ahead.reset();
+    m_compressed.reset();
+    m_last_read_begin = 0;
+    m_file_key_valid = false;
+    m_reopen = false;
     m_name.Clear();
     m_file.Close();
 
     SetSize(0);
+    m_pipe_reader.reset();
     m_chunks.swap(PipeChunks {});
+    m_spill_file.Close();
+    m_resident_chunks = 0;
+    m_clock_hand = 0;
+    m_spill_disabled = false;
     m_text = nullptr;
     m_redirected = false;
     m_eof = false;
 
     ClearProcessed();
-
+    m_sync_index = 0;
+    m_sync_offset = 0;
+    m_rewrap_pending = false;
+    m_rewrap_rows_per_byte = 0;
+    m_rewrap_lines_per_byte = 0;
+    m_sampled_lines_per_byte = 0;
+
+    m_data = m_buffer;
     m_data_offset = 0;
     m_data_length = 0;
     m_data_slop = 0;
+    m_bulk_window = c_data_buffer_main;
+
+    UpdateMemoryCharges();
 }
 
 void ContentCache::ClearProcessed()
 {
+    // The map can only be invalidated while the UI thread owns it, so a
+    // subsequent StartBackgroundIndexing() starts over from the beginning.
+    assert(!IsBackgroundIndexing());
+    DiscardSparse();
     m_map.ClearProcessed();
+    m_stale.Reset();
     m_completed = false;
     if (!m_text && !m_redirected)
         m_eof = false;
+    ++m_content_generation;
+}
+
+void ContentCache::InvalidateProcessed(FileOffset begin, FileOffset end)
+{
+    assert(!IsBackgroundIndexing());
+    assert(begin <= end);
+    DiscardSparse();
+    m_stale.Reset();
+
+    if (begin < m_map.Processed())
+    {
+        // Keep a copy of the rows, to adopt the ones after end once
+        // processing gets there.
+        if (end < m_map.Processed())
+        {
+            m_stale.CopyFrom(m_map);
+            m_stale_end = end;
+        }
+        if (!m_map.RestoreCheckpoint(begin))
+            m_map.ClearProcessed();
+        m_completed = false;
+        m_line_count_width = 0;
+    }
+
+    // The loaded data may predate the change.
+    m_data = m_buffer;
+    m_data_offset = 0;
+    m_data_length = 0;
+    m_data_slop = 0;
+
+    if (!m_text && !m_redirected)
+        m_eof = false;
+    ++m_content_generation;
+    UpdateMemoryCharges();
+}
+
+void ContentCache::AdoptStaleRows()
+{
+    // Past the change, the rows are the same as before wherever a line
+    // begins in the same place.  AdoptFrom() resets m_stale on success.
+    const FileOffset next = m_map.NextLineOffset();
+    if (next < m_stale_end)
+        return;
+    if (m_map.GetWrapWidth() != m_stale.GetWrapWidth() || next >= m_stale.NextLineOffset())
+    {
+        m_stale.Reset();
+        return;
+    }
+
+    const bool next_is_whitespace = (next < m_data_offset || next >= m_data_offset + m_data_length ||
+                                     IsWhiteSpace(m_data[next - m_data_offset]));
+    if (m_map.AdoptFrom(std::move(m_stale), next_is_whitespace))
+    {
+        m_line_count_width = 0;
+        if (m_size < m_map.Processed())
+            SetSize(m_map.Processed());
+    }
 }
 
-void ContentCache::SetWrapWidth(unsigned wrap)
+void ContentCache::SetWrapWidth(unsigned wrap, size_t top)
 {
+    assert(!IsBackgroundIndexing());
+
+    // Re-anchor at the top row before its offset is lost.  The last anchor
+    // can be stale (e.g. after scrolling through a fully processed file,
+    // which doesn't need syncing), and a pending rewrap already has the
+    // right one.
+    if (top != size_t(-1) && !m_rewrap_pending && wrap != m_map.GetWrapWidth())
+        SetSyncAnchor(top);
+
+    const unsigned old_wrap = m_map.GetWrapWidth();
+    const FileOffset processed = m_map.Processed();
+    const size_t rows = m_map.Count();
+    const size_t lines = m_map.CountFriendlyLines();
+
     if (m_map.SetWrapWidth(wrap))
     {
         assert(!m_map.Count());
+        DiscardSparse();
         m_completed = false;
+
+        // Newlines don't depend on the wrap width, so the density of lines
+        // carries over, and the density of continuation rows scales with the
+        // wrap width.  That's enough to start a sparse window at the row that
+        // was at the top instead of reprocessing everything before it.
+        if (processed)
+        {
+            const double continued = (old_wrap && wrap) ? double(rows - lines) * old_wrap / wrap : 0;
+            m_rewrap_lines_per_byte = double(lines) / double(processed);
+            m_rewrap_rows_per_byte = (double(lines) + continued) / double(processed);
+        }
+        m_rewrap_pending = true;
+        ++m_generation;
     }
 }
 
@@ -1380,7 +3137,7 @@ unsigned ContentCache::CalcMarginWidth(bool hex_mode)
             if (!m_line_count_width)
             {
                 s.Clear();
-                s.Printf(L"%lu", CountFriendlyLines());
+                s.Printf(L"%lu", EstimateLineCount());
                 m_line_count_width = max(c_min_num_width, s.Length());
             }
             margin += m_line_count_width + hex_mode/*c_div_char*/ + c_margin_padding;
@@ -1399,13 +3156,105 @@ unsigned ContentCache::CalcMarginWidth(bool hex_mode)
     return margin;
 }
 
+void ContentCache::RowCacheState::Capture(const ContentCache& cache)
+{
+    const ViewerOptions& options = cache.m_options;
+    content_generation = cache.m_content_generation;
+    generation = cache.m_generation;
+    wrap = cache.m_map.GetWrapWidth();
+    line_count_width = cache.m_line_count_width;
+    file_size_width = cache.m_file_size_width;
+    tab_width = options.tab_width;
+    ctrl_mode = options.ctrl_mode;
+    filter_byte_char = options.filter_byte_char;
+    binary = cache.m_map.IsBinaryFile();
+    expand_tabs = options.expand_tabs;
+    show_whitespace = options.show_whitespace;
+    show_line_endings = options.show_line_endings;
+    show_line_numbers = options.show_line_numbers;
+    show_file_offsets = options.show_file_offsets;
+    show_debug_info = options.show_debug_info;
+}
+
+bool ContentCache::RowCacheState::Equals(const RowCacheState& other) const
+{
+    return (content_generation == other.content_generation &&
+            generation == other.generation &&
+            wrap == other.wrap &&
+            line_count_width == other.line_count_width &&
+            file_size_width == other.file_size_width &&
+            tab_width == other.tab_width &&
+            ctrl_mode == other.ctrl_mode &&
+            filter_byte_char == other.filter_byte_char &&
+            binary == other.binary &&
+            expand_tabs == other.expand_tabs &&
+            show_whitespace == other.show_whitespace &&
+            show_line_endings == other.show_line_endings &&
+            show_line_numbers == other.show_line_numbers &&
+            show_file_offsets == other.show_file_offsets &&
+            show_debug_info == other.show_debug_info);
+}
+
+void ContentCache::SyncRowCache()
+{
+    RowCacheState state;
+    state.Capture(*this);
+    if (!state.Equals(m_row_cache_state))
+    {
+        m_row_cache.Clear();
+        m_row_cache_state = state;
+    }
+}
+
 unsigned ContentCache::FormatLineData(const size_t line, bool middle, unsigned left_offset, StrW& s, const unsigned max_width, Error& e, const WCHAR* const color, const FoundOffset* const found_line, unsigned max_len)
 {
+    PerfScope perf(PerfTimer::FormatLine);
+    PerfAdd(PerfCount::RowsFormatted, 1);
+
     if (!EnsureFileData(line, e))
         return 0;
-    if (line >= m_map.Count())
+    if (line >= Count())
         return 0;
 
+    SyncRowCache();
+
+    // A limited length is only for measuring part of a row; it still uses
+    // the cached decoded text, but the partial row isn't worth caching.
+    if (max_len != unsigned(-1))
+        return FormatLineDataInternal(line, middle, left_offset, s, max_width, color, found_line, max_len);
+
+    // Highlighted matches aren't part of the cache key, and rows with them
+    // are few, so they're formatted without the cache.
+    if (m_highlights && !m_highlights->empty())
+        return FormatLineDataInternal(line, middle, left_offset, s, max_width, color, found_line, max_len);
+
+    FormattedRowKey key;
+    key.line = line;
+    key.offset = GetOffset(line);
+    key.length = GetLength(line);
+    key.left_offset = left_offset;
+    key.max_width = max_width;
+    key.color = color;
+    key.middle = middle;
+    if (found_line && key.offset <= found_line->offset && found_line->offset < key.offset + key.length)
+    {
+        key.found_offset = found_line->offset;
+        key.found_len = found_line->len;
+    }
+
+    unsigned cells;
+    if (m_row_cache.Lookup(key, s, cells))
+        return cells;
+
+    const unsigned begin = s.Length();
+    cells = FormatLineDataInternal(line, middle, left_offset, s, max_width, color, found_line, max_len);
+    m_row_cache.Store(key, s.Text() + begin, s.Length() - begin, cells);
+    return cells;
+}
+
+unsigned ContentCache::FormatLineDataInternal(const size_t line, bool middle, unsigned left_offset, StrW& s, const unsigned max_width, const WCHAR* const color, const FoundOffset* const found_line, unsigned max_len)
+{
+    assert(line < Count());
     assert(!found_line || !found_line->Empty());
     const FileOffset offset = GetOffset(line);
 
@@ -1452,8 +3301,19 @@ unsigned ContentCache::FormatLineData(const size_t line, bool middle, unsigned l
     const unsigned len = min(max_len, GetLength(line));
     assert(ptr + len <= m_data + m_data_length);
 
-    StrW tmp;
-    m_map.GetLineText(ptr, len, tmp);
+    // Horizontal scrolling and found text highlighting format the same
+    // bytes differently, but they still decode the same way.
+    StrWScratch tmp;
+    FormattedRowKey text_key;
+    text_key.offset = offset;
+    text_key.length = len;
+    text_key.decoded = true;
+    unsigned unused;
+    if (!m_row_cache.Lookup(text_key, tmp, unused))
+    {
+        m_map.GetLineText(ptr, len, tmp);
+        m_row_cache.Store(text_key, tmp.Text(), tmp.Length(), 0);
+    }
 
     unsigned visible_len = 0;
     unsigned total_cells = 0;
@@ -1461,7 +3321,9 @@ unsigned ContentCache::FormatLineData(const size_t line, bool middle, unsigned l
     int32 truncate_len = -1;
 
     bool need_found_highlight = false;
-    bool highlighting_found_text = false;
+    bool need_match_highlight = false;
+    const WCHAR* highlighting = nullptr;
+    size_t next_highlight = 0;
 
     s.AppendColor(color ? color : norm);
 
@@ -1483,6 +3345,13 @@ unsigned ContentCache::FormatLineData(const size_t line, bool middle, unsigned l
             need_found_highlight = true;
         if (need_found_highlight && text >= tmp.Text() + found_line->offset + found_line->len - offset)
             need_found_highlight = false;
+        if (m_highlights && text >= tmp.Text() && text < tmp.Text() + tmp.Length())
+        {
+            const FileOffset here = offset + (text - tmp.Text());
+            while (next_highlight < m_highlights->size() && here >= (*m_highlights)[next_highlight].offset + (*m_highlights)[next_highlight].len)
+                ++next_highlight;
+            need_match_highlight = (next_highlight < m_highlights->size() && here >= (*m_highlights)[next_highlight].offset);
+        }
 
         if (visible_len >= left_offset)
         {
@@ -1491,15 +3360,13 @@ unsigned ContentCache::FormatLineData(const size_t line, bool middle, unsigned l
                 left_offset = 0;
                 visible_len = 0;
             }
-            if (need_found_highlight && !highlighting_found_text)
-            {
-                s.AppendColor(GetColor(ColorElement::SearchFound));
-                highlighting_found_text = true;
-            }
-            else if (highlighting_found_text && !need_found_highlight)
+            const WCHAR* const want = (need_found_highlight ? GetColor(ColorElement::SearchFound) :
+                                       need_match_highlight ? GetColor(ColorElement::SearchMatch) :
+                                       nullptr);
+            if (want != highlighting)
             {
-                s.AppendColor(color ? color : norm);
-                highlighting_found_text = false;
+                s.AppendColor(want ? want : (color ? color : norm));
+                highlighting = want;
             }
             s.Append(text, text_len);
         }
@@ -1510,6 +3377,34 @@ unsigned ContentCache::FormatLineData(const size_t line, bool middle, unsigned l
     const WCHAR* const end = tmp.Text() + tmp.Length();
     const WCHAR* walk = tmp.Text();
     const WCHAR* const maybe_bom = (offset == 0 && !m_map.IsBinaryFile() && m_map.IsUnicodeEncoding()) ? walk : nullptr;
+
+    // When scrolled to the right, start from the last recorded checkpoint
+    // that's still left of left_offset, and record more checkpoints along
+    // the way.  The cell counts only match up once left_offset is past the
+    // leading indent.
+    std::vector<ColumnCheckpoint>* const checkpoints = (left_offset && left_offset >= fmt.m_leading_indent) ? m_row_cache.GetCheckpoints(text_key) : nullptr;
+    unsigned next_checkpoint = c_checkpoint_cells;
+    if (checkpoints && !checkpoints->empty())
+    {
+        next_checkpoint = checkpoints->back().visible_len + c_checkpoint_cells;
+
+        auto cp = std::upper_bound(checkpoints->begin(), checkpoints->end(), left_offset, [](unsigned value, const ColumnCheckpoint& c) {
+            return value < c.visible_len;
+        });
+        if (cp != checkpoints->begin())
+        {
+            --cp;
+            walk = tmp.Text() + cp->index;
+            visible_len = cp->visible_len;
+            total_cells = cp->total_cells;
+            if (found_line && offset <= found_line->offset && found_line->offset < offset + len)
+            {
+                const FileOffset found_index = found_line->offset - offset;
+                need_found_highlight = (found_index < cp->index && cp->index < found_index + found_line->len);
+            }
+        }
+    }
+
     while (walk < end)
     {
         if (!*walk)
@@ -1527,6 +3422,12 @@ unsigned ContentCache::FormatLineData(const size_t line, bool middle, unsigned l
                 if (!left_offset && visible_len >= max_width)
                     goto LOut;
 
+                if (checkpoints && left_offset && visible_len >= next_checkpoint)
+                {
+                    checkpoints->push_back({ unsigned(inner_iter.character_pointer() - tmp.Text()), visible_len, total_cells });
+                    next_checkpoint = visible_len + c_checkpoint_cells;
+                }
+
                 if (c == '\r' && !m_options.show_line_endings && !m_map.IsBinaryFile() && inner_iter.more() && *inner_iter.get_pointer() == '\n')
                 {
                     // Omit trailing \r\n at end of line in a text file.
@@ -1685,7 +3586,7 @@ LOut:
         append_text(c_eol_marker, -1);
         s.AppendColor(color ? color : norm);
     }
-    else if (highlighting_found_text)
+    else if (highlighting)
     {
         s.AppendColor(color ? color : norm);
     }
@@ -1701,13 +3602,16 @@ LOut:
 
 bool ContentCache::FormatHexData(FileOffset offset, bool middle, unsigned row, unsigned hex_bytes, StrW& s, Error& e, const WCHAR* marked_color, const FoundOffset* found_line)
 {
+    PerfScope perf(PerfTimer::FormatLine);
+    PerfAdd(PerfCount::RowsFormatted, 1);
+
     offset += row * hex_bytes;
 
     if (!EnsureHexData(offset, hex_bytes, e))
         return false;
 
-    StrW _norm;
-    StrW _hilite;
+    StrWInline<64> _norm;
+    StrWInline<64> _hilite;
     _norm.Set(GetColor(ColorElement::Content));
     _hilite.Set(_norm);
     if (offset % 0x400 == 0)
@@ -1730,8 +3634,8 @@ bool ContentCache::FormatHexData(FileOffset offset, bool middle, unsigned row, u
     }
     assert(ptr + len <= m_data + m_data_length);
 
-    StrW tmp;
-    StrW tmp2;
+    StrWInline<128> tmp;
+    StrWInline<32> tmp2;
     m_map.GetLineText(ptr, len, tmp, true/*hex_mode*/);
     assert(tmp.Length() == len);
     if (tmp.Length() != len)
@@ -1749,6 +3653,14 @@ bool ContentCache::FormatHexData(FileOffset offset, bool middle, unsigned row, u
         }
     }
 
+    // Overlay the edits for the whole row at once, and then format all of
+    // the hex digits at once.
+    m_hex_values.assign(ptr, ptr + len);
+    m_hex_colors.resize(len);
+    const bool any_dirty = GetDirtyBytes(offset, len, m_hex_values.data(), m_hex_colors.data());
+    m_hex_digits.resize(len * 2);
+    FormatHexDigits(m_hex_values.data(), len, m_hex_digits.data());
+
     bool highlighting_found_text = false;
 
 #ifdef DEBUG
@@ -1775,11 +3687,15 @@ bool ContentCache::FormatHexData(FileOffset offset, bool middle, unsigned row, u
     // Format line number.
     if (m_options.show_line_numbers)
     {
-        const size_t prev_line = (offset < hex_bytes) ? 0 : m_map.FirstLineNumberInHexRow(offset - hex_bytes, hex_bytes);
-        const size_t this_line = m_map.FirstLineNumberInHexRow(offset, hex_bytes);
+        // Line numbers are only known where the line map has been processed.
         tmp2.Clear();
-        if (prev_line < this_line)
-            tmp2.Printf(L"%zu%s", this_line, c_div_char);
+        if (m_completed || offset + hex_bytes <= m_map.Processed())
+        {
+            const size_t prev_line = (offset < hex_bytes) ? 0 : m_map.FirstLineNumberInHexRow(offset - hex_bytes, hex_bytes);
+            const size_t this_line = m_map.FirstLineNumberInHexRow(offset, hex_bytes);
+            if (prev_line < this_line)
+                tmp2.Printf(L"%zu%s", this_line, c_div_char);
+        }
         s.AppendColorOverlay(norm, GetColor(ColorElement::LineNumber));
         s.Printf(L"%*s", m_line_count_width + 1, tmp2.Text());
         s.AppendColor(norm);
@@ -1813,13 +3729,11 @@ bool ContentCache::FormatHexData(FileOffset offset, bool middle, unsigned row, u
         }
         if (ii < len)
         {
-            BYTE value = ptr[ii];
             bool colored = false;
-            ColorElement byte_color;
-            if (IsByteDirty(offset + ii, value, byte_color))
+            if (any_dirty && m_hex_colors[ii] != ColorElement::Content)
             {
                 colored = true;
-                s.AppendColorOverlay(norm, GetColor(byte_color));
+                s.AppendColorOverlay(norm, GetColor(m_hex_colors[ii]));
             }
             else
             {
@@ -1827,7 +3741,7 @@ bool ContentCache::FormatHexData(FileOffset offset, bool middle, unsigned row, u
                 if (colored)
                     s.AppendColorOverlay(norm, GetColor(ColorElement::CtrlCode));
             }
-            s.Printf(L"%02X", value);
+            s.Append(m_hex_digits.data() + ii * 2, 2);
             if (colored)
             {
                 if (highlighting_found_text)
@@ -1847,7 +3761,7 @@ bool ContentCache::FormatHexData(FileOffset offset, bool middle, unsigned row, u
         s.AppendColor(norm);
 
     // Format the text characters.
-    StrW old_color;
+    StrWInline<64> old_color;
     s.Printf(L"  ", 2);
     s.AppendColorOverlay(norm, GetColor(ColorElement::Divider));
     // s.Append(L"\u2502", 1);
@@ -1857,15 +3771,14 @@ bool ContentCache::FormatHexData(FileOffset offset, bool middle, unsigned row, u
     highlighting_found_text = false;
     for (unsigned ii = 0; ii < len; ++ii)
     {
-        BYTE c = ptr[ii];
+        const BYTE c = m_hex_values[ii];
         bool edited = false;
-        ColorElement byte_color;
         const WCHAR* new_color = marked_color ? marked_color : norm;
 
-        if (IsByteDirty(offset + ii, c, byte_color))
+        if (any_dirty && m_hex_colors[ii] != ColorElement::Content)
         {
             edited = true;
-            new_color = MakeOverlayColor(norm, GetColor(byte_color));
+            new_color = MakeOverlayColor(norm, GetColor(m_hex_colors[ii]));
             if (c)
             {
                 tmp2.SetFromCodepage(m_map.GetCodePage(true), reinterpret_cast<const char*>(&c), 1);
@@ -1901,7 +3814,8 @@ bool ContentCache::FormatHexData(FileOffset offset, bool middle, unsigned row, u
                 s.Append(c_oem437[c], 1);
             }
         }
-        else if (!c || wcwidth(tmp.Text()[ii]) != 1 || (m_options.ascii_filter && c > 0x7f))
+        else if (!c || (m_options.ascii_filter && c > 0x7f) ||
+                 (!(tmp.Text()[ii] >= ' ' && tmp.Text()[ii] < 0x7f) && wcwidth(tmp.Text()[ii]) != 1))
         {
 filter_byte:
             if (!edited && !marked_color)
@@ -1930,56 +3844,37 @@ filter_byte:
 bool ContentCache::ProcessThrough(size_t line, Error& e, bool cancelable)
 {
     assert(!e.Test());
+    assert(!IsBackgroundIndexing());
+
+    if (m_sparse_active && line >= m_sparse_base)
+        return ProcessSparseThrough(line - m_sparse_base, e, cancelable);
 
     bool ret = true;
     if (HasContent())
     {
         while (line >= m_map.Count() && !m_completed)
         {
-            m_line_count_width = 0;
-
-            const FileOffset offset = m_map.Processed();
-            if (!LoadData(offset, m_data_slop, e))
+            bool more;
+            if (!ProcessNextChunk(more, e))
             {
                 m_completed = true;
                 return false;
             }
 
-            const size_t to_process = m_data_offset + m_data_length - offset;
-            if (!to_process)
+            if (!more)
             {
                 ret = false;
                 break;
             }
 
-            const BYTE* data = m_data + (offset - m_data_offset);
-            m_map.Next(data, to_process);
-
-            if (m_size < m_map.Processed())
-                SetSize(m_map.Processed());
-
-            if (cancelable && IsSignaled())
+            if (cancelable && IsCanceled())
             {
                 e.Set(E_ABORT);
                 return false;
             }
         }
 
-        if (m_map.Processed() >= m_size)
-        {
-            m_map.Next(nullptr, 0);
-            m_completed = true;
-#ifdef DEBUG
-            size_t total_bytes = 0;
-            for (size_t i = 0; i < m_map.Count(); ++i)
-            {
-                const size_t len = GetLength(i);
-                total_bytes += len;
-            }
-            assert(m_map.Processed() == m_size);
-            assert(total_bytes == m_size);
-#endif
-        }
+        CompleteIfProcessed();
     }
     else
     {
@@ -1989,43 +3884,1191 @@ bool ContentCache::ProcessThrough(size_t line, Error& e, bool cancelable)
     return ret;
 }
 
-bool ContentCache::ProcessToEnd(Error& e, bool cancelable)
+void ContentCache::CompleteIfProcessed()
 {
-    assert(!e.Test());
-    if (!m_completed)
+    // A pipe that's still arriving may yet continue its last line.
+    if (!m_completed && !m_pipe_reader && m_map.Processed() >= m_size)
     {
-        ProcessThrough(size_t(-1), e, cancelable);
-        if (e.Code() == ERROR_HANDLE_EOF)
-            e.Clear();
+        m_map.Next(nullptr, 0);
+        m_completed = true;
+#ifdef DEBUG
+        size_t total_bytes = 0;
+        for (size_t i = 0; i < m_map.Count(); ++i)
+        {
+            const size_t len = GetLength(i);
+            total_bytes += len;
+        }
+        assert(m_map.Processed() == m_size);
+        assert(total_bytes == m_size);
+#endif
     }
-    return !e.Test();
 }
 
-FileOffset ContentCache::GetMaxHexOffset(unsigned hex_width) const
+bool ContentCache::ProcessNextChunk(bool& more, Error& e, bool sparse)
 {
-    const FileOffset partial = (GetFileSize() % hex_width);
-    return GetFileSize() + (partial ? hex_width - partial : 0);
+    m_line_count_width = 0;
+
+    FileLineMap& map = sparse ? m_sparse : m_map;
+    const FileOffset offset = map.Processed();
+    if (!LoadData(offset, m_data_slop, e))
+        return false;
+
+    const size_t to_process = m_data_offset + m_data_length - offset;
+    more = !!to_process;
+    if (more)
+    {
+        const BYTE* data = m_data + (offset - m_data_offset);
+        map.Next(data, to_process);
+
+        if (m_size < map.Processed())
+            SetSize(map.Processed());
+
+        if (!sparse && m_stale.Count())
+            AdoptStaleRows();
+    }
+
+    // The first chunk determines the encoding, so the cached index can't be
+    // validated until after processing it.
+    if (!sparse && !m_index_cache.empty())
+        ApplyIndexCache();
+
+    if (!sparse && m_sparse_active)
+        MergeSparse();
+
+    if (m_progress && !sparse)
+        m_progress->Publish(m_map.Processed(), m_map.Count());
+    UpdateMemoryCharges();
+    return true;
+}
+
+bool ContentCache::IsCanceled() const
+{
+    return IsSignaled() || (m_progress && m_progress->IsCanceled());
+}
+
+bool ContentCache::StartBackgroundIndexing()
+{
+    assert(!IsBackgroundIndexing());
+
+    if (m_completed || !HasContent() || m_map.Processed() >= m_size)
+        return false;
+
+    m_bg_progress.Reset();
+    m_bg_progress.Publish(m_map.Processed(), m_map.Count());
+    m_bg_thread = CreateThread(nullptr, 0, BackgroundIndexingProc, this, 0, nullptr);
+    return IsBackgroundIndexing();
+}
+
+void ContentCache::StopBackgroundIndexing()
+{
+    if (IsBackgroundIndexing())
+    {
+        // The worker checks for cancellation between chunks, so this waits
+        // at most for one chunk to be processed.
+        m_bg_progress.Cancel();
+        WaitForSingleObject(m_bg_thread, INFINITE);
+        m_bg_thread.Close();
+    }
+}
+
+DWORD WINAPI ContentCache::BackgroundIndexingProc(void* param)
+{
+    ContentCache* const cache = static_cast<ContentCache*>(param);
+
+    // No bulk reads here:  the viewer stops the worker on every input and
+    // every refresh, so a chunk must stay small enough not to delay that,
+    // and ending a bulk scope would free the buffer and the read-ahead each
+    // time.  The read-ahead still overlaps I/O with processing.
+    // Stop short of the end; the UI thread finishes the map in ProcessThrough
+    // (which also reports any errors).  An error here just stops the worker,
+    // and the UI thread will encounter it again when it gets that far.
+    ProgressChannel& progress = cache->m_bg_progress;
+    while (!progress.IsCanceled() && !cache->m_completed && cache->m_map.Processed() < cache->m_size)
+    {
+        Error e;
+        bool more;
+        if (!cache->ProcessNextChunk(more, e) || !more)
+            break;
+        progress.Publish(cache->m_map.Processed(), cache->m_map.Count());
+    }
+
+    return 0;
+}
+
+struct ParallelIndexRange
+{
+                    ParallelIndexRange(const ViewerOptions& options) : map(options) {}
+    FileLineMap     map;
+    const BYTE*     bytes = nullptr;    // The whole file.
+    FileOffset      size = 0;
+    FileOffset      end = 0;            // Process at least through here.
+    const std::atomic<bool>* stop = nullptr;
+    bool            faulted = false;    // The mapped file shrank (or failed to page in).
+    SHBasic         thread;
+};
+
+// Reading a mapped view raises EXCEPTION_IN_PAGE_ERROR if the file shrinks
+// underneath it or paging in fails.  The reads that don't go through
+// LoadMappedData()'s size check are guarded with this filter.  The guarded
+// functions can't have objects that need unwinding.
+static int InPageErrorFilter(DWORD code)
+{
+    return (code == EXCEPTION_IN_PAGE_ERROR) ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH;
+}
+
+static void IndexRange(ParallelIndexRange* range)
+{
+    // Feed the data in the same size pieces as ProcessThrough() does.
+    while (!*range->stop && range->map.Processed() < range->end)
+    {
+        const FileOffset offset = range->map.Processed();
+        const size_t available = size_t(std::min<FileOffset>(c_data_buffer_main + c_data_buffer_slop, range->size - offset));
+        if (!available)
+            break;
+        range->map.Next(range->bytes + offset, available);
+        if (range->map.Processed() <= offset)
+            break;
+    }
+}
+
+static DWORD WINAPI ParallelIndexProc(void* param)
+{
+    ParallelIndexRange* const range = static_cast<ParallelIndexRange*>(param);
+
+    __try
+    {
+        IndexRange(range);
+    }
+    __except (InPageErrorFilter(GetExceptionCode()))
+    {
+        range->faulted = true;
+    }
+
+    return 0;
+}
+
+static bool FindSeamGuarded(const BYTE* bytes, FileOffset size, uint32 char_size, unsigned lo_byte, FileOffset& seam)
+{
+    __try
+    {
+        if (char_size == 1)
+        {
+            const BYTE* const nl = static_cast<const BYTE*>(memchr(bytes + seam, '\n', size_t(size - seam)));
+            seam = nl ? FileOffset(nl - bytes) + 1 : size;
+        }
+        else
+        {
+            while (seam + 2 <= size &&
+                   !(bytes[seam + lo_byte] == '\n' && bytes[seam + 1 - lo_byte] == 0))
+                seam += 2;
+            seam += 2;
+        }
+        return true;
+    }
+    __except (InPageErrorFilter(GetExceptionCode()))
+    {
+        return false;
+    }
+}
+
+static bool ReadByteGuarded(const BYTE* p, BYTE& out)
+{
+    __try
+    {
+        out = *p;
+        return true;
+    }
+    __except (InPageErrorFilter(GetExceptionCode()))
+    {
+        return false;
+    }
+}
+
+// A temporary view of a whole mapped file, for ProcessInParallel().
+struct ScopedMappedView
+{
+    ~ScopedMappedView() { if (p) UnmapViewOfFile(p); }
+    const BYTE* p = nullptr;
+};
+
+bool ContentCache::ProcessInParallel(Error& e, bool cancelable)
+{
+    // When not wrapping, the ranges between newlines can be processed
+    // independently, as long as all of the data is directly addressable.
+    // Split the rest of the file into ranges that begin after a newline,
+    // process them on worker threads, and then stitch them together.  The
+    // stitching verifies that each range's lines line up with the lines that
+    // serial processing would have produced; if a range doesn't line up
+    // (e.g. a BreakMax or skipped whitespace crossed a seam) then serial
+    // processing simply continues until it does.
+    const FileOffset c_min_range = 8 * 1024 * 1024;
+
+    assert(!IsBackgroundIndexing());
+    if (m_map.GetWrapWidth() || !m_map.Processed() || m_completed)
+        return true;
+
+    const FileOffset begin = m_map.Processed();
+    if (begin >= m_size || m_size - begin < c_min_range * 2)
+        return true;
+
+    // A mapped file gets a whole-file view only for the duration of this
+    // pass; reads from it are guarded, in case the file shrinks meanwhile.
+    const BYTE* bytes = nullptr;
+    ScopedMappedView whole;
+    if (m_text)
+    {
+        bytes = reinterpret_cast<const BYTE*>(m_text);
+    }
+    else if (EnsureMapping() && m_mapped_size >= m_size)
+    {
+        LARGE_INTEGER liSize;
+        if (GetFileSizeEx(m_file, &liSize) && FileOffset(liSize.QuadPart) >= m_size && SIZE_T(m_size) == m_size)
+            whole.p = static_cast<const BYTE*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, SIZE_T(m_size)));
+        bytes = whole.p;
+    }
+    if (!bytes)
+        return true;
+
+    const uint32 char_size = m_map.CharSize();
+    const unsigned lo_byte = (m_map.GetCodePage() == 1201) ? 1 : 0;
+    const DWORD num_cpus = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    const FileOffset num_ranges = std::min<FileOffset>(std::max<DWORD>(1, num_cpus), (m_size - begin) / c_min_range);
+    if (num_ranges < 2)
+        return true;
+
+    // Find the seams.  Range 0 is processed by this thread, directly into
+    // m_map.
+    std::vector<FileOffset> seams;
+    for (FileOffset ii = 1; ii < num_ranges; ++ii)
+    {
+        FileOffset seam = begin + ((m_size - begin) / num_ranges) * ii;
+        if (char_size == 2)
+            seam &= ~FileOffset(1);
+        if (!seams.empty() && seam <= seams.back())
+            continue;
+        if (!FindSeamGuarded(bytes, m_size, char_size, lo_byte, seam))
+            return true;
+        if (seam >= m_size || (!seams.empty() && seam <= seams.back()))
+            continue;
+        seams.emplace_back(seam);
+    }
+    if (seams.empty())
+        return true;
+
+    std::atomic<bool> stop = false;
+    std::vector<std::unique_ptr<ParallelIndexRange>> ranges;
+    for (size_t ii = 0; ii < seams.size(); ++ii)
+    {
+        auto range = std::make_unique<ParallelIndexRange>(m_options);
+        range->map.InitForRange(m_map, seams[ii]);
+        range->bytes = bytes;
+        range->size = m_size;
+        range->end = (ii + 1 < seams.size()) ? seams[ii + 1] : m_size;
+        range->stop = &stop;
+        range->thread = CreateThread(nullptr, 0, ParallelIndexProc, range.get(), 0, nullptr);
+        if (range->thread.Empty())
+            break;
+        ranges.emplace_back(std::move(range));
+    }
+
+    auto is_whitespace = [&](FileOffset offset) {
+        BYTE c;
+        return offset < m_size && ReadByteGuarded(bytes + offset, c) && IsWhiteSpace(c);
+    };
+
+    bool ok = true;
+    bool more = true;
+    size_t next = 0;
+    while (more && next < ranges.size())
+    {
+        // Process serially into m_map until reaching the next seam.
+        const FileOffset seam = seams[next];
+        while (m_map.NextLineOffset() < seam)
+        {
+            if (!ProcessNextChunk(more, e))
+            {
+                m_completed = true;
+                ok = false;
+                break;
+            }
+            if (!more)
+                break;
+            if (cancelable && IsCanceled())
+            {
+                e.Set(E_ABORT);
+                ok = false;
+                break;
+            }
+        }
+        if (!ok || !more)
+            break;
+
+        // Adopt the next range, if its lines line up.  Otherwise serial
+        // processing continues into the following range instead.
+        auto& range = ranges[next];
+        WaitForSingleObject(range->thread, INFINITE);
+        range->thread.Close();
+        if (!range->faulted && m_map.AdoptFrom(std::move(range->map), is_whitespace(m_map.NextLineOffset())))
+        {
+            m_line_count_width = 0;
+            if (m_size < m_map.Processed())
+                SetSize(m_map.Processed());
+        }
+        range.reset();
+        ++next;
+    }
+
+    stop = true;
+    for (auto& range : ranges)
+    {
+        if (range && !range->thread.Empty())
+            WaitForSingleObject(range->thread, INFINITE);
+    }
+
+    return ok;
+}
+
+bool ContentCache::ProcessToEnd(Error& e, bool cancelable)
+{
+    assert(!e.Test());
+    BulkReadScope bulk(*this);
+    if (!m_completed)
+    {
+        // Processing everything makes a sparse window pointless, and the
+        // parallel processing is much faster than catching up to it.
+        DiscardSparse();
+        if (!ProcessInParallel(e, cancelable))
+        {
+            if (e.Code() == ERROR_HANDLE_EOF)
+                e.Clear();
+            if (e.Test())
+                return false;
+        }
+        ProcessThrough(size_t(-1), e, cancelable);
+        if (e.Code() == ERROR_HANDLE_EOF)
+            e.Clear();
+    }
+    return !e.Test();
+}
+
+bool ContentCache::CanUseSparse(FileOffset offset) const
+{
+    // The window borrows the encoding from m_map, and begins after a newline
+    // so that its rows line up with m_map's rows later, even when wrapping.
+    // Estimating the window's indices needs the density of rows, either
+    // from m_map or from before the wrap width changed.
+    return (!m_redirected && !m_text && !m_completed &&
+            (m_map.Processed() > 0 || m_rewrap_rows_per_byte > 0 || m_sampled_lines_per_byte > 0) &&
+            offset > m_map.Processed() && offset - m_map.Processed() >= c_sparse_min_distance);
+}
+
+bool ContentCache::FindLineStart(FileOffset& offset, const FileOffset limit, Error& e)
+{
+    // Finds the first line start after a newline in [offset, limit).  Returns
+    // false without setting e if there isn't one.
+    const uint32 char_size = m_map.CharSize();
+    const unsigned lo_byte = (m_map.GetCodePage() == 1201) ? 1 : 0;
+
+    FileOffset pos = offset;
+    if (char_size == 2)
+        pos = (pos + 1) & ~FileOffset(1);
+
+    while (pos < limit)
+    {
+        if (!LoadData(pos, m_data_slop, e))
+            return false;
+        if (pos < m_data_offset || pos >= m_data_offset + m_data_length)
+            return false;
+
+        const BYTE* const bytes = m_data + (pos - m_data_offset);
+        const size_t available = size_t(std::min<FileOffset>(m_data_offset + m_data_length, limit) - pos);
+        if (char_size == 1)
+        {
+            const BYTE* const nl = static_cast<const BYTE*>(memchr(bytes, '\n', available));
+            if (nl)
+            {
+                offset = pos + (nl - bytes) + 1;
+                return true;
+            }
+            pos += available;
+        }
+        else
+        {
+            size_t ii = 0;
+            for (; ii + 2 <= available; ii += 2)
+            {
+                if (bytes[ii + lo_byte] == '\n' && bytes[ii + 1 - lo_byte] == 0)
+                {
+                    offset = pos + ii + 2;
+                    return true;
+                }
+            }
+            if (!ii)
+                break;
+            pos += ii;
+        }
+    }
+
+    return false;
+}
+
+bool ContentCache::StartSparse(FileOffset offset, Error& e)
+{
+    assert(CanUseSparse(offset));
+
+    DiscardSparse();
+
+    // Resync at a line start shortly before the offset, looking further back
+    // if there isn't one nearby.  The newline index may already know where
+    // the line begins (e.g. after the wrap width changed).
+    FileOffset begin = 0;
+    const bool known = (m_map.FindLineStart(offset, begin) && begin > m_map.Processed() &&
+                        offset - begin <= c_sparse_max_resync);
+    for (FileOffset back = c_sparse_window; !known; back *= 2)
+    {
+        if (back > c_sparse_max_resync || offset - m_map.Processed() <= back)
+            return false;
+
+        begin = offset - back;
+        if (FindLineStart(begin, offset, e) && begin < m_size)
+            break;
+        if (e.Test())
+            return false;
+    }
+
+    // Estimate the index and line number of the first row from the density
+    // of the rows.
+    double rows_per_byte;
+    double lines_per_byte;
+    GetDensity(rows_per_byte, lines_per_byte);
+
+    const double gap = double(begin - m_map.Processed());
+    m_sparse.InitForRange(m_map, begin);
+    m_sparse_begin = begin;
+    m_sparse_base = m_map.Count() + size_t(gap * rows_per_byte);
+    m_sparse_line_base = m_map.CountFriendlyLines() + size_t(gap * lines_per_byte);
+    if (m_map.GetWrapWidth() && !m_map.NewlinesBegin() && begin <= m_map.NewlinesEnd())
+    {
+        // Wrapped lines are numbered by newlines, so the newline index knows
+        // the line number exactly.
+        m_sparse_line_base = std::max<size_t>(m_map.CountFriendlyLines(), m_map.CountNewlinesBefore(begin));
+    }
+    m_sparse_active = true;
+    m_sparse_eof = false;
+    m_line_count_width = 0;
+    ++m_generation;
+    return true;
+}
+
+bool ContentCache::ProcessSparseThrough(size_t line, Error& e, bool cancelable)
+{
+    assert(m_sparse_active);
+
+    bool ret = true;
+    while (line >= m_sparse.Count() && !m_sparse_eof)
+    {
+        bool more;
+        if (!ProcessNextChunk(more, e, true/*sparse*/))
+        {
+            if (e.Code() != ERROR_HANDLE_EOF)
+                return false;
+            e.Clear();
+            more = false;
+        }
+
+        if (!more)
+        {
+            ret = false;
+            break;
+        }
+
+        if (cancelable && IsCanceled())
+        {
+            e.Set(E_ABORT);
+            return false;
+        }
+    }
+
+    if (!m_sparse_eof && m_sparse.Processed() >= m_size)
+    {
+        m_sparse.Next(nullptr, 0);
+        m_sparse_eof = true;
+    }
+
+    return ret && line < m_sparse.Count();
+}
+
+bool ContentCache::ExtendSparseBackward(Error& e)
+{
+    assert(m_sparse_active);
+
+    // When the window is close to m_map, just let m_map catch up to it.
+    if (m_sparse_begin - m_map.Processed() <= c_sparse_window * 2)
+        return FoldSparse(e, false);
+
+    FileOffset begin = m_sparse_begin - c_sparse_window;
+    if (!FindLineStart(begin, m_sparse_begin, e))
+        return false;
+
+    // Index the bytes up to the existing window, then append the window.
+    FileLineMap map(m_options);
+    map.InitForRange(m_map, begin);
+    while (map.Processed() < m_sparse_begin)
+    {
+        const FileOffset offset = map.Processed();
+        if (!LoadData(offset, m_data_slop, e))
+            return false;
+        const FileOffset end = std::min<FileOffset>(m_data_offset + m_data_length, m_sparse_begin);
+        if (offset < m_data_offset || end <= offset)
+            return false;
+        map.Next(m_data + (offset - m_data_offset), size_t(end - offset));
+        if (map.Processed() <= offset)
+            return false;
+    }
+
+    const size_t added = map.Count();
+    const size_t added_lines = map.CountFriendlyLines();
+    if (!map.AdoptFrom(std::move(m_sparse), false/*next_is_whitespace*/))
+        return false;
+
+    m_sparse = std::move(map);
+    m_sparse_begin = begin;
+    m_sparse_base = (m_sparse_base - m_map.Count() > added) ? m_sparse_base - added : m_map.Count();
+    m_sparse_line_base = (m_sparse_line_base - m_map.CountFriendlyLines() > added_lines) ? m_sparse_line_base - added_lines : m_map.CountFriendlyLines();
+    m_line_count_width = 0;
+    ++m_generation;
+    return true;
+}
+
+bool ContentCache::FoldSparse(Error& e, bool cancelable)
+{
+    // Process m_map until it reaches the window and adopts it.
+    while (m_sparse_active)
+    {
+        bool more;
+        if (!ProcessNextChunk(more, e))
+        {
+            m_completed = true;
+            return false;
+        }
+
+        if (!more)
+        {
+            DiscardSparse();
+            break;
+        }
+
+        if (cancelable && IsCanceled())
+        {
+            e.Set(E_ABORT);
+            return false;
+        }
+    }
+
+    CompleteIfProcessed();
+    return true;
+}
+
+void ContentCache::MergeSparse()
+{
+    assert(m_sparse_active);
+
+    if (m_map.NextLineOffset() < m_sparse_begin)
+    {
+        // Keep the estimated indices past the rows m_map has produced.
+        if (m_map.Count() > m_sparse_base)
+        {
+            m_sparse_base = m_map.Count();
+            ++m_generation;
+        }
+        m_sparse_line_base = std::max<size_t>(m_sparse_line_base, m_map.CountFriendlyLines());
+        return;
+    }
+
+    // The window begins after a newline, where whitespace is never skipped,
+    // so there is no need to check whether the next line begins with
+    // whitespace.  If m_map doesn't line up with the window then it has
+    // passed it, and simply keeps going.
+    m_map.AdoptFrom(std::move(m_sparse), false/*next_is_whitespace*/);
+    if (m_size < m_map.Processed())
+        SetSize(m_map.Processed());
+
+    m_sparse.Reset();
+    m_sparse_active = false;
+    m_sparse_eof = false;
+    m_line_count_width = 0;
+    ++m_generation;
+}
+
+void ContentCache::DiscardSparse()
+{
+    if (m_sparse_active)
+    {
+        m_sparse.Reset();
+        m_sparse_active = false;
+        m_sparse_eof = false;
+        m_line_count_width = 0;
+        ++m_generation;
+    }
+}
+
+size_t ContentCache::SeekOffset(FileOffset offset, Error& e, bool cancelable)
+{
+    assert(!e.Test());
+    assert(!IsBackgroundIndexing());
+
+    m_rewrap_pending = false;
+
+    if (HasContent() && !m_completed)
+    {
+        if (m_sparse_active && offset >= m_sparse_begin &&
+            offset - m_sparse_begin < c_sparse_min_distance + (m_sparse.Processed() - m_sparse_begin))
+        {
+            // Extend the existing window.
+            while (!m_sparse_eof && m_sparse.NextLineOffset() <= offset)
+            {
+                if (!ProcessSparseThrough(m_sparse.Count(), e))
+                    break;
+            }
+        }
+        else if (offset >= m_map.Processed() && CanUseSparse(offset) && StartSparse(offset, e))
+        {
+            while (!m_sparse_eof && m_sparse.NextLineOffset() <= offset)
+            {
+                if (!ProcessSparseThrough(m_sparse.Count(), e))
+                    break;
+            }
+        }
+        else if (!e.Test() && offset >= m_size)
+        {
+            ProcessToEnd(e, cancelable);
+        }
+        else if (!e.Test())
+        {
+            while (!m_completed && m_map.NextLineOffset() <= offset)
+            {
+                bool more;
+                if (!ProcessNextChunk(more, e))
+                {
+                    m_completed = true;
+                    break;
+                }
+                if (!more)
+                    break;
+                if (cancelable && IsCanceled())
+                {
+                    e.Set(E_ABORT);
+                    break;
+                }
+            }
+            CompleteIfProcessed();
+        }
+
+        if (e.Code() == ERROR_HANDLE_EOF)
+            e.Clear();
+    }
+
+    const size_t index = OffsetToIndex(offset);
+    SetSyncAnchor(index);
+    return index;
+}
+
+bool ContentCache::NewlineNumberToOffset(size_t line, FileOffset& offset) const
+{
+    // Finds where a line begins without processing the rows before it, if
+    // the newline index reaches it.  Only wrapped text numbers lines by
+    // newlines; otherwise rows split at max_line_length count as lines too.
+    if (!m_map.GetWrapWidth() || IsBinaryFile())
+        return false;
+    return m_map.NewlineNumberToOffset(line, offset) && offset < m_size;
+}
+
+size_t ContentCache::SyncIndex(size_t index, Error& e)
+{
+    assert(!IsBackgroundIndexing());
+
+    // After the wrap width changes, only process near the row that was at
+    // the top, and let the rest of the file be processed later.
+    if (m_rewrap_pending)
+        return SeekOffset(m_sync_offset, e);
+
+    if (m_sync_generation != m_generation)
+        index = RemapIndex(index);
+
+    // The rows between m_map and the window don't exist yet.  Extend the
+    // window backward to reach nearby rows, or start a new window at an
+    // estimated offset to reach distant rows.
+    while (m_sparse_active && index >= m_map.Count() && index < m_sparse_base)
+    {
+        m_sync_index = m_sparse_base;
+        m_sync_offset = m_sparse_begin;
+        m_sync_generation = m_generation;
+
+        const size_t rows_back = m_sparse_base - index;
+        const size_t gap_rows = m_sparse_base - m_map.Count();
+        const FileOffset gap_bytes = m_sparse_begin - m_map.Processed();
+        const FileOffset bytes_back = FileOffset(double(gap_bytes) * rows_back / gap_rows);
+        if (bytes_back > c_sparse_min_distance)
+            return SeekOffset(m_sparse_begin - bytes_back, e);
+
+        if (!ExtendSparseBackward(e))
+        {
+            index = m_sparse_active ? m_sparse_base : RemapIndex(index);
+            break;
+        }
+        index = RemapIndex(index);
+    }
+
+    SetSyncAnchor(index);
+    return index;
+}
+
+void ContentCache::SetSyncAnchor(size_t index)
+{
+    // Remember a row that exists, so that its offset can find it again after
+    // the indices shift.
+    const size_t count = Count();
+    if (index >= count)
+        index = count ? count - 1 : 0;
+    if (m_sparse_active && index >= m_map.Count() && index < m_sparse_base)
+        index = m_sparse.Count() ? m_sparse_base : (m_map.Count() ? m_map.Count() - 1 : 0);
+
+    m_sync_index = index;
+    m_sync_offset = count ? GetOffset(index) : 0;
+    m_sync_generation = m_generation;
+}
+
+size_t ContentCache::RemapIndex(size_t index) const
+{
+    const size_t anchor = OffsetToIndex(m_sync_offset);
+    if (index >= m_sync_index)
+        return anchor + (index - m_sync_index);
+    const size_t back = m_sync_index - index;
+    return (anchor > back) ? anchor - back : 0;
+}
+
+void ContentCache::DetectFileType()
+{
+    // Detect the file type and encoding from the beginning of the file plus
+    // regions spread across the rest of it, so that a binary looking header
+    // or late non-ASCII text doesn't mislead the detection.  This also keeps
+    // detection independent of the data buffer size.  If reading fails,
+    // FileLineMap::Next() falls back to analyzing the first data it gets.
+    std::vector<BYTE> sample(c_detect_head_size + c_detect_regions * c_detect_region_size);
+
+    Error e;
+    DWORD head_len;
+    if (!ReadAt(0, sample.data(), c_detect_head_size, head_len, e))
+        return;
+
+    size_t len = head_len;
+    if (m_size > FileOffset(c_detect_head_size) + c_detect_region_size)
+    {
+        const FileOffset span = m_size - c_detect_head_size - c_detect_region_size;
+        for (unsigned i = 1; i <= c_detect_regions; ++i)
+        {
+            BYTE* const region = sample.data() + len;
+            DWORD region_len;
+            if (!ReadAt(c_detect_head_size + span * i / c_detect_regions, region, c_detect_region_size, region_len, e))
+                break;
+
+            // Keep only whole lines, so that multibyte characters aren't
+            // severed where the regions are joined.
+            const BYTE* const first = static_cast<const BYTE*>(memchr(region, '\n', region_len));
+            if (!first)
+                continue;
+            DWORD end = region_len;
+            while (end && region[end - 1] != '\n')
+                --end;
+            const DWORD begin = DWORD(first + 1 - region);
+            if (begin >= end)
+                continue;
+            memmove(region, region + begin, end - begin);
+            len += end - begin;
+        }
+    }
+
+    UINT codepage;
+    StrW encoding_name;
+    const FileDataType type = AnalyzeFileSamples(sample.data(), len, head_len, &codepage, &encoding_name);
+    m_map.SetFileType(type, codepage, encoding_name.Text());
+}
+
+void ContentCache::LoadIndexCache()
+{
+    assert(IsOpen());
+
+    if (!GetIndexCacheFileName(m_name.Text(), m_index_cache_name))
+    {
+        m_index_cache_name.Clear();
+        return;
+    }
+
+    IndexCacheKey key;
+    std::vector<BYTE> data;
+    if (!key.Read(m_file) || !ReadIndexCacheFile(m_index_cache_name.Text(), data) || data.size() < sizeof(IndexCacheHeader))
+        return;
+
+    IndexCacheHeader hdr;
+    memcpy(&hdr, data.data(), sizeof(hdr));
+    if (hdr.magic != c_index_cache_magic || hdr.version != c_index_cache_version)
+        return;
+
+    // A different file at the same path can't use the cached index, and
+    // neither can a file that shrank or was rewritten in place.  A file that
+    // grew may have been appended to; ApplyIndexCache() verifies that.
+    if (!hdr.key.SameFile(key) || key.size < hdr.key.size || hdr.resume_offset > hdr.key.size)
+        return;
+    if (key.size == hdr.key.size && CompareFileTime(&key.last_write, &hdr.key.last_write) != 0)
+        return;
+
+    m_index_cache = std::move(data);
+}
+
+void ContentCache::ApplyIndexCache()
+{
+    assert(m_index_cache.size() >= sizeof(IndexCacheHeader));
+
+    IndexCacheHeader hdr;
+    memcpy(&hdr, m_index_cache.data(), sizeof(hdr));
+
+    // Keep the cached index around if the settings don't match; they may
+    // match again later (e.g. after toggling wrapping off and on), and the
+    // map starts over from the beginning whenever they change.
+    IndexCacheHeader current;
+    GetIndexCacheSettings(current, m_map, m_options);
+    if (!SameIndexCacheSettings(hdr, current) || m_map.Processed() >= hdr.resume_offset)
+        return;
+
+    Error e;
+    const FileOffset tail_begin = hdr.resume_offset - hdr.tail_length;
+    bool ok = (LoadData(hdr.resume_offset, m_data_slop, e) &&
+               tail_begin >= m_data_offset &&
+               hdr.resume_offset <= m_data_offset + m_data_length &&
+               HashIndexCacheBytes(m_data + (tail_begin - m_data_offset), hdr.tail_length) == hdr.tail_hash);
+
+    if (ok)
+    {
+        const BYTE* const begin = m_index_cache.data() + sizeof(hdr);
+        const BYTE* const end = m_index_cache.data() + m_index_cache.size();
+        ok = m_map.ResumeFromIndex(begin, end, hdr.resume_offset);
+    }
+
+    if (ok)
+    {
+        m_index_cache_resumed = hdr.resume_offset;
+        m_line_count_width = 0;
+    }
+    else
+    {
+        // The file was modified, so the cache file is useless.
+        DeleteIndexCacheFile(m_index_cache_name.Text());
+    }
+
+    std::vector<BYTE>().swap(m_index_cache);
+}
+
+bool ContentCache::FindResumeRow(size_t& rows, FileOffset& resume_offset)
+{
+    // Processing can only resume with a fresh line iterator at the start of
+    // a row that follows a newline, so find the last such row.
+    Error e;
+    const uint32 char_size = m_map.CharSize();
+    const unsigned lo_byte = (m_map.GetCodePage() == 1201) ? 1 : 0;
+    rows = m_map.Count();
+    for (size_t tries = 0; rows > 1 && tries < c_index_cache_max_backtrack; ++tries)
+    {
+        --rows;
+        const FileOffset offset = m_map.GetOffset(rows);
+        if (!LoadData(offset, m_data_slop, e))
+            return false;
+        if (offset < m_data_offset + char_size || offset > m_data_offset + m_data_length)
+            return false;
+
+        const BYTE* const prev = m_data + (offset - char_size - m_data_offset);
+        if ((char_size == 1) ? (prev[0] == '\n') : (prev[lo_byte] == '\n' && prev[1 - lo_byte] == 0))
+        {
+            resume_offset = offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ContentCache::SaveIndexCache()
+{
+    if (m_index_cache_name.Empty() || !IsOpen() || IsDirty() || IsSaved())
+        return;
+    if (m_map.IsBinaryFile() || m_map.Processed() < c_index_cache_min_size || m_map.Processed() <= m_index_cache_resumed)
+        return;
+
+    size_t rows;
+    FileOffset resume_offset;
+    if (!FindResumeRow(rows, resume_offset))
+        return;
+
+    IndexCacheHeader hdr = {};
+    hdr.magic = c_index_cache_magic;
+    hdr.version = c_index_cache_version;
+    if (!hdr.key.Read(m_file))
+        return;
+    GetIndexCacheSettings(hdr, m_map, m_options);
+    hdr.tail_length = uint32(min<FileOffset>(resume_offset, c_data_buffer_slop));
+    hdr.resume_offset = resume_offset;
+
+    // The data was loaded around resume_offset above.
+    const FileOffset tail_begin = resume_offset - hdr.tail_length;
+    if (tail_begin < m_data_offset)
+        return;
+    hdr.tail_hash = HashIndexCacheBytes(m_data + (tail_begin - m_data_offset), hdr.tail_length);
+
+    // The map is about to be cleared anyway.
+    m_map.Truncate(rows);
+
+    std::vector<BYTE> data;
+    const BYTE* const p = reinterpret_cast<const BYTE*>(&hdr);
+    data.insert(data.end(), p, p + sizeof(hdr));
+    m_map.SerializeIndex(data);
+
+    WriteIndexCacheFile(m_index_cache_name.Text(), data);
+}
+
+FileOffset ContentCache::GetMaxHexOffset(unsigned hex_width) const
+{
+    const FileOffset partial = (GetFileSize() % hex_width);
+    return GetFileSize() + (partial ? hex_width - partial : 0);
+}
+
+unsigned ContentCache::GetLength(size_t line) const
+{
+    assert(line < Count());
+    if (line < Count())
+    {
+        const bool in_sparse = (m_sparse_active && line >= m_sparse_base);
+        const FileLineMap& map = in_sparse ? m_sparse : m_map;
+        if (!in_sparse && line >= m_map.Count())
+            return 0;
+        if (in_sparse)
+            line -= m_sparse_base;
+
+        // IMPORTANT:  Must have processed through the _next_ line as well to
+        // get an accurate length!
+        assert(map.Processed() == m_size || line + 1 < map.Count());
+        const FileOffset offset = map.GetOffset(line);
+        const FileOffset next = (line + 1 < map.Count()) ? map.GetOffset(line + 1) : map.Processed();
+        assert(next - offset <= 1024);
+        return unsigned(next - offset);
+    }
+    return 0;
+}
+
+bool ContentCache::GetLineText(size_t index, StrW& out, Error& e)
+{
+    out.Clear();
+    if (!EnsureFileData(index, e))
+        return false;
+
+    const FileOffset offset = GetOffset(index);
+    const BYTE* ptr = m_data + (offset - m_data_offset);
+    m_map.GetLineText(ptr, GetLength(index), out);
+    TrimLineEnding(out);
+    return true;
+}
+
+bool ContentCache::GetLineExtent(FileOffset offset, FileOffset& begin, FileOffset& end, Error& e)
+{
+    size_t index = SeekOffset(offset, e, true/*cancelable*/);
+    if (e.Test() || index >= Count())
+        return false;
+
+    // Rows of the same line share its line number.
+    const size_t line = GetLineNunber(index);
+    while (index > 0 && GetLineNunber(index - 1) == line)
+        --index;
+    begin = GetOffset(index);
+
+    while (true)
+    {
+        ProcessThrough(index + 1, e, true/*cancelable*/);
+        if (e.Test())
+            return false;
+        if (index + 1 >= Count())
+        {
+            end = m_size;
+            break;
+        }
+        ++index;
+        if (GetLineNunber(index) != line)
+        {
+            end = GetOffset(index);
+            break;
+        }
+    }
+    return true;
+}
+
+// Exports read and write this much at a time.
+static const DWORD c_export_block = 4 * 1024 * 1024;
+
+struct ExportBuffer
+{
+    ~ExportBuffer() { if (p) VirtualFree(p, 0, MEM_RELEASE); }
+    BYTE* p = nullptr;
+};
+
+// Writes bytes from a mapped view; see InPageErrorFilter().
+static bool WriteMappedGuarded(Exporter& out, const BYTE* p, DWORD len, Error& e)
+{
+    __try
+    {
+        return out.Write(p, len, e);
+    }
+    __except (InPageErrorFilter(GetExceptionCode()))
+    {
+        e.Sys(ERROR_FILE_INVALID);
+        return false;
+    }
+}
+
+bool ContentCache::ExportBytes(FileOffset begin, FileOffset end, Exporter& out, Error& e)
+{
+    assert(!IsBackgroundIndexing());
+    assert(begin <= end);
+
+    end = std::min(end, m_size);
+
+    // Only used when reading with ReadFile (e.g. network or compressed
+    // files); page aligned, so the reads can be too.
+    ExportBuffer buffer;
+
+    FileOffset pos = begin;
+    while (pos < end)
+    {
+        if (IsCanceled())
+        {
+            e.Set(E_ABORT);
+            return false;
+        }
+
+        const DWORD len = DWORD(std::min<FileOffset>(end - pos, c_export_block));
+        const BYTE* p = nullptr;
+        DWORD got = 0;
+        bool mapped = false;
+        if (m_text)
+        {
+            p = reinterpret_cast<const BYTE*>(m_text) + pos;
+            got = len;
+        }
+        else if (m_redirected)
+        {
+            // Write each chunk where it is.
+            const size_t index = size_t(pos / s_page_size);
+            const DWORD ofs = DWORD(pos % s_page_size);
+            if (index >= m_chunks.size())
+                break;
+            if (!EnsurePipeChunk(index, e))
+                return false;
+            const PipeChunk& chunk = m_chunks[index];
+            if (chunk.Used() <= ofs)
+                break;
+            p = chunk.Bytes() + ofs;
+            got = std::min<DWORD>(len, chunk.Used() - ofs);
+        }
+        else
+        {
+            if (EnsureMapping())
+            {
+                if (!LoadMappedData(pos, pos + len, len))
+                    UnmapFile();
+                else if (m_view && pos >= m_view_offset && pos + len <= m_view_offset + m_view_length)
+                {
+                    p = m_view + (pos - m_view_offset);
+                    got = len;
+                    mapped = true;
+                }
+            }
+            if (!p)
+            {
+                if (!buffer.p)
+                {
+                    buffer.p = static_cast<BYTE*>(VirtualAlloc(nullptr, c_export_block, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE));
+                    if (!buffer.p)
+                    {
+                        e.Sys();
+                        return false;
+                    }
+                }
+                if (!ReadAt(pos, buffer.p, len, got, e))
+                    return false;
+                p = buffer.p;
+            }
+        }
+
+        // The content can end early (e.g. if the file was truncated).
+        if (!got)
+            break;
+        if (mapped ? !WriteMappedGuarded(out, p, got, e) : !out.Write(p, got, e))
+            return false;
+        pos += got;
+    }
+
+    return true;
+}
+
+size_t ContentCache::Count() const
+{
+    return m_sparse_active ? m_sparse_base + m_sparse.Count() : m_map.Count();
+}
+
+size_t ContentCache::CountFriendlyLines() const
+{
+    return m_sparse_active ? m_sparse_line_base + m_sparse.CountFriendlyLines() : m_map.CountFriendlyLines();
+}
+
+FileOffset ContentCache::GetOffset(size_t index) const
+{
+    if (m_sparse_active && index >= m_map.Count())
+    {
+        // Rows between m_map and the window have not been indexed yet.
+        if (index < m_sparse_base || !m_sparse.Count())
+            return m_sparse_begin;
+        return m_sparse.GetOffset(index - m_sparse_base);
+    }
+    return m_map.GetOffset(index);
+}
+
+size_t ContentCache::GetLineNunber(size_t index) const
+{
+    if (m_sparse_active && index >= m_sparse_base)
+        return m_sparse_line_base + m_sparse.GetLineNumber(index - m_sparse_base);
+    if (m_sparse_active && index >= m_map.Count())
+    {
+        // Interpolate between the end of m_map and the window.
+        const size_t rows = m_sparse_base - m_map.Count();
+        const size_t lines = m_sparse_line_base - m_map.CountFriendlyLines();
+        return m_map.CountFriendlyLines() + 1 + size_t(double(index - m_map.Count()) * lines / rows);
+    }
+    return m_map.GetLineNumber(index);
+}
+
+size_t ContentCache::FriendlyLineNumberToIndex(size_t line) const
+{
+    if (m_sparse_active && line > m_sparse_line_base && line > m_map.CountFriendlyLines())
+        return m_sparse_base + m_sparse.FriendlyLineNumberToIndex(line - m_sparse_line_base);
+    return m_map.FriendlyLineNumberToIndex(line);
 }
 
-unsigned ContentCache::GetLength(size_t line) const
+size_t ContentCache::OffsetToIndex(FileOffset offset) const
 {
-    assert(line < Count());
-    if (line < Count())
-    {
-        // IMPORTANT:  Must have processed through the _next_ line as well to
-        // get an accurate length!
-        assert(m_map.Processed() == m_size || line + 1 < Count());
-        const FileOffset offset = GetOffset(line);
-        const FileOffset next = (line + 1 < Count()) ? GetOffset(line + 1) : m_map.Processed();
-        assert(next - offset <= 1024);
-        return unsigned(next - offset);
-    }
-    return 0;
+    if (m_sparse_active && offset >= m_sparse_begin && m_sparse.Count())
+        return m_sparse_base + m_sparse.OffsetToIndex(offset);
+    return m_map.OffsetToIndex(offset);
 }
 
 bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, unsigned max_width, FoundOffset& found_line, unsigned& left_offset, Error& e, bool first)
 {
-    StrW tmp;
+    PerfScope perf(PerfTimer::Find);
+    BulkReadScope bulk(*this);
     const unsigned needle_delta = searcher->GetNeedleDelta();
 
     if (found_line.Empty())
@@ -2046,23 +5089,86 @@ bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, un
         }
         else
         {
-            const size_t index = m_map.OffsetToIndex(found_line.offset);
-            const unsigned offset = unsigned(found_line.offset - m_map.GetOffset(index));
+            const size_t index = OffsetToIndex(found_line.offset);
+            const unsigned offset = unsigned(found_line.offset - GetOffset(index));
             found_line.Found(offset, 0);
         }
     }
 
     assert(!found_line.Empty());
-    size_t index = m_map.OffsetToIndex(found_line.offset);
+    size_t index = OffsetToIndex(found_line.offset);
+
+    // Scanning needs to know the encoding, which is detected while
+    // processing the first chunk.
+    if (next && !m_map.Processed() && HasContent())
+    {
+        ProcessThrough(0, e, true/*cancelable*/);
+        if (e.Test())
+            return false;
+    }
+    const bool scan = (next && searcher->CanScan(m_map));
     while (true)
     {
-        if (IsSignaled())
+        if (IsCanceled())
         {
             found_line.Found(GetOffset(index), 0);
             e.Set(E_ABORT);
             return false;
         }
 
+        if (scan)
+        {
+            // Scan the raw data for the next candidate, so that rows only
+            // need to be resolved where a match might be.  In big unwrapped
+            // files SeekOffset() can use a sparse window instead of indexing
+            // everything before the candidate.
+            if (!first)
+            {
+                ProcessThrough(index + 1, e, true/*cancelable*/);
+                if (e.Test())
+                {
+                    if (e.Code() == E_ABORT)
+                    {
+                        found_line.Found(GetOffset(index), 0);
+                        left_offset = 0;
+                    }
+                    return false;
+                }
+                if (index + 1 >= Count())
+                    return false;
+                ++index;
+                first = true;
+            }
+
+            // If canceled, resume after the last row that was searched.
+            const FileOffset resume = GetOffset(index ? index - 1 : 0);
+            FileOffset candidate;
+            if (!ScanForCandidate(*searcher, GetOffset(index), candidate, e))
+            {
+                if (e.Code() == E_ABORT)
+                {
+                    found_line.Found(resume, 0);
+                    left_offset = 0;
+                }
+                else if (e.Code() == ERROR_HANDLE_EOF)
+                {
+                    e.Clear();
+                }
+                return false;
+            }
+
+            index = SeekOffset(candidate, e, true/*cancelable*/);
+            if (e.Test())
+            {
+                if (e.Code() == E_ABORT)
+                {
+                    found_line.Found(resume, 0);
+                    left_offset = 0;
+                }
+                return false;
+            }
+        }
+
         if (next)
         {
             // IMPORTANT:  Must process through the _next_ line to get an
@@ -2090,11 +5196,28 @@ bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, un
         }
         else
         {
-            // Going in reverse doesn't need to use ProcessThrough().
+            // Going in reverse doesn't need to use ProcessThrough(), except
+            // to reach the rows before a sparse window.
             if (!first)
             {
                 if (!index || index > Count())
                     return false;
+                if (m_sparse_active && index == m_sparse_base)
+                {
+                    const FileOffset here = GetOffset(index);
+                    if (!FoldSparse(e, true/*cancelable*/))
+                    {
+                        if (e.Code() == E_ABORT)
+                        {
+                            found_line.Found(here, 0);
+                            left_offset = 0;
+                        }
+                        return false;
+                    }
+                    index = OffsetToIndex(here);
+                    if (!index)
+                        return false;
+                }
                 --index;
             }
         }
@@ -2135,7 +5258,6 @@ bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, un
         }
 
         // FUTURE:  Optional regex search?
-        // PERF:  Boyer-Moore search?
         if (searcher->Match(m_map, ptr, len, e))
         {
             if (e.Test())
@@ -2147,36 +5269,7 @@ bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, un
             if (index_in_line >= real_len)
                 return false; // Was actually found on the _next_ line.
             found_line.Found(GetOffset(index) + index_in_line, needle_len);
-            // Calculate horizontal scroll offset.
-            tmp.Clear();
-            FormatLineData(index, false, 0, tmp, -1, e, nullptr, nullptr, index_in_line);
-            const unsigned prefix_cells = cell_count(tmp.Text());
-            tmp.Clear();
-            FormatLineData(index, false, 0, tmp, -1, e, nullptr, nullptr, index_in_line + needle_len);
-            const unsigned prefixneedle_cells = cell_count(tmp.Text());
-            const unsigned needle_cells = prefixneedle_cells - prefix_cells;
-            if (prefix_cells + needle_cells + c_find_horiz_scroll_threshold <= max_width)
-            {
-                left_offset = 0;
-            }
-            else
-            {
-                // Center the found text horizontally.
-                const int center_offset = (max_width - needle_cells) / 2;
-                left_offset = int(prefix_cells) - center_offset;
-                // Nudge the left offset so it doesn't scroll past the
-                // wrap width or line length.
-                tmp.Clear();
-                const unsigned line_cells = FormatLineData(index, false, 0, tmp, -1, e);
-                if (line_cells)
-                {
-                    if (m_map.GetWrapWidth())
-                        left_offset = min<int>(left_offset, int(line_cells) - min(max_width, m_map.GetWrapWidth()));
-                    else
-                        left_offset = min<int>(left_offset, int(line_cells) + c_find_horiz_scroll_threshold - max_width);
-                }
-                left_offset = max<int>(0, left_offset);
-            }
+            left_offset = CalcFoundLeftOffset(index, index_in_line, needle_len, max_width, e);
             return true;
         }
 
@@ -2184,9 +5277,113 @@ bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, un
     }
 }
 
-bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, unsigned hex_width, FoundOffset& found_line, Error& e, bool first)
+unsigned ContentCache::CalcFoundLeftOffset(size_t index, unsigned index_in_line, unsigned needle_len, unsigned max_width, Error& e)
 {
     StrW tmp;
+    FormatLineData(index, false, 0, tmp, -1, e, nullptr, nullptr, index_in_line);
+    const unsigned prefix_cells = cell_count(tmp.Text());
+    tmp.Clear();
+    FormatLineData(index, false, 0, tmp, -1, e, nullptr, nullptr, index_in_line + needle_len);
+    const unsigned prefixneedle_cells = cell_count(tmp.Text());
+    const unsigned needle_cells = prefixneedle_cells - prefix_cells;
+    if (prefix_cells + needle_cells + c_find_horiz_scroll_threshold <= max_width)
+        return 0;
+
+    // Center the found text horizontally.
+    const int center_offset = (max_width - needle_cells) / 2;
+    int left_offset = int(prefix_cells) - center_offset;
+    // Nudge the left offset so it doesn't scroll past the wrap width or line
+    // length.
+    tmp.Clear();
+    const unsigned line_cells = FormatLineData(index, false, 0, tmp, -1, e);
+    if (line_cells)
+    {
+        if (m_map.GetWrapWidth())
+            left_offset = min<int>(left_offset, int(line_cells) - min(max_width, m_map.GetWrapWidth()));
+        else
+            left_offset = min<int>(left_offset, int(line_cells) + c_find_horiz_scroll_threshold - max_width);
+    }
+    return unsigned(max<int>(0, left_offset));
+}
+
+bool ContentCache::FindAllInLine(size_t line, Searcher& searcher, std::vector<FoundOffset>& spans, Error& e)
+{
+    spans.clear();
+
+    if (!EnsureFileData(line, e))
+        return false;
+
+    const FileOffset offset = GetOffset(line);
+    assert(offset >= m_data_offset);
+    const BYTE* const ptr = m_data + (offset - m_data_offset);
+    const unsigned len = GetLength(line);
+    assert(ptr + len <= m_data + m_data_length);
+
+    for (bool found = searcher.Match(m_map, ptr, len, e); found && !e.Test(); found = searcher.Next(m_map, e))
+    {
+        // Empty regex matches have nothing to highlight.
+        if (!searcher.GetMatchLength())
+            continue;
+        FoundOffset span;
+        span.Found(offset + searcher.GetMatchStart(), searcher.GetMatchLength());
+        spans.emplace_back(span);
+    }
+    return !e.Test();
+}
+
+unsigned ContentCache::GetFoundLeftOffset(const FoundOffset& found, unsigned max_width, Error& e)
+{
+    assert(!found.Empty());
+    const size_t index = SeekOffset(found.offset, e);
+    if (e.Test() || index >= Count())
+        return 0;
+    return CalcFoundLeftOffset(index, unsigned(found.offset - GetOffset(index)), found.len, max_width, e);
+}
+
+bool ContentCache::ScanForCandidate(Searcher& searcher, FileOffset offset, FileOffset& candidate, Error& e)
+{
+    // Returns false without setting e if there are no more candidates.
+    const unsigned overlap = searcher.GetScanOverlap();
+    while (offset < m_size)
+    {
+        if (IsCanceled())
+        {
+            e.Set(E_ABORT);
+            return false;
+        }
+
+        if (!LoadData(offset, m_data_slop, e))
+            return false;
+        if (offset < m_data_offset || offset >= m_data_offset + m_data_length)
+            return false;
+
+        if (m_progress)
+            m_progress->Publish(offset, m_map.Count());
+
+        const BYTE* const data = m_data + (offset - m_data_offset);
+        const size_t available = size_t(m_data_offset + m_data_length - offset);
+        const size_t found = searcher.Scan(data, available);
+        if (found != size_t(-1))
+        {
+            candidate = offset + found;
+            return true;
+        }
+
+        // Overlap the next buffer so matches that straddle the end of this
+        // buffer are found.
+        if (offset + available >= m_size)
+            break;
+        offset += (available > overlap) ? available - overlap : 1;
+    }
+
+    return false;
+}
+
+bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, unsigned hex_width, FoundOffset& found_line, Error& e, bool first)
+{
+    PerfScope perf(PerfTimer::Find);
+    BulkReadScope bulk(*this);
+    StrWScratch tmp;
     const unsigned needle_delta = searcher->GetNeedleDelta();
 
     if (found_line.Empty())
@@ -2198,10 +5395,31 @@ bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, un
     }
 
     assert(!found_line.Empty());
+
+    // Byte searches match the raw bytes exactly, so going forward in hex mode
+    // they can scan big buffers directly instead of matching one hex row at
+    // a time.  Like matching row by row, only the first match in each row is
+    // reported, so the next scan begins at the next row.
+    if (next && searcher->GetSearcherType() == SearcherType::Bytes)
+    {
+        const FileOffset from = ((found_line.offset == FileOffset(-1)) ? 0 :
+                                 (found_line.offset & ~FileOffset(hex_width - 1)) + hex_width);
+        FileOffset candidate;
+        if (!ScanForCandidate(*searcher, from, candidate, e))
+        {
+            if (e.Code() == ERROR_HANDLE_EOF)
+                e.Clear();
+            return false;
+        }
+
+        found_line.Found(candidate, searcher->GetNeedleDelta());
+        return true;
+    }
+
     FileOffset offset = found_line.offset;
     while (true)
     {
-        if (IsSignaled())
+        if (IsCanceled())
         {
             found_line.Found(offset, 0);
             e.Set(E_ABORT);
@@ -2273,7 +5491,7 @@ bool ContentCache::Find(bool next, const std::shared_ptr<Searcher>& searcher, un
 }
 
 #ifdef DEBUG
-enum LoadType { LT_NONE, LT_HEADOPT, LT_TAILOPT, LT_ABSOLUTE, LT_REDIRECT, LT_TEXT };
+enum LoadType { LT_NONE, LT_HEADOPT, LT_TAILOPT, LT_ABSOLUTE, LT_REDIRECT, LT_TEXT, LT_MAPPED, LT_CACHED };
 LoadType g_last_load_type = LT_NONE;
 #endif
 
@@ -2350,14 +5568,104 @@ bool ContentCache::EnsureHexData(FileOffset offset, unsigned length, Error& e)
     return true;
 }
 
+bool ContentCache::LoadMappedData(const FileOffset begin, const FileOffset end, const DWORD window)
+{
+    assert(m_mapping);
+    assert(begin <= end);
+
+    // Check the size before each access.  If the file has shrunk since it
+    // was mapped, then reading past its new end would raise an in-page
+    // exception, so fall back to ReadFile.  If it has grown, then map it
+    // again so the new data is reachable.
+    LARGE_INTEGER liSize;
+    if (!GetFileSizeEx(m_file, &liSize) || FileOffset(liSize.QuadPart) < m_mapped_size)
+        return false;
+    if (end > m_mapped_size && FileOffset(liSize.QuadPart) > m_mapped_size)
+    {
+        UnmapFile();
+        if (!MapFile())
+            return false;
+    }
+
+    const FileOffset avail_end = std::min<FileOffset>(end, m_mapped_size);
+    if (begin >= avail_end)
+    {
+        m_data = m_buffer;
+        m_data_offset = begin;
+        m_data_length = 0;
+        m_data_slop = 0;
+        m_eof = true;
+#ifdef DEBUG
+        g_last_load_type = LT_MAPPED;
+#endif
+        return true;
+    }
+
+    if (!m_view || begin < m_view_offset || avail_end > m_view_offset + m_view_length)
+    {
+        // Map a sliding window.  The view offset must be a multiple of the
+        // allocation granularity, and s_page_size is.
+        const FileOffset view_offset = begin - (begin % s_page_size);
+        const FileOffset view_length = std::min<FileOffset>(m_mapped_size - view_offset, c_mapped_view_size);
+        assert(view_offset + view_length >= avail_end);
+
+        if (m_view)
+        {
+            UnmapViewOfFile(m_view);
+            m_view = nullptr;
+            m_view_offset = 0;
+            m_view_length = 0;
+        }
+
+        m_view = static_cast<const BYTE*>(MapViewOfFile(m_mapping, FILE_MAP_READ, DWORD(view_offset >> 32), DWORD(view_offset), SIZE_T(view_length)));
+        if (!m_view)
+            return false;
+
+        m_view_offset = view_offset;
+        m_view_length = view_length;
+    }
+
+    m_data = m_view + (begin - m_view_offset);
+    m_data_offset = begin;
+    m_data_length = DWORD(avail_end - begin);
+    PerfAdd(PerfCount::BytesRead, m_data_length);
+    if (begin + window < end)
+        m_data_slop = DWORD(end - (begin + window));
+    else
+        m_data_slop = 0;
+    if (avail_end < end)
+        m_eof = true;
+#ifdef DEBUG
+    g_last_load_type = LT_MAPPED;
+#endif
+    return true;
+}
+
 bool ContentCache::LoadData(const FileOffset offset, DWORD& end_slop, Error& e)
 {
     assert(HasContent());
+    PerfScope perf(PerfTimer::LoadData);
 
-    const DWORD c_data_buffer_max = c_data_buffer_slop + c_data_buffer_main + c_data_buffer_slop;
+    // Bulk reads grow the window with each consecutive forward read.  The
+    // slop stays the same size, so matches and lines that span windows
+    // are still found.
+    DWORD window = c_data_buffer_main;
+    if (m_bulk_reads && !m_text)
+    {
+        const bool forward = (offset >= m_data_offset);
+        if (!forward)
+            m_bulk_window = c_data_buffer_main;
+        // Reading from a mapped view doesn't copy into the buffer, so it
+        // doesn't need to grow.
+        if (EnsureMapping() || GrowDataBuffer(m_bulk_window))
+            window = m_bulk_window;
+        if (forward)
+            m_bulk_window = std::min<DWORD>(m_bulk_window * 2, c_data_buffer_bulk);
+    }
+    const DWORD c_data_buffer_max = c_data_buffer_slop + window + c_data_buffer_slop;
 
     FileOffset begin = offset;
-    FileOffset end = offset + c_data_buffer_main + c_data_buffer_slop;
+    FileOffset end = offset + window + c_data_buffer_slop;
 
     if (begin)
     {
@@ -2384,7 +5692,7 @@ bool ContentCache::LoadData(const FileOffset offset, DWORD& end_slop, Error& e)
         m_data_offset = begin;
         m_data_length = to_read;
         m_data_slop = 0;
-        memmove(m_data, m_text + begin, to_read);
+        m_data = reinterpret_cast<const BYTE*>(m_text) + begin;
 #ifdef DEBUG
         g_last_load_type = LT_TEXT;
 #endif
@@ -2393,21 +5701,23 @@ bool ContentCache::LoadData(const FileOffset offset, DWORD& end_slop, Error& e)
 
     if (m_redirected)
     {
-        assert(m_eof);
         size_t index = begin / s_page_size;
         DWORD ofs = begin % s_page_size;
         assert(!kept_at_head);
+        m_data = m_buffer;
         m_data_offset = begin;
         m_data_length = 0;
         while (to_read)
         {
             assert(index < m_chunks.size());
+            if (!EnsurePipeChunk(index, e))
+                return false;
             auto& chunk = m_chunks[index];
             assert(chunk.Used() >= ofs);
             const DWORD len = std::min<DWORD>(to_read, chunk.Used() - ofs);
             if (!len)
                 break;
-            memmove(m_data + m_data_length, chunk.Bytes() + ofs, len);
+            memmove(m_buffer + m_data_length, chunk.Bytes() + ofs, len);
             assert(to_read >= len);
             to_read -= len;
             m_data_length += len;
@@ -2415,8 +5725,8 @@ bool ContentCache::LoadData(const FileOffset offset, DWORD& end_slop, Error& e)
             ofs += len;
             ofs %= s_page_size;
         }
-        if (begin + c_data_buffer_main < end)
-            m_data_slop = DWORD(end - (begin + c_data_buffer_main));
+        if (begin + window < end)
+            m_data_slop = DWORD(end - (begin + window));
         else
             m_data_slop = 0;
 #ifdef DEBUG
@@ -2425,6 +5735,19 @@ bool ContentCache::LoadData(const FileOffset offset, DWORD& end_slop, Error& e)
         return true;
     }
 
+    if (EnsureMapping())
+    {
+        if (LoadMappedData(begin, end, window))
+            return true;
+        // Fall back to using ReadFile.
+        UnmapFile();
+        if (!GrowDataBuffer(window))
+        {
+            e.Sys(ERROR_NOT_ENOUGH_MEMORY);
+            return false;
+        }
+    }
+
 #ifdef DEBUG
     g_last_load_type = LT_ABSOLUTE;
 #endif
@@ -2446,7 +5769,7 @@ bool ContentCache::LoadData(const FileOffset offset, DWORD& end_slop, Error& e)
             const size_t keep_length = std::min<size_t>(m_data_length, end - begin) - offset_to_begin_in_data;
             assert(keep_length <= c_data_buffer_max);
             // Shift the data to keep.
-            memmove(m_data, m_data + offset_to_begin_in_data, keep_length);
+            memmove(m_buffer, m_data + offset_to_begin_in_data, keep_length);
             // Adjust what to read from file to fill the rest of the buffer.
             assert(to_read >= keep_length);
             kept_at_head = DWORD(keep_length);
@@ -2471,7 +5794,7 @@ bool ContentCache::LoadData(const FileOffset offset, DWORD& end_slop, Error& e)
             assert(m_data_offset > begin);
             const size_t offset_to_dest_for_data = (m_data_offset - begin);
             // Shift the data to keep.
-            memmove(m_data + offset_to_dest_for_data, m_data, keep_length);
+            memmove(m_buffer + offset_to_dest_for_data, m_data, keep_length);
             // Adjust what to read from file to fill the rest of the buffer.
             assert(to_read >= keep_length);
             kept_at_tail = DWORD(keep_length);
@@ -2486,7 +5809,7 @@ bool ContentCache::LoadData(const FileOffset offset, DWORD& end_slop, Error& e)
 
     LARGE_INTEGER liMove;
     liMove.QuadPart = begin + kept_at_head;
-    if (!SetFilePointerEx(m_file, liMove, nullptr, FILE_BEGIN))
+    if (!m_compressed && !SetFilePointerEx(m_file, liMove, nullptr, FILE_BEGIN))
     {
 LError:
         const DWORD err = GetLastError();
@@ -2496,18 +5819,73 @@ LError:
         return false;
     }
 
+    if (!m_read_ahead && !m_compressed)
+    {
+        // Failure is not an error; it just means reading synchronously.
+        m_read_ahead = std::make_unique<ReadAhead>();
+        m_read_ahead->Open(m_name.Text());
+    }
+
     DWORD bytes_read = 0;
     assert(kept_at_head + to_read + kept_at_tail <= c_data_buffer_max);
-    if (!ReadFile(m_file, m_data + kept_at_head, to_read, &bytes_read, nullptr))
+    const size_t block_cache_limit = size_t(m_options.block_cache_limit) * 1024 * 1024;
+    if (block_cache_limit && m_file_key_valid &&
+        ReadCachedBlocks(m_file_key, begin + kept_at_head, to_read, m_buffer + kept_at_head, bytes_read))
     {
-        assert(!bytes_read);
-        goto LError;
+#ifdef DEBUG
+        g_last_load_type = LT_CACHED;
+#endif
+    }
+    else if (m_compressed)
+    {
+        // The block cache holds uncompressed blocks, which saves
+        // decompressing again when scrolling back to before a seek point.
+        if (!m_compressed->Read(begin + kept_at_head, m_buffer + kept_at_head, to_read, bytes_read, e))
+        {
+            m_eof = true;
+            return false;
+        }
+        if (block_cache_limit && m_file_key_valid)
+            StoreCachedBlocks(m_file_key, begin + kept_at_head, bytes_read, m_buffer + kept_at_head, bytes_read < to_read, block_cache_limit);
+    }
+    else
+    {
+        if (m_read_ahead->Take(begin + kept_at_head, to_read, m_buffer + kept_at_head))
+        {
+            bytes_read = to_read;
+        }
+        else if (!ReadFile(m_file, m_buffer + kept_at_head, to_read, &bytes_read, nullptr))
+        {
+            assert(!bytes_read);
+            goto LError;
+        }
+
+        if (block_cache_limit && m_file_key_valid)
+            StoreCachedBlocks(m_file_key, begin + kept_at_head, bytes_read, m_buffer + kept_at_head, bytes_read < to_read, block_cache_limit);
+
+        // Guess the scroll direction from the previous read, and start
+        // reading the next window in that direction so it's ready by the
+        // time it's needed (indexing and searching then overlap I/O with
+        // parsing).
+        const DWORD ahead = c_data_buffer_slop + (m_bulk_reads ? m_bulk_window : c_data_buffer_main) + c_data_buffer_slop;
+        if (begin >= m_last_read_begin)
+        {
+            if (bytes_read == to_read)
+                m_read_ahead->Start(end, ahead);
+        }
+        else if (begin)
+        {
+            m_read_ahead->Start((begin > ahead) ? begin - ahead : 0, ahead);
+        }
     }
+    m_last_read_begin = begin;
+    PerfAdd(PerfCount::BytesRead, bytes_read);
 
+    m_data = m_buffer;
     m_data_offset = begin;
     m_data_length = kept_at_head + bytes_read + kept_at_tail;
-    if (begin + c_data_buffer_main < end)
-        m_data_slop = DWORD(end - (begin + c_data_buffer_main));
+    if (begin + window < end)
+        m_data_slop = DWORD(end - (begin + window));
     else
         m_data_slop = 0;
     if (bytes_read < to_read)
@@ -2517,51 +5895,33 @@ LError:
 
 void ContentCache::SetByte(FileOffset offset, BYTE value, bool high_nybble)
 {
-    const FileOffset block_offset = offset & ~(PatchBlock::c_size - 1);
-    const unsigned index = offset & (PatchBlock::c_size - 1);
-
     Error e;
-    if (!EnsureHexData(block_offset, PatchBlock::c_size, e))
+    if (!EnsureHexData(offset, 1, e))
         return;
 
-    auto f = m_patch_blocks.find(block_offset);
-    if (f == m_patch_blocks.end())
-    {
-        m_patch_blocks.emplace(block_offset, block_offset);
-        f = m_patch_blocks.find(block_offset);
-    }
-
     value &= 0x0f;
     if (high_nybble)
         value <<= 4;
 
+    // The original is what's in the file now, which may include saved edits.
+    const BYTE original = m_data[offset - m_data_offset];
     BYTE b;
     ColorElement color;
-    const bool dirty = IsByteDirty(offset, b, color);
-    if (!dirty)
-    {
-        const BYTE* ptr = m_data + (block_offset - m_data_offset);
-        b = ptr[index];
-    }
+    if (!IsByteDirty(offset, b, color))
+        b = original;
 
     value |= b & (high_nybble ? 0x0f : 0xf0);
 
-    f->second.SetByte(offset, value, dirty ? nullptr : &b);
+    m_patches.Set(offset, value, original);
+    ++m_content_generation;
 }
 
 bool ContentCache::RevertByte(FileOffset offset)
 {
-    const FileOffset block_offset = offset & ~(PatchBlock::c_size - 1);
-    auto f = m_patch_blocks.find(block_offset);
-    if (f == m_patch_blocks.end())
-        return false;
-
-    if (!f->second.IsSet(offset))
+    if (!m_patches.Revert(offset))
         return false;
 
-    f->second.RevertByte(offset);
-    if (!f->second.IsDirty())
-        m_patch_blocks.erase(block_offset);
+    ++m_content_generation;
     return true;
 }
 
@@ -2569,9 +5929,14 @@ bool ContentCache::SaveBytes(Error& e)
 {
     assert(IsOpen());
     assert(!IsPipe());
-    if (!IsOpen() || IsPipe() || !IsDirty())
+    assert(!IsCompressed());
+    if (!IsOpen() || IsPipe() || IsCompressed() || !IsDirty())
         return false;
 
+    // Anything read ahead is about to be stale.
+    if (m_read_ahead)
+        m_read_ahead->Cancel();
+
     SHFile h = CreateFileW(m_name.Text(), GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, 0);
     if (h == INVALID_HANDLE_VALUE)
     {
@@ -2580,26 +5945,25 @@ bool ContentCache::SaveBytes(Error& e)
         return false;
     }
 
-    bool ok = true;
-    for (auto& p : m_patch_blocks)
-    {
-        if (!p.second.Save(h, false/*original*/, e))
-        {
-            ok = false;
-            break;
-        }
+    FileOffset begin;
+    FileOffset end;
+    const bool extent = m_patches.GetExtent(begin, end);
 
-        auto saved = m_patch_blocks_saved.find(p.first);
-        if (saved != m_patch_blocks_saved.end())
-            saved->second.MergeFrom(p.second);
-        else
-            m_patch_blocks_saved.emplace(p.first, p.second);
-    }
+    // Runs that get written are remembered for UndoSave, even if a later
+    // run fails.
+    const bool ok = m_patches.Save(h, false/*original*/, e, &m_patches_saved);
+
+    h.Close();
+    RefreshFileKey();
 
     if (ok)
     {
         DiscardBytes();
-        ClearProcessed();  // Make sure to reread the file.
+        // Make sure to reread the edited part of the file.
+        if (extent)
+            InvalidateProcessed(begin, end);
+        else
+            ClearProcessed();
     }
 
     return ok;
@@ -2609,9 +5973,13 @@ void ContentCache::UndoSave(Error& e)
 {
     assert(!IsDirty());
 
-    if (!IsOpen() || IsDirty() || m_patch_blocks_saved.empty())
+    if (!IsOpen() || IsDirty() || m_patches_saved.Empty())
         return;
 
+    // Anything read ahead is about to be stale.
+    if (m_read_ahead)
+        m_read_ahead->Cancel();
+
     SHFile h = CreateFileW(m_name.Text(), GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, 0);
     if (h == INVALID_HANDLE_VALUE)
     {
@@ -2620,98 +5988,78 @@ void ContentCache::UndoSave(Error& e)
         return;
     }
 
-    for (auto& p : m_patch_blocks_saved)
-    {
-        if (!p.second.Save(h, true/*original*/, e))
-            return;
-    }
+    const bool ok = m_patches_saved.Save(h, true/*original*/, e);
+
+    h.Close();
+    RefreshFileKey();
+
+    if (!ok)
+        return;
+
+    // Make sure to reread the restored part of the file.
+    FileOffset begin;
+    FileOffset end;
+    if (m_patches_saved.GetExtent(begin, end))
+        InvalidateProcessed(begin, end);
+    else
+        ClearProcessed();
+    m_patches_saved.Clear();
+}
 
-    m_patch_blocks_saved.clear();
-    ClearProcessed();  // Make sure to reread the file.
+void ContentCache::RefreshFileKey()
+{
+    // Blocks cached for the old content must not be used for the new
+    // content, so if the last write time didn't change (e.g. because of a
+    // coarse timestamp resolution) then stop using the block cache.
+    const IndexCacheKey old = m_file_key;
+    m_file_key_valid = (m_file_key.Read(m_file) && CompareFileTime(&old.last_write, &m_file_key.last_write) != 0);
 }
 
 bool ContentCache::IsByteDirty(FileOffset offset, BYTE& value, ColorElement& color) const
 {
-    const FileOffset block_offset = offset & ~(PatchBlock::c_size - 1);
-    auto edited = m_patch_blocks.find(block_offset);
-    if (edited != m_patch_blocks.end() && edited->second.IsSet(offset))
+    if (m_patches.Get(offset, value))
     {
-        value = edited->second.GetByte(offset);
         color = ColorElement::EditedByte;
         return true;
     }
-    auto saved = m_patch_blocks_saved.find(block_offset);
-    if (saved != m_patch_blocks_saved.end() && saved->second.IsSet(offset))
+    if (m_patches_saved.Get(offset, value))
     {
-        value = saved->second.GetByte(offset);
         color = ColorElement::SavedByte;
         return true;
     }
     return false;
 }
 
-static bool NextEditedByteRow(const std::map<FileOffset, PatchBlock>& patch_blocks, FileOffset here, FileOffset& there, unsigned hex_width, bool next)
+bool ContentCache::GetDirtyBytes(FileOffset offset, unsigned len, BYTE* values, ColorElement* colors) const
 {
-    auto f = patch_blocks.lower_bound(here);
-    if (next)
-    {
-        while (f != patch_blocks.end())
-        {
-            const FileOffset rowofs = f->first & ~(FileOffset(hex_width) - 1);
-            if (here < rowofs)
-            {
-                there = f->first;
-                for (unsigned index = 0; index < f->second.c_size; ++index)
-                {
-                    if (f->second.IsSet(there + index))
-                    {
-                        there += index;
-                        break;
-                    }
-                }
-                return true;
-            }
-            ++f;
-        }
-    }
-    else
-    {
-        if (f == patch_blocks.end())
-            --f;
+    bool any = false;
+    for (unsigned ii = 0; ii < len; ++ii)
+        colors[ii] = ColorElement::Content;
 
-        while (true)
+    // Saved edits first, so that edits that haven't been saved take
+    // precedence.
+    const auto overlay = [&](const PatchOverlay& patches, ColorElement color)
+    {
+        patches.ForEachRange(offset, offset + len, [&](FileOffset begin, const BYTE* bytes, size_t count)
         {
-            const FileOffset rowofs = f->first & ~(FileOffset(hex_width) - 1);
-            if (here > rowofs)
-            {
-                there = f->first;
-                for (unsigned index = f->second.c_size; index--;)
-                {
-                    if (f->second.IsSet(there + index))
-                    {
-                        there += index;
-                        break;
-                    }
-                }
-                return true;
-            }
-            if (f == patch_blocks.begin())
-                break;
-            --f;
-        }
-    }
-
-    return false;
+            const unsigned at = unsigned(begin - offset);
+            memcpy(values + at, bytes, count);
+            for (size_t ii = 0; ii < count; ++ii)
+                colors[at + ii] = color;
+            any = true;
+        });
+    };
+    overlay(m_patches_saved, ColorElement::SavedByte);
+    overlay(m_patches, ColorElement::EditedByte);
+    return any;
 }
 
 bool ContentCache::NextEditedByteRow(FileOffset here, FileOffset& there, unsigned hex_width, bool next) const
 {
-    here &= ~(FileOffset(hex_width) - 1);
-
     FileOffset there1 = -1;
     FileOffset there2 = -1;
-    const bool found1 = !m_patch_blocks.empty() && ::NextEditedByteRow(m_patch_blocks, here, there1, hex_width, next);
-    const bool found2 = !m_patch_blocks_saved.empty() && ::NextEditedByteRow(m_patch_blocks_saved, here, there2, hex_width, next);
+    const bool found1 = m_patches.NextRow(here, there1, hex_width, next);
+    const bool found2 = m_patches_saved.NextRow(here, there2, hex_width, next);
 
     if (found1 && found2)
     {
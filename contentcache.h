@@ -9,10 +9,19 @@
 #include "wcwidth.h"
 #include "wcwidth_iter.h"
 #include "colors.h"
+#include "indexcache.h"
+#include "rowcache.h"
+#include "patchoverlay.h"
+#include "progress.h"
+#include "decompress.h"
+#include "memorybudget.h"
 
 #include <vector>
 #include <map>
+#include <memory>
+#include <atomic>
 
+class Exporter;
 typedef unsigned __int64 FileOffset;
 
 struct FoundOffset
@@ -29,25 +38,6 @@ struct FoundOffset
     bool            is_valid;       // True when offset is valid, False otherwise.
 };
 
-class PatchBlock
-{
-public:
-    static const DWORD c_size = 8;
-                    PatchBlock(FileOffset offset);
-    bool            IsDirty() const { return !!m_mask; }
-    bool            IsSet(FileOffset offset) const;
-    BYTE            GetByte(FileOffset offset) const;
-    void            SetByte(FileOffset offset, BYTE value, const BYTE* original);
-    void            RevertByte(FileOffset offset);
-    void            MergeFrom(const PatchBlock& other);
-    bool            Save(HANDLE hfile, bool original, Error& e);
-private:
-    FileOffset      m_offset;
-    BYTE            m_bytes[c_size];
-    BYTE            m_original[c_size];
-    BYTE            m_mask;
-};
-
 struct PipeChunk
 {
 public:
@@ -57,29 +47,158 @@ public:
                     ~PipeChunk();
     PipeChunk&      operator=(const PipeChunk& other) = delete;
     PipeChunk&      operator=(PipeChunk&& other);
-    const BYTE*     Bytes() const { return m_bytes; }
+    const BYTE*     Bytes() const { assert(IsResident()); return m_bytes; }
     DWORD           Capacity() const;
     DWORD           Used() const { return m_used; }
     DWORD           Available() const { return Capacity() - Used(); }
-    BYTE*           WritePtr() { return m_bytes + Used(); }
+    BYTE*           WritePtr() { assert(IsResident()); return m_bytes + Used(); }
     void            Wrote(DWORD wrote);
+
+    // Full chunks can be spilled to a temp file and read back on demand.
+    bool            IsResident() const { return !!m_bytes; }
+    bool            Spill(HANDLE file, FileOffset offset, Error& e);
+    bool            Restore(HANDLE file, FileOffset offset, Error& e);
+    void            Touch() { m_referenced = true; }
+    bool            Age() { const bool was = m_referenced; m_referenced = false; return was; }
 private:
     void            Move(PipeChunk&& other);
 private:
     BYTE*           m_bytes;
     DWORD           m_used = 0;
-    // Note:  There is one DWORD of implicit padding here, which is available
-    // for future use.
+    bool            m_referenced = false;   // For the clock eviction in ContentCache.
+    bool            m_on_disk = false;      // The temp file has a copy of the bytes.
 };
 
 typedef std::vector<PipeChunk> PipeChunks;
 
+// Reads a pipe on a background thread, so the viewer can show and search
+// piped input while it's still arriving.  The reader only ever touches its
+// own pending chunks; the UI thread moves them into the ContentCache by
+// calling Take().
+class PipeReader
+{
+public:
+                    PipeReader(HANDLE pipe);
+                    ~PipeReader();
+    bool            Start();
+    bool            Wait(DWORD timeout) const;
+    bool            Take(PipeChunks& chunks, FileOffset& size, bool& done, DWORD& err);
+private:
+    static DWORD WINAPI ReaderProc(void* param);
+private:
+    const HANDLE    m_pipe;
+    SHBasic         m_thread;
+    SHBasic         m_arrived;              // Auto-reset event; set whenever data arrives.
+    CRITICAL_SECTION m_cs;
+    PipeChunks      m_pending;              // Guarded by m_cs.
+    bool            m_done = false;         // Guarded by m_cs.
+    DWORD           m_error = 0;            // Guarded by m_cs.
+    std::atomic<bool> m_stop = false;
+};
+
+// Asynchronous read-ahead for files that are read with ReadFile (e.g. on
+// network shares), so the next window can be in flight while the current
+// one is being displayed or parsed.  Uses its own overlapped handle, since
+// ContentCache reads synchronously through m_file.
+class ReadAhead
+{
+public:
+                    ReadAhead() = default;
+                    ~ReadAhead();
+    bool            Open(const WCHAR* name);
+    void            Start(FileOffset offset, DWORD length);
+    void            Cancel();
+    bool            Take(FileOffset offset, DWORD length, BYTE* dest);
+    DWORD           Capacity() const { return m_capacity; }
+private:
+    bool            Finish();
+private:
+    SHFile          m_file;
+    SHBasic         m_event;
+    BYTE*           m_buffer = nullptr;
+    DWORD           m_capacity = 0;
+    OVERLAPPED      m_overlapped = {};
+    FileOffset      m_offset = 0;
+    DWORD           m_requested = 0;
+    DWORD           m_length = 0;           // Bytes read, once finished.
+    bool            m_pending = false;
+    bool            m_valid = false;
+};
+
 struct FormattingInfo
 {
+    bool            Equals(const FormattingInfo& other) const { return m_leading_indent == other.m_leading_indent; }
+
 // TODO:  Syntaxing highlighting info can go in here as well.
     BYTE            m_leading_indent = 0;
 };
 
+// Compact index of display rows.  Offsets are stored as an absolute base
+// offset per block of rows plus a 16 bit delta per row.  Line numbers and
+// formatting are stored as breakpoints where they change, so unwrapped rows
+// cost nothing extra.
+class LineIndex
+{
+public:
+                    LineIndex() = default;
+                    ~LineIndex() = default;
+    LineIndex&      operator=(LineIndex&& other) = default;
+    LineIndex&      operator=(const LineIndex& other) = default;
+
+    void            Clear();
+    void            Append(FileOffset offset, bool continuation=false, const FormattingInfo& fmt={});
+    void            AppendFrom(const LineIndex& other, size_t first);
+
+    size_t          Count() const { return m_deltas.size(); }
+    size_t          CountFriendlyLines() const { return Count() - m_continued; }
+    FileOffset      GetOffset(size_t index) const;
+    size_t          GetLineNumber(size_t index) const;
+    FormattingInfo  GetFormattingInfo(size_t index) const;
+    size_t          FriendlyLineNumberToIndex(size_t line) const;
+    size_t          LowerBound(FileOffset offset) const;
+    size_t          UpperBound(FileOffset offset) const;
+    size_t          MemoryUsage() const;
+
+    // For the on-disk index cache.
+    void            Truncate(size_t count);
+    void            Serialize(std::vector<BYTE>& out) const;
+    bool            Deserialize(const BYTE* p, const BYTE* end);
+
+private:
+    size_t          RunEnd(size_t run) const;
+    size_t          RunTotalBefore(size_t run) const { return run ? m_continuations[run - 1].total : 0; }
+
+private:
+    static constexpr size_t c_block_rows = 16;
+    static constexpr uint16 c_delta_overflow = 0xffff;
+
+    struct Overflow
+    {
+        size_t      index;
+        FileOffset  offset;
+    };
+
+    // A run of consecutive rows that continue the preceding row's line.
+    struct ContinuationRun
+    {
+        size_t      begin;          // First row in the run.
+        size_t      total;          // Continuation rows through end of run.
+    };
+
+    struct FormattingRun
+    {
+        size_t      begin;          // First row using fmt.
+        FormattingInfo fmt;
+    };
+
+    std::vector<FileOffset> m_bases;            // Offset of first row in each block.
+    std::vector<uint16> m_deltas;               // Offset of each row relative to its block.
+    std::vector<Overflow> m_overflow;           // Rows whose delta doesn't fit.
+    std::vector<ContinuationRun> m_continuations;
+    std::vector<FormattingRun> m_formatting;
+    size_t          m_continued = 0;
+};
+
 class FileLineIter
 {
 public:
@@ -95,6 +214,19 @@ public:
                                 // and then skip whitespace.
     };
 
+    // What carries over from one call to SetBytes() to the next.
+    struct State
+    {
+        uint32      pending_length;
+        uint32      pending_width;
+        uint32      pending_wrap_length;
+        uint32      pending_wrap_width;
+        uint32      pending_wrap_indent;
+        int32       consecutive_spaces;
+        uint32      hanging_indent;
+        bool        any_nonspace;
+    };
+
                     FileLineIter(const ViewerOptions& options);
                     ~FileLineIter();
     FileLineIter&   operator=(FileLineIter&& other);
@@ -108,10 +240,14 @@ public:
     Outcome         Next(const BYTE*& bytes, uint32& length, uint32& width);
     uint32          HangingIndent() const { return m_hanging_indent; }
     bool            SkipWhitespace(uint32 curr_len, uint32& skipped);
+    void            SaveState(State& state) const;
+    void            RestoreState(const State& state);
     bool            IsBinaryFile() const { return m_binary_file; }
+    uint32          CharSize() const { return m_decoder ? m_decoder->CharSize() : 1; }
 
 #ifdef DEBUG
     size_t          GetProcessedLineCount() const { return m_line_index; }
+    void            SetProcessedLineCount(size_t count) { m_line_index = count; }
 #endif
 
 private:
@@ -122,6 +258,9 @@ private:
     UINT            m_codepage = 0;
     bool            m_binary_file = true;
     std::unique_ptr<IDecoder> m_decoder;
+    bool            m_ascii_runs = false;       // Printable ASCII decodes as itself.
+    bool            m_utf16_runs = false;       // UTF16 text; scan it a WCHAR at a time.
+    bool            m_byte_swap = false;        // UTF16 big endian.
 
     FileOffset      m_offset = 0;
     const BYTE*     m_bytes = nullptr;
@@ -158,7 +297,38 @@ public:
     FileOffset      Processed() const { return m_processed; }
     void            Next(const BYTE* bytes, size_t count);
 
-    size_t          Count() const { return m_lines.size(); }
+    // For processing separate ranges of a file in parallel.
+    void            InitForRange(const FileLineMap& other, FileOffset offset);
+    FileOffset      NextLineOffset() const { return m_pending_begin; }
+    bool            AdoptFrom(FileLineMap&& other, bool next_is_whitespace);
+    uint32          CharSize() const { return m_line_iter.CharSize(); }
+
+    // The processing state is checkpointed every so many rows, so that
+    // processing can restart partway through the file after part of it
+    // changes.  RestoreCheckpoint() truncates the map to the last checkpoint
+    // before offset, or returns false if there isn't one.  CopyFrom() copies
+    // another map, so its rows can be adopted again later.
+    bool            RestoreCheckpoint(FileOffset offset);
+    void            CopyFrom(const FileLineMap& other);
+
+    // Where lines begin, i.e. the start of the file and after each newline.
+    // Unlike the rows, this doesn't depend on the wrap width, so it's kept
+    // when the wrap width changes.  It's complete for the range from
+    // NewlinesBegin() through NewlinesEnd().
+    FileOffset      NewlinesBegin() const { return m_newlines_begin; }
+    FileOffset      NewlinesEnd() const { return m_newlines_end; }
+    bool            FindLineStart(FileOffset offset, FileOffset& start) const;
+    bool            NewlineNumberToOffset(size_t line, FileOffset& offset) const;
+    size_t          CountNewlinesBefore(FileOffset offset) const;
+
+    // For the on-disk index cache.
+    void            Truncate(size_t count) { m_index.Truncate(count); }
+    void            SerializeIndex(std::vector<BYTE>& out) const { m_index.Serialize(out); }
+    bool            ResumeFromIndex(const BYTE* p, const BYTE* end, FileOffset offset);
+    void            ResumeAt(size_t rows, FileOffset offset);
+
+    size_t          Count() const { return m_index.Count(); }
+    size_t          MemoryUsage() const { return m_index.MemoryUsage() + m_newlines.MemoryUsage() + m_checkpoints.capacity() * sizeof(Checkpoint); }
     size_t          CountFriendlyLines() const;
     FileOffset      GetOffset(size_t index) const;
     FormattingInfo  GetFormattingInfo(size_t index) const;
@@ -179,12 +349,29 @@ public:
     void            SetFileType(FileDataType type, UINT codepage, const WCHAR* encoding_name);
 
 private:
+    void            ClearRows();
+    void            NextRows(const BYTE* bytes, size_t count);
+    void            IndexNewlines(const BYTE* bytes, FileOffset begin);
+    void            AddCheckpoint();
 
 private:
+    struct Checkpoint
+    {
+        size_t      rows;
+        FileOffset  processed;
+        FileOffset  pending_begin;
+        FileLineIter::State iter;
+        uint8       skip_whitespace;
+        bool        wrapped_current_line;
+        bool        continues;          // The next row continues the current line.
+    };
+
     // Content.
-    std::vector<FileOffset> m_lines;
-    std::vector<size_t> m_line_numbers;
-    std::vector<FormattingInfo> m_formatting;
+    LineIndex       m_index;
+    LineIndex       m_newlines;
+    FileOffset      m_newlines_begin = 0;
+    FileOffset      m_newlines_end = 0;
+    std::vector<Checkpoint> m_checkpoints;
 
     // Processing.
     size_t          m_current_line_number = 1;
@@ -211,12 +398,14 @@ class ContentCache
 {
 public:
                     ContentCache(const ViewerOptions& options);
-                    ~ContentCache() { Close(); }
+                    ~ContentCache();
     ContentCache&   operator=(ContentCache&& other);
 
     bool            HasContent() const;
     bool            IsOpen() const { return m_file != INVALID_HANDLE_VALUE; }
     bool            IsPipe() const { return m_redirected; }
+    bool            IsPipeLive() const { return !!m_pipe_reader; }
+    bool            IsCompressed() const { return !!m_compressed; }
     bool            IsDetectedBinaryFile() const { return m_map.IsDetectedBinaryFile(); }
     bool            IsBinaryFile() const { return m_map.IsBinaryFile(); }
     UINT            GetCodePage(bool hex_mode=false) const { return m_map.GetCodePage(hex_mode); }
@@ -227,50 +416,186 @@ public:
     void            SetEncoding(UINT codepage);
     bool            Open(const WCHAR* name, Error& e);
     void            Close();
+    const WCHAR*    GetName() const { return m_name.Text(); }
+
+    // Keeps the state of a file that isn't being viewed anymore, so viewing
+    // it again doesn't need to reprocess it.  Resume() returns false if the
+    // file changed since Suspend(), in which case it must be reopened.
+    void            Suspend();
+    bool            Resume();
+    size_t          GetMemoryUsage() const;
+
+    // Spills piped input to the temp file to free at least excess bytes, if
+    // possible, for staying within the memory budget.  Returns the number of
+    // bytes freed.
+    size_t          ReclaimMemory(size_t excess);
+
+    // Unmaps a memory mapped file while the viewer is idle, so other
+    // programs can truncate or replace it meanwhile.  It's mapped again on
+    // demand.
+    void            ReleaseMapping();
 
     void            ClearProcessed();
-    void            SetWrapWidth(unsigned wrap);
+    // Like ClearProcessed(), but only for what bytes from begin through end
+    // affect (e.g. after saving edits there).  Processing restarts from the
+    // last checkpoint before begin, and the rows after end are reused once
+    // the lines line up again.
+    void            InvalidateProcessed(FileOffset begin, FileOffset end);
+    // Pass the index of the row at the top as top, so that SyncIndex() can
+    // find it again after rewrapping.
+    void            SetWrapWidth(unsigned wrap, size_t top=size_t(-1));
     unsigned        CalcMarginWidth(bool hex_mode);
     unsigned        FormatLineData(size_t line, bool middle, unsigned left_offset, StrW& s, unsigned max_width, Error& e, const WCHAR* marked_color=nullptr, const FoundOffset* found_line=nullptr, unsigned max_len=-1);
     bool            FormatHexData(FileOffset offset, bool middle, unsigned row, unsigned hex_bytes, StrW& s, Error& e, const WCHAR* marked_color=nullptr, const FoundOffset* found_line=nullptr);
 
+    // Moves piped input that has arrived since the last call into the
+    // cache.  Returns true if the content grew or the pipe reached EOF.
+    bool            PollPipe(Error& e);
+
+    // Follow mode for files.  Picks up bytes appended since the last call
+    // and resumes the line map where it left off.  Returns true if the file
+    // grew.  Sets replaced if the file was truncated or replaced (e.g. by log
+    // rotation), in which case the caller should reopen it.
+    bool            CheckForGrowth(bool& replaced, Error& e);
+
     bool            ProcessThrough(size_t line, Error& e, bool cancelable=false);
     bool            ProcessToEnd(Error& e, bool cancelable=false);
+
+    // Bulk reads use larger windows, which suit one-pass scans (indexing
+    // and searching) better than scrolling.  The window grows with each
+    // consecutive forward read, so a search that finds a match nearby
+    // doesn't pay for reading megabytes.  Returns the previous setting;
+    // see BulkReadScope.
+    bool            SetBulkReads(bool bulk);
+
+    // While background indexing is running, the worker thread owns the
+    // ContentCache and the caller must not use it (not even const methods)
+    // until after calling StopBackgroundIndexing().
+    bool            StartBackgroundIndexing();
+    void            StopBackgroundIndexing();
+    bool            IsBackgroundIndexing() const { return !m_bg_thread.Empty(); }
+    const ProgressChannel& GetBackgroundProgress() const { return m_bg_progress; } // Safe while background indexing.
+    HANDLE          GetBackgroundIndexingThread() const { return m_bg_thread; }      // Signaled when the worker stops.
     FileOffset      Processed() const { return m_map.Processed(); }
     bool            Completed() const { return m_completed; }
     bool            Eof() const { return m_eof; }
 
-    size_t          Count() const { return m_map.Count(); }
-    size_t          CountFriendlyLines() const { return m_map.CountFriendlyLines(); }
+    // Lets another thread watch the progress of processing and scanning,
+    // and cancel cancelable operations in addition to Ctrl-Break.  The
+    // channel is not transferred by operator=.
+    void            SetProgress(ProgressChannel* progress) { m_progress = progress; }
+
+    // Random access into big files.  SeekOffset() may build a detached
+    // window of rows near the offset (a sparse checkpoint) instead of
+    // processing everything before it.  The indices of rows in the window
+    // are estimates until m_map catches up and adopts the window, so callers
+    // that hold onto an index must pass it through SyncIndex() after
+    // processing may have happened.  After the wrap width changes,
+    // SyncIndex() seeks back to the offset of the last synced index.
+    size_t          SeekOffset(FileOffset offset, Error& e, bool cancelable=false);
+    bool            NewlineNumberToOffset(size_t line, FileOffset& offset) const;
+    size_t          SyncIndex(size_t index, Error& e);
+    void            DiscardSparse();
+    bool            IsApproximate(size_t index) const { return m_sparse_active && index >= m_map.Count(); }
+
+    // Until processing completes, these estimate the totals from the density
+    // of newlines sampled across the file (or of the rows processed so far),
+    // and they converge to the exact counts as processing proceeds.
+    size_t          EstimateRowCount() const;
+    size_t          EstimateLineCount() const;
+
+    size_t          Count() const;
+    size_t          CountFriendlyLines() const;
     FileOffset      GetFileSize() const { return m_size; }
     FileOffset      GetMaxHexOffset(unsigned hex_width) const;
-    FileOffset      GetOffset(size_t index) const { return m_map.GetOffset(index); }
-    size_t          GetLineNunber(size_t index) const { return m_map.GetLineNumber(index); }
-    size_t          FriendlyLineNumberToIndex(size_t index) const { return m_map.FriendlyLineNumberToIndex(index); }
+    FileOffset      GetOffset(size_t index) const;
+    size_t          GetLineNunber(size_t index) const;
+    size_t          FriendlyLineNumberToIndex(size_t index) const;
+    size_t          OffsetToIndex(FileOffset offset) const;
     unsigned        GetLength(size_t index) const;
+    bool            GetLineText(size_t index, StrW& out, Error& e);
+
+    // The bytes of the line containing offset (all of its rows, when it's
+    // wrapped), including its line ending.
+    bool            GetLineExtent(FileOffset offset, FileOffset& begin, FileOffset& end, Error& e);
+    // Streams bytes straight from the mapped view, piped chunks, or large
+    // reads, without decoding them.  Unsaved edits aren't included.  Uses
+    // the progress channel for canceling.
+    bool            ExportBytes(FileOffset begin, FileOffset end, Exporter& out, Error& e);
 
     bool            Find(bool next, const std::shared_ptr<Searcher>& searcher, unsigned max_width, FoundOffset& found, unsigned& left_offset, Error& e, bool first);
     bool            Find(bool next, const std::shared_ptr<Searcher>& searcher, unsigned hex_width, FoundOffset& found, Error& e, bool first);
+    unsigned        GetFoundLeftOffset(const FoundOffset& found, unsigned max_width, Error& e);
+
+    // Every match in a row, in order, for highlighting them all.  While
+    // highlights are set, FormatLineData() highlights the spans that start in
+    // the row it formats (the spans must be sorted by offset).
+    bool            FindAllInLine(size_t line, Searcher& searcher, std::vector<FoundOffset>& spans, Error& e);
+    void            SetHighlights(const std::vector<FoundOffset>* spans) { m_highlights = spans; }
 
     FileOffset      GetBufferOffset() const { return m_data_offset; }
     unsigned        GetBufferLength() const { return m_data_length; }
 
-    bool            IsDirty() const { return !m_patch_blocks.empty(); }
-    bool            IsSaved() const { return !m_patch_blocks_saved.empty(); }
+    bool            IsDirty() const { return !m_patches.Empty(); }
+    bool            IsSaved() const { return !m_patches_saved.Empty(); }
+    uint32          GetContentGeneration() const { return m_content_generation; }
+    uint32          GetGeneration() const { return m_generation; }      // Changes whenever row indices shift.
     void            SetByte(FileOffset offset, BYTE value, bool high_nybble);
     bool            RevertByte(FileOffset offset);
     bool            SaveBytes(Error& e);
-    void            DiscardBytes() { m_patch_blocks.clear(); }
+    void            DiscardBytes() { m_patches.Clear(); ++m_content_generation; }
     void            UndoSave(Error& e);
     bool            NextEditedByteRow(FileOffset here, FileOffset& there, unsigned hex_width, bool next) const;
 
 private:
     void            SetSize(FileOffset size);
     bool            EnsureDataBuffer(Error& e);
+    bool            GrowDataBuffer(DWORD window);
+    void            ShrinkDataBuffer();
+    bool            MapFile();
+    bool            EnsureMapping();
+    bool            ReopenSuspended();
+    bool            ReadAt(FileOffset offset, BYTE* dest, DWORD length, DWORD& bytes_read, Error& e);
+    void            SampleDensity();
+    void            GetDensity(double& rows_per_byte, double& lines_per_byte) const;
+    void            UnmapFile();
+    bool            LoadMappedData(FileOffset begin, FileOffset end, DWORD window);
     bool            LoadData(FileOffset offset, DWORD& end_slop, Error& e);
+    bool            ProcessNextChunk(bool& more, Error& e, bool sparse=false);
+    void            CompleteIfProcessed();
+    bool            ProcessInParallel(Error& e, bool cancelable);
+    bool            CanUseSparse(FileOffset offset) const;
+    bool            FindLineStart(FileOffset& offset, FileOffset limit, Error& e);
+    bool            StartSparse(FileOffset offset, Error& e);
+    bool            ProcessSparseThrough(size_t line, Error& e, bool cancelable=false);
+    bool            ExtendSparseBackward(Error& e);
+    bool            FoldSparse(Error& e, bool cancelable);
+    void            MergeSparse();
+    void            SetSyncAnchor(size_t index);
+    size_t          RemapIndex(size_t index) const;
+    void            DetectFileType();
+    void            LoadIndexCache();
+    void            ApplyIndexCache();
+    void            SaveIndexCache();
+    bool            FindResumeRow(size_t& rows, FileOffset& resume_offset);
+    void            AdoptStaleRows();
+    size_t          GetPipeChunkBudget() const;
+    bool            EnsurePipeChunk(size_t index, Error& e);
+    void            TrimPipeChunks(size_t pinned=size_t(-1));
+    bool            SpillPipeChunk(size_t pinned=size_t(-1));
+    void            UpdateMemoryCharges();
+    static DWORD WINAPI BackgroundIndexingProc(void* param);
+    bool            IsCanceled() const;
+    bool            ScanForCandidate(Searcher& searcher, FileOffset offset, FileOffset& candidate, Error& e);
+    unsigned        CalcFoundLeftOffset(size_t index, unsigned index_in_line, unsigned needle_len, unsigned max_width, Error& e);
     bool            EnsureFileData(size_t line, Error& e);
+    unsigned        FormatLineDataInternal(size_t line, bool middle, unsigned left_offset, StrW& s, unsigned max_width, const WCHAR* marked_color, const FoundOffset* found_line, unsigned max_len);
+    void            SyncRowCache();
     bool            EnsureHexData(FileOffset offset, unsigned length, Error& e);
     bool            IsByteDirty(FileOffset offset, BYTE& value, ColorElement& color) const;
+    bool            GetDirtyBytes(FileOffset offset, unsigned len, BYTE* values, ColorElement* colors) const;
+    void            RefreshFileKey();
+    bool            IsReplaced(const IndexCacheKey& key) const;
 
 private:
     const ViewerOptions& m_options;
@@ -283,18 +608,124 @@ private:
 
     bool            m_redirected = false;
     PipeChunks      m_chunks;
+    std::unique_ptr<PipeReader> m_pipe_reader; // Only while piped input is still arriving.
+    SHFile          m_spill_file;           // Temp file for chunks beyond the memory budget.
+    size_t          m_resident_chunks = 0;
+    size_t          m_clock_hand = 0;
+    bool            m_spill_disabled = false;
+    MemoryCharge    m_line_map_memory = MemoryCharge(MemoryUse::LineMaps);
+    MemoryCharge    m_buffer_memory = MemoryCharge(MemoryUse::Buffers);
+    MemoryCharge    m_pipe_memory = MemoryCharge(MemoryUse::PipeChunks);
     const char*     m_text = nullptr;
 
     FileLineMap     m_map;
     bool            m_completed = false;
     bool            m_eof = false;
 
-    BYTE*           m_data = nullptr;
+    FileLineMap     m_sparse;               // Detached window of rows past m_map.
+    FileOffset      m_sparse_begin = 0;
+    size_t          m_sparse_base = 0;      // Estimated index of the window's first row.
+    size_t          m_sparse_line_base = 0; // Estimated lines before the window's first row.
+    bool            m_sparse_active = false;
+    bool            m_sparse_eof = false;
+    FileLineMap     m_stale;                // Rows from before InvalidateProcessed().
+    FileOffset      m_stale_end = 0;        // Where its rows become valid again.
+    uint32          m_generation = 0;       // Changes whenever row indices shift.
+    uint32          m_sync_generation = 0;
+    size_t          m_sync_index = 0;
+    FileOffset      m_sync_offset = 0;
+    bool            m_rewrap_pending = false; // SyncIndex() seeks to m_sync_offset after the wrap width changes.
+    double          m_rewrap_rows_per_byte = 0;  // Estimated density at the new wrap width.
+    double          m_rewrap_lines_per_byte = 0;
+    double          m_sampled_lines_per_byte = 0;   // Newline density sampled across the file.
+
+    StrW            m_index_cache_name;     // Empty unless the index cache applies.
+    std::vector<BYTE> m_index_cache;        // Cached index waiting to be applied.
+    FileOffset      m_index_cache_resumed = 0;
+
+    BYTE*           m_buffer = nullptr;     // Buffer for ReadFile, pipes, etc.
+    DWORD           m_buffer_size = 0;
+    DWORD           m_bulk_window = c_data_buffer_main; // Next window for bulk reads.
+    bool            m_bulk_reads = false;
+    const BYTE*     m_data = nullptr;       // Points into m_buffer or m_view or m_text.
     FileOffset      m_data_offset = 0;
     DWORD           m_data_length = 0;
     DWORD           m_data_slop = 0;
 
-    std::map<FileOffset, PatchBlock> m_patch_blocks;
-    std::map<FileOffset, PatchBlock> m_patch_blocks_saved;
+    std::unique_ptr<ReadAhead> m_read_ahead; // Only when reading with ReadFile.
+    std::unique_ptr<CompressedFile> m_compressed; // Reads decompress the file.
+    IndexCacheKey   m_file_key;             // Identifies the file in the block cache.
+    bool            m_file_key_valid = false;
+    bool            m_reopen = false;       // Suspended with the file closed; Resume() reopens it.
+
+    // Options that affect processing, as of Suspend().
+    struct ProcessingOptions
+    {
+        void        Capture(const ViewerOptions& options);
+        bool        Equals(const ProcessingOptions& other) const;
+        unsigned    max_line_length = 0;
+        unsigned    tab_width = 0;
+        unsigned    hanging_extra = 0;
+        CtrlMode    ctrl_mode = CtrlMode::OEM437;
+        bool        expand_tabs = false;
+    };
+    ProcessingOptions m_suspended_options;
+    FileOffset      m_last_read_begin = 0;  // For guessing the scroll direction.
+
+    SHBasic         m_mapping;              // Mapping object, when the file is memory mapped.
+    const BYTE*     m_view = nullptr;
+    FileOffset      m_view_offset = 0;
+    FileOffset      m_view_length = 0;
+    FileOffset      m_mapped_size = 0;
+    bool            m_remap = false;        // Released while idle; map again on demand.
+
+    PatchOverlay    m_patches;              // Edits that haven't been saved.
+    PatchOverlay    m_patches_saved;        // Edits that have been saved (for UndoSave).
+    std::vector<BYTE> m_hex_values;         // Scratch for formatting hex rows.
+    std::vector<ColorElement> m_hex_colors; // Scratch for formatting hex rows.
+    std::vector<WCHAR> m_hex_digits;        // Scratch for formatting hex rows.
+    uint32          m_content_generation = 0; // Changes whenever edits or reprocessing could change search results.
+
+    // Everything besides FormattedRowKey that affects formatting rows, as
+    // of the last time the row cache was used.
+    struct RowCacheState
+    {
+        void        Capture(const ContentCache& cache);
+        bool        Equals(const RowCacheState& other) const;
+        uint32      content_generation = 0;
+        uint32      generation = 0;
+        unsigned    wrap = 0;
+        unsigned    line_count_width = 0;
+        unsigned    file_size_width = 0;
+        unsigned    tab_width = 0;
+        CtrlMode    ctrl_mode = CtrlMode::OEM437;
+        WCHAR       filter_byte_char = 0;
+        bool        binary = false;
+        bool        expand_tabs = false;
+        bool        show_whitespace = false;
+        bool        show_line_endings = false;
+        bool        show_line_numbers = false;
+        bool        show_file_offsets = false;
+        bool        show_debug_info = false;
+    };
+    FormattedRowCache m_row_cache;
+    RowCacheState   m_row_cache_state;
+
+    SHBasic         m_bg_thread;
+    ProgressChannel m_bg_progress;          // Canceling it stops the worker.
+    ProgressChannel* m_progress = nullptr;
+    const std::vector<FoundOffset>* m_highlights = nullptr;
 };
 
+
+// Enables bulk reads for the duration of a scan, restoring the previous
+// setting afterwards.
+class BulkReadScope
+{
+public:
+                    BulkReadScope(ContentCache& cache) : m_cache(cache), m_prev(cache.SetBulkReads(true)) {}
+                    ~BulkReadScope() { m_cache.SetBulkReads(m_prev); }
+private:
+    ContentCache&   m_cache;
+    const bool      m_prev;
+};
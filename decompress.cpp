@@ -0,0 +1,542 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "decompress.h"
+#include "signaled.h"
+
+#include <algorithm>
+
+#ifdef INCLUDE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef INCLUDE_ZSTD
+#include <zstd.h>
+#endif
+
+static const DWORD c_input_size = 64 * 1024;
+static const DWORD c_skip_size = 64 * 1024;
+static const size_t c_max_points = 512;
+static const FileOffset c_initial_span = 1024 * 1024;
+
+#pragma region // CompressedFile
+
+CompressedFile::CompressedFile(HANDLE file, FileOffset raw_size)
+: m_file(file)
+, m_raw_size(raw_size)
+, m_span(c_initial_span)
+{
+    m_input.resize(c_input_size);
+}
+
+bool CompressedFile::Read(const FileOffset offset, BYTE* const dest, DWORD length, DWORD& bytes_read, Error& e)
+{
+    bytes_read = 0;
+    if (offset >= m_size)
+        return true;
+    length = DWORD(min<FileOffset>(length, m_size - offset));
+
+    // Continue from where the stream is, unless it's already past offset or
+    // a seek point is closer.
+    const SeekPoint& point = m_points[FindPoint(offset)];
+    if (!m_cursor_valid || m_cursor > offset || m_cursor < point.out)
+    {
+        m_cursor_valid = false;
+        if (!Restart(point, e))
+            return false;
+        m_cursor = point.out;
+        m_cursor_valid = true;
+    }
+
+    DWORD produced;
+    while (m_cursor < offset)
+    {
+        if (m_skip.empty())
+            m_skip.resize(c_skip_size);
+        if (!Decompress(m_skip.data(), DWORD(min<FileOffset>(m_skip.size(), offset - m_cursor)), produced, e))
+            goto LError;
+        if (!produced)
+            return true;
+        m_cursor += produced;
+    }
+
+    while (bytes_read < length)
+    {
+        if (!Decompress(dest + bytes_read, length - bytes_read, produced, e))
+            goto LError;
+        if (!produced)
+            break;
+        bytes_read += produced;
+        m_cursor += produced;
+    }
+    return true;
+
+LError:
+    m_cursor_valid = false;
+    return false;
+}
+
+size_t CompressedFile::MemoryUsage() const
+{
+    size_t usage = m_input.size() + m_skip.size() + m_points.capacity() * sizeof(m_points[0]);
+    for (const auto& point : m_points)
+        usage += point.window.capacity();
+    return usage + StreamMemoryUsage();
+}
+
+bool CompressedFile::ReadAt(FileOffset offset, BYTE* dest, DWORD length, DWORD& bytes_read) const
+{
+    LARGE_INTEGER liMove;
+    liMove.QuadPart = offset;
+    bytes_read = 0;
+    return (SetFilePointerEx(m_file, liMove, nullptr, FILE_BEGIN) &&
+            ReadFile(m_file, dest, length, &bytes_read, nullptr));
+}
+
+bool CompressedFile::IsTimeForPoint(FileOffset out) const
+{
+    return m_points.empty() || out - m_points.back().out >= m_span;
+}
+
+void CompressedFile::AddPoint(SeekPoint&& point)
+{
+    if (m_points.size() >= c_max_points)
+    {
+        size_t kept = 1;
+        for (size_t ii = 2; ii < m_points.size(); ii += 2)
+            m_points[kept++] = std::move(m_points[ii]);
+        m_points.resize(kept);
+        m_span *= 2;
+    }
+    m_points.emplace_back(std::move(point));
+}
+
+size_t CompressedFile::FindPoint(FileOffset offset) const
+{
+    assert(!m_points.empty());
+    assert(!m_points[0].out);
+    const auto it = std::upper_bound(m_points.begin(), m_points.end(), offset, [](FileOffset value, const SeekPoint& point) {
+        return value < point.out;
+    });
+    return (it - m_points.begin()) - 1;
+}
+
+#pragma endregion // CompressedFile
+
+#ifdef INCLUDE_ZLIB
+#pragma region // GzipFile
+
+static const DWORD c_gzip_window = 32768;
+static const int c_gzip_window_bits = 15 + 16;  // Parse the gzip header and trailer.
+static const int c_raw_window_bits = -15;       // Raw deflate data.
+
+class GzipFile : public CompressedFile
+{
+public:
+                    GzipFile(HANDLE file, FileOffset raw_size) : CompressedFile(file, raw_size) {}
+                    ~GzipFile();
+
+protected:
+    bool            BuildIndex(Error& e) override;
+    bool            Restart(const SeekPoint& point, Error& e) override;
+    bool            Decompress(BYTE* dest, DWORD length, DWORD& produced, Error& e) override;
+    size_t          StreamMemoryUsage() const override;
+
+private:
+    bool            Fill(DWORD min_avail, Error& e);
+    bool            NextMember(bool& more, Error& e);
+
+private:
+    z_stream        m_strm = {};
+    bool            m_strm_init = false;
+    bool            m_raw = false;          // Started mid-member, so the trailer isn't parsed.
+    FileOffset      m_in_pos = 0;           // Offset in the file just past the input.
+};
+
+GzipFile::~GzipFile()
+{
+    if (m_strm_init)
+        inflateEnd(&m_strm);
+}
+
+bool GzipFile::BuildIndex(Error& e)
+{
+    if (inflateInit2(&m_strm, c_gzip_window_bits) != Z_OK)
+    {
+        e.Set(L"Unable to initialize zlib.");
+        return false;
+    }
+    m_strm_init = true;
+
+    // The output goes around a circular window, so that the 32KB preceding
+    // any deflate block boundary is available when adding a point there.
+    std::vector<BYTE> window(c_gzip_window);
+    FileOffset out = 0;
+    FileOffset member_out = 0;
+
+    AddPoint({ 0, 0, -1 });
+    m_strm.avail_out = 0;
+    while (true)
+    {
+        if (IsSignaled())
+        {
+            e.Set(E_ABORT);
+            return false;
+        }
+
+        if (!Fill(1, e))
+            return false;
+        if (!m_strm.avail_in)
+            break;  // Truncated; show what's there.
+
+        if (!m_strm.avail_out)
+        {
+            m_strm.next_out = window.data();
+            m_strm.avail_out = c_gzip_window;
+        }
+
+        const uInt avail_out = m_strm.avail_out;
+        const int ret = inflate(&m_strm, Z_BLOCK);
+        out += avail_out - m_strm.avail_out;
+
+        if (ret == Z_STREAM_END)
+        {
+            bool more;
+            if (!NextMember(more, e))
+                return false;
+            if (!more)
+                break;
+            member_out = out;
+            if (IsTimeForPoint(out))
+                AddPoint({ out, m_in_pos - m_strm.avail_in, -1 });
+            continue;
+        }
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            // If nothing decompressed, then it isn't really gzip data.
+            // Otherwise show what's before the corruption.
+            if (!out)
+                return false;
+            break;
+        }
+
+        // The end of any deflate block other than the last one is a place
+        // where decompression can restart, given the bits already consumed
+        // from the current byte and the window.
+        if ((m_strm.data_type & 128) && !(m_strm.data_type & 64) && IsTimeForPoint(out))
+        {
+            SeekPoint point = { out, m_in_pos - m_strm.avail_in, m_strm.data_type & 7 };
+            const DWORD left = m_strm.avail_out;
+            point.window.resize(c_gzip_window);
+            memcpy(point.window.data(), window.data() + c_gzip_window - left, left);
+            memcpy(point.window.data() + left, window.data(), c_gzip_window - left);
+            // Output from before the member isn't part of its window.
+            const FileOffset have = out - member_out;
+            if (have < c_gzip_window)
+                point.window.erase(point.window.begin(), point.window.end() - size_t(have));
+            AddPoint(std::move(point));
+        }
+    }
+
+    m_size = out;
+    return true;
+}
+
+bool GzipFile::Restart(const SeekPoint& point, Error& e)
+{
+    m_raw = (point.bits >= 0);
+    if (inflateReset2(&m_strm, m_raw ? c_raw_window_bits : c_gzip_window_bits) != Z_OK)
+    {
+LError:
+        e.Set(L"Unable to initialize zlib.");
+        return false;
+    }
+    m_strm.next_in = m_input.data();
+    m_strm.avail_in = 0;
+    m_in_pos = point.in;
+
+    if (point.bits > 0)
+    {
+        BYTE partial;
+        DWORD bytes_read;
+        if (!ReadAt(point.in - 1, &partial, 1, bytes_read))
+        {
+            e.Sys();
+            return false;
+        }
+        if (bytes_read != 1)
+        {
+            e.Sys(ERROR_HANDLE_EOF);
+            return false;
+        }
+        if (inflatePrime(&m_strm, point.bits, partial >> (8 - point.bits)) != Z_OK)
+            goto LError;
+    }
+
+    if (!point.window.empty() && inflateSetDictionary(&m_strm, point.window.data(), uInt(point.window.size())) != Z_OK)
+        goto LError;
+    return true;
+}
+
+bool GzipFile::Decompress(BYTE* const dest, const DWORD length, DWORD& produced, Error& e)
+{
+    produced = 0;
+    while (produced < length)
+    {
+        if (!Fill(1, e))
+            return false;
+        if (!m_strm.avail_in)
+            break;
+
+        m_strm.next_out = dest + produced;
+        m_strm.avail_out = length - produced;
+        const int ret = inflate(&m_strm, Z_NO_FLUSH);
+        produced = length - m_strm.avail_out;
+
+        if (ret == Z_STREAM_END)
+        {
+            bool more;
+            if (!NextMember(more, e))
+                return false;
+            if (!more)
+                break;
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            e.Set(L"The compressed data is corrupt.");
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t GzipFile::StreamMemoryUsage() const
+{
+    // Approximately the inflate state plus its window.
+    return 8 * 1024 + c_gzip_window;
+}
+
+bool GzipFile::Fill(DWORD min_avail, Error& e)
+{
+    // Keeps any unused input, so a few bytes can be peeked at across the
+    // end of the buffer.
+    if (m_strm.avail_in >= min_avail)
+        return true;
+    if (m_strm.avail_in)
+        memmove(m_input.data(), m_strm.next_in, m_strm.avail_in);
+    m_strm.next_in = m_input.data();
+
+    DWORD bytes_read;
+    if (!ReadAt(m_in_pos, m_input.data() + m_strm.avail_in, DWORD(m_input.size()) - m_strm.avail_in, bytes_read))
+    {
+        e.Sys();
+        return false;
+    }
+    m_in_pos += bytes_read;
+    m_strm.avail_in += bytes_read;
+    return true;
+}
+
+bool GzipFile::NextMember(bool& more, Error& e)
+{
+    // Gzip files can be concatenated, and the result is a valid gzip file.
+    // Anything else after a member is ignored.
+    more = false;
+
+    if (m_raw)
+    {
+        // Skip the CRC and length that end the member.
+        if (!Fill(8, e))
+            return false;
+        if (m_strm.avail_in < 8)
+            return true;
+        m_strm.next_in += 8;
+        m_strm.avail_in -= 8;
+    }
+
+    if (!Fill(2, e))
+        return false;
+    if (m_strm.avail_in < 2 || m_strm.next_in[0] != 0x1f || m_strm.next_in[1] != 0x8b)
+        return true;
+
+    if (inflateReset2(&m_strm, c_gzip_window_bits) != Z_OK)
+    {
+        e.Set(L"Unable to initialize zlib.");
+        return false;
+    }
+    m_raw = false;
+    more = true;
+    return true;
+}
+
+#pragma endregion // GzipFile
+#endif // INCLUDE_ZLIB
+
+#ifdef INCLUDE_ZSTD
+#pragma region // ZstdFile
+
+class ZstdFile : public CompressedFile
+{
+public:
+                    ZstdFile(HANDLE file, FileOffset raw_size) : CompressedFile(file, raw_size) {}
+                    ~ZstdFile() { ZSTD_freeDCtx(m_dctx); }
+
+protected:
+    bool            BuildIndex(Error& e) override;
+    bool            Restart(const SeekPoint& point, Error& e) override;
+    bool            Decompress(BYTE* dest, DWORD length, DWORD& produced, Error& e) override;
+    size_t          StreamMemoryUsage() const override { return ZSTD_sizeof_DCtx(m_dctx); }
+
+private:
+    bool            Fill(Error& e);
+
+private:
+    ZSTD_DCtx*      m_dctx = nullptr;
+    ZSTD_inBuffer   m_in = {};
+    FileOffset      m_in_pos = 0;           // Offset in the file just past the input.
+    bool            m_pending = false;      // The context may hold more output.
+};
+
+bool ZstdFile::BuildIndex(Error& e)
+{
+    m_dctx = ZSTD_createDCtx();
+    if (!m_dctx)
+    {
+        e.Set(L"Unable to initialize zstd.");
+        return false;
+    }
+
+    // Frames are decompressed independently, so each frame boundary is a
+    // place where decompression can restart.  Data written as a single
+    // frame can only restart from the beginning.
+    std::vector<BYTE> scratch(ZSTD_DStreamOutSize());
+    FileOffset out = 0;
+
+    AddPoint({ 0, 0, -1 });
+    m_in = { m_input.data(), 0, 0 };
+    while (true)
+    {
+        if (IsSignaled())
+        {
+            e.Set(E_ABORT);
+            return false;
+        }
+
+        if (!m_pending)
+        {
+            if (!Fill(e))
+                return false;
+            if (m_in.pos >= m_in.size)
+                break;  // Truncated or complete.
+        }
+
+        ZSTD_outBuffer output = { scratch.data(), scratch.size(), 0 };
+        const size_t ret = ZSTD_decompressStream(m_dctx, &output, &m_in);
+        if (ZSTD_isError(ret))
+        {
+            // If nothing decompressed, then it isn't really zstd data.
+            // Otherwise show what's before the corruption.
+            if (!out)
+                return false;
+            break;
+        }
+        out += output.pos;
+        m_pending = (ret && output.pos == output.size);
+
+        if (!ret && IsTimeForPoint(out))
+            AddPoint({ out, m_in_pos - (m_in.size - m_in.pos), -1 });
+    }
+
+    m_size = out;
+    return true;
+}
+
+bool ZstdFile::Restart(const SeekPoint& point, Error& e)
+{
+    if (ZSTD_isError(ZSTD_DCtx_reset(m_dctx, ZSTD_reset_session_only)))
+    {
+        e.Set(L"Unable to initialize zstd.");
+        return false;
+    }
+    m_in = { m_input.data(), 0, 0 };
+    m_in_pos = point.in;
+    m_pending = false;
+    return true;
+}
+
+bool ZstdFile::Decompress(BYTE* const dest, const DWORD length, DWORD& produced, Error& e)
+{
+    produced = 0;
+    while (produced < length)
+    {
+        if (!m_pending)
+        {
+            if (!Fill(e))
+                return false;
+            if (m_in.pos >= m_in.size)
+                break;
+        }
+
+        ZSTD_outBuffer output = { dest + produced, length - produced, 0 };
+        const size_t ret = ZSTD_decompressStream(m_dctx, &output, &m_in);
+        if (ZSTD_isError(ret))
+        {
+            e.Set(L"The compressed data is corrupt.");
+            return false;
+        }
+        produced += DWORD(output.pos);
+        m_pending = (ret && output.pos == output.size);
+    }
+    return true;
+}
+
+bool ZstdFile::Fill(Error& e)
+{
+    if (m_in.pos < m_in.size)
+        return true;
+
+    DWORD bytes_read;
+    if (!ReadAt(m_in_pos, m_input.data(), DWORD(m_input.size()), bytes_read))
+    {
+        e.Sys();
+        return false;
+    }
+    m_in = { m_input.data(), bytes_read, 0 };
+    m_in_pos += bytes_read;
+    return true;
+}
+
+#pragma endregion // ZstdFile
+#endif // INCLUDE_ZSTD
+
+std::unique_ptr<CompressedFile> OpenCompressedFile(HANDLE file, FileOffset raw_size, Error& e)
+{
+    std::unique_ptr<CompressedFile> compressed;
+
+#if defined(INCLUDE_ZLIB) || defined(INCLUDE_ZSTD)
+    BYTE magic[4];
+    DWORD len = 0;
+    LARGE_INTEGER liMove;
+    liMove.QuadPart = 0;
+    if (!SetFilePointerEx(file, liMove, nullptr, FILE_BEGIN) ||
+        !ReadFile(file, magic, sizeof(magic), &len, nullptr))
+        return nullptr;
+
+#ifdef INCLUDE_ZLIB
+    if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        compressed = std::make_unique<GzipFile>(file, raw_size);
+#endif
+#ifdef INCLUDE_ZSTD
+    if (len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        compressed = std::make_unique<ZstdFile>(file, raw_size);
+#endif
+
+    if (compressed && !compressed->BuildIndex(e))
+        compressed.reset();
+#endif
+
+    return compressed;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+
+#include <memory>
+#include <vector>
+
+typedef unsigned __int64 FileOffset;
+
+class Error;
+
+// Random access to the uncompressed content of a gzip or zstd file.
+//
+// Opening makes one pass over the whole compressed stream to learn the
+// uncompressed size, and records seek points along the way:  for gzip each
+// point is a deflate block boundary plus the 32KB of output preceding it (as
+// in zlib's zran example), and for zstd each point is a frame boundary.  A
+// read decompresses forward from the nearest point at or before the offset,
+// and the stream is kept where the read ended so that sequential reads don't
+// restart from a point.
+//
+// The number of points is bounded, so memory stays bounded no matter how big
+// the file is; when the table fills, every other point is dropped and the
+// spacing between points doubles.
+//
+// Each format is only supported when built with the corresponding premake
+// option (--zlib or --zstd).
+class CompressedFile
+{
+protected:
+    struct SeekPoint
+    {
+        FileOffset  out;                    // Offset in the uncompressed data.
+        FileOffset  in;                     // Offset in the compressed file.
+        int         bits;                   // Gzip bits in the byte before in, or -1 at the start of a member.
+        std::vector<BYTE> window;           // Gzip output preceding the point.
+    };
+
+public:
+    virtual         ~CompressedFile() = default;
+
+    FileOffset      GetSize() const { return m_size; }
+    FileOffset      GetRawSize() const { return m_raw_size; }
+    bool            Read(FileOffset offset, BYTE* dest, DWORD length, DWORD& bytes_read, Error& e);
+    size_t          MemoryUsage() const;
+
+protected:
+                    CompressedFile(HANDLE file, FileOffset raw_size);
+    virtual bool    BuildIndex(Error& e) = 0;
+    virtual bool    Restart(const SeekPoint& point, Error& e) = 0;
+    virtual bool    Decompress(BYTE* dest, DWORD length, DWORD& produced, Error& e) = 0;
+    virtual size_t  StreamMemoryUsage() const = 0;
+
+    bool            ReadAt(FileOffset offset, BYTE* dest, DWORD length, DWORD& bytes_read) const;
+    bool            IsTimeForPoint(FileOffset out) const;
+    void            AddPoint(SeekPoint&& point);
+
+private:
+    size_t          FindPoint(FileOffset offset) const;
+
+protected:
+    const HANDLE    m_file;                 // Not owned.
+    FileOffset      m_size = 0;
+    const FileOffset m_raw_size;
+    std::vector<BYTE> m_input;
+
+private:
+    FileOffset      m_cursor = 0;           // Uncompressed offset where the stream is.
+    bool            m_cursor_valid = false;
+    std::vector<SeekPoint> m_points;
+    FileOffset      m_span;
+    std::vector<BYTE> m_skip;               // Scratch for decompressing up to an offset.
+
+    friend std::unique_ptr<CompressedFile> OpenCompressedFile(HANDLE file, FileOffset raw_size, Error& e);
+};
+
+// Returns nullptr without setting e if the file isn't compressed in a
+// supported format.  Sets e to E_ABORT if indexing is canceled.
+std::unique_ptr<CompressedFile> OpenCompressedFile(HANDLE file, FileOffset raw_size, Error& e);
@@ -0,0 +1,243 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "dirsize.h"
+#include "os.h"
+
+#include <thread>
+
+// Sizing is mostly waiting on the file system, so a few threads are enough
+// to keep it busy without flooding it.
+static const unsigned c_max_dirsize_threads = 8;
+
+DirectorySizes::DirectorySizes()
+{
+    InitializeCriticalSection(&m_cs);
+}
+
+DirectorySizes::~DirectorySizes()
+{
+    if (!m_stop.Empty())
+        SetEvent(m_stop);
+    ++m_generation;
+    for (const auto& thread : m_threads)
+        WaitForSingleObject(thread, INFINITE);
+    m_threads.clear();
+    DeleteCriticalSection(&m_cs);
+}
+
+bool DirectorySizes::Start()
+{
+    if (!m_threads.empty())
+        return true;
+
+    m_stop = CreateEvent(nullptr, true, false, nullptr);
+    m_wake = CreateSemaphore(nullptr, 0, LONG_MAX, nullptr);
+    if (m_stop.Empty() || m_wake.Empty())
+        return false;
+
+    const unsigned count = clamp<unsigned>(std::thread::hardware_concurrency(), 1, c_max_dirsize_threads);
+    for (unsigned ii = 0; ii < count; ++ii)
+    {
+        HANDLE thread = CreateThread(nullptr, 0, WorkerProc, this, 0, nullptr);
+        if (thread)
+            m_threads.emplace_back(thread);
+    }
+    return !m_threads.empty();
+}
+
+void DirectorySizes::MakeKey(const WCHAR* dir, std::wstring& key)
+{
+    key.assign(dir);
+    while (key.length() > 3 && (key.back() == '\\' || key.back() == '/'))
+        key.pop_back();
+    if (!key.empty())
+        CharLowerBuffW(&key[0], DWORD(key.length()));
+}
+
+void DirectorySizes::Queue(const WCHAR* dir, const FILETIME& modified)
+{
+    Request req;
+    MakeKey(dir, req.dir);
+    req.modified = modified;
+
+    unsigned __int64 size;
+    if (Lookup(req.dir.c_str(), modified, size))
+        return;
+    if (!Start())
+        return;
+
+    EnterCriticalSection(&m_cs);
+    req.generation = m_generation.load(std::memory_order_relaxed);
+    const bool added = m_queued.emplace(req.dir).second;
+    if (added)
+    {
+        m_queue.emplace_back(std::move(req));
+        ++m_busy;
+    }
+    LeaveCriticalSection(&m_cs);
+
+    if (added)
+        ReleaseSemaphore(m_wake, 1, nullptr);
+}
+
+void DirectorySizes::CancelPending()
+{
+    // Requests in progress stay busy until their workers notice.
+    EnterCriticalSection(&m_cs);
+    ++m_generation;
+    m_busy -= int32(m_queue.size());
+    m_queue.clear();
+    m_queued.clear();
+    LeaveCriticalSection(&m_cs);
+}
+
+void DirectorySizes::ClearCache()
+{
+    EnterCriticalSection(&m_cs);
+    m_cache.clear();
+    LeaveCriticalSection(&m_cs);
+}
+
+bool DirectorySizes::Lookup(const WCHAR* dir, const FILETIME& modified, unsigned __int64& size) const
+{
+    std::wstring key;
+    MakeKey(dir, key);
+
+    bool found = false;
+    EnterCriticalSection(&m_cs);
+    const auto iter = m_cache.find(key);
+    if (iter != m_cache.end() && CompareFileTime(&iter->second.modified, &modified) == 0)
+    {
+        size = iter->second.size;
+        found = true;
+    }
+    LeaveCriticalSection(&m_cs);
+    return found;
+}
+
+void DirectorySizes::Store(const std::wstring& dir, const FILETIME& modified, unsigned __int64 size)
+{
+    EnterCriticalSection(&m_cs);
+    Entry& entry = m_cache[dir];
+    entry.modified = modified;
+    entry.size = size;
+    LeaveCriticalSection(&m_cs);
+    ++m_completed;
+}
+
+bool DirectorySizes::IsCanceled(uint32 generation) const
+{
+    return generation != m_generation.load(std::memory_order_relaxed);
+}
+
+bool DirectorySizes::DequeueRequest(Request& req)
+{
+    bool got = false;
+    EnterCriticalSection(&m_cs);
+    if (!m_queue.empty())
+    {
+        req = std::move(m_queue.front());
+        m_queue.pop_front();
+        got = true;
+    }
+    LeaveCriticalSection(&m_cs);
+    return got;
+}
+
+bool DirectorySizes::SumDirectory(std::wstring& dir, const uint32 generation, unsigned __int64& total)
+{
+    const size_t dir_len = dir.length();
+    if (dir_len && dir.back() != '\\')
+        dir.push_back('\\');
+    const size_t base_len = dir.length();
+    dir.push_back('*');
+
+    WIN32_FIND_DATAW fd;
+    SHFind hfind = FindFirstFileExW(dir.c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (hfind.Empty())
+    {
+        dir.resize(dir_len);
+        return !IsCanceled(generation);
+    }
+
+    bool ok = true;
+    do
+    {
+        if (IsCanceled(generation))
+        {
+            ok = false;
+            break;
+        }
+
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            // Don't follow junctions or symlinks, so cycles and other
+            // volumes aren't counted.
+            if (OS::IsPseudoDirectory(fd.cFileName) || (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+                continue;
+
+            dir.resize(base_len);
+            dir.append(fd.cFileName);
+            CharLowerBuffW(&dir[base_len], DWORD(dir.length() - base_len));
+
+            unsigned __int64 size;
+            if (!Lookup(dir.c_str(), fd.ftLastWriteTime, size))
+            {
+                size = 0;
+                if (!SumDirectory(dir, generation, size))
+                {
+                    ok = false;
+                    break;
+                }
+                Store(dir, fd.ftLastWriteTime, size);
+            }
+            total += size;
+        }
+        else
+        {
+            ULARGE_INTEGER size;
+            size.LowPart = fd.nFileSizeLow;
+            size.HighPart = fd.nFileSizeHigh;
+            total += size.QuadPart;
+        }
+    }
+    while (FindNextFileW(hfind, &fd));
+
+    dir.resize(dir_len);
+    return ok;
+}
+
+DWORD WINAPI DirectorySizes::WorkerProc(void* param)
+{
+    DirectorySizes* const self = static_cast<DirectorySizes*>(param);
+    const HANDLE handles[] = { self->m_stop, self->m_wake };
+
+    while (WaitForMultipleObjects(_countof(handles), handles, false, INFINITE) == WAIT_OBJECT_0 + 1)
+    {
+        // The request may have been canceled since it was queued.
+        Request req;
+        if (!self->DequeueRequest(req))
+            continue;
+
+        unsigned __int64 size = 0;
+        if (!self->IsCanceled(req.generation))
+        {
+            std::wstring dir(req.dir);
+            if (self->SumDirectory(dir, req.generation, size))
+                self->Store(req.dir, req.modified, size);
+        }
+
+        // Canceling already forgot the queued requests.
+        EnterCriticalSection(&self->m_cs);
+        if (!self->IsCanceled(req.generation))
+            self->m_queued.erase(req.dir);
+        --self->m_busy;
+        LeaveCriticalSection(&self->m_cs);
+    }
+
+    return 0;
+}
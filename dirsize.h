@@ -0,0 +1,78 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "str.h"
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Totals the sizes of the files under directories, recursively, on a pool
+// of worker threads.  Each result is cached by path along with the
+// directory's last write time, and is reused only while the time is the
+// same.  Sizing a directory also caches the sizes of all the directories
+// under it, so navigating into one shows its subdirectories' sizes at once.
+//
+// A directory's last write time only changes when its own entries change,
+// so changes deeper down aren't noticed until the cache is cleared.
+class DirectorySizes
+{
+    struct Entry
+    {
+        FILETIME    modified;
+        unsigned __int64 size;
+    };
+
+    struct Request
+    {
+        std::wstring dir;
+        FILETIME    modified;
+        uint32      generation;
+    };
+
+public:
+                    DirectorySizes();
+                    ~DirectorySizes();
+
+    // Queues a directory to be sized, unless it's already cached.
+    void            Queue(const WCHAR* dir, const FILETIME& modified);
+    // Drops queued directories, and stops sizing the ones in progress.
+    void            CancelPending();
+    void            ClearCache();
+
+    bool            Lookup(const WCHAR* dir, const FILETIME& modified, unsigned __int64& size) const;
+
+    // Counts directories sized so far; when it changes there are new
+    // results to Lookup().
+    uint32          GetCompleted() const { return m_completed.load(std::memory_order_acquire); }
+    bool            IsBusy() const { return m_busy.load(std::memory_order_acquire) > 0; }
+
+private:
+    bool            Start();
+    bool            DequeueRequest(Request& req);
+    bool            SumDirectory(std::wstring& dir, uint32 generation, unsigned __int64& total);
+    void            Store(const std::wstring& dir, const FILETIME& modified, unsigned __int64 size);
+    bool            IsCanceled(uint32 generation) const;
+    static void     MakeKey(const WCHAR* dir, std::wstring& key);
+    static DWORD WINAPI WorkerProc(void* param);
+
+private:
+    mutable CRITICAL_SECTION m_cs;
+    std::unordered_map<std::wstring, Entry> m_cache;    // Protected by m_cs.
+    std::deque<Request> m_queue;                        // Protected by m_cs.
+    std::unordered_set<std::wstring> m_queued;          // Protected by m_cs.
+    std::vector<SHBasic> m_threads;
+    SHBasic         m_wake;                 // Semaphore counting queued requests.
+    SHBasic         m_stop;
+    std::atomic<uint32> m_generation = 0;
+    std::atomic<uint32> m_completed = 0;
+    std::atomic<int32> m_busy = 0;          // Queued plus in progress.
+};
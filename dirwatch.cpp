@@ -0,0 +1,106 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "dirwatch.h"
+
+// Big enough for a burst of changes; if it overflows, the caller rescans.
+static const DWORD c_watch_buffer_size = 64 * 1024;
+
+static const DWORD c_watch_filter = (FILE_NOTIFY_CHANGE_FILE_NAME |
+                                     FILE_NOTIFY_CHANGE_DIR_NAME |
+                                     FILE_NOTIFY_CHANGE_ATTRIBUTES |
+                                     FILE_NOTIFY_CHANGE_SIZE |
+                                     FILE_NOTIFY_CHANGE_LAST_WRITE);
+
+bool DirectoryWatcher::Start(const WCHAR* dir)
+{
+    Stop();
+
+    m_event = CreateEvent(nullptr, true, false, nullptr);
+    m_buffer = static_cast<DWORD*>(malloc(c_watch_buffer_size));
+    if (m_event.Empty() || !m_buffer)
+    {
+        Stop();
+        return false;
+    }
+
+    m_dir_handle = CreateFileW(dir, FILE_LIST_DIRECTORY, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, nullptr,
+                               OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS|FILE_FLAG_OVERLAPPED, 0);
+    if (m_dir_handle.Empty() || !Read())
+    {
+        Stop();
+        return false;
+    }
+    return true;
+}
+
+void DirectoryWatcher::Stop()
+{
+    if (m_pending)
+    {
+        CancelIoEx(m_dir_handle, &m_overlapped);
+        DWORD bytes;
+        GetOverlappedResult(m_dir_handle, &m_overlapped, &bytes, true);
+        m_pending = false;
+    }
+    m_dir_handle.Close();
+    m_event.Close();
+    free(m_buffer);
+    m_buffer = nullptr;
+}
+
+bool DirectoryWatcher::Read()
+{
+    ZeroMemory(&m_overlapped, sizeof(m_overlapped));
+    m_overlapped.hEvent = m_event;
+    if (!ReadDirectoryChangesW(m_dir_handle, m_buffer, c_watch_buffer_size, false, c_watch_filter, nullptr, &m_overlapped, nullptr))
+        return false;
+    m_pending = true;
+    return true;
+}
+
+bool DirectoryWatcher::TakeChanges(std::unordered_set<std::wstring>& names)
+{
+    if (!m_pending || WaitForSingleObject(m_event, 0) != WAIT_OBJECT_0)
+        return IsWatching();
+
+    DWORD bytes;
+    m_pending = false;
+    const bool ok = !!GetOverlappedResult(m_dir_handle, &m_overlapped, &bytes, false);
+
+    // No bytes means the buffer overflowed and the changes were lost.  An
+    // error usually means the directory itself went away; either way the
+    // directory needs to be scanned again, and watching stops on error.
+    if (!ok || !bytes)
+    {
+        if (!ok || !Read())
+            Stop();
+        return false;
+    }
+
+    std::wstring name;
+    const BYTE* p = reinterpret_cast<const BYTE*>(m_buffer);
+    while (true)
+    {
+        const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+        name.assign(info->FileName, info->FileNameLength / sizeof(WCHAR));
+        if (!name.empty())
+        {
+            CharLowerBuffW(&name[0], DWORD(name.length()));
+            names.emplace(std::move(name));
+        }
+        if (!info->NextEntryOffset)
+            break;
+        p += info->NextEntryOffset;
+    }
+
+    if (!Read())
+    {
+        Stop();
+        return false;
+    }
+    return true;
+}
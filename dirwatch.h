@@ -0,0 +1,44 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "str.h"
+
+#include <string>
+#include <unordered_set>
+
+// Watches a directory (not its subdirectories) for entries being added,
+// removed, renamed, or modified, so a listing can be updated with just the
+// changes instead of scanning the whole directory again.
+class DirectoryWatcher
+{
+public:
+                    DirectoryWatcher() = default;
+                    ~DirectoryWatcher() { Stop(); }
+
+    bool            Start(const WCHAR* dir);
+    void            Stop();
+    bool            IsWatching() const { return !m_dir_handle.Empty(); }
+    HANDLE          GetEvent() const { return m_event; }    // Signaled when changes arrive.
+
+    // Collects the names of the entries that changed since the last call,
+    // lowercased.  Each may have been added, removed, or modified; the
+    // caller looks at what's there now.  Returns false if changes were lost
+    // (e.g. too many at once), in which case the directory needs to be
+    // scanned again.
+    bool            TakeChanges(std::unordered_set<std::wstring>& names);
+
+private:
+    bool            Read();
+
+private:
+    SHFile          m_dir_handle;
+    SHBasic         m_event;
+    OVERLAPPED      m_overlapped = {};
+    DWORD*          m_buffer = nullptr;         // DWORD aligned, as required.
+    bool            m_pending = false;
+};
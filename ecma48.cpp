@@ -12,10 +12,16 @@
 #include "wcwidth_iter.h"
 
 #include <assert.h>
+#include <emmintrin.h>
 
 //------------------------------------------------------------------------------
 uint32 cell_count(const WCHAR* in)
 {
+    // Printable ASCII has no escape codes, and is one cell per character.
+    const uint32 len = uint32(wcslen(in));
+    if (__printable_ascii_prefix(in, len) == len)
+        return len;
+
     uint32 count = 0;
 
     ecma48_state state;
@@ -31,6 +37,50 @@ uint32 cell_count(const WCHAR* in)
     return count;
 }
 
+//------------------------------------------------------------------------------
+// Footer fragments, key names, and menu items are measured again every time
+// they're drawn, and they're almost always the same strings as last time.  So
+// remember the widths of recent ones, in a small table indexed by a hash of
+// the content.  The table is only for the UI thread.
+struct cell_count_entry
+{
+    uint32 hash = 0;
+    uint32 cells = 0;
+    StrW text;
+};
+static cell_count_entry s_cell_count_cache[256];
+static const uint32 c_max_cached_length = 256;
+
+uint32 cached_cell_count(const WCHAR* in)
+{
+    uint32 hash = 2166136261;
+    uint32 len = 0;
+    for (const WCHAR* walk = in; *walk; ++walk, ++len)
+    {
+        if (len >= c_max_cached_length)
+            return cell_count(in);
+        hash = (hash ^ *walk) * 16777619;
+    }
+
+    cell_count_entry& entry = s_cell_count_cache[hash % _countof(s_cell_count_cache)];
+    if (entry.hash != hash || entry.text.Length() != len || wmemcmp(entry.text.Text(), in, len) != 0)
+    {
+        entry.hash = hash;
+        entry.cells = cell_count(in);
+        entry.text.Set(in, len);
+    }
+    return entry.cells;
+}
+
+void clear_cell_count_cache()
+{
+    for (auto& entry : s_cell_count_cache)
+    {
+        entry.hash = 0;
+        entry.text.Clear();
+    }
+}
+
 //------------------------------------------------------------------------------
 static bool in_range(int32 value, int32 left, int32 right)
 {
@@ -345,6 +395,62 @@ int32 str_iter::next()
     return 0;
 }
 
+//------------------------------------------------------------------------------
+// Advances past everything up to the next C0 control code (which includes the
+// nul terminator), eight characters at a time.  Surrogate pairs are never
+// split, since neither half is a control code.
+void str_iter::skip_text()
+{
+    const __m128i below = _mm_set1_epi16(0x20);
+    const __m128i zero = _mm_setzero_si128();
+    // Lanes below 0x20 saturate to nonzero; everything else to zero.
+    auto find_c0 = [&](__m128i chars) -> int
+    {
+        return ~_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(below, chars), zero)) & 0xffff;
+    };
+
+    const WCHAR* ptr = m_ptr;
+    if (m_end >= ptr)
+    {
+        for (; ptr + 8 <= m_end; ptr += 8)
+        {
+            const int mask = find_c0(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)));
+            if (mask)
+            {
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                m_ptr = ptr + bit / 2;
+                return;
+            }
+        }
+        while (ptr < m_end && *ptr >= 0x20)
+            ++ptr;
+    }
+    else
+    {
+        // Without a length, only the nul says where the string ends.  So
+        // read aligned blocks, which can't cross into an unreadable page.
+        while ((uintptr_t(ptr) & 15) && *ptr >= 0x20)
+            ++ptr;
+        if (!(uintptr_t(ptr) & 15))
+        {
+            while (true)
+            {
+                const int mask = find_c0(_mm_load_si128(reinterpret_cast<const __m128i*>(ptr)));
+                if (mask)
+                {
+                    unsigned long bit;
+                    _BitScanForward(&bit, mask);
+                    ptr += bit / 2;
+                    break;
+                }
+                ptr += 8;
+            }
+        }
+    }
+    m_ptr = ptr;
+}
+
 //------------------------------------------------------------------------------
 bool str_iter::more() const
 {
@@ -471,7 +577,9 @@ bool ecma48_iter::next_char(int32 c)
         return true;
     }
 
+    // Plain text usually comes in long runs; skip to the end of the run.
     m_iter.next();
+    m_iter.skip_text();
     return false;
 }
 
@@ -638,6 +746,17 @@ void ecma48_processor(const WCHAR* in, StrW* out, uint32* cell_count, ecma48_pro
     bool colorless = !!int32(flags & ecma48_processor_flags::colorless);
     bool lineless = !!int32(flags & ecma48_processor_flags::lineless);
 
+    // Printable ASCII has no escape codes, and is one cell per character.
+    const uint32 len = uint32(wcslen(in));
+    if (__printable_ascii_prefix(in, len) == len)
+    {
+        if (out)
+            out->Append(in, len);
+        if (cell_count)
+            *cell_count = len;
+        return;
+    }
+
     ecma48_state state;
     ecma48_iter iter(in, state);
     while (const ecma48_code& code = iter.next())
@@ -21,6 +21,8 @@ enum class ecma48_processor_flags { none = 0, plaintext = 1<<1, colorless = 1<<2
 DEFINE_ENUM_FLAG_OPERATORS(ecma48_processor_flags);
 void ecma48_processor(const WCHAR* in, StrW* out, uint32* cell_count, ecma48_processor_flags flags=ecma48_processor_flags::none);
 uint32 cell_count(const WCHAR*);
+uint32 cached_cell_count(const WCHAR*);     // UI thread only.
+void clear_cell_count_cache();
 
 //------------------------------------------------------------------------------
 enum ecma48_state_enum
@@ -166,6 +168,7 @@ public:
     void            truncate(unsigned len);
     int32           peek();
     int32           next();
+    void            skip_text();
     bool            more() const;
     uint32          length() const;
 
@@ -38,7 +38,22 @@ int32 ellipsify(const WCHAR* in, int32 limit, StrW& out, bool expand_ctrl)
             break;
         if (code.get_type() == ecma48_code::type_chars)
         {
-            wcwidth_iter inner_iter(code.get_pointer(), code.get_length());
+            // Printable ASCII that fits before the ellipsis can be copied
+            // as is.  Leave the last ASCII character for the iterator, in
+            // case it begins a sequence.
+            const WCHAR* chars = code.get_pointer();
+            int32 chars_len = int32(code.get_length());
+            const int32 ascii = int32(__printable_ascii_prefix(chars, uint32(chars_len)));
+            const int32 fast = min<int32>((ascii == chars_len) ? ascii : ascii - 1, limit - c_ellipsis_cells - visible_len);
+            if (fast > 0)
+            {
+                out.Append(chars, fast);
+                visible_len += fast;
+                chars += fast;
+                chars_len -= fast;
+            }
+
+            wcwidth_iter inner_iter(chars, chars_len);
             while (const int32 c = inner_iter.next())
             {
                 const int32 clen = (inner_iter.character_wcwidth_signed() < 0) ? (expand_ctrl ? 2 : 1) : inner_iter.character_wcwidth_signed();
@@ -5,12 +5,13 @@
 
 #include "pch.h"
 #include "encodings.h"
+#include "perf.h"
 
 #include <unordered_set>
+#include <emmintrin.h>
 #include <MLang.h>
 
 static bool s_multibyte_enabled = true;
-static HRESULT s_hr_coinit = E_UNEXPECTED;
 static IMultiLanguage* s_mlang1 = nullptr;
 static IMultiLanguage2* s_mlang = nullptr;
 
@@ -30,6 +31,10 @@ static const DWORD c_ctrl_binary = 0b00000011111111111100000101111111;
 // Bit 0 is ambiguous; it could be a UTF16 file.
 // BEL/TAB/LF/VT/FF/CR/EOF ctrl codes are textual.
 
+// When analyzing samples, at most one byte in this many may be a control
+// code that means the file is binary.
+static const size_t c_binary_ratio = 1000;
+
 inline bool IsBinary(BYTE c)
 {
     return (c <= 26 && (c_ctrl_binary & (1 << c)));
@@ -228,27 +233,39 @@ void Utf8Accumulator::ClearInvalid()
 #pragma endregion // Utf8Accumulator
 #pragma region // MLang
 
+// COM is only needed for MLang, so it isn't initialized until something
+// first needs MLang.  That can be on a background thread, so where possible
+// the whole process joins the MTA instead of just the calling thread.
 bool TryCoInitialize()
 {
-    static bool s_inited = false;
-    if (!s_inited)
-        s_hr_coinit = CoInitializeEx(NULL, COINIT_MULTITHREADED);
-    return SUCCEEDED(s_hr_coinit);
-}
-bool IsCoInitialized()
-{
+    static const HRESULT s_hr_coinit = []()
+    {
+        // The cookie is a CO_MTA_USAGE_COOKIE, which older SDKs don't declare.
+        typedef HRESULT (WINAPI* CoIncrementMTAUsage_t)(HANDLE* cookie);
+        const HMODULE hlib = GetModuleHandleW(L"combase.dll");
+        const auto pfn = hlib ? CoIncrementMTAUsage_t(GetProcAddress(hlib, "CoIncrementMTAUsage")) : nullptr;
+
+        // The cookie is never released; the MTA lasts until the process
+        // exits.
+        HANDLE cookie;
+        HRESULT hr = pfn ? pfn(&cookie) : E_NOTIMPL;
+        if (FAILED(hr))
+            hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+        return hr;
+    }();
     return SUCCEEDED(s_hr_coinit);
 }
 
 static HRESULT EnsureMLang()
 {
-    static bool s_inited = false;
-    static HRESULT s_hr_ensure = E_UNEXPECTED;
-    if (!s_inited)
+    static const HRESULT s_hr_ensure = []()
     {
-        static HRESULT s_hr_cocreate1 = CoCreateInstance(CLSID_CMultiLanguage, NULL, CLSCTX_INPROC_SERVER, IID_IMultiLanguage, (void**)&s_mlang1);
-        static HRESULT s_hr_cocreate2 = CoCreateInstance(CLSID_CMultiLanguage, NULL, CLSCTX_INPROC_SERVER, IID_IMultiLanguage2, (void**)&s_mlang);
-        if (FAILED(s_hr_cocreate1) || FAILED(s_hr_cocreate2))
+        if (!TryCoInitialize())
+            return E_FAIL;
+
+        const HRESULT hr_cocreate1 = CoCreateInstance(CLSID_CMultiLanguage, NULL, CLSCTX_INPROC_SERVER, IID_IMultiLanguage, (void**)&s_mlang1);
+        const HRESULT hr_cocreate2 = CoCreateInstance(CLSID_CMultiLanguage, NULL, CLSCTX_INPROC_SERVER, IID_IMultiLanguage2, (void**)&s_mlang);
+        if (FAILED(hr_cocreate1) || FAILED(hr_cocreate2))
         {
             if (s_mlang1)
             {
@@ -261,9 +278,9 @@ static HRESULT EnsureMLang()
                 s_mlang = nullptr;
             }
         }
-        s_hr_ensure = FAILED(s_hr_cocreate2) ? s_hr_cocreate2 : s_hr_cocreate1;
-        s_inited = true;
-    }
+        MarkStartup("MLang");
+        return FAILED(hr_cocreate2) ? hr_cocreate2 : hr_cocreate1;
+    }();
     return s_hr_ensure;
 }
 
@@ -368,6 +385,19 @@ static bool IsValidUTF8WithHighBit(const BYTE* bytes, int32 length)
     Utf8Accumulator acc;
     while (length > 0)
     {
+        // Skip 16 bytes at a time while they're all ASCII and no multibyte
+        // sequence is in progress.
+        if (length >= 16 && acc.Ready())
+        {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+            if (!_mm_movemask_epi8(x))
+            {
+                length -= 16;
+                bytes += 16;
+                continue;
+            }
+        }
+
         const int32 b = acc.Build(*bytes);
         if (b < 0)
             return false;
@@ -381,9 +411,6 @@ static bool IsValidUTF8WithHighBit(const BYTE* bytes, int32 length)
 
 static bool DetectCodePage(const BYTE* bytes, int32 length, UINT* codepage, StrW* encoding_name)
 {
-    if (!IsCoInitialized())
-        return false;
-
     // Shrink the length until the last character does not have the high bit
     // set.  This is meant to avoid ending on a severed multi-byte character,
     // which could skew the encoding detection.
@@ -435,7 +462,25 @@ static bool DetectCodePage(const BYTE* bytes, int32 length, UINT* codepage, StrW
     return SUCCEEDED(hr);
 }
 
-FileDataType AnalyzeFileType(const BYTE* const bytes, const size_t count, UINT* codepage, StrW* encoding_name)
+static FileDataType BinaryFileType(UINT* codepage, StrW* encoding_name)
+{
+    if (encoding_name)
+        encoding_name->Clear();
+    StrW tmp;
+    if (codepage)
+    {
+        *codepage = GetSingleByteOEMCP(&tmp);
+        if (encoding_name->Empty())
+        {
+            encoding_name->Set(L"Binary File");
+            if (!tmp.Empty())
+                encoding_name->Printf(L" (%s)", tmp.Text());
+        }
+    }
+    return FileDataType::Binary;
+}
+
+static bool AnalyzeFileTags(const BYTE* const bytes, const size_t count, UINT* codepage, StrW* encoding_name, FileDataType& type)
 {
     if (!count)
     {
@@ -444,7 +489,8 @@ FileDataType AnalyzeFileType(const BYTE* const bytes, const size_t count, UINT*
 binary_encoding:
         if (codepage)
             *codepage = GetSingleByteOEMCP();
-        return FileDataType::Binary;
+        type = FileDataType::Binary;
+        return true;
     }
 
     // Special case certain file type tags for binary files that could
@@ -465,7 +511,8 @@ binary_encoding:
                 *codepage = CP_WINUNICODE;
             if (encoding_name)
                 GetCodePageName(CP_WINUNICODE, *encoding_name);
-            return FileDataType::Text;
+            type = FileDataType::Text;
+            return true;
         }
         if (!memcmp(bytes, c_tag_Motorola, sizeof(c_tag_Motorola)))
         {
@@ -473,7 +520,8 @@ binary_encoding:
                 *codepage = 1201;
             if (encoding_name)
                 GetCodePageName(1201, *encoding_name);
-            return FileDataType::Text;
+            type = FileDataType::Text;
+            return true;
         }
     }
 
@@ -486,34 +534,16 @@ binary_encoding:
                 *codepage = CP_UTF8;
             if (encoding_name)
                 encoding_name->Set(L"Unicode (UTF-8)");
-            return FileDataType::Text;
+            type = FileDataType::Text;
+            return true;
         }
     }
 
-    // Check for binary files by scanning the first 4096 bytes for control
-    // characters other than BEL, TAB, CR, LF, VT, FF, or ^Z.
-    const BYTE* p = bytes;
-    for (size_t ii = count; ii--; ++p)
-    {
-        if (IsBinary(*p))
-        {
-            if (encoding_name)
-                encoding_name->Clear();
-            StrW tmp;
-            if (codepage)
-            {
-                *codepage = GetSingleByteOEMCP(&tmp);
-                if (encoding_name->Empty())
-                {
-                    encoding_name->Set(L"Binary File");
-                    if (!tmp.Empty())
-                        encoding_name->Printf(L" (%s)", tmp.Text());
-                }
-            }
-            return FileDataType::Binary;
-        }
-    }
+    return false;
+}
 
+static FileDataType AnalyzeTextEncoding(const BYTE* const bytes, const size_t count, UINT* codepage, StrW* encoding_name)
+{
     if (codepage)
     {
         *codepage = 0;
@@ -529,6 +559,51 @@ binary_encoding:
     return FileDataType::Text;
 }
 
+FileDataType AnalyzeFileType(const BYTE* const bytes, const size_t count, UINT* codepage, StrW* encoding_name)
+{
+    FileDataType type;
+    if (AnalyzeFileTags(bytes, count, codepage, encoding_name, type))
+        return type;
+
+    // Check for binary files by scanning the first 4096 bytes for control
+    // characters other than BEL, TAB, CR, LF, VT, FF, or ^Z.
+    const BYTE* p = bytes;
+    for (size_t ii = count; ii--; ++p)
+    {
+        if (IsBinary(*p))
+            return BinaryFileType(codepage, encoding_name);
+    }
+
+    return AnalyzeTextEncoding(bytes, count, codepage, encoding_name);
+}
+
+FileDataType AnalyzeFileSamples(const BYTE* const bytes, const size_t count, const size_t head_count, UINT* codepage, StrW* encoding_name)
+{
+    assert(head_count <= count);
+
+    FileDataType type;
+    if (AnalyzeFileTags(bytes, head_count, codepage, encoding_name, type))
+        return type;
+
+    // With samples from across the file, a NUL anywhere still means binary,
+    // but other control characters only mean binary if there are more than a
+    // trace of them.  E.g. a log file may contain an occasional backspace.
+    size_t num_binary = 0;
+    for (size_t ii = 0; ii < count; ++ii)
+    {
+        if (IsBinary(bytes[ii]))
+        {
+            if (!bytes[ii])
+                return BinaryFileType(codepage, encoding_name);
+            ++num_binary;
+        }
+    }
+    if (num_binary * c_binary_ratio > count)
+        return BinaryFileType(codepage, encoding_name);
+
+    return AnalyzeTextEncoding(bytes, count, codepage, encoding_name);
+}
+
 #pragma endregion // MLang
 #pragma region // Decoders
 
@@ -572,6 +647,12 @@ uint32 Utf8Decoder::Decode(const BYTE* p, uint32 available, uint32& num_bytes)
 #ifdef DEBUG
     const BYTE* orig = p;
 #endif
+    if (*p < 0x80)
+    {
+        num_bytes = 1;
+        return *p;
+    }
+
     Utf8Accumulator acc;
     while (available)
     {
@@ -599,10 +680,19 @@ public:
     uint32          Decode(const BYTE* p, uint32 available, uint32& num_bytes) override;
 private:
     uint32          DecodeOneCodepoint(const CHAR* src, UINT src_size, WCHAR* dst, UINT dst_size);
+    uint32          DecodeProbe(const BYTE* p, uint32 available, uint32& num_bytes);
+    const uint32*   EnsureTrailTable(BYTE lead);
 private:
     const UINT      m_codepage;
     CPINFOEXW       m_info;
     IMLangConvertCharset* m_converter = nullptr;
+
+    // For double byte code pages, a lead byte bitmap and a table per lead
+    // byte mapping trail bytes to codepoints (0 if invalid).  The tables are
+    // filled from the OS converter the first time each lead byte is seen.
+    bool            m_dbcs = false;
+    uint32          m_lead_bits[256 / 32] = {};
+    std::unique_ptr<uint32[]> m_trail_tables[256];
 };
 
 MultiByteDecoder::MultiByteDecoder(UINT codepage)
@@ -621,7 +711,15 @@ MultiByteDecoder::MultiByteDecoder(UINT codepage)
             m_converter->Release();
             m_converter = nullptr;
         }
+        return;
+    }
+
+    for (const BYTE* range = m_info.LeadByte; range[0] || range[1]; range += 2)
+    {
+        for (uint32 b = range[0]; b <= range[1]; ++b)
+            m_lead_bits[b / 32] |= 1u << (b % 32);
     }
+    m_dbcs = (m_info.MaxCharSize == 2);
 }
 
 MultiByteDecoder::~MultiByteDecoder()
@@ -659,41 +757,92 @@ uint32 MultiByteDecoder::DecodeOneCodepoint(const CHAR* src, UINT src_size, WCHA
 #endif
 }
 
+const uint32* MultiByteDecoder::EnsureTrailTable(BYTE lead)
+{
+    if (!m_trail_tables[lead])
+    {
+        m_trail_tables[lead] = std::make_unique<uint32[]>(256);
+        uint32* const table = m_trail_tables[lead].get();
+
+        CHAR src[2] = { CHAR(lead) };
+        WCHAR dst[8];
+        for (uint32 trail = 0; trail < 256; ++trail)
+        {
+            src[1] = CHAR(trail);
+            const uint32 dst_size = DecodeOneCodepoint(src, 2, dst, _countof(dst));
+            uint32 c = 0;
+            if (dst_size == 1)
+            {
+                c = dst[0];
+            }
+            else if (dst_size == 2)
+            {
+                c = dst[0];
+                c <<= 10;
+                c += dst[1];
+                c -= 0x35fdc00;
+            }
+            table[trail] = c;
+        }
+    }
+    return m_trail_tables[lead].get();
+}
+
+uint32 MultiByteDecoder::DecodeProbe(const BYTE* p, uint32 available, uint32& num_bytes)
+{
+    CHAR* src = const_cast<CHAR*>(reinterpret_cast<const CHAR*>(p));
+    WCHAR dst[8];
+
+    if (available > m_info.MaxCharSize)
+        available = m_info.MaxCharSize;
+
+    for (uint32 num = 1; num <= available; ++num)
+    {
+        const uint32 dst_size = DecodeOneCodepoint(src, num, dst, _countof(dst));
+        if (dst_size)
+        {
+            assert(dst_size == 1 || dst_size == 2);
+            uint32 c = dst[0];
+            if (dst_size == 2)
+            {
+                c <<= 10;
+                c += dst[1];
+                c -= 0x35fdc00;
+            }
+            num_bytes = num;
+            return c;
+        }
+    }
+
+    return 0;
+}
+
 uint32 MultiByteDecoder::Decode(const BYTE* p, uint32 available, uint32& num_bytes)
 {
     assert(available > 0);
     assert(Valid());
 
     // If the input is a lead byte, then decode the input.
-    for (const BYTE* range = m_info.LeadByte; range[0] || range[1]; range += 2)
+    const BYTE lead = *p;
+    if (m_lead_bits[lead / 32] & (1u << (lead % 32)))
     {
-        if (range[0] <= *p && *p <= range[1])
+        if (m_dbcs)
         {
-            CHAR* src = const_cast<CHAR*>(reinterpret_cast<const CHAR*>(p));
-            WCHAR dst[8];
-
-            if (available > m_info.MaxCharSize)
-                available = m_info.MaxCharSize;
-
-            for (uint32 num = 1; num < available; ++num)
+            if (available >= 2)
             {
-                const uint32 dst_size = DecodeOneCodepoint(src, num, dst, _countof(dst));
-                if (dst_size)
+                const uint32 c = EnsureTrailTable(lead)[p[1]];
+                if (c)
                 {
-                    assert(dst_size == 1 || dst_size == 2);
-                    uint32 c = dst[0];
-                    if (dst_size == 2)
-                    {
-                        c <<= 10;
-                        c += dst[1];
-                        c -= 0x35fdc00;
-                    }
-                    num_bytes = num;
+                    num_bytes = 2;
                     return c;
                 }
             }
-
-            break;
+        }
+        else
+        {
+            const uint32 c = DecodeProbe(p, available, num_bytes);
+            if (c)
+                return c;
         }
     }
 
@@ -761,7 +910,7 @@ invalid_one_wchar:
 
     p += 2;
     const WCHAR wch2 = Next(p);
-    if (wch < 0xDC00 || wch > 0xDFFF)
+    if (wch2 < 0xDC00 || wch2 > 0xDFFF)
         goto invalid_one_wchar;
 
     uint32 c = wch;
@@ -848,7 +997,7 @@ bool IsCodePageAllowed(UINT cp)
     return true;
 }
 
-std::vector<EncodingDefinition> GetAvailableEncodings()
+static std::vector<EncodingDefinition> EnumAvailableEncodings()
 {
     std::unordered_set<UINT> installed_codepages;
     std::unordered_set<UINT> codepages;
@@ -901,4 +1050,12 @@ std::vector<EncodingDefinition> GetAvailableEncodings()
     return encodings;
 }
 
+std::vector<EncodingDefinition> GetAvailableEncodings()
+{
+    // Enumerating is slow (it loads MLang and walks every installed
+    // codepage), and the answer doesn't change while the program runs.
+    static const std::vector<EncodingDefinition> s_encodings = EnumAvailableEncodings();
+    return s_encodings;
+}
+
 #pragma endregion // Available Encodings
@@ -14,6 +14,9 @@ class StrW;
 
 enum class FileDataType { Binary, Text };
 FileDataType AnalyzeFileType(const BYTE* bytes, size_t count, UINT* codepage=nullptr, StrW* encoding_name=nullptr);
+// The first head_count bytes are from the beginning of the file, and the rest
+// are samples of whole lines from elsewhere in the file.
+FileDataType AnalyzeFileSamples(const BYTE* bytes, size_t count, size_t head_count, UINT* codepage=nullptr, StrW* encoding_name=nullptr);
 
 // Decodes input into UTF32 codepoints.
 struct IDecoder
@@ -31,7 +34,6 @@ struct IDecoder
 std::unique_ptr<IDecoder> CreateDecoder(UINT codepage);
 
 bool TryCoInitialize();
-bool IsCoInitialized();
 bool IsCodePageAllowed(UINT cp);
 bool GetCodePageName(UINT cp, StrW& encoding_name);
 UINT GetSingleByteOEMCP(StrW* encoding_name=nullptr);
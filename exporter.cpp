@@ -0,0 +1,248 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "exporter.h"
+#include "error.h"
+#include "os.h"
+
+// Writes smaller than this are gathered; bigger ones go straight through,
+// in pieces of this size so canceling doesn't wait long.
+static const DWORD c_export_buffer_size = 4 * 1024 * 1024;
+static const DWORD c_export_pipe_size = 1024 * 1024;
+
+// How often to check for canceling while waiting for a command to exit.
+static const DWORD c_export_poll = 100;
+
+Exporter::~Exporter()
+{
+    // Not closed normally, so the export failed or was canceled.
+    if (!m_file.Empty())
+    {
+        m_file.Close();
+        if (!m_process.Empty())
+            TerminateProcess(m_process, 1);
+        else
+            DeleteFileW(m_name.Text());
+    }
+    if (m_buffer)
+        VirtualFree(m_buffer, 0, MEM_RELEASE);
+}
+
+bool Exporter::OpenFile(const WCHAR* name, Error& e)
+{
+    assert(m_file.Empty());
+    m_file = CreateFileW(name, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file.Empty())
+    {
+        e.Sys();
+        return false;
+    }
+    // A partially written file is deleted if the export doesn't finish.
+    m_name.Set(name);
+    return EnsureBuffer(e);
+}
+
+bool Exporter::OpenCommand(const WCHAR* command, Error& e)
+{
+    assert(m_file.Empty());
+
+    StrW comspec;
+    if (!OS::GetEnv(L"COMSPEC", comspec))
+        comspec.Set(L"cmd.exe");
+
+    // Writing to the pipe is overlapped, so that canceling works even if the
+    // command stops reading its input.  Anonymous pipes can't be overlapped,
+    // so it's a uniquely named pipe.
+    static volatile LONG s_serial = 0;
+    WCHAR pipe_name[64];
+    swprintf_s(pipe_name, _countof(pipe_name), L"\\\\.\\pipe\\list-export-%u-%u", GetCurrentProcessId(), DWORD(InterlockedIncrement(&s_serial)));
+    m_file = CreateNamedPipeW(pipe_name, PIPE_ACCESS_OUTBOUND|FILE_FLAG_FIRST_PIPE_INSTANCE|FILE_FLAG_OVERLAPPED,
+                              PIPE_TYPE_BYTE|PIPE_WAIT|PIPE_REJECT_REMOTE_CLIENTS, 1, c_export_pipe_size, 0, 0, nullptr);
+    if (m_file.Empty())
+    {
+        e.Sys();
+        return false;
+    }
+    m_event = CreateEvent(nullptr, true, false, nullptr);
+    if (m_event.Empty())
+    {
+        e.Sys();
+        m_file.Close();
+        return false;
+    }
+
+    // Only the read end of the pipe and NUL are inherited.  The command's
+    // output has nowhere to go while the viewer owns the screen, so it goes
+    // to NUL; the command line can still redirect it.
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, true/*bInheritHandle*/ };
+    SHFile input = CreateFileW(pipe_name, GENERIC_READ, 0, &sa, OPEN_EXISTING, 0, nullptr);
+    if (input.Empty())
+    {
+        e.Sys();
+        m_file.Close();
+        return false;
+    }
+
+    SHFile output = CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+
+    StrW cmdline;
+    cmdline.AppendMaybeQuoted(comspec.Text());
+    cmdline.Append(L" /c ");
+    cmdline.Append(command);
+
+    STARTUPINFOW si = { sizeof(si) };
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = input;
+    si.hStdOutput = output.Empty() ? nullptr : output.Get();
+    si.hStdError = si.hStdOutput;
+
+    // Its own process group keeps Ctrl-Break from reaching it; canceling
+    // the export terminates it instead.
+    const HANDLE inherit[] = { si.hStdInput, si.hStdOutput };
+    PROCESS_INFORMATION pi = {};
+    if (!OS::CreateProcessInheriting(cmdline.Reserve(0), CREATE_NEW_PROCESS_GROUP, si, inherit, _countof(inherit), pi))
+    {
+        e.Sys();
+        m_file.Close();
+        return false;
+    }
+
+    CloseHandle(pi.hThread);
+    m_process = pi.hProcess;
+    return EnsureBuffer(e);
+}
+
+bool Exporter::EnsureBuffer(Error& e)
+{
+    if (!m_buffer)
+    {
+        // VirtualAlloc is page aligned.
+        m_buffer = static_cast<BYTE*>(VirtualAlloc(nullptr, c_export_buffer_size, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE));
+        if (!m_buffer)
+        {
+            e.Sys();
+            return false;
+        }
+    }
+    m_used = 0;
+    return true;
+}
+
+bool Exporter::Write(const BYTE* p, size_t len, Error& e)
+{
+    assert(m_buffer);
+
+    if (m_used + len > c_export_buffer_size)
+    {
+        if (!Flush(e))
+            return false;
+        if (len >= c_export_buffer_size)
+            return WriteThrough(p, len, e);
+    }
+
+    memcpy(m_buffer + m_used, p, len);
+    m_used += DWORD(len);
+    return true;
+}
+
+bool Exporter::WriteThrough(const BYTE* p, size_t len, Error& e)
+{
+    while (len)
+    {
+        if (m_progress.IsCanceled())
+        {
+            e.Set(E_ABORT);
+            return false;
+        }
+
+        DWORD written = 0;
+        const DWORD chunk = DWORD(std::min<size_t>(len, c_export_buffer_size));
+        if (!m_event.Empty())
+        {
+            // Wait in polls, so canceling works even if the command isn't
+            // reading.
+            OVERLAPPED ov = {};
+            ov.hEvent = m_event;
+            if (!WriteFile(m_file, p, chunk, nullptr, &ov))
+            {
+                if (GetLastError() != ERROR_IO_PENDING)
+                {
+                    e.Sys();
+                    return false;
+                }
+                while (WaitForSingleObject(m_event, c_export_poll) == WAIT_TIMEOUT)
+                {
+                    if (m_progress.IsCanceled())
+                    {
+                        CancelIoEx(m_file, &ov);
+                        GetOverlappedResult(m_file, &ov, &written, true/*bWait*/);
+                        e.Set(E_ABORT);
+                        return false;
+                    }
+                }
+            }
+            if (!GetOverlappedResult(m_file, &ov, &written, false/*bWait*/))
+            {
+                e.Sys();
+                return false;
+            }
+        }
+        else if (!WriteFile(m_file, p, chunk, &written, nullptr))
+        {
+            e.Sys();
+            return false;
+        }
+
+        p += written;
+        len -= written;
+        m_written += written;
+        m_progress.Publish(m_written, 0);
+    }
+    return true;
+}
+
+bool Exporter::Flush(Error& e)
+{
+    const DWORD used = m_used;
+    m_used = 0;
+    return WriteThrough(m_buffer, used, e);
+}
+
+bool Exporter::Close(Error& e)
+{
+    if (m_file.Empty())
+        return true;
+
+    const bool flushed = Flush(e);
+    m_file.Close();
+
+    if (!m_name.Empty())
+    {
+        if (!flushed)
+            DeleteFileW(m_name.Text());
+        m_name.Clear();
+    }
+
+    if (!m_process.Empty())
+    {
+        // Closing stdin lets the command finish.
+        while (WaitForSingleObject(m_process, c_export_poll) == WAIT_TIMEOUT)
+        {
+            if (m_progress.IsCanceled())
+            {
+                TerminateProcess(m_process, 1);
+                if (flushed)
+                    e.Set(E_ABORT);
+                break;
+            }
+        }
+        if (!GetExitCodeProcess(m_process, &m_exit_code))
+            m_exit_code = DWORD(-1);
+        m_process.Close();
+    }
+
+    return flushed && !e.Test();
+}
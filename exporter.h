@@ -0,0 +1,53 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "str.h"
+#include "progress.h"
+
+class Error;
+typedef unsigned __int64 FileOffset;
+
+// Writes exported bytes to a file, or to the stdin of a command run with
+// %COMSPEC% /c.  Small writes are gathered into a page aligned buffer, and
+// big ones go straight through, so the destination always sees big writes.
+// Writing checks the progress channel for cancellation, and publishes the
+// number of bytes written to it.  A file that isn't closed successfully
+// (e.g. the export failed or was canceled) is deleted.
+class Exporter
+{
+public:
+                    Exporter(ProgressChannel& progress) : m_progress(progress) {}
+                    ~Exporter();
+
+    bool            OpenFile(const WCHAR* name, Error& e);
+    bool            OpenCommand(const WCHAR* command, Error& e);
+    bool            Write(const BYTE* p, size_t len, Error& e);
+    // Flushes, and for a command closes its stdin and waits for it to exit
+    // (canceling terminates it).
+    bool            Close(Error& e);
+
+    bool            IsCommand() const { return !m_process.Empty(); }
+    FileOffset      GetWritten() const { return m_written; }
+    DWORD           GetExitCode() const { return m_exit_code; }
+
+private:
+    bool            EnsureBuffer(Error& e);
+    bool            WriteThrough(const BYTE* p, size_t len, Error& e);
+    bool            Flush(Error& e);
+
+private:
+    ProgressChannel& m_progress;
+    SHFile          m_file;
+    StrW            m_name;                 // The file, for deleting it if the export fails.
+    SHBasic         m_event;                // For overlapped writes to a command.
+    SHBasic         m_process;
+    BYTE*           m_buffer = nullptr;
+    DWORD           m_used = 0;
+    FileOffset      m_written = 0;
+    DWORD           m_exit_code = 0;
+};
@@ -0,0 +1,308 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "fields.h"
+#include "colors.h"
+#include "wcwidth.h"
+#include "wcwidth_iter.h"
+
+#include <algorithm>
+#include <intrin.h>
+#include <emmintrin.h>
+
+// Columns are capped, so one long field doesn't push the rest off screen.
+const unsigned c_max_column_width = 40;
+const unsigned c_min_column_width = 1;
+
+static const WCHAR c_column_separator[] = L" \u2502 ";    // " │ "
+const unsigned c_column_separator_cells = 3;
+
+void SplitFields(const WCHAR* text, unsigned len, WCHAR delimiter, std::vector<FieldSpan>& fields)
+{
+    fields.clear();
+
+    while (len && (text[len - 1] == '\n' || text[len - 1] == '\r'))
+        --len;
+
+    const bool quotes = (delimiter != '\t');
+    bool quoted = false;
+    unsigned begin = 0;
+
+    auto hit = [&](unsigned index)
+    {
+        if (text[index] != delimiter)
+            quoted = !quoted;
+        else if (!quoted)
+        {
+            fields.push_back({ begin, index });
+            begin = index + 1;
+        }
+    };
+
+    // Compare 8 characters at a time against the delimiter and the quote.
+    // Each character sets two bits in the mask.
+    const __m128i d = _mm_set1_epi16(short(delimiter));
+    const __m128i q = _mm_set1_epi16(short(quotes ? '"' : delimiter));
+    unsigned ii = 0;
+    for (; ii + 8 <= len; ii += 8)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + ii));
+        unsigned mask = unsigned(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(v, d), _mm_cmpeq_epi16(v, q))));
+        while (mask)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            hit(ii + bit / 2);
+            mask &= ~(3u << bit);
+        }
+    }
+    for (; ii < len; ++ii)
+    {
+        if (text[ii] == delimiter || (quotes && text[ii] == '"'))
+            hit(ii);
+    }
+
+    fields.push_back({ begin, len });
+}
+
+WCHAR DetectDelimiter(const std::vector<StrW>& rows)
+{
+    static const WCHAR c_candidates[] = { '\t', ',', ';', '|' };
+
+    std::vector<FieldSpan> fields;
+    std::vector<size_t> counts;
+    WCHAR best = 0;
+    size_t best_agree = 0;
+    size_t best_count = 0;
+    size_t nonempty = 0;
+
+    for (const WCHAR delimiter : c_candidates)
+    {
+        counts.clear();
+        for (const auto& row : rows)
+        {
+            if (!row.Length())
+                continue;
+            SplitFields(row.Text(), row.Length(), delimiter, fields);
+            counts.push_back(fields.size());
+        }
+        nonempty = counts.size();
+        if (!nonempty)
+            return 0;
+
+        // The most common number of fields is the shape of the data.
+        std::sort(counts.begin(), counts.end());
+        size_t mode = 0;
+        size_t agree = 0;
+        for (size_t ii = 0; ii < counts.size();)
+        {
+            size_t jj = ii;
+            while (jj < counts.size() && counts[jj] == counts[ii])
+                ++jj;
+            if (jj - ii >= agree)
+            {
+                agree = jj - ii;
+                mode = counts[ii];
+            }
+            ii = jj;
+        }
+
+        if (mode > 1 && (agree > best_agree || (agree == best_agree && mode > best_count)))
+        {
+            best = delimiter;
+            best_agree = agree;
+            best_count = mode;
+        }
+    }
+
+    // Most rows need to agree; one delimiter in a row of prose doesn't make
+    // a table.
+    return (best_agree * 2 > nonempty) ? best : 0;
+}
+
+void FieldLayout::Init(WCHAR delimiter)
+{
+    Clear();
+    m_delimiter = delimiter;
+}
+
+void FieldLayout::Clear()
+{
+    m_delimiter = 0;
+    m_widths.clear();
+    m_order.clear();
+}
+
+unsigned FieldLayout::MeasureField(const WCHAR* text, unsigned len)
+{
+    unsigned cells = 0;
+    wcwidth_iter iter(text, len);
+    while (iter.next())
+    {
+        cells += iter.character_wcwidth_onectrl();
+        if (cells >= c_max_column_width)
+            return c_max_column_width;
+    }
+    return cells;
+}
+
+void FieldLayout::AddFields(size_t count)
+{
+    while (m_widths.size() < count)
+    {
+        m_order.push_back(unsigned(m_widths.size()));
+        m_widths.push_back(c_min_column_width);
+    }
+}
+
+bool FieldLayout::Measure(const WCHAR* text, unsigned len)
+{
+    assert(m_delimiter);
+    SplitFields(text, len, m_delimiter, m_fields);
+    AddFields(m_fields.size());
+
+    bool wider = false;
+    for (size_t ii = 0; ii < m_fields.size(); ++ii)
+    {
+        const unsigned cells = MeasureField(text + m_fields[ii].begin, m_fields[ii].end - m_fields[ii].begin);
+        if (cells > m_widths[ii])
+        {
+            m_widths[ii] = cells;
+            wider = true;
+        }
+    }
+    return wider;
+}
+
+bool FieldLayout::Merge(const std::vector<unsigned>& widths)
+{
+    AddFields(widths.size());
+
+    bool wider = false;
+    for (size_t ii = 0; ii < widths.size(); ++ii)
+    {
+        const unsigned cells = std::min(widths[ii], c_max_column_width);
+        if (cells > m_widths[ii])
+        {
+            m_widths[ii] = cells;
+            wider = true;
+        }
+    }
+    return wider;
+}
+
+unsigned FieldLayout::GetColumnLeft(size_t column) const
+{
+    unsigned left = 0;
+    for (size_t ii = 0; ii < column && ii < m_order.size(); ++ii)
+        left += m_widths[m_order[ii]] + c_column_separator_cells;
+    return left;
+}
+
+void FieldLayout::HideColumn(size_t column)
+{
+    // Keep at least one column.
+    if (column < m_order.size() && m_order.size() > 1)
+        m_order.erase(m_order.begin() + column);
+}
+
+void FieldLayout::MoveColumn(size_t column, bool right)
+{
+    if (column >= m_order.size())
+        return;
+    if (right && column + 1 < m_order.size())
+        std::swap(m_order[column], m_order[column + 1]);
+    else if (!right && column > 0)
+        std::swap(m_order[column], m_order[column - 1]);
+}
+
+void FieldLayout::ShowAllColumns()
+{
+    m_order.clear();
+    for (size_t ii = 0; ii < m_widths.size(); ++ii)
+        m_order.push_back(unsigned(ii));
+}
+
+unsigned FieldLayout::FormatRow(const WCHAR* text, unsigned len, unsigned left, unsigned max_width, StrW& s, const WCHAR* color) const
+{
+    assert(m_delimiter);
+    SplitFields(text, len, m_delimiter, m_fields);
+
+    const WCHAR* const norm = color ? color : GetColor(ColorElement::Content);
+    const unsigned right = left + max_width;
+    unsigned pos = 0;
+
+    // Appends text that occupies cells, clipped to the visible range.  Wide
+    // characters that straddle an edge become spaces.
+    auto append = [&](const WCHAR* p, unsigned units, unsigned cells)
+    {
+        if (pos >= left && pos + cells <= right)
+            s.Append(p, units);
+        else if (pos + cells > left && pos < right)
+            s.AppendSpaces(std::min(pos + cells, right) - std::max(pos, left));
+        pos += cells;
+    };
+
+    s.AppendColor(norm);
+    for (size_t column = 0; column < m_order.size() && pos < right; ++column)
+    {
+        if (column)
+        {
+            if (pos + c_column_separator_cells > left && pos < right)
+                s.AppendColorOverlay(norm, GetColor(ColorElement::Divider));
+            append(c_column_separator, _countof(c_column_separator) - 1, c_column_separator_cells);
+            s.AppendColor(norm);
+        }
+
+        const unsigned field = m_order[column];
+        const unsigned width = m_widths[field];
+        const unsigned column_end = pos + width;
+        if (column_end <= left)
+        {
+            pos = column_end;
+            continue;
+        }
+
+        if (field < m_fields.size())
+        {
+            const WCHAR* const p = text + m_fields[field].begin;
+            const unsigned field_len = m_fields[field].end - m_fields[field].begin;
+            const bool truncate = (MeasureField(p, field_len) > width);
+            const unsigned limit = truncate ? column_end - 1 : column_end;
+
+            wcwidth_iter iter(p, field_len);
+            while (iter.next())
+            {
+                const int32 clen = iter.character_wcwidth_signed();
+                if (clen < 0)
+                {
+                    // Control characters (e.g. tabs in a CSV field).
+                    if (pos + 1 > limit)
+                        break;
+                    append(L" ", 1, 1);
+                }
+                else
+                {
+                    if (pos + clen > limit)
+                        break;
+                    append(iter.character_pointer(), iter.character_length(), clen);
+                }
+            }
+            if (truncate && pos < column_end)
+            {
+                while (pos + 1 < column_end)
+                    append(L" ", 1, 1);
+                append(L"\u2026", 1, 1);                    // …
+            }
+        }
+
+        while (pos < column_end && pos < right)
+            append(L" ", 1, 1);
+        pos = std::max(pos, column_end);
+    }
+
+    return (pos > left) ? std::min(pos, right) - left : 0;
+}
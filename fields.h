@@ -0,0 +1,66 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include <vector>
+
+#include "str.h"
+
+struct FieldSpan
+{
+    unsigned        begin;
+    unsigned        end;
+};
+
+// Finds the fields in a row of delimited text (TSV, CSV, etc).  The line
+// ending is ignored.  For delimiters other than tab, double quotes group a
+// field that contains the delimiter.
+void SplitFields(const WCHAR* text, unsigned len, WCHAR delimiter, std::vector<FieldSpan>& fields);
+
+// Picks the delimiter that splits most of the sample rows into the same
+// number of fields, or returns 0 if the rows don't look delimited.
+WCHAR DetectDelimiter(const std::vector<StrW>& rows);
+
+// Lays out the fields of delimited rows in aligned columns.  The widths come
+// from samples, so they can be refined as more rows are sampled; fields
+// wider than their column are truncated.  Columns can be hidden or moved.
+class FieldLayout
+{
+public:
+    void            Init(WCHAR delimiter);
+    void            Clear();
+    bool            Empty() const { return !m_delimiter; }
+    WCHAR           GetDelimiter() const { return m_delimiter; }
+
+    // Measuring returns true if any column got wider.
+    bool            Measure(const WCHAR* text, unsigned len);
+    bool            Merge(const std::vector<unsigned>& widths);
+    const std::vector<unsigned>& GetWidths() const { return m_widths; }
+
+    size_t          CountColumns() const { return m_order.size(); }
+    size_t          CountFields() const { return m_widths.size(); }
+    unsigned        GetField(size_t column) const { return m_order[column]; }
+    unsigned        GetColumnLeft(size_t column) const;
+    void            HideColumn(size_t column);
+    void            MoveColumn(size_t column, bool right);
+    void            ShowAllColumns();
+
+    // Formats the columns visible from left through max_width cells, and
+    // returns the number of cells.
+    unsigned        FormatRow(const WCHAR* text, unsigned len, unsigned left, unsigned max_width, StrW& s, const WCHAR* color) const;
+
+    static unsigned MeasureField(const WCHAR* text, unsigned len);
+
+private:
+    void            AddFields(size_t count);
+
+private:
+    WCHAR           m_delimiter = 0;
+    std::vector<unsigned> m_widths;         // Cells, by field index.
+    std::vector<unsigned> m_order;          // Field index of each visible column.
+    mutable std::vector<FieldSpan> m_fields;
+};
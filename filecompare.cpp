@@ -0,0 +1,499 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "filecompare.h"
+#include "contentcache.h"
+#include "vieweroptions.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+// A block ends after a row whose hash has these bits clear, so blocks
+// average 64 rows, but they never exceed c_max_block_rows.
+static const uint64 c_block_mask = 63;
+static const size_t c_max_block_rows = 1024;
+
+// When no element is unique, the histogram fallback splits on the rarest
+// element instead, but only if it's rare enough and the range is small
+// enough that repeated splitting can't take quadratic time on big inputs.
+static const uint32 c_max_histogram_count = 64;
+static const size_t c_max_histogram_span = 4096;
+
+static const uint64 c_fnv_basis = 0xcbf29ce484222325ull;
+static const uint64 c_fnv_prime = 0x100000001b3ull;
+
+static uint64 HashRow(const StrW& text)
+{
+    uint64 h = c_fnv_basis;
+    const WCHAR* p = text.Text();
+    for (unsigned len = text.Length(); len--; ++p)
+    {
+        h ^= uint64(*p);
+        h *= c_fnv_prime;
+    }
+    return h;
+}
+
+static uint64 MixHash(uint64 h, uint64 value)
+{
+    h ^= value + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    return h;
+}
+
+//------------------------------------------------------------------------------
+// Patience diff.
+
+typedef std::vector<std::pair<size_t, size_t>> Matches;
+
+struct MatchWork
+{
+    bool            is_match;
+    size_t          a_begin;
+    size_t          a_end;
+    size_t          b_begin;
+    size_t          b_end;
+};
+
+struct MatchCount
+{
+    uint32          count_a = 0;
+    uint32          count_b = 0;
+    size_t          pos_a = 0;                  // First occurrence.
+    size_t          pos_b = 0;                  // First occurrence.
+};
+
+// Finds anchors in the ranges:  the longest increasing run of elements that
+// occur exactly once in each range, or else one occurrence of the rarest
+// element.
+static void FindAnchors(const uint64* a, size_t a_begin, size_t a_end, const uint64* b, size_t b_begin, size_t b_end, Matches& anchors)
+{
+    anchors.clear();
+
+    std::unordered_map<uint64, MatchCount> counts;
+    counts.reserve(a_end - a_begin);
+    for (size_t i = a_begin; i < a_end; ++i)
+    {
+        MatchCount& c = counts[a[i]];
+        if (!c.count_a++)
+            c.pos_a = i;
+    }
+    for (size_t j = b_begin; j < b_end; ++j)
+    {
+        const auto it = counts.find(b[j]);
+        if (it != counts.end() && !it->second.count_b++)
+            it->second.pos_b = j;
+    }
+
+    // Unique in both, in the order they occur in a.
+    Matches unique;
+    for (size_t i = a_begin; i < a_end; ++i)
+    {
+        const MatchCount& c = counts[a[i]];
+        if (c.count_a == 1 && c.count_b == 1)
+            unique.emplace_back(i, c.pos_b);
+    }
+
+    if (unique.empty())
+    {
+        if (std::max(a_end - a_begin, b_end - b_begin) > c_max_histogram_span)
+            return;
+
+        const MatchCount* rarest = nullptr;
+        for (const auto& entry : counts)
+        {
+            const MatchCount& c = entry.second;
+            if (c.count_b && (!rarest || c.count_a + c.count_b < rarest->count_a + rarest->count_b))
+                rarest = &c;
+        }
+        if (rarest && rarest->count_a + rarest->count_b <= c_max_histogram_count)
+            anchors.emplace_back(rarest->pos_a, rarest->pos_b);
+        return;
+    }
+
+    // Patience sorting finds the longest increasing subsequence of b
+    // positions; each pile remembers the top of the previous pile.
+    std::vector<size_t> tops;                   // Index into unique.
+    std::vector<size_t> prev(unique.size());
+    for (size_t k = 0; k < unique.size(); ++k)
+    {
+        const size_t pos_b = unique[k].second;
+        const auto pile = std::lower_bound(tops.begin(), tops.end(), pos_b, [&](size_t top, size_t value) {
+            return unique[top].second < value;
+        });
+        prev[k] = (pile == tops.begin()) ? size_t(-1) : *(pile - 1);
+        if (pile == tops.end())
+            tops.emplace_back(k);
+        else
+            *pile = k;
+    }
+
+    for (size_t k = tops.back(); k != size_t(-1); k = prev[k])
+        anchors.emplace_back(unique[k]);
+    std::reverse(anchors.begin(), anchors.end());
+}
+
+// Appends the matching pairs of elements in increasing order.  Unmatched
+// elements between the pairs are the differences.
+static bool MatchSequences(const uint64* a, size_t a_size, const uint64* b, size_t b_size, Matches& matches, const ProgressChannel& progress)
+{
+    std::vector<MatchWork> stack;
+    Matches anchors;
+
+    stack.push_back({ false, 0, a_size, 0, b_size });
+    while (!stack.empty())
+    {
+        if (progress.IsCanceled())
+            return false;
+
+        MatchWork work = stack.back();
+        stack.pop_back();
+        if (work.is_match)
+        {
+            matches.emplace_back(work.a_begin, work.b_begin);
+            continue;
+        }
+
+        while (work.a_begin < work.a_end && work.b_begin < work.b_end && a[work.a_begin] == b[work.b_begin])
+            matches.emplace_back(work.a_begin++, work.b_begin++);
+
+        // The common suffix comes after everything in the middle, so it's
+        // pushed first.
+        while (work.a_begin < work.a_end && work.b_begin < work.b_end && a[work.a_end - 1] == b[work.b_end - 1])
+        {
+            --work.a_end;
+            --work.b_end;
+            stack.push_back({ true, work.a_end, 0, work.b_end, 0 });
+        }
+
+        if (work.a_begin >= work.a_end || work.b_begin >= work.b_end)
+            continue;
+
+        FindAnchors(a, work.a_begin, work.a_end, b, work.b_begin, work.b_end, anchors);
+
+        // Push the ranges between the anchors in reverse order, so they're
+        // processed in order.
+        size_t a_end = work.a_end;
+        size_t b_end = work.b_end;
+        for (size_t k = anchors.size(); k--;)
+        {
+            const auto& anchor = anchors[k];
+            stack.push_back({ false, anchor.first + 1, a_end, anchor.second + 1, b_end });
+            stack.push_back({ true, anchor.first, 0, anchor.second, 0 });
+            a_end = anchor.first;
+            b_end = anchor.second;
+        }
+        if (!anchors.empty())
+            stack.push_back({ false, work.a_begin, a_end, work.b_begin, b_end });
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Hashing.
+
+struct HashJob
+{
+    ContentCache*   ctx = nullptr;
+    std::vector<uint64> hashes;                 // One per block.
+    std::vector<size_t> rows;                   // First row of each block.
+    size_t          count = 0;                  // Total rows.
+    bool            ok = false;
+};
+
+static DWORD WINAPI HashBlocksProc(void* param)
+{
+    HashJob* const job = static_cast<HashJob*>(param);
+    ContentCache& ctx = *job->ctx;
+    BulkReadScope bulk(ctx);
+
+    Error e;
+    StrW text;
+    uint64 block = c_fnv_basis;
+    size_t block_rows = 0;
+    for (size_t index = 0; true; ++index)
+    {
+        if (!ctx.ProcessThrough(index, e, true/*cancelable*/) || index >= ctx.Count())
+            break;
+        if (!ctx.GetLineText(index, text, e))
+            break;
+
+        const uint64 h = HashRow(text);
+        if (!block_rows)
+            job->rows.emplace_back(index);
+        block = MixHash(block, h);
+        if ((h & c_block_mask) == 0 || ++block_rows >= c_max_block_rows)
+        {
+            job->hashes.emplace_back(block);
+            block = c_fnv_basis;
+            block_rows = 0;
+        }
+    }
+    if (block_rows)
+        job->hashes.emplace_back(block);
+
+    job->count = ctx.Count();
+    job->ok = !(e.Test() && e.Code() != ERROR_HANDLE_EOF);
+    return 0;
+}
+
+static bool HashRows(ContentCache& ctx, size_t begin, size_t end, std::vector<uint64>& hashes)
+{
+    Error e;
+    StrW text;
+    hashes.clear();
+    hashes.reserve(end - begin);
+    for (size_t index = begin; index < end; ++index)
+    {
+        if (!ctx.GetLineText(index, text, e))
+            return false;
+        hashes.emplace_back(HashRow(text));
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// FileCompare.
+
+bool FileCompare::Start(const WCHAR* name0, const ContentCache& context0, const WCHAR* name1)
+{
+    Clear();
+
+    m_names[0].Set(name0);
+    m_names[1].Set(name1);
+    m_codepage = context0.GetCodePage();
+    m_binary = context0.IsBinaryFile();
+    m_override_encoding = (m_codepage != context0.GetDetectedCodePage() || m_binary != context0.IsDetectedBinaryFile());
+
+    m_thread = CreateThread(nullptr, 0, WorkerProc, this, 0, nullptr);
+    if (m_thread.Empty())
+    {
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+void FileCompare::Clear()
+{
+    if (!m_thread.Empty())
+    {
+        m_progress[0].Cancel();
+        m_progress[1].Cancel();
+        WaitForSingleObject(m_thread, INFINITE);
+        m_thread.Close();
+    }
+
+    m_names[0].Clear();
+    m_names[1].Clear();
+    std::vector<Hunk>().swap(m_hunks);
+    m_progress[0].Reset();
+    m_progress[1].Reset();
+    m_complete = false;
+    m_canceled = false;
+}
+
+bool FileCompare::Poll()
+{
+    if (m_thread.Empty() || WaitForSingleObject(m_thread, 0) != WAIT_OBJECT_0)
+        return false;
+
+    m_thread.Close();
+    return true;
+}
+
+int FileCompare::GetSide(const WCHAR* name) const
+{
+    if (!IsActive() || !name)
+        return -1;
+    for (int side = 0; side < 2; ++side)
+    {
+        if (_wcsicmp(name, m_names[side].Text()) == 0)
+            return side;
+    }
+    return -1;
+}
+
+bool FileCompare::IsDifferent(int side, FileOffset offset, unsigned length) const
+{
+    if (side < 0 || !IsComplete() || m_hunks.empty())
+        return false;
+
+    // The last hunk that starts before the end of the row.
+    const FileOffset row_end = offset + std::max<unsigned>(1, length);
+    auto it = std::upper_bound(m_hunks.begin(), m_hunks.end(), row_end, [side](FileOffset value, const Hunk& hunk) {
+        return value <= hunk.begin[side];
+    });
+    if (it == m_hunks.begin())
+        return false;
+    --it;
+
+    // An empty side marks the row where the other side's rows would go.
+    if (it->begin[side] == it->end[side])
+        return it->begin[side] >= offset;
+    return it->end[side] > offset;
+}
+
+bool FileCompare::NextDifference(int side, FileOffset from, bool next, FileOffset& there) const
+{
+    if (side < 0 || !IsComplete() || m_hunks.empty())
+        return false;
+
+    auto before = [side](const Hunk& hunk, FileOffset value) { return hunk.begin[side] < value; };
+    auto it = std::lower_bound(m_hunks.begin(), m_hunks.end(), from, before);
+    if (next)
+    {
+        if (it != m_hunks.end() && it->begin[side] == from)
+            ++it;
+        if (it == m_hunks.end())
+            return false;
+    }
+    else
+    {
+        if (it == m_hunks.begin())
+            return false;
+        --it;
+    }
+
+    there = it->begin[side];
+    return true;
+}
+
+size_t FileCompare::AlignLine(int side, size_t line) const
+{
+    if (side < 0 || !IsComplete() || m_hunks.empty())
+        return line;
+
+    const int other = !side;
+    auto it = std::upper_bound(m_hunks.begin(), m_hunks.end(), line, [side](size_t value, const Hunk& hunk) {
+        return value < hunk.line[side];
+    });
+    if (it == m_hunks.begin())
+        return line;
+    --it;
+
+    // Inside a hunk, go to the corresponding row of the other side (or as
+    // close as it has); after a hunk, the lines correspond one to one.
+    const Hunk& hunk = *it;
+    if (line < hunk.line[side] + hunk.lines[side])
+        return hunk.line[other] + std::min<size_t>(line - hunk.line[side], hunk.lines[other] ? hunk.lines[other] - 1 : 0);
+    return line - (hunk.line[side] + hunk.lines[side]) + (hunk.line[other] + hunk.lines[other]);
+}
+
+DWORD WINAPI FileCompare::WorkerProc(void* param)
+{
+    FileCompare* const compare = static_cast<FileCompare*>(param);
+    compare->Compare();
+    return 0;
+}
+
+void FileCompare::Compare()
+{
+    Error e;
+    ContentCache ctx0(g_options);
+    ContentCache ctx1(g_options);
+    ContentCache* ctx[2] = { &ctx0, &ctx1 };
+    for (int side = 0; side < 2; ++side)
+    {
+        ctx[side]->SetProgress(&m_progress[side]);
+        if (!ctx[side]->Open(m_names[side].Text(), e))
+            return;
+    }
+    if (m_override_encoding)
+        ctx0.SetEncoding(m_binary ? 0 : m_codepage);
+
+    // Hash both files at once; this thread hashes the first one.
+    HashJob jobs[2];
+    jobs[0].ctx = &ctx0;
+    jobs[1].ctx = &ctx1;
+    {
+        SHBasic thread = CreateThread(nullptr, 0, HashBlocksProc, &jobs[1], 0, nullptr);
+        HashBlocksProc(&jobs[0]);
+        if (thread.Empty())
+            HashBlocksProc(&jobs[1]);
+        else
+            WaitForSingleObject(thread, INFINITE);
+    }
+    if (!jobs[0].ok || !jobs[1].ok)
+    {
+        m_canceled = (m_progress[0].IsCanceled() || m_progress[1].IsCanceled());
+        return;
+    }
+
+    auto row_offset = [&](int side, size_t row) {
+        return (row < jobs[side].count) ? ctx[side]->GetOffset(row) : ctx[side]->GetFileSize();
+    };
+    auto line_number = [&](int side, size_t row) {
+        return (row < jobs[side].count) ? ctx[side]->GetLineNunber(row) : ctx[side]->CountFriendlyLines() + 1;
+    };
+    auto add_hunk = [&](size_t a_begin, size_t a_end, size_t b_begin, size_t b_end) {
+        const size_t begin[2] = { a_begin, b_begin };
+        const size_t end[2] = { a_end, b_end };
+        Hunk hunk;
+        for (int side = 0; side < 2; ++side)
+        {
+            hunk.begin[side] = row_offset(side, begin[side]);
+            hunk.end[side] = row_offset(side, end[side]);
+            hunk.line[side] = line_number(side, begin[side]);
+            hunk.lines[side] = line_number(side, end[side]) - hunk.line[side];
+        }
+        m_hunks.emplace_back(hunk);
+    };
+    auto block_row = [&](int side, size_t block) {
+        return (block < jobs[side].rows.size()) ? jobs[side].rows[block] : jobs[side].count;
+    };
+
+    // Match the blocks, and then match rows only where the blocks differ.
+    Matches block_matches;
+    if (!MatchSequences(jobs[0].hashes.data(), jobs[0].hashes.size(), jobs[1].hashes.data(), jobs[1].hashes.size(), block_matches, m_progress[0]))
+    {
+        m_canceled = true;
+        return;
+    }
+    block_matches.emplace_back(jobs[0].hashes.size(), jobs[1].hashes.size());
+
+    Matches row_matches;
+    std::vector<uint64> hashes[2];
+    size_t next_block[2] = {};
+    for (const auto& match : block_matches)
+    {
+        const size_t a_begin = block_row(0, next_block[0]);
+        const size_t a_end = block_row(0, match.first);
+        const size_t b_begin = block_row(1, next_block[1]);
+        const size_t b_end = block_row(1, match.second);
+        next_block[0] = match.first + 1;
+        next_block[1] = match.second + 1;
+
+        if (a_begin == a_end && b_begin == b_end)
+            continue;
+        if (a_begin == a_end || b_begin == b_end)
+        {
+            add_hunk(a_begin, a_end, b_begin, b_end);
+            continue;
+        }
+
+        if (!HashRows(ctx0, a_begin, a_end, hashes[0]) || !HashRows(ctx1, b_begin, b_end, hashes[1]))
+            return;
+        row_matches.clear();
+        if (!MatchSequences(hashes[0].data(), hashes[0].size(), hashes[1].data(), hashes[1].size(), row_matches, m_progress[0]))
+        {
+            m_canceled = true;
+            return;
+        }
+        row_matches.emplace_back(hashes[0].size(), hashes[1].size());
+
+        size_t next_row[2] = {};
+        for (const auto& row : row_matches)
+        {
+            if (row.first > next_row[0] || row.second > next_row[1])
+                add_hunk(a_begin + next_row[0], a_begin + row.first, b_begin + next_row[1], b_begin + row.second);
+            next_row[0] = row.first + 1;
+            next_row[1] = row.second + 1;
+        }
+    }
+
+    m_complete = true;
+}
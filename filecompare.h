@@ -0,0 +1,80 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "str.h"
+#include "progress.h"
+
+#include <vector>
+
+class ContentCache;
+typedef unsigned __int64 FileOffset;
+
+// Compares two files line by line on background threads, for marking and
+// jumping between their differences in the viewer, and for lining them up
+// side by side (or when switching between them, if the terminal is narrow).
+//
+// Each file's rows are hashed on its own thread, and grouped into blocks
+// whose boundaries depend on the content (so an insertion only disturbs the
+// block it lands in).  Only the block hashes are kept.  A patience diff
+// (with a histogram style fallback when no line is unique) first matches
+// the blocks, and then the rows are hashed again and matched only within
+// the blocks that differ.  So the diff's own memory scales with the
+// differences, but each file's line map is still built in full (the same as
+// viewing the file), to find the rows' offsets and line numbers.
+class FileCompare
+{
+public:
+    // A run of differing rows.  Either side may be empty (an insertion or a
+    // deletion), and then begin == end is where the other side's rows would
+    // go.  Line numbers are 1 based, the same as the viewer shows.
+    struct Hunk
+    {
+        FileOffset  begin[2];
+        FileOffset  end[2];
+        size_t      line[2];
+        size_t      lines[2];
+    };
+
+                    FileCompare() = default;
+                    ~FileCompare() { Clear(); }
+
+    bool            Start(const WCHAR* name0, const ContentCache& context0, const WCHAR* name1);
+    void            Clear();
+    bool            Poll();
+    bool            IsRunning() const { return !m_thread.Empty(); }
+    HANDLE          GetThread() const { return m_thread; }
+    bool            IsActive() const { return !m_names[0].Empty(); }
+    bool            IsComplete() const { return !IsRunning() && m_complete; }
+    bool            IsCanceled() const { return !IsRunning() && m_canceled; }
+
+    // Which file (0 or 1) the name is, or -1 if neither.
+    int             GetSide(const WCHAR* name) const;
+    const WCHAR*    GetName(int side) const { return m_names[side].Text(); }
+
+    // These are only meaningful once IsComplete().
+    size_t          Count() const { return m_hunks.size(); }
+    bool            IsDifferent(int side, FileOffset offset, unsigned length) const;
+    bool            NextDifference(int side, FileOffset from, bool next, FileOffset& there) const;
+    size_t          AlignLine(int side, size_t line) const;
+
+private:
+    static DWORD WINAPI WorkerProc(void* param);
+    void            Compare();
+
+private:
+    StrW            m_names[2];
+    UINT            m_codepage = 0;             // For side 0.
+    bool            m_binary = false;
+    bool            m_override_encoding = false;
+
+    std::vector<Hunk> m_hunks;                  // Written by the worker; sorted.
+    ProgressChannel m_progress[2];              // Canceling them stops the worker.
+    bool            m_complete = false;         // Set by the worker; read only once it has exited.
+    bool            m_canceled = false;         // Set by the worker.
+    SHBasic         m_thread;
+};
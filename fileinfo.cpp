@@ -7,35 +7,138 @@
 #include "fileinfo.h"
 #include "os.h"
 
+#include <atomic>
+
+#pragma region // Name blocks
+
+// File names are packed into blocks instead of each name having its own heap
+// allocation.  Each thread fills its own block, so scanning threads don't
+// contend.  A block is freed when the last name in it is released.
+//
+// Blocks are the size of the VirtualAlloc allocation granularity, so they're
+// aligned to their size, and the block containing a name can be found from
+// the name's address.
+
+static const size_t c_name_block_size = 64 * 1024;
+
+struct NameBlock
+{
+    std::atomic<uint32> refs;
+    uint32          used;
+};
+
+static NameBlock* BlockFromName(const WCHAR* name)
+{
+    return reinterpret_cast<NameBlock*>(uintptr_t(name) & ~uintptr_t(c_name_block_size - 1));
+}
+
+static void ReleaseNameBlock(NameBlock* block)
+{
+    if (block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        VirtualFree(block, 0, MEM_RELEASE);
+}
+
+struct ThreadNameBlock
+{
+                    ~ThreadNameBlock() { if (block) ReleaseNameBlock(block); }
+    NameBlock*      block = nullptr;        // The thread holds a reference.
+};
+
+static thread_local ThreadNameBlock t_name_block;
+
+static const WCHAR* AllocName(const WCHAR* name, unsigned len)
+{
+    const uint32 bytes = (len + 1) * sizeof(*name);
+    assert(sizeof(NameBlock) + bytes <= c_name_block_size);
+
+    NameBlock* block = t_name_block.block;
+    if (!block || block->used + bytes > c_name_block_size)
+    {
+        void* const mem = VirtualAlloc(nullptr, c_name_block_size, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE);
+        if (!mem)
+            return nullptr;
+        assert(!(uintptr_t(mem) & (c_name_block_size - 1)));
+
+        NameBlock* const fresh = new (mem) NameBlock;
+        fresh->refs.store(1, std::memory_order_relaxed);
+        fresh->used = sizeof(NameBlock);
+        if (block)
+            ReleaseNameBlock(block);
+        t_name_block.block = block = fresh;
+    }
+
+    WCHAR* const p = reinterpret_cast<WCHAR*>(reinterpret_cast<BYTE*>(block) + block->used);
+    memcpy(p, name, len * sizeof(*name));
+    p[len] = '\0';
+    block->used += bytes;
+    block->refs.fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+#pragma endregion // Name blocks
+#pragma region // FileInfo
+
 std::vector<StrW> FileInfo::s_dirs;
 
+FileInfo& FileInfo::operator=(FileInfo&& other)
+{
+    if (this != &other)
+    {
+        ReleaseName();
+        m_name = other.m_name;
+        m_name_len = other.m_name_len;
+        m_ulSize = other.m_ulSize;
+        m_ftModified = other.m_ftModified;
+        m_dwAttr = other.m_dwAttr;
+        m_dir = other.m_dir;
+        m_dir_size = other.m_dir_size;
+        m_details = std::move(other.m_details);
+        other.m_name = nullptr;
+        other.m_name_len = 0;
+    }
+    return *this;
+}
+
+void FileInfo::ReleaseName()
+{
+    if (m_name)
+    {
+        ReleaseNameBlock(BlockFromName(m_name));
+        m_name = nullptr;
+        m_name_len = 0;
+    }
+}
+
 void FileInfo::Init(const WIN32_FIND_DATA* pfd, const WCHAR* dir)
 {
-    m_name.Set(pfd->cFileName);
+    ReleaseName();
+    m_details.reset();
+    const unsigned len = unsigned(wcslen(pfd->cFileName));
+    m_name = AllocName(pfd->cFileName, len);
+    if (m_name)
+        m_name_len = len;
 
     m_dwAttr = pfd->dwFileAttributes;
     m_ftModified = pfd->ftLastWriteTime;
 
     m_ulSize.LowPart = pfd->nFileSizeLow;
     m_ulSize.HighPart = pfd->nFileSizeHigh;
+    m_dir_size = false;
 
     if (dir)
+        m_dir = InternDirectory(dir);
+}
+
+int FileInfo::InternDirectory(const WCHAR* dir)
+{
+    for (size_t ii = 0; ii < s_dirs.size(); ++ii)
     {
-        for (size_t ii = 0; ii < s_dirs.size(); ++ii)
-        {
-            if (wcscmp(dir, s_dirs[ii].Text()) == 0)
-            {
-                m_dir = int(ii);
-                break;
-            }
-        }
-
-        if (m_dir < 0)
-        {
-            m_dir = int(s_dirs.size());
-            s_dirs.emplace_back(dir);
-        }
+        if (wcscmp(dir, s_dirs[ii].Text()) == 0)
+            return int(ii);
     }
+
+    s_dirs.emplace_back(dir);
+    return int(s_dirs.size() - 1);
 }
 
 const WCHAR* FileInfo::GetDirectory() const
@@ -54,13 +157,38 @@ void FileInfo::GetPathName(StrW& s) const
         s.Append(dir);
         EnsureTrailingSlash(s);
     }
-    s.Append(m_name);
+    s.Append(GetName(), m_name_len);
+}
+
+void FileInfo::SetDirectorySize(unsigned __int64 size)
+{
+    assert(IsDirectory());
+    m_ulSize.QuadPart = size;
+    m_dir_size = true;
+    m_details.reset();
+}
+
+void FileInfo::ClearDirectorySize()
+{
+    if (m_dir_size)
+    {
+        m_ulSize.QuadPart = 0;
+        m_dir_size = false;
+        m_details.reset();
+    }
+}
+
+FileInfo::FormattedDetails& FileInfo::GetFormattedDetails() const
+{
+    if (!m_details)
+        m_details = std::make_unique<FormattedDetails>();
+    return *m_details;
 }
 
 bool FileInfo::IsPseudoDirectory() const
 {
     if (GetAttributes() & FILE_ATTRIBUTE_DIRECTORY)
-        return OS::IsPseudoDirectory(m_name.Text());
+        return OS::IsPseudoDirectory(GetName());
     return false;
 }
 
@@ -69,6 +197,8 @@ bool FileInfo::IsDirectory() const
     return !!(GetAttributes() & FILE_ATTRIBUTE_DIRECTORY);
 }
 
+#pragma endregion // FileInfo
+
 const WCHAR* FindExtension(const WCHAR* file)
 {
     const WCHAR* ext = 0;
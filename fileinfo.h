@@ -15,32 +15,59 @@ class FileInfo
 {
 public:
                         FileInfo() {}
-                        ~FileInfo() {}
+                        ~FileInfo() { ReleaseName(); }
 
                         // For std::stable_sort.
-                        FileInfo(FileInfo&& other) = default;
-    FileInfo&           operator=(FileInfo&& other) = default;
+                        FileInfo(FileInfo&& other) { *this = std::move(other); }
+    FileInfo&           operator=(FileInfo&& other);
 
     void                Init(const WIN32_FIND_DATA* pfd, const WCHAR* dir=nullptr);
 
+                        // Init() with no dir is thread safe; the directory
+                        // can be set afterwards on the main thread.
+    void                SetDirectory(int dir) { m_dir = dir; }
+    static int          InternDirectory(const WCHAR* dir);
+
     DWORD               GetAttributes() const { return m_dwAttr; }
     const FILETIME&     GetModifiedTime() const { return m_ftModified; }
     const unsigned __int64& GetSize() const { return *reinterpret_cast<const unsigned __int64*>(&m_ulSize); }
-    const StrW&         GetName() const { return m_name; }
+    const WCHAR*        GetName() const { return m_name ? m_name : L""; }
+    unsigned            GetNameLength() const { return m_name_len; }
     const WCHAR*        GetDirectory() const;
     void                GetPathName(StrW& s) const;
 
     bool                IsPseudoDirectory() const;
     bool                IsDirectory() const;
 
-    void                UpdateAttributes(DWORD attr) { m_dwAttr = attr; }
+    void                UpdateAttributes(DWORD attr) { m_dwAttr = attr; m_details.reset(); }
+
+                        // Directories have no size until one is computed.
+    bool                HasDirectorySize() const { return m_dir_size; }
+    void                SetDirectorySize(unsigned __int64 size);
+    void                ClearDirectorySize();
+
+                        // Formatted detail fields, cached by list_format.
+                        // The key identifies the formatting options.
+    struct FormattedDetails
+    {
+        uint32          key = 0;
+        unsigned        width = 0;
+        StrW            text;
+    };
+    FormattedDetails&   GetFormattedDetails() const;
+
+private:
+    void                ReleaseName();
 
 private:
-    StrW                m_name;
+    const WCHAR*        m_name = nullptr;   // Packed into a shared name block.
+    unsigned            m_name_len = 0;
     ULARGE_INTEGER      m_ulSize = {};
     FILETIME            m_ftModified = {};
     DWORD               m_dwAttr = INVALID_FILE_ATTRIBUTES;
     int                 m_dir = -1;
+    bool                m_dir_size = false;
+    mutable std::unique_ptr<FormattedDetails> m_details;
 
     static std::vector<StrW> s_dirs;
 };
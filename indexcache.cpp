@@ -0,0 +1,153 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "indexcache.h"
+#include "os.h"
+
+// Don't bother reading cache files that are implausibly large.
+static const DWORD c_max_cache_file_size = 1024 * 1024 * 1024;
+
+static uint64 HashName(const WCHAR* p)
+{
+    // FNV-1a.
+    uint64 hash = 0xcbf29ce484222325;
+    for (; *p; ++p)
+    {
+        const WCHAR c = ToUpper(*p);
+        hash = (hash ^ (c & 0xff)) * 0x100000001b3;
+        hash = (hash ^ (c >> 8)) * 0x100000001b3;
+    }
+    return hash;
+}
+
+uint32 HashIndexCacheBytes(const BYTE* p, size_t len)
+{
+    // FNV-1a.
+    uint32 hash = 0x811c9dc5;
+    for (const BYTE* const end = p + len; p < end; ++p)
+        hash = (hash ^ *p) * 0x01000193;
+    return hash;
+}
+
+bool IndexCacheKey::Read(HANDLE file)
+{
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(file, &info))
+        return false;
+
+    volume_serial = info.dwVolumeSerialNumber;
+    file_index_high = info.nFileIndexHigh;
+    file_index_low = info.nFileIndexLow;
+    size = (uint64(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    last_write = info.ftLastWriteTime;
+    return true;
+}
+
+bool IndexCacheKey::SameFile(const IndexCacheKey& other) const
+{
+    return (volume_serial == other.volume_serial &&
+            file_index_high == other.file_index_high &&
+            file_index_low == other.file_index_low);
+}
+
+static bool GetIndexCacheDir(StrW& out)
+{
+    StrW local;
+    if (!OS::GetEnv(L"LOCALAPPDATA", local))
+        return false;
+
+    PathW dir;
+    dir.SetMaybeRooted(local.Text(), L"ListRedux");
+    CreateDirectoryW(dir.Text(), nullptr);
+    dir.JoinComponent(L"IndexCache");
+    if (!CreateDirectoryW(dir.Text(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+        return false;
+
+    out = std::move(dir);
+    return true;
+}
+
+bool GetIndexCacheFileName(const WCHAR* name, StrW& out)
+{
+    Error e;
+    StrW full;
+    if (!OS::GetFullPathName(name, full, e))
+        return false;
+
+    StrW dir;
+    if (!GetIndexCacheDir(dir))
+        return false;
+
+    StrW file;
+    file.Printf(L"%016I64x.idx", HashName(full.Text()));
+
+    PathW path;
+    path.SetMaybeRooted(dir.Text(), file.Text());
+    out = std::move(path);
+    return true;
+}
+
+bool ReadIndexCacheFile(const WCHAR* cache_name, std::vector<BYTE>& out)
+{
+    out.clear();
+
+    SHFile h = CreateFileW(cache_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (h.Empty())
+        return false;
+
+    LARGE_INTEGER liSize;
+    if (!GetFileSizeEx(h, &liSize) || !liSize.QuadPart || liSize.QuadPart > c_max_cache_file_size)
+        return false;
+
+    out.resize(size_t(liSize.QuadPart));
+
+    DWORD bytes_read;
+    if (!ReadFile(h, out.data(), DWORD(out.size()), &bytes_read, nullptr) || bytes_read != out.size())
+    {
+        out.clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool WriteIndexCacheFile(const WCHAR* cache_name, const std::vector<BYTE>& data)
+{
+    if (data.size() > c_max_cache_file_size)
+        return false;
+
+    // Write to a temporary file first so a partially written cache file
+    // never replaces a good one.
+    StrW tmp_name;
+    tmp_name.Printf(L"%s.%x.tmp", cache_name, GetCurrentProcessId());
+
+    {
+        SHFile h = CreateFileW(tmp_name.Text(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, 0);
+        if (h.Empty())
+            return false;
+
+        DWORD written;
+        if (!WriteFile(h, data.data(), DWORD(data.size()), &written, nullptr) || written != data.size())
+        {
+            h.Close();
+            DeleteFileW(tmp_name.Text());
+            return false;
+        }
+    }
+
+    if (!MoveFileExW(tmp_name.Text(), cache_name, MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileW(tmp_name.Text());
+        return false;
+    }
+
+    return true;
+}
+
+void DeleteIndexCacheFile(const WCHAR* cache_name)
+{
+    DeleteFileW(cache_name);
+}
@@ -0,0 +1,31 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "str.h"
+
+#include <vector>
+
+// Identifies a file (and roughly its state) for the on-disk line index cache.
+struct IndexCacheKey
+{
+    bool            Read(HANDLE file);
+    bool            SameFile(const IndexCacheKey& other) const;
+
+    DWORD           volume_serial = 0;
+    DWORD           file_index_high = 0;
+    DWORD           file_index_low = 0;
+    uint64          size = 0;
+    FILETIME        last_write = {};
+};
+
+bool GetIndexCacheFileName(const WCHAR* name, StrW& out);
+bool ReadIndexCacheFile(const WCHAR* cache_name, std::vector<BYTE>& out);
+bool WriteIndexCacheFile(const WCHAR* cache_name, const std::vector<BYTE>& data);
+void DeleteIndexCacheFile(const WCHAR* cache_name);
+
+uint32 HashIndexCacheBytes(const BYTE* p, size_t len);
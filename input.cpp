@@ -410,10 +410,13 @@ static InputRecord ProcessInput(MOUSE_EVENT_RECORD const& record)
     return input;
 }
 
-InputRecord SelectInput(const DWORD timeout, AutoMouseConsoleMode* mouse)
+InputRecord SelectInput(const DWORD timeout, AutoMouseConsoleMode* mouse, const HANDLE* wake, uint32 wake_count)
 {
     const HANDLE hin = GetStdHandle(STD_INPUT_HANDLE);
 
+    assert(wake_count < MAXIMUM_WAIT_OBJECTS);
+    wake_count = min<uint32>(wake_count, MAXIMUM_WAIT_OBJECTS - 1);
+
     static INPUT_RECORD s_cached_record;
     static bool s_has_cached_record = false;
 
@@ -431,6 +434,7 @@ InputRecord SelectInput(const DWORD timeout, AutoMouseConsoleMode* mouse)
         if (dimensions != s_dimensions && !has_lead_surrogate)
         {
             initialize_wcwidth();
+            clear_cell_count_cache();
             s_dimensions = dimensions;
             return { InputType::Resize };
         }
@@ -443,10 +447,13 @@ InputRecord SelectInput(const DWORD timeout, AutoMouseConsoleMode* mouse)
         if (!s_has_cached_record)
         {
             uint32 count = 1;
-            HANDLE handles[3] = { hin };
+            HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { hin };
+            for (uint32 ii = 0; ii < wake_count; ++ii)
+                handles[count++] = wake[ii];
 
+            // Waking up is like timing out; the caller checks on its work.
             const DWORD waited = WaitForMultipleObjects(count, handles, false, timeout);
-            if (waited == WAIT_TIMEOUT)
+            if (waited == WAIT_TIMEOUT || (waited > WAIT_OBJECT_0 && waited < WAIT_OBJECT_0 + count))
                 return { InputType::None };
             if (waited != WAIT_OBJECT_0)
                 return { InputType::Error };
@@ -519,6 +526,65 @@ severed:
     return input;
 }
 
+ScopedEscapeWatcher::ScopedEscapeWatcher(ProgressChannel& progress)
+: m_progress(progress)
+{
+    m_stop = CreateEvent(nullptr, true, false, nullptr);
+    if (m_stop)
+        m_thread = CreateThread(nullptr, 0, WatcherProc, this, 0, nullptr);
+}
+
+ScopedEscapeWatcher::~ScopedEscapeWatcher()
+{
+    if (!m_thread.Empty())
+    {
+        SetEvent(m_stop);
+        WaitForSingleObject(m_thread, INFINITE);
+    }
+}
+
+DWORD WINAPI ScopedEscapeWatcher::WatcherProc(void* param)
+{
+    ScopedEscapeWatcher* const watcher = static_cast<ScopedEscapeWatcher*>(param);
+    const HANDLE handles[] = { watcher->m_stop, GetStdHandle(STD_INPUT_HANDLE) };
+
+    while (WaitForMultipleObjects(_countof(handles), handles, false, INFINITE) == WAIT_OBJECT_0 + 1)
+    {
+        INPUT_RECORD record;
+        DWORD count;
+        if (!PeekConsoleInputW(handles[1], &record, 1, &count))
+            break;
+        if (!count)
+            continue;
+
+        if (record.EventType == KEY_EVENT)
+        {
+            const KEY_EVENT_RECORD& key = record.Event.KeyEvent;
+            if (key.bKeyDown && key.wVirtualKeyCode == VK_ESCAPE &&
+                !(key.dwControlKeyState & (CTRL_PRESSED|ALT_PRESSED|SHIFT_PRESSED)))
+            {
+                ReadConsoleInputW(handles[1], &record, 1, &count);
+                watcher->m_escaped = true;
+                watcher->m_progress.Cancel();
+                break;
+            }
+
+            // Key up events are ignored anyway, except for Alt codes (see
+            // ProcessInput).
+            if (key.bKeyDown || (key.wVirtualKeyCode == VK_MENU && key.uChar.UnicodeChar))
+                break;
+        }
+        else if (record.EventType != FOCUS_EVENT && record.EventType != MENU_EVENT)
+        {
+            break;
+        }
+
+        ReadConsoleInputW(handles[1], &record, 1, &count);
+    }
+
+    return 0;
+}
+
 bool IsMouseLeftButtonDown()
 {
     return !!(GetButtonState() & FROM_LEFT_1ST_BUTTON_PRESSED);
@@ -1818,7 +1884,7 @@ void ClickableRow::Add(const WCHAR* text, int16 id, int16 priority, bool right_a
     if (text)
     {
         elm.m_text.Set(text);
-        elm.m_width = cell_count(text);
+        elm.m_width = cached_cell_count(text);
         elm.m_id = id;
     }
     else
@@ -9,6 +9,7 @@
 
 #include "ellipsify.h"
 #include "colors.h"
+#include "progress.h"
 
 typedef uint16 textpos_t;
 
@@ -71,6 +72,7 @@ enum class History
     SweepArgsAfter,
     Goto,
     OpenFile,
+    Export,
     MAX,
 };
 
@@ -253,7 +255,29 @@ private:
     bool            m_need_layout = false;
 };
 
-InputRecord SelectInput(DWORD timeout=INFINITE, AutoMouseConsoleMode* mouse=nullptr);
+// Lets ESC cancel work that runs on the UI thread, by watching the input
+// on another thread until the watcher goes out of scope.  Input other than
+// ESC stays queued for SelectInput(), and ends the watching, since input is
+// processed in order.
+class ScopedEscapeWatcher
+{
+public:
+                    ScopedEscapeWatcher(ProgressChannel& progress);
+                    ~ScopedEscapeWatcher();
+    bool            WasEscaped() const { return m_escaped; }
+private:
+    static DWORD WINAPI WatcherProc(void* param);
+private:
+    ProgressChannel& m_progress;
+    SHBasic         m_stop;
+    SHBasic         m_thread;
+    std::atomic<bool> m_escaped = false;
+};
+
+// Waits for input, the timeout, or any of the wake handles to be signaled
+// (e.g. a worker thread finishing).  Returns InputType::None for a timeout
+// or a wake handle.
+InputRecord SelectInput(DWORD timeout=INFINITE, AutoMouseConsoleMode* mouse=nullptr, const HANDLE* wake=nullptr, uint32 wake_count=0);
 bool ReadInput(StrW& out, History history=History::MAX, DWORD max_length=30, DWORD max_width=32, std::optional<std::function<int32(const InputRecord&, const ReadInputBuffer&, void*)>> input_callback=std::nullopt);
 bool IsMouseLeftButtonDown();
 
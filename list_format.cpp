@@ -13,6 +13,7 @@
 #include "wcwidth.h"
 #include "wcwidth_iter.h"
 #include "columns.h"
+#include "perf.h"
 
 #include <algorithm>
 #include <memory>
@@ -91,7 +92,7 @@ static unsigned s_locale_monthname_longest_len = 1;
 static WCHAR s_decimal[2];
 static WCHAR s_thousand[2];
 
-void InitLocale()
+static void InitLocale()
 {
     WCHAR tmp[80];
 
@@ -245,6 +246,19 @@ void InitLocale()
     }
 }
 
+// The locale tables are only needed for showing file times, so they're
+// initialized the first time a time is formatted or measured.
+static void EnsureLocale()
+{
+    static bool s_inited = false;
+    if (!s_inited)
+    {
+        InitLocale();
+        MarkStartup("locale");
+        s_inited = true;
+    }
+}
+
 struct AttrChar
 {
     WCHAR ch;
@@ -288,18 +302,18 @@ static void FormatAttributes(StrW& s, const DWORD dwAttr)
 
 void FormatFilename(StrW& s, const FileInfo* pfi, unsigned max_width, const WCHAR* color)
 {
-    const StrW& name = pfi->GetName();
+    const WCHAR* const name = pfi->GetName();
 
     s.AppendColor(color);
 
     StrW tmp;
-    const WCHAR* p = name.Text();
+    const WCHAR* p = name;
     unsigned name_width = 0;
 
     if (max_width)
     {
         const unsigned truncate_width = max_width - (pfi->IsDirectory() ? 2 : 0);
-        name_width = __wcswidth(name.Text());
+        name_width = __wcswidth(name);
         if (name_width > truncate_width)
         {
             if (truncate_width)
@@ -540,7 +554,7 @@ static const WCHAR* GetDirectorySizeTag(WCHAR chStyle)
 
 static void FormatFileSize(StrW& s, const FileInfo* pfi, WCHAR chStyle=0, const WCHAR* fallback_color=nullptr, unsigned size_width=0)
 {
-    const WCHAR* const tag = pfi->IsDirectory() ? GetDirectorySizeTag(chStyle) : nullptr;
+    const WCHAR* const tag = (pfi->IsDirectory() && !pfi->HasDirectorySize()) ? GetDirectorySizeTag(chStyle) : nullptr;
 
 #ifdef DEBUG
     const unsigned orig_len = s.Length();
@@ -601,6 +615,8 @@ static void FormatLocaleDateTime(StrW& s, const SYSTEMTIME* psystime)
 
 static unsigned GetTimeFieldWidthByStyle(WCHAR chStyle)
 {
+    EnsureLocale();
+
     switch (chStyle)
     {
     case 'l':           assert(s_locale_date_time_len); return s_locale_date_time_len;
@@ -644,6 +660,8 @@ static const FILETIME& NowAsFileTime()
 
 static void FormatTime(StrW& s, const FileInfo* pfi, WCHAR chStyle, const WCHAR* fallback_color=nullptr)
 {
+    EnsureLocale();
+
     SYSTEMTIME systime;
 
     {
@@ -818,10 +836,10 @@ unsigned WidthForFileInfoSize(const FileInfo* pfi, int details, int size_width)
         }
         else if (size_width < 0)
         {
-            if (pfi->IsDirectory())
+            if (pfi->IsDirectory() && !pfi->HasDirectorySize())
             {
-                // The width for directories is constant for a size_style, so
-                // the caller is responsible for calculating it.
+                // The width for directory tags is constant for a size_style,
+                // so the caller is responsible for calculating it.
                 size_width = 0;
             }
             else
@@ -860,7 +878,7 @@ unsigned WidthForFileInfo(const FileInfo* pfi, int details, int size_width)
         // Directories add 1 for up/down arrow plus 1 for trailing backslash.
         unsigned filename_width = 0;
         filename_width += (pfi->IsDirectory() ? 2 : 0);
-        filename_width += __wcswidth(pfi->GetName().Text());
+        filename_width += __wcswidth(pfi->GetName());
         width += max<unsigned>(filename_width, c_min_filename_width);
     }
 
@@ -869,6 +887,54 @@ unsigned WidthForFileInfo(const FileInfo* pfi, int details, int size_width)
     return width;
 }
 
+static uint32 FormattedDetailsKey(int details, int size_width)
+{
+    // Everything except the file itself that affects the formatted details.
+    // Zero means the details can't be cached.
+    if (size_width < 0 || size_width > 0xff)
+        return 0;
+    uint32 key = 1u << 31;
+    key |= uint32(details & 0x07);
+    key |= uint32(SizeStyleForDetails(details) & 0x7f) << 3;
+    key |= uint32(s_time_style & 0x7f) << 10;
+    key |= uint32(size_width) << 17;
+    key |= (s_scale_fields & SCALE_SIZE) ? 1u << 25 : 0;
+    key |= s_no_dir_tag ? 1u << 26 : 0;
+    key |= s_mini_decimal ? 1u << 27 : 0;
+    return key;
+}
+
+static const FileInfo::FormattedDetails& EnsureFormattedDetails(const FileInfo* pfi, int details, int size_width)
+{
+    static FileInfo::FormattedDetails s_uncached;
+
+    const uint32 key = FormattedDetailsKey(details, size_width);
+    FileInfo::FormattedDetails& cached = key ? pfi->GetFormattedDetails() : s_uncached;
+    if (!key || cached.key != key)
+    {
+        StrW& d = cached.text;
+        d.Clear();
+        if (details >= 2)
+        {
+            d.AppendSpaces(1);
+            FormatTime(d, pfi, s_time_style);
+        }
+        if (details >= 1)
+        {
+            d.AppendSpaces(1);
+            FormatFileSize(d, pfi, SizeStyleForDetails(details), nullptr, size_width);
+        }
+        if (details >= 3)
+        {
+            d.AppendSpaces(1);
+            FormatAttributes(d, pfi->GetAttributes());
+        }
+        cached.key = key;
+        cached.width = cell_count(d.Text());
+    }
+    return cached;
+}
+
 unsigned FormatFileInfo(StrW& s, const FileInfo* pfi, unsigned max_width, int details, bool selected, bool tagged, int size_width)
 {
     if (max_width < 3)
@@ -906,26 +972,23 @@ unsigned FormatFileInfo(StrW& s, const FileInfo* pfi, unsigned max_width, int de
 
     if (details && details_width > 0)
     {
-        StrW d;
-        if (details >= 2)
+        // Formatting the times and sizes is the expensive part of drawing
+        // the file list, so each file keeps its formatted details until the
+        // formatting options change.
+        const FileInfo::FormattedDetails& cached = EnsureFormattedDetails(pfi, details, size_width);
+        if (cached.width <= details_width - 1)
         {
-            d.AppendSpaces(1);
-            FormatTime(d, pfi, s_time_style);
+            s.Append(cached.text);
+            s.AppendSpaces(details_width - 1 - cached.width);
         }
-        if (details >= 1)
-        {
-            d.AppendSpaces(1);
-            FormatFileSize(d, pfi, SizeStyleForDetails(details), nullptr, size_width);
-        }
-        if (details >= 3)
+        else
         {
-            d.AppendSpaces(1);
-            FormatAttributes(d, pfi->GetAttributes());
+            StrW d(cached.text);
+            const unsigned w = TruncateWcwidth(d, details_width - 1, s_chTruncated);
+            assert(w <= details_width - 1);
+            d.AppendSpaces(details_width - 1 - w);
+            s.Append(d);
         }
-        const unsigned w = TruncateWcwidth(d, details_width - 1, s_chTruncated);
-        assert(w <= details_width - 1);
-        d.AppendSpaces(details_width - 1 - w);
-        s.Append(d);
     }
 
     const WCHAR* div_color = nullptr;
@@ -20,8 +20,6 @@ void FormatFileInfoForPopupList(StrW& s, const FileInfo* pfi, unsigned max_width
 unsigned FormatFileData(StrW& s, const WIN32_FIND_DATAW& fd, bool include_size);
 unsigned FormatFileData(StrW& s, const FileInfo& info, bool include_size);
 
-void InitLocale();
-
 enum ColorScaleFields { SCALE_NONE = 0, SCALE_TIME = 1<<0, SCALE_SIZE = 1<<1, };
 DEFINE_ENUM_FLAG_OPERATORS(ColorScaleFields);
 
@@ -36,6 +36,9 @@
 #include "wcwidth.h"
 #include "encodings.h"
 #include "os.h"
+#include "perf.h"
+#include "memorybudget.h"
+#include "blockcache.h"
 
 #include <memory>
 #include <algorithm>
@@ -80,6 +83,10 @@ int __cdecl _tmain(int argc, const WCHAR** argv)
     }
 
     initialize_wcwidth();
+    InitPerf();
+
+    // The block cache is the first to give way when over the memory budget.
+    RegisterMemoryReclaimer(nullptr, MemoryReclaimPriority::BlockCache, TrimCachedBlocks);
 
     // Remember the app name, and generate the short usage text.
 
@@ -188,8 +195,6 @@ int __cdecl _tmain(int argc, const WCHAR** argv)
 
     // Interpret the options.
 
-    InitLocale();
-
     const LongOption<WCHAR>* long_opt;
     std::vector<StrW> files;
     std::optional<size_t> goto_line;
@@ -343,7 +348,7 @@ int __cdecl _tmain(int argc, const WCHAR** argv)
     if (hex_view >= 0)
         SetViewerHexViewMode(hex_view > 0);
 
-    TryCoInitialize();
+    MarkStartup("options");
 
     StrW dir;
     std::vector<FileInfo> fileinfos;
@@ -363,7 +368,7 @@ int __cdecl _tmain(int argc, const WCHAR** argv)
         if (e.Test())
             return e.Report();
 
-        std::stable_sort(fileinfos.begin(), fileinfos.end(), CmpFileInfo);
+        SortFileInfos(fileinfos);
 
         if (!navigate || !files.empty())
         {
@@ -380,6 +385,8 @@ int __cdecl _tmain(int argc, const WCHAR** argv)
         }
     }
 
+    MarkStartup("scan");
+
     if (!navigate && files.size() == 1)
     {
         if (goto_line.has_value())
@@ -452,6 +459,10 @@ int __cdecl _tmain(int argc, const WCHAR** argv)
                 if (s.Length())
                     files.emplace_back(std::move(s));
                 break;
+            case ChooserOutcome::VIEWFOUND:
+                files.clear();
+                files.emplace_back(chooser.GetFoundFile());
+                break;
             case ChooserOutcome::VIEWTAGGED:
                 files = chooser.GetTaggedFiles();
                 if (do_search)
@@ -469,6 +480,9 @@ int __cdecl _tmain(int argc, const WCHAR** argv)
     interactive.End();
     MaybeReprintLastScreen();
 
+    if (GetStartupReport(s))
+        OutputConsole(s.Text(), s.Length());
+
     if (e.Test())
         return e.Report();
 
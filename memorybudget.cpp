@@ -0,0 +1,112 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "memorybudget.h"
+#include "vieweroptions.h"
+
+#include <atomic>
+#include <vector>
+
+struct RegisteredReclaimer
+{
+    const void*     owner;
+    MemoryReclaimPriority priority;
+    MemoryReclaimer reclaimer;
+};
+
+static std::atomic<size_t> s_usage[size_t(MemoryUse::MAX)];
+static std::vector<RegisteredReclaimer> s_reclaimers;  // Sorted by priority.
+static bool s_trimming = false;
+
+void MemoryCharge::Set(size_t bytes)
+{
+    if (bytes != m_bytes)
+    {
+        if (bytes > m_bytes)
+            s_usage[size_t(m_use)].fetch_add(bytes - m_bytes, std::memory_order_relaxed);
+        else
+            s_usage[size_t(m_use)].fetch_sub(m_bytes - bytes, std::memory_order_relaxed);
+        m_bytes = bytes;
+    }
+}
+
+void RegisterMemoryReclaimer(const void* owner, MemoryReclaimPriority priority, MemoryReclaimer&& reclaimer)
+{
+    assert(!s_trimming);
+    auto it = s_reclaimers.begin();
+    while (it != s_reclaimers.end() && it->priority <= priority)
+        ++it;
+    s_reclaimers.insert(it, { owner, priority, std::move(reclaimer) });
+}
+
+void UnregisterMemoryReclaimer(const void* owner)
+{
+    assert(!s_trimming);
+    for (auto it = s_reclaimers.begin(); it != s_reclaimers.end();)
+    {
+        if (it->owner == owner)
+            it = s_reclaimers.erase(it);
+        else
+            ++it;
+    }
+}
+
+size_t GetMemoryUsage(MemoryUse use)
+{
+    return s_usage[size_t(use)].load(std::memory_order_relaxed);
+}
+
+size_t GetTotalMemoryUsage()
+{
+    size_t total = 0;
+    for (const auto& usage : s_usage)
+        total += usage.load(std::memory_order_relaxed);
+    return total;
+}
+
+size_t GetMemoryBudget()
+{
+    return size_t(g_options.memory_budget) * 1024 * 1024;
+}
+
+void TrimToMemoryBudget()
+{
+    const size_t budget = GetMemoryBudget();
+    if (!budget || s_trimming)
+        return;
+
+    // Memory that isn't evictable (e.g. the line index of the file being
+    // viewed) still counts toward the budget, so the evictable memory is
+    // what gives way.
+    s_trimming = true;
+    for (auto& r : s_reclaimers)
+    {
+        while (true)
+        {
+            const size_t total = GetTotalMemoryUsage();
+            if (total <= budget)
+                goto LDone;
+            if (!r.reclaimer(total - budget))
+                break;
+        }
+    }
+LDone:
+    s_trimming = false;
+}
+
+const WCHAR* GetMemoryUseName(MemoryUse use)
+{
+    switch (use)
+    {
+    case MemoryUse::LineMaps:       return L"lines";
+    case MemoryUse::Buffers:        return L"buffers";
+    case MemoryUse::PipeChunks:     return L"pipe";
+    case MemoryUse::BlockCache:     return L"blocks";
+    case MemoryUse::SearchHits:     return L"hits";
+    case MemoryUse::FileLists:      return L"files";
+    default:                        return L"?";
+    }
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include <functional>
+
+// Process-wide accounting of the memory held by the caches and other big
+// structures, so that one budget (the MemoryBudget option) can cap them all.
+// Each owner charges its usage to a category with a MemoryCharge, and the
+// owners of evictable memory register reclaimers.  TrimToMemoryBudget() runs
+// the reclaimers in priority order until usage is within the budget.
+//
+// Charges may be updated from any thread, but reclaimers are registered and
+// run on the UI thread.
+
+enum class MemoryUse
+{
+    LineMaps,           // Line indexes, including of recently viewed files.
+    Buffers,            // Read buffers and decompressor state.
+    PipeChunks,         // Piped input held in memory.
+    BlockCache,         // Blocks read with ReadFile, kept for revisiting.
+    SearchHits,         // Find-all results.
+    FileLists,          // File lists in the chooser.
+    MAX
+};
+
+// Lower priority reclaimers run first.
+enum class MemoryReclaimPriority
+{
+    BlockCache          = 10,
+    RecentFiles         = 20,
+    PipeChunks          = 30,
+};
+
+class MemoryCharge
+{
+public:
+    explicit        MemoryCharge(MemoryUse use) : m_use(use) {}
+                    ~MemoryCharge() { Set(0); }
+                    MemoryCharge(const MemoryCharge&) = delete;
+    MemoryCharge&   operator=(const MemoryCharge&) = delete;
+
+    void            Set(size_t bytes);
+    size_t          Get() const { return m_bytes; }
+
+private:
+    const MemoryUse m_use;
+    size_t          m_bytes = 0;
+};
+
+// A reclaimer tries to free at least excess bytes, and returns how many it
+// freed (or 0 if it has nothing left to free).  Freed memory must also be
+// uncharged, of course.
+typedef std::function<size_t(size_t excess)> MemoryReclaimer;
+
+void RegisterMemoryReclaimer(const void* owner, MemoryReclaimPriority priority, MemoryReclaimer&& reclaimer);
+void UnregisterMemoryReclaimer(const void* owner);
+
+size_t GetMemoryUsage(MemoryUse use);
+size_t GetTotalMemoryUsage();
+size_t GetMemoryBudget();               // 0 means no budget.
+void TrimToMemoryBudget();
+
+const WCHAR* GetMemoryUseName(MemoryUse use);
@@ -203,4 +203,75 @@ bool IsHidden(const WIN32_FIND_DATA& fd)
     return (fd.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN);
 }
 
+bool CreateProcessInheriting(WCHAR* cmdline, DWORD flags, const STARTUPINFOW& si, const HANDLE* handles, DWORD count, PROCESS_INFORMATION& pi)
+{
+    // Listing the same handle twice is an error, and stdout and stderr are
+    // often the same handle.
+    HANDLE unique[8];
+    DWORD num = 0;
+    for (DWORD ii = 0; ii < count; ++ii)
+    {
+        if (!handles[ii] || handles[ii] == INVALID_HANDLE_VALUE)
+            continue;
+        bool dup = false;
+        for (DWORD jj = 0; jj < num; ++jj)
+            dup |= (unique[jj] == handles[ii]);
+        if (!dup)
+        {
+            assert(num < _countof(unique));
+            if (num >= _countof(unique))
+            {
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return false;
+            }
+            unique[num++] = handles[ii];
+        }
+    }
+
+    SIZE_T size = 0;
+    InitializeProcThreadAttributeList(nullptr, 1, 0, &size);
+    LPPROC_THREAD_ATTRIBUTE_LIST attrs = static_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(malloc(size));
+    if (!attrs)
+    {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return false;
+    }
+    if (!InitializeProcThreadAttributeList(attrs, 1, 0, &size))
+    {
+        free(attrs);
+        return false;
+    }
+
+    bool ok = false;
+    if (!num || UpdateProcThreadAttribute(attrs, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, unique, num * sizeof(unique[0]), nullptr, nullptr))
+    {
+        STARTUPINFOEXW six = {};
+        six.StartupInfo = si;
+        six.StartupInfo.cb = sizeof(six);
+        six.lpAttributeList = num ? attrs : nullptr;
+        ok = !!CreateProcessW(nullptr, cmdline, nullptr, nullptr, num > 0/*bInheritHandles*/,
+                              flags|EXTENDED_STARTUPINFO_PRESENT, nullptr, nullptr, &six.StartupInfo, &pi);
+    }
+
+    const DWORD err = GetLastError();
+    DeleteProcThreadAttributeList(attrs);
+    free(attrs);
+    SetLastError(err);
+    return ok;
+}
+
+bool StopThreadIo(HANDLE thread, DWORD timeout)
+{
+    // The thread may not have started its I/O yet when the first cancel
+    // happens, so keep canceling until it exits or the time is up.
+    const DWORD start = GetTickCount();
+    while (WaitForSingleObject(thread, 10) == WAIT_TIMEOUT)
+    {
+        if (GetTickCount() - start >= timeout)
+            return false;
+        CancelSynchronousIo(thread);
+    }
+    return true;
+}
+
 } // namespace OS
@@ -21,4 +21,15 @@ bool GetFullPathName(const WCHAR* name, StrW& full, Error& e);
 bool IsFATDrive(const WCHAR* path, Error& e);
 bool IsHidden(const WIN32_FIND_DATA& fd);
 
+// Starts a process that inherits only the listed handles (which must be
+// inheritable), instead of every inheritable handle in this process.  Null
+// and duplicate handles in the list are ignored.  Sets the last error on
+// failure, like CreateProcessW.
+bool CreateProcessInheriting(WCHAR* cmdline, DWORD flags, const STARTUPINFOW& si, const HANDLE* handles, DWORD count, PROCESS_INFORMATION& pi);
+
+// Cancels a worker thread's synchronous I/O (e.g. opening or reading a file
+// on a slow network share) until the thread exits, for up to timeout
+// milliseconds.  Returns false if the thread is still running.
+bool StopThreadIo(HANDLE thread, DWORD timeout);
+
 }
@@ -13,6 +13,7 @@
 #include "vieweroptions.h"
 #include "wcwidth.h"
 #include "wcwidth_iter.h"
+#include "perf.h"
 
 const WORD c_cxTab = 8;
 
@@ -25,6 +26,7 @@ static int s_emulation = -1;
 static StrW s_last_screen;
 static bool s_locked_last_screen = false;
 static Terminal* s_terminal = new Terminal;
+static uint32 s_output_serial = 0;
 
 bool IsConsole(HANDLE h)
 {
@@ -175,7 +177,8 @@ DWORD GetConsoleColsRows()
     return (s_num_rows << 16) | s_num_cols;
 }
 
-static void WriteConsoleInternal(const WCHAR* p, unsigned len, const WCHAR* color=nullptr)
+// Appends text to out, translating "\n" to "\r\n".
+static void AppendConsoleText(StrW& out, const WCHAR* p, unsigned len, const WCHAR* color)
 {
     if (color)
     {
@@ -184,18 +187,13 @@ static void WriteConsoleInternal(const WCHAR* p, unsigned len, const WCHAR* colo
     }
 
     if (color)
-    {
-        StrW tmp;
-        tmp.Printf(L"\x1b[0;%sm", color);
-        s_terminal->WriteConsole(tmp.Text(), tmp.Length());
-    }
+        out.Printf(L"\x1b[0;%sm", color);
 
-    StrA tmp;
     while (len)
     {
         if (p[0] == '\n')
         {
-            s_terminal->WriteConsole(L"\r\n", 2);
+            out.Append(L"\r\n", 2);
             --len;
             ++p;
         }
@@ -205,18 +203,55 @@ static void WriteConsoleInternal(const WCHAR* p, unsigned len, const WCHAR* colo
             ++run;
 
         if (run)
-            s_terminal->WriteConsole(p, run);
+            out.Append(p, run);
 
         len -= run;
         p += run;
     }
 
     if (color)
-        s_terminal->WriteConsole(L"\x1b[m", 3);
+        out.Append(L"\x1b[m", 3);
 
     assert(!len);
 }
 
+// Output is only written by the UI thread, so the buffers need no lock.
+static StrW s_output_buffer;
+static unsigned s_batch_depth = 0;
+
+static unsigned s_stats_writes = 0;
+static LONGLONG s_stats_ticks = 0;
+
+static void FlushConsoleText(const WCHAR* p, unsigned len)
+{
+    PerfScope perf(PerfTimer::ConsoleWrite);
+    PerfAdd(PerfCount::ConsoleBytes, len * sizeof(*p));
+
+    LARGE_INTEGER begin;
+    LARGE_INTEGER end;
+    const unsigned writes = s_terminal->GetWriteCount();
+    QueryPerformanceCounter(&begin);
+
+    s_terminal->WriteConsole(p, len);
+
+    QueryPerformanceCounter(&end);
+    s_stats_writes += s_terminal->GetWriteCount() - writes;
+    s_stats_ticks += end.QuadPart - begin.QuadPart;
+}
+
+static void WriteConsoleInternal(const WCHAR* p, unsigned len, const WCHAR* color=nullptr)
+{
+    if (s_batch_depth)
+    {
+        AppendConsoleText(s_output_buffer, p, len, color);
+        return;
+    }
+
+    s_output_buffer.Clear();
+    AppendConsoleText(s_output_buffer, p, len, color);
+    FlushConsoleText(s_output_buffer.Text(), s_output_buffer.Length());
+}
+
 void OutputConsole(const WCHAR* p, unsigned len, const WCHAR* color)
 {
     if (len == unsigned(-1))
@@ -224,9 +259,54 @@ void OutputConsole(const WCHAR* p, unsigned len, const WCHAR* color)
     if (!len)
         return;
 
+    ++s_output_serial;
     WriteConsoleInternal(p, len, color);
 }
 
+ScopedOutputBatch::ScopedOutputBatch()
+{
+    if (!s_batch_depth++)
+        s_output_buffer.Clear();
+}
+
+ScopedOutputBatch::~ScopedOutputBatch()
+{
+    assert(s_batch_depth);
+    if (!--s_batch_depth && s_output_buffer.Length())
+    {
+        FlushConsoleText(s_output_buffer.Text(), s_output_buffer.Length());
+        s_output_buffer.Clear();
+    }
+}
+
+// Reports the number of console writes and the time spent in them since the
+// previous call.
+void GetOutputConsoleStats(unsigned& writes, unsigned& usec)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    writes = s_stats_writes;
+    usec = unsigned(s_stats_ticks * 1000000 / freq.QuadPart);
+    s_stats_writes = 0;
+    s_stats_ticks = 0;
+}
+
+// Increments with every write, so callers can tell whether anything else
+// has written to the console since their last write.
+uint32 GetOutputConsoleSerial()
+{
+    return s_output_serial;
+}
+
+bool IsConsoleEmulated()
+{
+#ifdef INCLUDE_TERMINAL_EMULATOR
+    return s_terminal->IsEmulating();
+#else
+    return false;
+#endif
+}
+
 void ExpandTabs(const WCHAR* s, StrW& out, unsigned max_width)
 {
     StrW tmp;
@@ -21,6 +21,18 @@ void ExpandTabs(const WCHAR* s, StrW& out, unsigned max_width=0);
 void WrapText(const WCHAR* s, StrW& out, unsigned max_width=0);
 void AppendKeyName(StrW& s, const WCHAR* key, ColorElement color_after, const WCHAR* desc=nullptr, bool enabled=true);
 void OutputConsole(const WCHAR* p, unsigned len=unsigned(-1), const WCHAR* color=nullptr);
+uint32 GetOutputConsoleSerial();
+bool IsConsoleEmulated();
+void GetOutputConsoleStats(unsigned& writes, unsigned& usec);
+
+// While any ScopedOutputBatch exists, OutputConsole accumulates its output,
+// and the outermost one writes it all to the console at once.
+class ScopedOutputBatch
+{
+public:
+                    ScopedOutputBatch();
+                    ~ScopedOutputBatch();
+};
 
 void PrintfV(const WCHAR* format, va_list args);
 void Printf(const WCHAR* format, ...);
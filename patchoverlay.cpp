@@ -0,0 +1,200 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "patchoverlay.h"
+
+#include <algorithm>
+
+PatchOverlay::Runs::const_iterator PatchOverlay::FirstOverlapping(FileOffset offset) const
+{
+    // The first run that ends after offset.
+    auto iter = m_runs.upper_bound(offset);
+    if (iter != m_runs.begin())
+    {
+        auto prev = std::prev(iter);
+        if (prev->second.End(prev->first) > offset)
+            iter = prev;
+    }
+    return iter;
+}
+
+bool PatchOverlay::Get(FileOffset offset, BYTE& value) const
+{
+    auto iter = FirstOverlapping(offset);
+    if (iter == m_runs.end() || iter->first > offset)
+        return false;
+
+    value = iter->second.bytes[size_t(offset - iter->first)];
+    return true;
+}
+
+bool PatchOverlay::GetExtent(FileOffset& begin, FileOffset& end) const
+{
+    if (m_runs.empty())
+        return false;
+
+    begin = m_runs.begin()->first;
+    end = m_runs.rbegin()->second.End(m_runs.rbegin()->first);
+    return true;
+}
+
+void PatchOverlay::SetRange(const FileOffset offset, const BYTE* values, const BYTE* originals, const size_t len)
+{
+    if (!len)
+        return;
+
+    const FileOffset end = offset + len;
+
+    // Find the runs that overlap or touch the range.
+    auto first = m_runs.upper_bound(offset);
+    if (first != m_runs.begin())
+    {
+        auto prev = std::prev(first);
+        if (prev->second.End(prev->first) >= offset)
+            first = prev;
+    }
+    auto last = first;
+    while (last != m_runs.end() && last->first <= end)
+        ++last;
+
+    // Typing forward in hex edit mode extends or overwrites within a single
+    // run; update it in place.
+    if (first != m_runs.end() && std::next(first) == last && first->first <= offset)
+    {
+        Run& run = first->second;
+        const FileOffset run_end = run.End(first->first);
+        if (end > run_end)
+        {
+            const size_t keep = size_t(run_end - offset);
+            run.original.insert(run.original.end(), originals + keep, originals + len);
+            run.bytes.resize(size_t(end - first->first));
+        }
+        memcpy(run.bytes.data() + (offset - first->first), values, len);
+        return;
+    }
+
+    // Otherwise build one run that spans the range and every run it
+    // overlaps or touches.  The union is contiguous because each of those
+    // runs overlaps or touches the range.
+    FileOffset new_begin = offset;
+    FileOffset new_end = end;
+    if (first != last)
+    {
+        new_begin = std::min<FileOffset>(new_begin, first->first);
+        const auto prev = std::prev(last);
+        new_end = std::max<FileOffset>(new_end, prev->second.End(prev->first));
+    }
+
+    Run merged;
+    merged.bytes.resize(size_t(new_end - new_begin));
+    merged.original.resize(size_t(new_end - new_begin));
+    memcpy(merged.original.data() + (offset - new_begin), originals, len);
+    for (auto iter = first; iter != last; ++iter)
+    {
+        const size_t at = size_t(iter->first - new_begin);
+        memcpy(merged.bytes.data() + at, iter->second.bytes.data(), iter->second.bytes.size());
+        memcpy(merged.original.data() + at, iter->second.original.data(), iter->second.original.size());
+    }
+    memcpy(merged.bytes.data() + (offset - new_begin), values, len);
+
+    m_runs.erase(first, last);
+    m_runs.emplace(new_begin, std::move(merged));
+}
+
+bool PatchOverlay::Revert(FileOffset offset)
+{
+    auto iter = m_runs.upper_bound(offset);
+    if (iter == m_runs.begin())
+        return false;
+    --iter;
+
+    const FileOffset begin = iter->first;
+    Run& run = iter->second;
+    const FileOffset end = run.End(begin);
+    if (offset >= end)
+        return false;
+
+    // Split off whatever follows the reverted byte, then truncate.
+    if (offset + 1 < end)
+    {
+        const size_t tail = size_t(offset + 1 - begin);
+        Run after;
+        after.bytes.assign(run.bytes.begin() + tail, run.bytes.end());
+        after.original.assign(run.original.begin() + tail, run.original.end());
+        m_runs.emplace(offset + 1, std::move(after));
+    }
+    if (offset == begin)
+    {
+        m_runs.erase(iter);
+    }
+    else
+    {
+        run.bytes.resize(size_t(offset - begin));
+        run.original.resize(size_t(offset - begin));
+    }
+    return true;
+}
+
+void PatchOverlay::MergeFrom(const PatchOverlay& other)
+{
+    for (const auto& r : other.m_runs)
+        SetRange(r.first, r.second.bytes.data(), r.second.original.data(), r.second.bytes.size());
+}
+
+bool PatchOverlay::NextRow(FileOffset here, FileOffset& there, unsigned hex_width, bool next) const
+{
+    here &= ~(FileOffset(hex_width) - 1);
+
+    if (next)
+    {
+        const FileOffset target = here + hex_width;
+        auto iter = FirstOverlapping(target);
+        if (iter == m_runs.end())
+            return false;
+        there = std::max<FileOffset>(iter->first, target);
+        return true;
+    }
+    else
+    {
+        auto iter = m_runs.lower_bound(here);
+        if (iter == m_runs.begin())
+            return false;
+        --iter;
+        there = std::min<FileOffset>(iter->second.End(iter->first), here) - 1;
+        return true;
+    }
+}
+
+bool PatchOverlay::Save(HANDLE hfile, bool original, Error& e, PatchOverlay* written) const
+{
+    for (const auto& r : m_runs)
+    {
+        const std::vector<BYTE>& bytes = original ? r.second.original : r.second.bytes;
+
+        // IMPORTANT:  It's tempting to want to read the current values
+        // first, to improve accuracy of UndoSave in case concurrent file
+        // writes might be happening.  BUT IT'S A TRAP!  It risks reading
+        // values that were already previously written, if a previous save
+        // fails partway through and the user retries the save.
+        DWORD num_io;
+        LARGE_INTEGER liSeek;
+        liSeek.QuadPart = r.first;
+        if (!SetFilePointerEx(hfile, liSeek, nullptr, FILE_BEGIN) ||
+            !WriteFile(hfile, bytes.data(), DWORD(bytes.size()), &num_io, nullptr))
+        {
+            e.Sys();
+            StrW msg;
+            msg.Printf(L"Error writing %zu byte(s) at offset %08.8I64x.", bytes.size(), r.first);
+            e.Set(msg.Text());
+            return false;
+        }
+
+        if (written)
+            written->SetRange(r.first, r.second.bytes.data(), r.second.original.data(), r.second.bytes.size());
+    }
+
+    return true;
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+
+#include <map>
+#include <vector>
+
+typedef unsigned __int64 FileOffset;
+
+class Error;
+
+// Edited bytes overlaid on a file, kept as contiguous runs of patched bytes
+// along with the original bytes they replace.  Runs never overlap or touch;
+// setting bytes next to or across existing runs coalesces them, so large
+// contiguous patches stay a single run, and saving writes each run at once.
+class PatchOverlay
+{
+public:
+                    PatchOverlay() = default;
+                    ~PatchOverlay() = default;
+
+    bool            Empty() const { return m_runs.empty(); }
+    void            Clear() { m_runs.clear(); }
+    // The range from the first patched byte through the end of the last.
+    bool            GetExtent(FileOffset& begin, FileOffset& end) const;
+
+    bool            Get(FileOffset offset, BYTE& value) const;
+    void            Set(FileOffset offset, BYTE value, BYTE original) { SetRange(offset, &value, &original, 1); }
+    // Bytes that are already set keep their original values.
+    void            SetRange(FileOffset offset, const BYTE* values, const BYTE* originals, size_t len);
+    bool            Revert(FileOffset offset);
+    void            MergeFrom(const PatchOverlay& other);
+
+    // Calls fn(offset, bytes, len) for each part of a run that overlaps the
+    // range [begin, end), in order.
+    template <class T>
+    void            ForEachRange(FileOffset begin, FileOffset end, T fn) const;
+
+    // Finds the first patched byte in a row after the row containing here,
+    // or the last patched byte in a row before it.
+    bool            NextRow(FileOffset here, FileOffset& there, unsigned hex_width, bool next) const;
+
+    // Writes each run (or the original bytes) to the file.  Each run that
+    // is written successfully is merged into written, if provided.
+    bool            Save(HANDLE hfile, bool original, Error& e, PatchOverlay* written=nullptr) const;
+
+private:
+    struct Run
+    {
+        FileOffset  End(FileOffset begin) const { return begin + bytes.size(); }
+        std::vector<BYTE> bytes;
+        std::vector<BYTE> original;
+    };
+    typedef std::map<FileOffset, Run> Runs;
+
+    Runs::const_iterator FirstOverlapping(FileOffset offset) const;
+
+    Runs            m_runs;
+};
+
+template <class T>
+void PatchOverlay::ForEachRange(FileOffset begin, FileOffset end, T fn) const
+{
+    for (auto iter = FirstOverlapping(begin); iter != m_runs.end() && iter->first < end; ++iter)
+    {
+        const FileOffset clip_begin = (iter->first > begin) ? iter->first : begin;
+        const FileOffset run_end = iter->second.End(iter->first);
+        const FileOffset clip_end = (run_end < end) ? run_end : end;
+        fn(clip_begin, iter->second.bytes.data() + (clip_begin - iter->first), size_t(clip_end - clip_begin));
+    }
+}
@@ -0,0 +1,185 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "perf.h"
+
+#include <algorithm>
+#ifdef INCLUDE_TRACELOGGING
+#include <TraceLoggingProvider.h>
+#endif
+
+std::atomic<bool> g_perf_active = false;
+
+static bool s_enabled = false;
+static std::atomic<bool> s_tracing = false;
+static std::atomic<LONGLONG> s_ticks[size_t(PerfTimer::MAX)];
+static std::atomic<unsigned> s_calls[size_t(PerfTimer::MAX)];
+static std::atomic<unsigned __int64> s_counts[size_t(PerfCount::MAX)];
+
+struct StartupMilestone
+{
+    const char*     name;
+    LONGLONG        ticks;
+};
+
+static bool s_startup_timing = false;
+static LARGE_INTEGER s_startup_begin;
+static std::atomic<bool> s_startup_done = false;
+static std::atomic<unsigned> s_num_milestones = 0;
+static StartupMilestone s_milestones[32];
+
+#ifdef INCLUDE_TRACELOGGING
+// {5b1c4a57-6f35-4a3e-9d1e-2f8c0e7b6a41}
+TRACELOGGING_DEFINE_PROVIDER(s_provider, "ListRedux",
+    (0x5b1c4a57, 0x6f35, 0x4a3e, 0x9d, 0x1e, 0x2f, 0x8c, 0x0e, 0x7b, 0x6a, 0x41));
+
+static const char* const c_timer_names[] =
+{
+    "LoadData",
+    "ProcessLines",
+    "Find",
+    "FormatLine",
+    "UpdateDisplay",
+    "ConsoleWrite",
+};
+static_assert(_countof(c_timer_names) == size_t(PerfTimer::MAX), "timer names don't match PerfTimer");
+
+static void NTAPI TraceEnableCallback(LPCGUID, ULONG is_enabled, UCHAR, ULONGLONG, ULONGLONG, PEVENT_FILTER_DESCRIPTOR, void*)
+{
+    s_tracing = !!is_enabled;
+    g_perf_active = s_enabled || s_tracing;
+}
+#endif
+
+void InitPerf()
+{
+    QueryPerformanceCounter(&s_startup_begin);
+    s_startup_timing = !!_wgetenv(L"LIST_STARTUP_TIME");
+
+#ifdef INCLUDE_TRACELOGGING
+    if (SUCCEEDED(TraceLoggingRegisterEx(s_provider, TraceEnableCallback, nullptr)))
+        atexit([](){ TraceLoggingUnregister(s_provider); });
+#endif
+}
+
+void EnablePerf(bool enable)
+{
+    if (enable && !s_enabled)
+    {
+        // Don't report what accumulated while tracing alone was active.
+        PerfFrame frame;
+        TakePerfFrame(frame);
+    }
+    s_enabled = enable;
+    g_perf_active = s_enabled || s_tracing;
+}
+
+void TakePerfFrame(PerfFrame& frame)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    frame.frequency = freq.QuadPart;
+    for (size_t ii = 0; ii < size_t(PerfTimer::MAX); ++ii)
+    {
+        frame.ticks[ii] = s_ticks[ii].exchange(0);
+        frame.calls[ii] = s_calls[ii].exchange(0);
+    }
+    for (size_t ii = 0; ii < size_t(PerfCount::MAX); ++ii)
+        frame.counts[ii] = s_counts[ii].exchange(0);
+}
+
+void PerfAddTicks(PerfTimer timer, LONGLONG ticks)
+{
+    s_ticks[size_t(timer)].fetch_add(ticks, std::memory_order_relaxed);
+    s_calls[size_t(timer)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void PerfAddCount(PerfCount count, unsigned __int64 amount)
+{
+    s_counts[size_t(count)].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void PerfScope::Stop()
+{
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    const LONGLONG ticks = end.QuadPart - m_begin.QuadPart;
+    PerfAddTicks(m_timer, ticks);
+
+#ifdef INCLUDE_TRACELOGGING
+    if (s_tracing.load(std::memory_order_relaxed))
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        TraceLoggingWrite(s_provider, "Timer",
+            TraceLoggingString(c_timer_names[size_t(m_timer)], "Name"),
+            TraceLoggingUInt64(unsigned __int64(ticks * 1000000 / freq.QuadPart), "Microseconds"));
+    }
+#endif
+}
+
+void MarkStartup(const char* milestone)
+{
+    if (!s_startup_timing || s_startup_done.load(std::memory_order_relaxed))
+        return;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    const unsigned index = s_num_milestones.fetch_add(1);
+    if (index < _countof(s_milestones))
+    {
+        s_milestones[index].name = milestone;
+        s_milestones[index].ticks = now.QuadPart - s_startup_begin.QuadPart;
+    }
+
+#ifdef INCLUDE_TRACELOGGING
+    if (s_tracing.load(std::memory_order_relaxed))
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        TraceLoggingWrite(s_provider, "Startup",
+            TraceLoggingString(milestone, "Milestone"),
+            TraceLoggingUInt64(unsigned __int64((now.QuadPart - s_startup_begin.QuadPart) * 1000000 / freq.QuadPart), "Microseconds"));
+    }
+#endif
+}
+
+void MarkFirstFrame()
+{
+    if (!s_startup_timing || s_startup_done.load(std::memory_order_relaxed))
+        return;
+
+    MarkStartup("first frame");
+    s_startup_done = true;
+}
+
+bool GetStartupReport(StrW& s)
+{
+    s.Clear();
+    if (!s_startup_timing)
+        return false;
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    const unsigned num = std::min<unsigned>(s_num_milestones.load(), _countof(s_milestones));
+
+    // Milestones from other threads can land out of order.
+    StartupMilestone sorted[_countof(s_milestones)];
+    memcpy(sorted, s_milestones, num * sizeof(sorted[0]));
+    std::sort(sorted, sorted + num, [](const StartupMilestone& a, const StartupMilestone& b) { return a.ticks < b.ticks; });
+
+    LONGLONG prev = 0;
+    s.Printf(L"Startup times (msec since main):\n");
+    for (unsigned ii = 0; ii < num; ++ii)
+    {
+        s.Printf(L"%9.2f  %+8.2f  %hs\n",
+                 double(sorted[ii].ticks) * 1000.0 / double(freq.QuadPart),
+                 double(sorted[ii].ticks - prev) * 1000.0 / double(freq.QuadPart),
+                 sorted[ii].name);
+        prev = sorted[ii].ticks;
+    }
+    return true;
+}
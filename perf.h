@@ -0,0 +1,87 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include <atomic>
+
+class StrW;
+
+// Timers and counters for the hot paths.  They're compiled into all builds,
+// but while disabled they only cost testing a flag.  The viewer enables them
+// while the debug row is shown, and reports them per frame.
+//
+// When built with the premake --etw option, timed scopes are also written as
+// TraceLogging events (provider "ListRedux") whenever a trace session such
+// as WPR has enabled the provider, even if the debug row isn't shown.
+
+enum class PerfTimer
+{
+    LoadData,
+    ProcessLines,
+    Find,
+    FormatLine,
+    UpdateDisplay,
+    ConsoleWrite,
+    MAX
+};
+
+enum class PerfCount
+{
+    BytesRead,
+    RowsFormatted,
+    ConsoleBytes,
+    MAX
+};
+
+struct PerfFrame
+{
+    LONGLONG        ticks[size_t(PerfTimer::MAX)];
+    unsigned        calls[size_t(PerfTimer::MAX)];
+    unsigned __int64 counts[size_t(PerfCount::MAX)];
+    LONGLONG        frequency;
+
+    double          Msec(PerfTimer timer) const { return double(ticks[size_t(timer)]) * 1000.0 / double(frequency); }
+    unsigned __int64 Count(PerfCount count) const { return counts[size_t(count)]; }
+};
+
+extern std::atomic<bool> g_perf_active;
+
+void InitPerf();
+void EnablePerf(bool enable);
+
+// Returns what accumulated since the previous call, and starts over.
+void TakePerfFrame(PerfFrame& frame);
+
+void PerfAddTicks(PerfTimer timer, LONGLONG ticks);
+void PerfAddCount(PerfCount count, unsigned __int64 amount);
+
+inline void PerfAdd(PerfCount count, unsigned __int64 amount)
+{
+    if (g_perf_active.load(std::memory_order_relaxed))
+        PerfAddCount(count, amount);
+}
+
+class PerfScope
+{
+public:
+                    PerfScope(PerfTimer timer) : m_timer(timer) { if (g_perf_active.load(std::memory_order_relaxed)) QueryPerformanceCounter(&m_begin); else m_begin.QuadPart = 0; }
+                    ~PerfScope() { if (m_begin.QuadPart) Stop(); }
+private:
+    void            Stop();
+private:
+    const PerfTimer m_timer;
+    LARGE_INTEGER   m_begin;
+};
+
+// Startup timing.  When the LIST_STARTUP_TIME environment variable is set,
+// milestones are recorded from the start of main until the first frame has
+// been drawn, and main prints them on exit.  Work that's deferred until it's
+// first needed (e.g. MLang) records a milestone when it happens, so it shows
+// up in the report if it lands on the startup path.
+void MarkStartup(const char* milestone);
+void MarkFirstFrame();
+bool GetStartupReport(StrW& s);
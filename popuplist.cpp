@@ -15,6 +15,12 @@
 #include "wcwidth_iter.h"
 #include "vieweroptions.h"
 
+#include <algorithm>
+#include <execution>
+#include <numeric>
+#include <thread>
+#include <shlwapi.h>
+
 constexpr scroll_bar_style c_sbstyle = scroll_bar_style::whole_line_chars;
 
 class PopupList
@@ -40,6 +46,10 @@ private:
     const WCHAR*    get_item_text(intptr_t index) const;
     void            clear_filter();
     bool            filter_items();
+    void            ensure_folded();
+    struct          FilterMatch;
+    void            filter_batch(const std::wstring& needle, bool fuzzy, const size_t* candidates,
+                                 size_t begin, size_t end, std::vector<FilterMatch>& out) const;
 
     // Layout.
     int32           m_terminal_width = 0;
@@ -73,6 +83,9 @@ private:
     intptr_t        m_filter_saved_index = -1;
     intptr_t        m_filter_saved_top = -1;
     std::vector<size_t> m_filtered_items;   // Maps filtered index to original index.
+    std::vector<size_t> m_filter_matches;   // All original indices that match.
+    std::vector<WCHAR> m_folded;            // Lowercase copy of the items, each NUL terminated.
+    std::vector<size_t> m_folded_offsets;   // Offset of each item in m_folded.
 
     // Current entry.
     intptr_t        m_top = 0;
@@ -101,7 +114,22 @@ private:
 
 const int32 min_screen_cols = 20;
 
-static bool strstr_compare(const StrW& needle, const WCHAR* haystack);
+static bool fuzzy_compare(const std::wstring& needle, const WCHAR* haystack, int32& score);
+
+// Filtering big lists splits the work across threads.
+static const size_t c_parallel_filter_threshold = 16384;
+static const size_t c_parallel_filter_chunk = 4096;
+// Filtering polls for input between batches.
+static const size_t c_filter_batch = 1024;
+static const size_t c_parallel_filter_batch = 65536;
+// Fuzzy filtering shows only the best matches.
+static const size_t c_fuzzy_max_results = 1000;
+
+struct PopupList::FilterMatch
+{
+    size_t          index;
+    int32           score;
+};
 
 PopupResult PopupList::Go(const WCHAR* title, const std::vector<StrW>& items, intptr_t index, PopupListFlags flags)
 {
@@ -148,7 +176,7 @@ cancel:
     }
     m_longest = max<uint32>(m_longest, c_min_popuplist_content_width);
     if (m_title)
-        m_longest = max(m_longest, cell_count(m_title) + 4);
+        m_longest = max(m_longest, cached_cell_count(m_title) + 4);
 
     // Make sure there's room.
     update_layout();
@@ -589,6 +617,7 @@ void PopupList::update_display()
 
         update_top();
 
+        ScopedOutputBatch batch;
         OutputConsole(c_hide_cursor);
 
         const bool draw_border = (m_prev_displayed < 0) || (m_title != m_orig_title);
@@ -766,6 +795,7 @@ void PopupList::clear_filter()
         m_count = m_items->size();
         m_filter_string.Clear();
         m_filtered_items.clear();
+        m_filter_matches.clear();
         m_index = m_filter_saved_index;
         m_ignore_scroll_offset = false;
         set_top(m_filter_saved_top);
@@ -784,11 +814,10 @@ bool PopupList::filter_items()
         return true;
     }
 
-    int32 defer_test = 0;
-    int32 tested = 0;
+    bool test_more_input = true;
     auto test_input = [&](){
-        ++tested;
-        defer_test = 128;
+        if (!test_more_input)
+            return false;
         const InputRecord input = SelectInput(0);
         if (input.type == InputType::None)
             return false;
@@ -808,45 +837,58 @@ bool PopupList::filter_items()
             }
         }
         //
-        defer_test = -1;
+        test_more_input = false;
         return false;
     };
 
+    ensure_folded();
+
+    std::wstring needle(m_needle.Text(), m_needle.Length());
+    CharLowerBuffW(&needle[0], DWORD(needle.length()));
+
+    const bool fuzzy = !!(m_flags & PopupListFlags::FuzzyFilter);
+
+    // When the needle grows, only the items that matched before can match.
+    const bool refine = (!m_filter_string.Empty() && StrCmpN(m_needle.Text(), m_filter_string.Text(), m_filter_string.Length()) == 0);
+    const size_t* const candidates = refine ? m_filter_matches.data() : nullptr;
+    const size_t total = refine ? m_filter_matches.size() : m_items->size();
+
     // Build new filtered list.
-    std::vector<size_t> filtered_items;
-    if (!m_filter_string.Empty() && StrCmpN(m_needle.Text(), m_filter_string.Text(), m_filter_string.Length()) == 0)
+    std::vector<FilterMatch> matches;
+    const size_t batch = (total >= c_parallel_filter_threshold) ? c_parallel_filter_batch : c_filter_batch;
+    for (size_t begin = 0; begin < total; begin += batch)
     {
-        // Further filter the filtered list.
-        for (size_t i = 0; i < m_filtered_items.size(); ++i)
-        {
-            // Interrupt if more input is available.
-            if (!defer_test-- && test_input())
-                return false;
+        // Interrupt if more input is available.
+        if (test_input())
+            return false;
 
-            const size_t original_index = m_filtered_items[i];
-            const bool match = m_needle.Empty() || strstr_compare(m_needle, (*m_items)[original_index].Text());
+        filter_batch(needle, fuzzy, candidates, begin, min<size_t>(begin + batch, total), matches);
+    }
 
-            if (match)
-                filtered_items.push_back(original_index);
-        }
+    m_filter_matches.resize(matches.size());
+    for (size_t i = 0; i < matches.size(); ++i)
+        m_filter_matches[i] = matches[i].index;
+
+    if (fuzzy)
+    {
+        // Only the best matches are shown, so there's no need to sort all of
+        // the matches.  Ties stay in their original order.
+        const size_t shown = min<size_t>(matches.size(), c_fuzzy_max_results);
+        std::partial_sort(matches.begin(), matches.begin() + shown, matches.end(), [](const FilterMatch& a, const FilterMatch& b){
+            if (a.score != b.score)
+                return a.score > b.score;
+            return a.index < b.index;
+        });
+        m_filtered_items.resize(shown);
+        for (size_t i = 0; i < shown; ++i)
+            m_filtered_items[i] = matches[i].index;
     }
     else
     {
-        for (size_t i = 0; i < m_items->size(); ++i)
-        {
-            // Interrupt if more input is available.
-            if (!defer_test-- && test_input())
-                return false;
-
-            const bool match = m_needle.Empty() || strstr_compare(m_needle, (*m_items)[i].Text());
-
-            if (match)
-                filtered_items.push_back(i);
-        }
+        m_filtered_items = m_filter_matches;
     }
 
     // Swap new filtered list into place.
-    m_filtered_items = std::move(filtered_items);
     m_count = m_filtered_items.size();
     m_vert_scroll_car.set_extents(m_visible_rows, m_count);
 
@@ -869,6 +911,74 @@ bool PopupList::filter_items()
     return true;
 }
 
+void PopupList::ensure_folded()
+{
+    if (m_folded_offsets.size() == m_items->size())
+        return;
+
+    size_t total = 0;
+    for (const auto& item : *m_items)
+        total += item.Length() + 1;
+
+    m_folded.resize(total);
+    m_folded_offsets.resize(m_items->size());
+    WCHAR* p = m_folded.data();
+    for (size_t i = 0; i < m_items->size(); ++i)
+    {
+        const StrW& item = (*m_items)[i];
+        m_folded_offsets[i] = size_t(p - m_folded.data());
+        memcpy(p, item.Text(), item.Length() * sizeof(*p));
+        p += item.Length();
+        *(p++) = '\0';
+    }
+    assert(p == m_folded.data() + total);
+
+    // CharLowerBuffW maps one character to one character, so the offsets stay
+    // valid.  It also leaves the NULs alone.
+    for (size_t done = 0; done < total;)
+    {
+        const DWORD len = DWORD(min<size_t>(total - done, 0x40000000));
+        CharLowerBuffW(m_folded.data() + done, len);
+        done += len;
+    }
+}
+
+void PopupList::filter_batch(const std::wstring& needle, const bool fuzzy, const size_t* const candidates,
+                             const size_t begin, const size_t end, std::vector<FilterMatch>& out) const
+{
+    auto filter_range = [&](size_t from, size_t to, std::vector<FilterMatch>& matches) {
+        for (size_t i = from; i < to; ++i)
+        {
+            const size_t index = candidates ? candidates[i] : i;
+            const WCHAR* const haystack = m_folded.data() + m_folded_offsets[index];
+            int32 score = 0;
+            const bool match = (fuzzy ?
+                                fuzzy_compare(needle, haystack, score) :
+                                (*haystack && wcsstr(haystack, needle.c_str())));
+            if (match)
+                matches.push_back({ index, score });
+        }
+    };
+
+    const size_t count = end - begin;
+    const size_t chunks = (count >= c_parallel_filter_threshold) ? min<size_t>(std::thread::hardware_concurrency(), count / c_parallel_filter_chunk) : 1;
+    if (chunks <= 1)
+    {
+        filter_range(begin, end, out);
+        return;
+    }
+
+    std::vector<std::vector<FilterMatch>> results(chunks);
+    std::vector<size_t> ids(chunks);
+    std::iota(ids.begin(), ids.end(), size_t(0));
+    std::for_each(std::execution::par, ids.begin(), ids.end(), [&](size_t c){
+        filter_range(begin + count * c / chunks, begin + count * (c + 1) / chunks, results[c]);
+    });
+
+    for (const auto& r : results)
+        out.insert(out.end(), r.begin(), r.end());
+}
+
 PopupResult ShowPopupList(const std::vector<StrW>& items, const WCHAR* title, intptr_t index, PopupListFlags flags)
 {
     PopupList popup;
@@ -876,10 +986,55 @@ PopupResult ShowPopupList(const std::vector<StrW>& items, const WCHAR* title, in
 }
 
 //------------------------------------------------------------------------------
-#include <shlwapi.h>
-static bool strstr_compare(const StrW& needle, const WCHAR* haystack)
+static bool is_fuzzy_boundary(WCHAR c)
 {
-    if (haystack && *haystack)
-        return !!StrStrIW(haystack, needle.Text());
+    switch (c)
+    {
+    case '\0':
+    case '\\':
+    case '/':
+    case ' ':
+    case '.':
+    case '_':
+    case '-':
+        return true;
+    }
     return false;
 }
+
+// Both strings are already lowercase.  Contiguous matches rank above all other
+// matches, and earlier ones rank higher.  Otherwise the needle's characters
+// must appear in order; consecutive characters and characters at the start of
+// a word rank higher, and gaps rank lower.
+static bool fuzzy_compare(const std::wstring& needle, const WCHAR* haystack, int32& score)
+{
+    if (!*haystack)
+        return false;
+
+    if (const WCHAR* found = wcsstr(haystack, needle.c_str()))
+    {
+        const WCHAR prev = (found > haystack) ? found[-1] : '\0';
+        score = 0x40000000 - int32(min<size_t>(found - haystack, 0x10000)) + (is_fuzzy_boundary(prev) ? 0x20000 : 0);
+        return true;
+    }
+
+    score = 0;
+    WCHAR prev = '\0';
+    int32 run = 0;
+    const WCHAR* h = haystack;
+    for (const WCHAR c : needle)
+    {
+        while (*h && *h != c)
+        {
+            prev = *(h++);
+            run = 0;
+            --score;
+        }
+        if (!*h)
+            return false;
+        score += 16 + (run * 8) + (is_fuzzy_boundary(prev) ? 32 : 0);
+        ++run;
+        prev = *(h++);
+    }
+    return true;
+}
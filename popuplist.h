@@ -28,6 +28,7 @@ enum class PopupListFlags
 {
     None                = 0x00,
     DimPaths            = 0x01,
+    FuzzyFilter         = 0x02,     // Rank fuzzy matches and show the best ones.
 };
 DEFINE_ENUM_FLAG_OPERATORS(PopupListFlags);
 
@@ -12,12 +12,21 @@ elseif (tonumber(_PREMAKE_VERSION:match("^5%.0%.0.beta(.*)") or "0") or 0) < 8 t
 end
 
 local use_re2 = (_OPTIONS["re2"] and true or nil)
+local use_zlib = (_OPTIONS["zlib"] and true or nil)
+local use_zstd = (_OPTIONS["zstd"] and true or nil)
+local use_etw = (_OPTIONS["etw"] and true or nil)
 if _ACTION and _ACTION:match("^vs") then
     if use_re2 then
         print("\x1b[0;35;1mUsing RE2 library.\x1b[m")
     else
         print("\x1b[0;36;1mNot using RE2 library.\x1b[m")
     end
+    if use_zlib then
+        print("\x1b[0;35;1mUsing zlib library.\x1b[m")
+    end
+    if use_zstd then
+        print("\x1b[0;35;1mUsing zstd library.\x1b[m")
+    end
 end
 
 
@@ -74,24 +83,30 @@ workspace("list")
         linktimeoptimization("on")
 
 --------------------------------------------------------------------------------
-define_exe("list")
-    targetname("list")
+local function use_libraries()
     links("kernel32")
     links("user32")
     links("advapi32")
     links("shell32")
     links("shlwapi")
 
-    includedirs(".build/" .. toolchain .. "/bin") -- for the generated manifest.xml
     if use_re2 then
         defines("INCLUDE_RE2")
         includedirs("../re2")
         includedirs("../re2/bazel-re2/external/abseil-cpp+")
     end
-
-    files("*.cpp")
-    files("wildmatch/*.cpp")
-    files("main.rc")
+    if use_zlib then
+        defines("INCLUDE_ZLIB")
+        includedirs("../zlib")
+        includedirs("../zlib/build")       -- for the generated zconf.h
+    end
+    if use_zstd then
+        defines("INCLUDE_ZSTD")
+        includedirs("../zstd/lib")
+    end
+    if use_etw then
+        defines("INCLUDE_TRACELOGGING")
+    end
 
     filter "action:vs*"
         defines("_CRT_SECURE_NO_WARNINGS")
@@ -120,6 +135,50 @@ define_exe("list")
             link_re2_libs("fastbuild")
     end
 
+    if use_zlib then
+        filter "debug"
+            links("../zlib/build/Debug/zlibstaticd.lib")
+
+        filter "release"
+            links("../zlib/build/Release/zlibstatic.lib")
+    end
+
+    if use_zstd then
+        filter "debug"
+            links("../zstd/out/lib/Debug/zstd_static.lib")
+
+        filter "release"
+            links("../zstd/out/lib/Release/zstd_static.lib")
+    end
+
+    filter {}
+end
+
+--------------------------------------------------------------------------------
+define_exe("list")
+    targetname("list")
+    includedirs(".build/" .. toolchain .. "/bin") -- for the generated manifest.xml
+
+    files("*.cpp")
+    files("wildmatch/*.cpp")
+    files("main.rc")
+
+    use_libraries()
+
+--------------------------------------------------------------------------------
+-- Benchmarks for indexing, searching, formatting, and scanning directories.
+-- Everything except main.cpp is shared with list.
+define_exe("bench")
+    targetname("bench")
+    includedirs(".")
+
+    files("*.cpp")
+    removefiles("main.cpp")
+    files("wildmatch/*.cpp")
+    files("bench/*.cpp")
+
+    use_libraries()
+
 
 
 --------------------------------------------------------------------------------
@@ -450,6 +509,23 @@ newoption {
     description = "List: generate SLN using RE2"
 }
 
+--------------------------------------------------------------------------------
+newoption {
+    trigger     = "zlib",
+    description = "List: generate SLN using zlib (view .gz files)"
+}
+
+--------------------------------------------------------------------------------
+newoption {
+    trigger     = "zstd",
+    description = "List: generate SLN using zstd (view .zst files)"
+}
+
+newoption {
+    trigger     = "etw",
+    description = "List: generate SLN with a TraceLogging provider for profiling with WPA"
+}
+
 --------------------------------------------------------------------------------
 newaction {
     trigger = "manifest",
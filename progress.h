@@ -0,0 +1,62 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include "signaled.h"
+
+#include <atomic>
+
+// Progress and cancellation shared between a worker and the UI thread.
+//
+// The worker publishes its progress and checks for cancellation without any
+// locks or system calls, so it can afford to do so very often.  The UI
+// thread samples the progress whenever it redraws, and cancels the work by
+// calling Cancel().  Ctrl-Break cancels every channel that was reset before
+// it happened, even if the UI thread has since called ClearSignaled().
+//
+// Reset() starts a new generation, so a sample can be matched to the work
+// it came from.  It must not be called while a worker is using the channel.
+class ProgressChannel
+{
+public:
+                    ProgressChannel() { Reset(); }
+                    ProgressChannel(const ProgressChannel&) = delete;
+    ProgressChannel& operator=(const ProgressChannel&) = delete;
+
+    void            Reset()
+                    {
+                        m_bytes.store(0, std::memory_order_relaxed);
+                        m_lines.store(0, std::memory_order_relaxed);
+                        m_hits.store(0, std::memory_order_relaxed);
+                        m_cancel.store(false, std::memory_order_relaxed);
+                        m_signal_count = GetSignalCount();
+                        m_generation.fetch_add(1, std::memory_order_release);
+                    }
+    uint32          Generation() const { return m_generation.load(std::memory_order_acquire); }
+
+    void            Cancel() { m_cancel.store(true, std::memory_order_relaxed); }
+    bool            IsCanceled() const { return m_cancel.load(std::memory_order_relaxed) || GetSignalCount() != m_signal_count; }
+
+    // Only the worker publishes, so these don't need read-modify-write.
+    void            Publish(uint64 bytes, uint64 lines)
+                    {
+                        m_bytes.store(bytes, std::memory_order_relaxed);
+                        m_lines.store(lines, std::memory_order_relaxed);
+                    }
+    void            AddHit() { m_hits.store(m_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+    uint64          Bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+    uint64          Lines() const { return m_lines.load(std::memory_order_relaxed); }
+    uint64          Hits() const { return m_hits.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64> m_bytes;            // Bytes processed.
+    std::atomic<uint64> m_lines;            // Lines found.
+    std::atomic<uint64> m_hits;             // Search hits found.
+    std::atomic<bool> m_cancel;
+    std::atomic<uint32> m_generation = 0;
+    uint32          m_signal_count = 0;     // GetSignalCount() as of Reset().
+};
@@ -0,0 +1,64 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "rowcache.h"
+
+void FormattedRowCache::Clear()
+{
+    m_map.clear();
+    m_lru.clear();
+}
+
+bool FormattedRowCache::Lookup(const FormattedRowKey& key, StrW& s, unsigned& cells)
+{
+    const auto found = m_map.find(key);
+    if (found == m_map.end())
+        return false;
+
+    const Entry& entry = *found->second;
+    s.Append(entry.text.c_str(), unsigned(entry.text.length()));
+    cells = entry.cells;
+
+    m_lru.splice(m_lru.begin(), m_lru, found->second);
+    return true;
+}
+
+void FormattedRowCache::Store(const FormattedRowKey& key, const WCHAR* text, unsigned len, unsigned cells)
+{
+    const auto found = m_map.find(key);
+    if (found != m_map.end())
+    {
+        m_lru.erase(found->second);
+        m_map.erase(found);
+    }
+
+    // Reuse the least recently used entry's storage when full.
+    if (m_lru.size() >= c_max_entries)
+    {
+        m_map.erase(m_lru.back().key);
+        m_lru.splice(m_lru.begin(), m_lru, std::prev(m_lru.end()));
+    }
+    else
+    {
+        m_lru.emplace_front();
+    }
+
+    Entry& entry = m_lru.front();
+    entry.key = key;
+    entry.text.assign(text, len);
+    entry.cells = cells;
+    entry.checkpoints.clear();
+    m_map.emplace(key, m_lru.begin());
+}
+
+std::vector<ColumnCheckpoint>* FormattedRowCache::GetCheckpoints(const FormattedRowKey& key)
+{
+    assert(key.decoded);
+    const auto found = m_map.find(key);
+    if (found == m_map.end())
+        return nullptr;
+    return &found->second->checkpoints;
+}
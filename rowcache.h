@@ -0,0 +1,106 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "str.h"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+typedef unsigned __int64 FileOffset;
+
+// Identifies a formatted row.  Anything else that affects formatting (the
+// encoding, wrapping, options, margin widths, and so on) is the owner's
+// responsibility; it must Clear() the cache when any of that changes.
+struct FormattedRowKey
+{
+    bool            operator==(const FormattedRowKey& other) const
+                    {
+                        return (line == other.line &&
+                                offset == other.offset &&
+                                length == other.length &&
+                                left_offset == other.left_offset &&
+                                max_width == other.max_width &&
+                                color == other.color &&
+                                found_offset == other.found_offset &&
+                                found_len == other.found_len &&
+                                middle == other.middle &&
+                                decoded == other.decoded);
+                    }
+
+    size_t          line = 0;
+    FileOffset      offset = 0;
+    unsigned        length = 0;
+    unsigned        left_offset = 0;
+    unsigned        max_width = 0;
+    const WCHAR*    color = nullptr;        // Colors from GetColor() never move.
+    FileOffset      found_offset = 0;       // Only if the found text starts in the row.
+    unsigned        found_len = 0;
+    bool            middle = false;
+    bool            decoded = false;        // Decoded text of offset and length, instead of a formatted row.
+};
+
+struct FormattedRowKeyHash
+{
+    size_t          operator()(const FormattedRowKey& key) const
+                    {
+                        uint64 h = key.offset * 0x9e3779b97f4a7c15;
+                        h ^= (uint64(key.left_offset) << 32 | key.length) + (h << 6) + (h >> 2);
+                        h ^= (uint64(key.max_width) << 32 | key.found_len) + (h << 6) + (h >> 2);
+                        h ^= key.found_offset + (h << 6) + (h >> 2);
+                        h ^= uint64(key.line) + (h << 6) + (h >> 2);
+                        h ^= uintptr_t(key.color) + (h << 6) + (h >> 2);
+                        h ^= (key.middle ? 1 : 0) | (key.decoded ? 2 : 0);
+                        return size_t(h);
+                    }
+};
+
+// Where a cell position starts in the decoded text of a row, so formatting
+// a long row that's scrolled far to the right can start measuring there
+// instead of at the beginning of the row.
+struct ColumnCheckpoint
+{
+    unsigned        index;                  // Index into the decoded text.
+    unsigned        visible_len;
+    unsigned        total_cells;
+};
+
+// Small LRU cache of recently formatted rows (and the decoded text they came
+// from), so that redrawing rows that haven't changed doesn't decode, expand,
+// and measure them again.
+class FormattedRowCache
+{
+public:
+    static const size_t c_max_entries = 512;
+
+    void            Clear();
+
+    // Appends the cached text to s.
+    bool            Lookup(const FormattedRowKey& key, StrW& s, unsigned& cells);
+    void            Store(const FormattedRowKey& key, const WCHAR* text, unsigned len, unsigned cells);
+
+    // Column checkpoints recorded for the decoded text of a row, in order.
+    // Returns nullptr if the key isn't cached.  The pointer is only valid
+    // until the next Store().
+    std::vector<ColumnCheckpoint>* GetCheckpoints(const FormattedRowKey& key);
+
+private:
+    struct Entry
+    {
+        FormattedRowKey key;
+        std::wstring text;
+        unsigned    cells;
+        std::vector<ColumnCheckpoint> checkpoints; // Only for decoded text.
+    };
+    typedef std::list<Entry> EntryList;
+
+private:
+    EntryList       m_lru;                  // Most recently used first.
+    std::unordered_map<FormattedRowKey, EntryList::iterator, FormattedRowKeyHash> m_map;
+};
@@ -9,6 +9,10 @@
 #include "output.h"
 #include "os.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
 static void AdjustSlashes(StrW& s)
 {
     for (const WCHAR* walk = s.Text(); *walk; walk++)
@@ -129,86 +133,174 @@ static void StripFilePart(StrW& s)
         s.Set(L".\\");
 }
 
-static bool ScanPattern(const WCHAR* pattern, std::vector<FileInfo>& files, Error& e, const bool include_files, const bool include_dirs)
+struct ScanJob
+{
+    StrW            pattern;
+    bool            include_files = false;
+    bool            include_dirs = false;
+    std::vector<FileInfo> files;            // Directory is set when merging.
+    StrW            dir;
+    DWORD           error_code = 0;
+};
+
+// Calls on_batch with each batch of files, if provided; it should move the
+// files out of the job.  Setting stop ends the scan early, even in the middle
+// of a big directory.
+static void ScanPattern(ScanJob& job, const std::function<void(ScanJob&)>* on_batch=nullptr, const std::atomic<bool>* stop=nullptr)
 {
+    const size_t c_batch_size = 4096;
+
+    // FindExInfoBasic skips the short names, which aren't used, and
+    // FIND_FIRST_EX_LARGE_FETCH uses bigger buffers, which especially helps
+    // on network shares.
     WIN32_FIND_DATA fd;
-    SHFind shFind = FindFirstFileW(pattern, &fd);
+    SHFind shFind = FindFirstFileExW(job.pattern.Text(), FindExInfoBasic, &fd, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
 
     if (shFind.Empty())
     {
         const DWORD dwErr = GetLastError();
-        if (dwErr == ERROR_FILE_NOT_FOUND)
-        {
-        }
-        else
-        {
-            e.Sys(dwErr);
-            return false;
-        }
+        if (dwErr != ERROR_FILE_NOT_FOUND)
+            job.error_code = dwErr;
     }
     else
     {
-        StrW dir;
-
         {
-            dir.Set(pattern);
+            StrW dir;
+            dir.Set(job.pattern);
             StripFilePart(dir);
 
-            StrW full;
-            full.ReserveMaxPath();
-            if (!OS::GetFullPathName(dir.Text(), full, e))
-                return false;
-
-            dir = std::move(full);
+            Error e;
+            job.dir.ReserveMaxPath();
+            if (!OS::GetFullPathName(dir.Text(), job.dir, e))
+            {
+                job.error_code = e.Code() ? e.Code() : ERROR_INVALID_NAME;
+                return;
+            }
         }
 
         do
         {
             const bool is_dir = !!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
-            if (is_dir && !include_dirs)
+            if (is_dir && !job.include_dirs)
                 continue;
-            if (!is_dir && !include_files)
+            if (!is_dir && !job.include_files)
                 continue;
 
             if (fd.cFileName[0] != '.' || fd.cFileName[1])
             {
                 FileInfo info;
-                info.Init(&fd, dir.Text());
-                files.emplace_back(std::move(info));
+                info.Init(&fd);
+                job.files.emplace_back(std::move(info));
+                if (on_batch && job.files.size() >= c_batch_size)
+                    (*on_batch)(job);
             }
         }
-        while (FindNextFile(shFind, &fd));
+        while ((!stop || !*stop) && FindNextFile(shFind, &fd));
 
-        const DWORD dwErr = GetLastError();
+        const DWORD dwErr = (stop && *stop) ? 0 : GetLastError();
         if (dwErr && dwErr != ERROR_NO_MORE_FILES)
-        {
-            e.Sys(dwErr);
-            return false;
-        }
+            job.error_code = dwErr;
     }
 
-    return true;
+    if (on_batch && !job.files.empty())
+        (*on_batch)(job);
 }
 
-static bool ScanPatterns(const std::vector<StrW>& patterns, std::vector<FileInfo>& files, Error& e)
+struct ScanJobQueue
 {
-    files.clear();
+    std::vector<ScanJob>& jobs;
+    std::atomic<size_t> next = 0;
+};
+
+static DWORD WINAPI ScanPatternProc(void* param)
+{
+    ScanJobQueue* const queue = static_cast<ScanJobQueue*>(param);
+    while (true)
+    {
+        const size_t index = queue->next++;
+        if (index >= queue->jobs.size())
+            break;
+        ScanPattern(queue->jobs[index]);
+    }
+    return 0;
+}
+
+static void MakeScanJobs(const std::vector<StrW>& patterns, std::vector<ScanJob>& jobs)
+{
+    jobs.clear();
 
     PathW s;
     for (const auto& pat : patterns)
     {
         const WCHAR* name = FindName(pat.Text());
         const bool pure_star = (name[0] == '*' && !name[1]);
-        if (!ScanPattern(pat.Text(), files, e, true/*include_files*/, pure_star/*include_dirs*/))
-            return false;
+        jobs.emplace_back();
+        jobs.back().pattern.Set(pat);
+        jobs.back().include_files = true;
+        jobs.back().include_dirs = pure_star;
         if (!pure_star)
         {
             s.Set(pat);
             s.EnsureTrailingSlash();
             s.ToParent();
             s.JoinComponent(L"*");
-            if (!ScanPattern(s.Text(), files, e, false/*include_files*/, true/*include_dirs*/))
-                return false;
+            jobs.emplace_back();
+            jobs.back().pattern.Set(s);
+            jobs.back().include_dirs = true;
+        }
+    }
+}
+
+static bool ScanPatterns(const std::vector<StrW>& patterns, std::vector<FileInfo>& files, Error& e)
+{
+    const DWORD c_max_scan_threads = 8;
+
+    files.clear();
+
+    std::vector<ScanJob> jobs;
+    MakeScanJobs(patterns, jobs);
+
+    // Scan the patterns concurrently; this thread takes part, too.  Each
+    // job collects its own files, so the merged order is the same as if
+    // the patterns were scanned one at a time.
+    ScanJobQueue queue = { jobs };
+    std::vector<SHBasic> threads;
+    if (jobs.size() > 1)
+    {
+        const DWORD num_cpus = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+        const size_t num_threads = std::min<size_t>(std::min<size_t>(std::max<DWORD>(1, num_cpus), c_max_scan_threads), jobs.size()) - 1;
+        for (size_t ii = 0; ii < num_threads; ++ii)
+        {
+            SHBasic thread = CreateThread(nullptr, 0, ScanPatternProc, &queue, 0, nullptr);
+            if (thread.Empty())
+                break;
+            threads.emplace_back(std::move(thread));
+        }
+    }
+    ScanPatternProc(&queue);
+    for (const auto& thread : threads)
+        WaitForSingleObject(thread, INFINITE);
+
+    size_t total = 0;
+    for (const auto& job : jobs)
+        total += job.files.size();
+    files.reserve(total);
+
+    for (auto& job : jobs)
+    {
+        if (!job.files.empty())
+        {
+            const int dir = FileInfo::InternDirectory(job.dir.Text());
+            for (auto& info : job.files)
+            {
+                info.SetDirectory(dir);
+                files.emplace_back(std::move(info));
+            }
+        }
+        if (job.error_code)
+        {
+            e.Sys(job.error_code);
+            return false;
         }
     }
 
@@ -282,3 +374,111 @@ bool ScanFiles(int argc, const WCHAR** argv, std::vector<FileInfo>& files, StrW&
     return open_files;
 }
 
+
+DirectoryScan::DirectoryScan()
+{
+    InitializeCriticalSection(&m_cs);
+}
+
+DirectoryScan::~DirectoryScan()
+{
+    Stop();
+    DeleteCriticalSection(&m_cs);
+}
+
+bool DirectoryScan::Start(const WCHAR* dir, StrW& dir_out, Error& e)
+{
+    Stop();
+    m_batches.clear();
+    m_stop = false;
+
+    std::vector<StrW> patterns;
+    ParsePatterns(1, &dir, patterns, e);
+    if (e.Test())
+        return false;
+
+    if (patterns.size())
+        dir_out.Set(patterns[0]);
+    else
+        dir_out.Clear();
+
+    MakeScanJobs(patterns, m_jobs);
+    m_thread = CreateThread(nullptr, 0, ScanProc, this, 0, nullptr);
+    if (m_thread.Empty())
+    {
+        e.Sys();
+        return false;
+    }
+    return true;
+}
+
+void DirectoryScan::Stop()
+{
+    if (!m_thread.Empty())
+    {
+        // The scan checks m_stop between entries; canceling the I/O also
+        // interrupts a FindNextFile() that's waiting on a slow share.
+        m_stop = true;
+        OS::StopThreadIo(m_thread, INFINITE);
+        m_thread.Close();
+    }
+}
+
+bool DirectoryScan::TakeArrived(std::vector<FileInfo>& files, Error& e)
+{
+    const bool done = (m_thread.Empty() || WaitForSingleObject(m_thread, 0) == WAIT_OBJECT_0);
+
+    std::vector<Batch> batches;
+    EnterCriticalSection(&m_cs);
+    batches.swap(m_batches);
+    LeaveCriticalSection(&m_cs);
+
+    // FileInfo::InternDirectory() is only safe on the main thread.
+    for (auto& batch : batches)
+    {
+        const int dir = FileInfo::InternDirectory(m_jobs[batch.job].dir.Text());
+        for (auto& info : batch.files)
+        {
+            info.SetDirectory(dir);
+            files.emplace_back(std::move(info));
+        }
+    }
+
+    if (!done)
+        return false;
+
+    m_thread.Close();
+    for (const auto& job : m_jobs)
+    {
+        if (job.error_code)
+        {
+            e.Sys(job.error_code);
+            break;
+        }
+    }
+    return true;
+}
+
+DWORD WINAPI DirectoryScan::ScanProc(void* param)
+{
+    DirectoryScan* const scan = static_cast<DirectoryScan*>(param);
+
+    // Scan the jobs in order, and stop at the first error, so the files
+    // arrive in the same order as ScanFiles() would produce them.
+    for (size_t index = 0; index < scan->m_jobs.size() && !scan->m_stop; ++index)
+    {
+        const std::function<void(ScanJob&)> on_batch = [scan, index](ScanJob& job) {
+            EnterCriticalSection(&scan->m_cs);
+            scan->m_batches.push_back({ index, std::move(job.files) });
+            LeaveCriticalSection(&scan->m_cs);
+            job.files.clear();
+        };
+
+        ScanJob& job = scan->m_jobs[index];
+        ScanPattern(job, &on_batch, &scan->m_stop);
+        if (job.error_code)
+            break;
+    }
+
+    return 0;
+}
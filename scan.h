@@ -8,9 +8,49 @@
 #include <windows.h>
 #include "fileinfo.h"
 
+#include <atomic>
 #include <memory>
+#include <vector>
 
 class Error;
 
 bool ScanFiles(int argc, const WCHAR** argv, std::vector<FileInfo>& files, StrW& dir, Error& e, bool cmdline=false);
 
+struct ScanJob;
+
+// Scans a directory (with an optional file mask) on a worker thread, and
+// hands over the files in batches as they arrive, so the first screenful
+// can be shown before a huge directory is fully enumerated.  The files
+// arrive in the same order as from ScanFiles(), but unsorted.
+class DirectoryScan
+{
+    struct Batch
+    {
+        size_t      job;
+        std::vector<FileInfo> files;
+    };
+
+public:
+                    DirectoryScan();
+                    ~DirectoryScan();
+
+    bool            Start(const WCHAR* dir, StrW& dir_out, Error& e);
+    void            Stop();
+    bool            IsRunning() const { return !m_thread.Empty(); }
+    HANDLE          GetThread() const { return m_thread; }  // Signaled when done.
+
+    // Appends the files that arrived since the last call.  Returns true
+    // once the scan is done, and then e reports the first error, if any.
+    bool            TakeArrived(std::vector<FileInfo>& files, Error& e);
+
+private:
+    static DWORD WINAPI ScanProc(void* param);
+
+private:
+    std::vector<ScanJob> m_jobs;
+    CRITICAL_SECTION m_cs;
+    std::vector<Batch> m_batches;           // Protected by m_cs.
+    std::atomic<bool> m_stop = false;
+    SHBasic         m_thread;
+};
+
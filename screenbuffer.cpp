@@ -0,0 +1,672 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "screenbuffer.h"
+#include "colors.h"
+#include "ecma48.h"
+#include "output.h"
+#include "wcwidth_iter.h"
+
+#include <algorithm>
+
+// Unchanged cells between two changed cells cost less to rewrite than to
+// skip over with a cursor positioning sequence.
+static const unsigned c_max_gap = 6;
+
+// Trailing blanks use CSI K when there are at least this many.
+static const unsigned c_min_erase = 4;
+
+static const uint32 c_cluster_flag = 0x80000000;
+
+#pragma region Attributes
+
+// Attributes are packed into 64 bits:  the foreground color in bits 0-25,
+// the background color in bits 26-51, and flags in bits 52-63.  Each color
+// is (kind << 24) | value, so that e.g. SGR 31 and SGR 38;5;1 are kept
+// distinct, the same as the terminal receives them.
+enum : uint32
+{
+    color_default       = 0,
+    color_classic       = 1,                // SGR 30-37 and 90-97; value 0-15.
+    color_palette       = 2,                // SGR 38;5;n; value 0-255.
+    color_rgb           = 3,                // SGR 38;2;r;g;b; value 0xrrggbb.
+};
+
+enum : uint32
+{
+    flag_bold           = 0x0001,
+    flag_faint          = 0x0002,
+    flag_italic         = 0x0004,
+    flag_underline      = 0x0008,
+    flag_dbl_underline  = 0x0010,
+    flag_blink          = 0x0020,
+    flag_reverse        = 0x0040,
+    flag_conceal        = 0x0080,
+    flag_strike         = 0x0100,
+    flag_overline       = 0x0200,
+
+    // Flags that make a blank cell look different than one erased by CSI K.
+    flags_visible_blank = flag_underline|flag_dbl_underline|flag_reverse|flag_conceal|flag_strike|flag_overline,
+};
+
+static const struct { uint32 flag; const WCHAR* sgr; } c_flag_sgr[] =
+{
+    { flag_bold,            L";1" },
+    { flag_faint,           L";2" },
+    { flag_italic,          L";3" },
+    { flag_underline,       L";4" },
+    { flag_blink,           L";5" },
+    { flag_reverse,         L";7" },
+    { flag_conceal,         L";8" },
+    { flag_strike,          L";9" },
+    { flag_dbl_underline,   L";21" },
+    { flag_overline,        L";53" },
+};
+
+static const unsigned c_bg_shift = 26;
+static const unsigned c_flags_shift = 52;
+static const uint32 c_color_mask = (1 << 26) - 1;
+
+inline uint32 GetFg(uint64 attr) { return uint32(attr) & c_color_mask; }
+inline uint32 GetBg(uint64 attr) { return uint32(attr >> c_bg_shift) & c_color_mask; }
+inline uint32 GetFlags(uint64 attr) { return uint32(attr >> c_flags_shift); }
+inline uint64 MakeAttr(uint32 fg, uint32 bg, uint32 flags) { return uint64(fg) | (uint64(bg) << c_bg_shift) | (uint64(flags) << c_flags_shift); }
+inline uint32 MakeColor(uint32 kind, uint32 value) { return (kind << 24) | value; }
+
+static void AppendColorSGR(StrW& out, uint32 color, bool bg)
+{
+    const uint32 value = color & 0xffffff;
+    switch (color >> 24)
+    {
+    case color_classic:
+        out.Printf(L";%u", (value < 8) ? (bg ? 40 : 30) + value : (bg ? 100 : 90) + value - 8);
+        break;
+    case color_palette:
+        out.Printf(L";%u;5;%u", bg ? 48 : 38, value);
+        break;
+    case color_rgb:
+        out.Printf(L";%u;2;%u;%u;%u", bg ? 48 : 38, value >> 16, (value >> 8) & 0xff, value & 0xff);
+        break;
+    }
+}
+
+void ScreenBuffer::ApplySGR(const int32* params, unsigned count)
+{
+    if (!count)
+    {
+        m_attr = 0;
+        return;
+    }
+
+    uint32 fg = GetFg(m_attr);
+    uint32 bg = GetBg(m_attr);
+    uint32 flags = GetFlags(m_attr);
+
+    for (unsigned ii = 0; ii < count; ++ii)
+    {
+        const int32 p = params[ii];
+        switch (p)
+        {
+        case 0:     fg = bg = flags = 0; break;
+        case 1:     flags |= flag_bold; break;
+        case 2:     flags |= flag_faint; break;
+        case 3:     flags |= flag_italic; break;
+        case 4:     flags |= flag_underline; break;
+        case 5:     flags |= flag_blink; break;
+        case 7:     flags |= flag_reverse; break;
+        case 8:     flags |= flag_conceal; break;
+        case 9:     flags |= flag_strike; break;
+        case 21:    flags |= flag_dbl_underline; break;
+        case 22:    flags &= ~(flag_bold|flag_faint); break;
+        case 23:    flags &= ~flag_italic; break;
+        case 24:    flags &= ~(flag_underline|flag_dbl_underline); break;
+        case 25:    flags &= ~flag_blink; break;
+        case 27:    flags &= ~flag_reverse; break;
+        case 28:    flags &= ~flag_conceal; break;
+        case 29:    flags &= ~flag_strike; break;
+        case 39:    fg = color_default; break;
+        case 49:    bg = color_default; break;
+        case 53:    flags |= flag_overline; break;
+        case 55:    flags &= ~flag_overline; break;
+
+        case 38:
+        case 48:
+            {
+                uint32 color;
+                if (ii + 2 < count && params[ii + 1] == 5)
+                {
+                    color = MakeColor(color_palette, params[ii + 2] & 0xff);
+                    ii += 2;
+                }
+                else if (ii + 4 < count && params[ii + 1] == 2)
+                {
+                    color = MakeColor(color_rgb, ((params[ii + 2] & 0xff) << 16) | ((params[ii + 3] & 0xff) << 8) | (params[ii + 4] & 0xff));
+                    ii += 4;
+                }
+                else
+                {
+                    ii = count;
+                    break;
+                }
+                if (p == 38)
+                    fg = color;
+                else
+                    bg = color;
+            }
+            break;
+
+        default:
+            if (p >= 30 && p <= 37)
+                fg = MakeColor(color_classic, p - 30);
+            else if (p >= 90 && p <= 97)
+                fg = MakeColor(color_classic, p - 90 + 8);
+            else if (p >= 40 && p <= 47)
+                bg = MakeColor(color_classic, p - 40);
+            else if (p >= 100 && p <= 107)
+                bg = MakeColor(color_classic, p - 100 + 8);
+            break;
+        }
+    }
+
+    m_attr = MakeAttr(fg, bg, flags);
+}
+
+void ScreenBuffer::AppendAttr(StrW& out, uint64 attr) const
+{
+    if (!attr)
+    {
+        out.Append(c_norm);
+        return;
+    }
+
+    const uint32 flags = GetFlags(attr);
+    out.Append(L"\x1b[0");
+    for (const auto& f : c_flag_sgr)
+    {
+        if (flags & f.flag)
+            out.Append(f.sgr);
+    }
+    AppendColorSGR(out, GetFg(attr), false);
+    AppendColorSGR(out, GetBg(attr), true);
+    out.Append(L"m");
+}
+
+#pragma endregion Attributes
+#pragma region Parsing
+
+void ScreenBuffer::SetSize(unsigned width, unsigned height)
+{
+    if (width == m_width && height == m_height)
+        return;
+
+    m_width = width;
+    m_height = height;
+    m_back.assign(width * height, ScreenCell());
+    m_front.assign(width * height, ScreenCell());
+    m_valid = false;
+    m_scroll_delta = 0;
+    m_row = 0;
+    m_col = 0;
+}
+
+static void ScrollRows(std::vector<ScreenCell>& cells, unsigned width, unsigned top, unsigned bottom, int delta)
+{
+    const unsigned count = unsigned(delta < 0 ? -delta : delta);
+    const auto begin = cells.begin() + top * width;
+    const auto end = cells.begin() + bottom * width;
+    const unsigned shift = count * width;
+    if (delta > 0)
+    {
+        std::copy(begin + shift, end, begin);
+        std::fill(end - shift, end, ScreenCell());
+    }
+    else
+    {
+        std::copy_backward(begin, end - shift, end);
+        std::fill(begin, begin + shift, ScreenCell());
+    }
+}
+
+void ScreenBuffer::Scroll(unsigned top, unsigned bottom, int delta, bool retain)
+{
+    if (!delta || top >= bottom || bottom > m_height || unsigned(delta < 0 ? -delta : delta) >= bottom - top)
+        return;
+
+    if (retain)
+        ScrollRows(m_back, m_width, top, bottom, delta);
+
+    if (m_scroll_delta && (m_scroll_top != top || m_scroll_bottom != bottom))
+    {
+        // Different regions can't be combined; just redraw both.
+        m_scroll_delta = 0;
+        return;
+    }
+
+    m_scroll_top = top;
+    m_scroll_bottom = bottom;
+    m_scroll_delta += delta;
+}
+
+uint32 ScreenBuffer::InternCluster(const WCHAR* text, unsigned len)
+{
+    std::wstring cluster(text, len);
+    const auto found = m_cluster_map.find(cluster);
+    if (found != m_cluster_map.end())
+        return found->second;
+
+    const uint32 index = c_cluster_flag | uint32(m_clusters.size());
+    m_clusters.emplace_back(cluster);
+    m_cluster_map.emplace(std::move(cluster), index);
+    return index;
+}
+
+void ScreenBuffer::EraseCells(unsigned row, unsigned begin, unsigned end)
+{
+    if (row >= m_height || begin >= end)
+        return;
+
+    ScreenCell* const cells = BackRow(row);
+
+    // Erasing half of a wide character erases all of it.
+    if (begin > 0 && cells[begin].width == 0)
+        --begin;
+    if (end < m_width && cells[end].width == 0)
+        ++end;
+
+    // Erased cells get the current background color, but none of the other
+    // attributes (this matches how Windows Terminal applies CSI K).
+    ScreenCell blank;
+    blank.attr = MakeAttr(color_default, GetBg(m_attr), 0);
+    std::fill(cells + begin, cells + end, blank);
+}
+
+void ScreenBuffer::WriteCells(const WCHAR* text, unsigned len)
+{
+    wcwidth_iter iter(text, len);
+    while (const char32_t c = iter.next())
+    {
+        unsigned width = iter.character_wcwidth_onectrl();
+        if (!width)
+            continue;
+        if (width > 2)
+            width = 2;
+
+        // Wrap to the next line, the same as the terminal.
+        if (m_col + width > m_width)
+        {
+            EraseCells(m_row, m_col, m_width);
+            m_col = 0;
+            ++m_row;
+        }
+        if (m_row >= m_height)
+            break;
+
+        ScreenCell* const cells = BackRow(m_row);
+
+        // Overwriting half of a wide character erases the other half.
+        if (m_col > 0 && cells[m_col].width == 0)
+            cells[m_col - 1] = ScreenCell();
+        if (m_col + width < m_width && cells[m_col + width].width == 0)
+            cells[m_col + width] = ScreenCell();
+
+        ScreenCell& cell = cells[m_col];
+        const unsigned chr_len = iter.character_length();
+        if (chr_len == 1 || (chr_len == 2 && c > 0xffff))
+            cell.text = uint32(c);
+        else
+            cell.text = InternCluster(iter.character_pointer(), chr_len);
+        cell.attr = m_attr;
+        cell.width = uint8(width);
+
+        if (width == 2)
+        {
+            ScreenCell& right = cells[m_col + 1];
+            right.text = 0;
+            right.attr = m_attr;
+            right.width = 0;
+        }
+
+        m_col += width;
+    }
+}
+
+void ScreenBuffer::Apply(const WCHAR* text, unsigned len, bool& passthrough)
+{
+    ecma48_state state;
+    ecma48_iter iter(text, state, len);
+    while (const ecma48_code& code = iter.next())
+    {
+        switch (code.get_type())
+        {
+        case ecma48_code::type_chars:
+            WriteCells(code.get_pointer(), code.get_length());
+            break;
+
+        case ecma48_code::type_c0:
+            switch (code.get_code())
+            {
+            case '\n':
+                // Output treats "\n" as "\r\n".
+                if (m_row + 1 < m_height)
+                    ++m_row;
+                m_col = 0;
+                break;
+            case '\r':
+                m_col = 0;
+                break;
+            case '\b':
+                if (m_col > 0)
+                    --m_col;
+                break;
+            default:
+                passthrough = true;
+                break;
+            }
+            break;
+
+        case ecma48_code::type_c1:
+            {
+                ecma48_code::csi<32> csi;
+                if (!code.decode_csi(csi) || csi.intermediate)
+                {
+                    passthrough = true;
+                    break;
+                }
+
+                if (csi.private_use)
+                {
+                    // The cursor is hidden and shown around each write.
+                    if ((csi.final == 'h' || csi.final == 'l') && csi.param_count == 1 && csi.params[0] == 25)
+                        break;
+                    passthrough = true;
+                    break;
+                }
+
+                switch (csi.final)
+                {
+                case 'H':
+                case 'f':
+                    m_row = std::min<unsigned>(std::max<int32>(csi.get_param(0, 1), 1), m_height) - 1;
+                    m_col = std::min<unsigned>(std::max<int32>(csi.get_param(1, 1), 1), m_width) - 1;
+                    break;
+                case 'G':
+                    m_col = std::min<unsigned>(std::max<int32>(csi.get_param(0, 1), 1), m_width) - 1;
+                    break;
+                case 'A':
+                    m_row -= std::min<unsigned>(std::max<int32>(csi.get_param(0, 1), 1), m_row);
+                    break;
+                case 'B':
+                    m_row = std::min<unsigned>(m_row + std::max<int32>(csi.get_param(0, 1), 1), m_height - 1);
+                    break;
+                case 'C':
+                    m_col = std::min<unsigned>(m_col + std::max<int32>(csi.get_param(0, 1), 1), m_width - 1);
+                    break;
+                case 'D':
+                    m_col -= std::min<unsigned>(std::max<int32>(csi.get_param(0, 1), 1), m_col);
+                    break;
+                case 'K':
+                    switch (csi.get_param(0, 0))
+                    {
+                    case 0:     EraseCells(m_row, m_col, m_width); break;
+                    case 1:     EraseCells(m_row, 0, std::min<unsigned>(m_col + 1, m_width)); break;
+                    case 2:     EraseCells(m_row, 0, m_width); break;
+                    }
+                    break;
+                case 'J':
+                    switch (csi.get_param(0, 0))
+                    {
+                    case 0:
+                        EraseCells(m_row, m_col, m_width);
+                        for (unsigned row = m_row + 1; row < m_height; ++row)
+                            EraseCells(row, 0, m_width);
+                        break;
+                    case 1:
+                        for (unsigned row = 0; row < m_row; ++row)
+                            EraseCells(row, 0, m_width);
+                        EraseCells(m_row, 0, std::min<unsigned>(m_col + 1, m_width));
+                        break;
+                    case 2:
+                        for (unsigned row = 0; row < m_height; ++row)
+                            EraseCells(row, 0, m_width);
+                        break;
+                    }
+                    break;
+                case 'm':
+                    ApplySGR(csi.params, csi.param_count);
+                    break;
+                default:
+                    passthrough = true;
+                    break;
+                }
+            }
+            break;
+
+        default:
+            passthrough = true;
+            break;
+        }
+    }
+}
+
+#pragma endregion Parsing
+#pragma region Output
+
+void ScreenBuffer::AppendCellText(StrW& out, const ScreenCell& cell) const
+{
+    if (cell.text & c_cluster_flag)
+    {
+        const std::wstring& cluster = m_clusters[cell.text & ~c_cluster_flag];
+        out.Append(cluster.c_str(), unsigned(cluster.length()));
+    }
+    else if (cell.text > 0xffff)
+    {
+        const uint32 c = cell.text - 0x10000;
+        const WCHAR pair[2] = { WCHAR(0xd800 + (c >> 10)), WCHAR(0xdc00 + (c & 0x3ff)) };
+        out.Append(pair, 2);
+    }
+    else
+    {
+        out.Append(WCHAR(cell.text));
+    }
+}
+
+void ScreenBuffer::AppendCursor(StrW& out, unsigned row, unsigned col)
+{
+    if (row == m_out_row && col == m_out_col)
+        return;
+
+    if (row == m_out_row)
+        out.Printf(L"\x1b[%uG", col + 1);
+    else if (!col)
+        out.Printf(L"\x1b[%uH", row + 1);
+    else
+        out.Printf(L"\x1b[%u;%uH", row + 1, col + 1);
+
+    m_out_row = row;
+    m_out_col = col;
+}
+
+void ScreenBuffer::AppendScroll(StrW& out)
+{
+    const unsigned top = m_scroll_top;
+    const unsigned bottom = m_scroll_bottom;
+    const int delta = m_scroll_delta;
+    m_scroll_delta = 0;
+
+    if (!delta || top >= bottom || bottom > m_height)
+        return;
+    const unsigned count = unsigned(delta < 0 ? -delta : delta);
+    if (count >= bottom - top)
+        return;
+
+    // Rows scrolled into view are erased using the current background color.
+    if (m_out_attr)
+    {
+        out.Append(c_norm);
+        m_out_attr = 0;
+    }
+
+    out.Printf(L"\x1b[%u;%ur", top + 1, bottom);
+    out.Printf(L"\x1b[%u%c", count, (delta > 0) ? L'S' : L'T');
+    out.Append(L"\x1b[r");
+
+    // Setting the scroll region moves the cursor home.
+    m_out_row = unsigned(-1);
+    m_out_col = unsigned(-1);
+
+    // Scroll what's on the screen the same way.
+    ScrollRows(m_front, m_width, top, bottom, delta);
+}
+
+void ScreenBuffer::AppendRow(StrW& out, unsigned row)
+{
+    const ScreenCell* const back = BackRow(row);
+    ScreenCell* const front = FrontRow(row);
+
+    unsigned col = 0;
+    while (true)
+    {
+        // Find the next changed cell.
+        if (m_valid)
+        {
+            while (col < m_width && back[col] == front[col])
+                ++col;
+        }
+        if (col >= m_width)
+            break;
+        while (col > 0 && (back[col].width == 0 || front[col].width == 0))
+            --col;
+
+        // Find the end of the run of changes, absorbing short gaps.
+        unsigned end = m_width;
+        if (m_valid)
+        {
+            unsigned last = col + 1;
+            for (end = last; end < m_width; ++end)
+            {
+                if (back[end] != front[end])
+                    last = end + 1;
+                else if (end - last >= c_max_gap)
+                    break;
+            }
+            end = last;
+            while (end < m_width && back[end].width == 0)
+                ++end;
+        }
+
+        // Blanks that reach the end of the row can be erased instead.
+        unsigned text_end = end;
+        if (end == m_width)
+        {
+            const ScreenCell& last = back[end - 1];
+            if (last.text == ' ' && last.width == 1 && !(GetFlags(last.attr) & flags_visible_blank))
+            {
+                unsigned blank = end - 1;
+                while (blank > col && back[blank - 1] == last)
+                    --blank;
+                if (end - blank >= c_min_erase)
+                    text_end = blank;
+            }
+        }
+
+        AppendCursor(out, row, col);
+        for (unsigned ii = col; ii < text_end; ++ii)
+        {
+            const ScreenCell& cell = back[ii];
+            if (!cell.width)
+                continue;
+            if (cell.attr != m_out_attr)
+            {
+                AppendAttr(out, cell.attr);
+                m_out_attr = cell.attr;
+            }
+            AppendCellText(out, cell);
+            m_out_col += cell.width;
+        }
+        if (text_end < end)
+        {
+            if (back[text_end].attr != m_out_attr)
+            {
+                AppendAttr(out, back[text_end].attr);
+                m_out_attr = back[text_end].attr;
+            }
+            out.Append(c_clreol);
+        }
+
+        // After writing the last column the cursor position depends on the
+        // terminal's wrapping behavior.
+        if (m_out_col >= m_width)
+        {
+            m_out_row = unsigned(-1);
+            m_out_col = unsigned(-1);
+        }
+
+        std::copy(back + col, back + end, front + col);
+        col = end;
+    }
+}
+
+void ScreenBuffer::Present(const WCHAR* text, unsigned len)
+{
+    if (!m_width || !m_height)
+        return;
+
+    if (m_serial != GetOutputConsoleSerial())
+        m_valid = false;
+    if (!m_valid)
+    {
+        m_out_row = unsigned(-1);
+        m_out_col = unsigned(-1);
+        m_scroll_delta = 0;
+    }
+    m_out_attr = uint64(-1);
+
+    bool passthrough = false;
+    Apply(text, len, passthrough);
+
+    StrW out;
+    if (passthrough)
+    {
+        // The text uses something the grid doesn't understand, so write it
+        // as is.  The grid still reflects everything else in it.
+        m_scroll_delta = 0;
+        out.Append(c_hide_cursor);
+        out.Append(text, len);
+        out.Append(c_show_cursor);
+        OutputConsole(out.Text(), out.Length());
+        if (m_valid)
+            m_front = m_back;
+        m_out_row = unsigned(-1);
+        m_out_col = unsigned(-1);
+        m_serial = GetOutputConsoleSerial();
+        return;
+    }
+
+    out.Append(c_hide_cursor);
+    const unsigned prolog = out.Length();
+
+    if (m_valid && m_scroll_delta && !IsConsoleEmulated())
+        AppendScroll(out);
+    m_scroll_delta = 0;
+
+    for (unsigned row = 0; row < m_height; ++row)
+        AppendRow(out, row);
+    m_valid = true;
+
+    const unsigned cursor_col = std::min<unsigned>(m_col, m_width - 1);
+    if (out.Length() == prolog && m_out_row == m_row && m_out_col == cursor_col)
+        return;
+
+    AppendCursor(out, m_row, cursor_col);
+    if (m_out_attr)
+        out.Append(c_norm);
+    out.Append(c_show_cursor);
+
+    OutputConsole(out.Text(), out.Length());
+    m_serial = GetOutputConsoleSerial();
+}
+
+#pragma endregion Output
@@ -0,0 +1,96 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "str.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A cell grid of what's on the screen, and what should be on the screen.
+//
+// Callers compose their output the same way as for OutputConsole (absolute
+// cursor positioning, SGR codes, CSI K, and "\n" line breaks), and Present()
+// applies it to the desired grid, compares that with the grid of what's
+// already on the screen, and writes only the cells that changed, in a single
+// write.  Callers may compose only the parts of the screen that they know
+// changed; the rest of the desired grid is retained from earlier frames.
+//
+// Writes through OutputConsole by anyone else invalidate the grid of what's
+// on the screen, so that the next Present() redraws everything.
+
+struct ScreenCell
+{
+    bool            operator==(const ScreenCell& other) const { return text == other.text && attr == other.attr && width == other.width; }
+    bool            operator!=(const ScreenCell& other) const { return !(*this == other); }
+
+    uint64          attr = 0;               // Packed ScreenBuffer attributes; 0 is default.
+    uint32          text = ' ';             // Codepoint, or c_cluster_flag | cluster index.
+    uint8           width = 1;              // 0 for the right half of a wide character.
+};
+
+class ScreenBuffer
+{
+public:
+                    ScreenBuffer() = default;
+                    ~ScreenBuffer() = default;
+
+    void            SetSize(unsigned width, unsigned height);
+    void            Invalidate() { m_valid = false; }
+
+    // Tells Present() that rows [top, bottom) of what's on the screen are
+    // about to move up by delta rows (or down, if delta is negative), so it
+    // can scroll them instead of redrawing them.  If retain is true, the
+    // rows are moved in what should be on the screen as well, and the caller
+    // only needs to compose the rows that scroll into view.
+    void            Scroll(unsigned top, unsigned bottom, int delta, bool retain=false);
+
+    void            Present(const WCHAR* text, unsigned len);
+
+private:
+    void            Apply(const WCHAR* text, unsigned len, bool& passthrough);
+    void            ApplySGR(const int32* params, unsigned count);
+    void            WriteCells(const WCHAR* text, unsigned len);
+    void            EraseCells(unsigned row, unsigned begin, unsigned end);
+    uint32          InternCluster(const WCHAR* text, unsigned len);
+    void            AppendCellText(StrW& out, const ScreenCell& cell) const;
+    void            AppendAttr(StrW& out, uint64 attr) const;
+    void            AppendCursor(StrW& out, unsigned row, unsigned col);
+    void            AppendScroll(StrW& out);
+    void            AppendRow(StrW& out, unsigned row);
+    ScreenCell*     BackRow(unsigned row) { return m_back.data() + row * m_width; }
+    ScreenCell*     FrontRow(unsigned row) { return m_front.data() + row * m_width; }
+
+private:
+    unsigned        m_width = 0;
+    unsigned        m_height = 0;
+    std::vector<ScreenCell> m_back;         // What should be on the screen.
+    std::vector<ScreenCell> m_front;        // What is on the screen.
+    bool            m_valid = false;        // Whether m_front is accurate.
+    uint32          m_serial = 0;           // Output serial number after the last write.
+
+    // Pending scroll.
+    unsigned        m_scroll_top = 0;
+    unsigned        m_scroll_bottom = 0;
+    int             m_scroll_delta = 0;
+
+    // Parsing state.
+    unsigned        m_row = 0;
+    unsigned        m_col = 0;
+    uint64          m_attr = 0;
+
+    // Output state.
+    unsigned        m_out_row = unsigned(-1);
+    unsigned        m_out_col = unsigned(-1);
+    uint64          m_out_attr = uint64(-1);
+
+    // Character clusters that are more than one codepoint (e.g. emoji
+    // sequences or combining marks), shared by both grids.
+    std::vector<std::wstring> m_clusters;
+    std::unordered_map<std::wstring, uint32> m_cluster_map;
+};
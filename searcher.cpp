@@ -15,8 +15,193 @@
 
 #include <regex>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <intrin.h>
+#include <emmintrin.h>
 
-static bool s_regex = false;    // Starts out false in every session.
+static SearcherType s_type = SearcherType::Literal;  // Starts out Literal in every session.
+
+// Needles at least this long use Boyer-Moore-Horspool; shorter needles use
+// an SSE2 filter on the first and last bytes, which skips 16 positions at a
+// time but can't skip ahead by more than that.
+const size_t c_horspool_min_needle = 24;
+
+// Case folding matches the C locale rules used by _wcsnicmp(), which only
+// fold ASCII letters.
+static inline WCHAR FoldChar(WCHAR c)
+{
+    return (c >= 'a' && c <= 'z') ? WCHAR(c - ('a' - 'A')) : c;
+}
+
+static bool VerifyBytes(const BYTE* p, const BYTE* needle, size_t n, const BYTE* fold)
+{
+    if (!fold)
+        return !memcmp(p, needle, n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (fold[p[i]] != needle[i])
+            return false;
+    }
+    return true;
+}
+
+static const BYTE* FindFiltered(const BYTE* hay, size_t len, const BYTE* needle, size_t n, const BYTE* fold, const BYTE (&first)[2], const BYTE (&last)[2])
+{
+    assert(n && len >= n);
+
+    // Each position is a candidate only if both its first and last bytes
+    // match, which rejects nearly all positions 16 at a time.
+    const size_t positions = len - n + 1;
+    size_t pos = 0;
+    const __m128i f0 = _mm_set1_epi8(char(first[0]));
+    const __m128i f1 = _mm_set1_epi8(char(first[1]));
+    const __m128i l0 = _mm_set1_epi8(char(last[0]));
+    const __m128i l1 = _mm_set1_epi8(char(last[1]));
+    for (; pos + 16 <= positions; pos += 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + pos));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + pos + n - 1));
+        const __m128i ma = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+        const __m128i mb = _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1));
+        unsigned mask = unsigned(_mm_movemask_epi8(_mm_and_si128(ma, mb)));
+        while (mask)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            if (VerifyBytes(hay + pos + bit + 1, needle + 1, n - 1, fold))
+                return hay + pos + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    for (; pos < positions; ++pos)
+    {
+        const BYTE a = hay[pos];
+        const BYTE b = hay[pos + n - 1];
+        if ((a == first[0] || a == first[1]) &&
+            (b == last[0] || b == last[1]) &&
+            VerifyBytes(hay + pos + 1, needle + 1, n - 1, fold))
+            return hay + pos;
+    }
+
+    return nullptr;
+}
+
+static const BYTE* FindHorspool(const BYTE* hay, size_t len, const BYTE* needle, size_t n, const BYTE* fold, const BYTE* verify_fold, const size_t* skip)
+{
+    assert(n && len >= n);
+
+    const BYTE last = needle[n - 1];
+    for (size_t pos = 0; pos + n <= len;)
+    {
+        const BYTE c = fold[hay[pos + n - 1]];
+        if (c == last && VerifyBytes(hay + pos, needle, n - 1, verify_fold))
+            return hay + pos;
+        pos += skip[c];
+    }
+
+    return nullptr;
+}
+
+// Describes how to match text directly on the bytes of a code page.
+struct ByteMatchEncoding
+{
+    bool            Init(UINT cp, bool caseless);
+    bool            EncodeNeedle(const StrW& find, std::vector<BYTE>& out) const;
+
+    UINT            cp = 0;
+    bool            one_to_one = false;         // Byte index == WCHAR index.
+    BYTE            fold[256];                  // Identity when not caseless.
+    BYTE            other[256];                 // The other case of each byte.
+};
+
+bool ByteMatchEncoding::Init(UINT _cp, bool caseless)
+{
+    cp = _cp;
+
+    // UTF8 is self synchronizing, so a needle's bytes can only match at
+    // character boundaries.  Single byte code pages map each byte to one
+    // WCHAR.  Other code pages have to be decoded.
+    WCHAR decoded[256];
+    if (cp == CP_UTF8)
+    {
+        one_to_one = false;
+        for (unsigned b = 0; b < 256; ++b)
+            decoded[b] = WCHAR((b < 0x80) ? b : 0xfffd);
+    }
+    else
+    {
+        CPINFO info;
+        if (cp == CP_UTF7 || cp == CP_WINUNICODE || cp == 1201 || !GetCPInfo(cp, &info) || info.MaxCharSize != 1)
+            return false;
+        one_to_one = true;
+
+        char all[256];
+        for (unsigned b = 0; b < 256; ++b)
+            all[b] = char(b);
+        if (MultiByteToWideChar(cp, 0, all, 256, decoded, 256) != 256)
+            return false;
+    }
+
+    // Build a folding table that maps each byte to the byte for the upper
+    // case form of its character.
+    for (unsigned b = 0; b < 256; ++b)
+    {
+        fold[b] = BYTE(b);
+        other[b] = BYTE(b);
+    }
+    if (caseless)
+    {
+        for (unsigned b = 0; b < 256; ++b)
+        {
+            if (decoded[b] < 'a' || decoded[b] > 'z')
+                continue;
+            const WCHAR upper = FoldChar(decoded[b]);
+            for (unsigned u = 0; u < 256; ++u)
+            {
+                if (decoded[u] == upper)
+                {
+                    fold[b] = BYTE(u);
+                    other[b] = BYTE(u);
+                    other[u] = BYTE(b);
+                    break;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool ByteMatchEncoding::EncodeNeedle(const StrW& find, std::vector<BYTE>& out) const
+{
+    out.clear();
+
+    // Invalid sequences decode as U+FFFD, which raw bytes can't match.
+    if (!find.Length() || wcschr(find.Text(), 0xfffd))
+        return false;
+
+    const int n = WideCharToMultiByte(cp, 0, find.Text(), find.Length(), nullptr, 0, nullptr, nullptr);
+    if (n <= 0)
+        return false;
+    out.resize(n);
+    WideCharToMultiByte(cp, 0, find.Text(), find.Length(), reinterpret_cast<char*>(out.data()), n, nullptr, nullptr);
+
+    // Characters that aren't representable (or get best fit mappings) can't
+    // be matched as bytes.
+    StrW check;
+    check.SetFromCodepage(cp, reinterpret_cast<const char*>(out.data()), out.size());
+    if (!check.Equal(find))
+    {
+        out.clear();
+        return false;
+    }
+
+    for (auto& c : out)
+        c = fold[c];
+    return true;
+}
 
 class Searcher_Literal : public Searcher
 {
@@ -27,47 +212,913 @@ public:
     SearcherType    GetSearcherType() const override { return SearcherType::Literal; }
     unsigned        GetNeedleDelta() const override { return m_find.Length(); }
 
+    bool            CanScan(const FileLineMap& map) override;
+    size_t          Scan(const BYTE* data, size_t length) override;
+    unsigned        GetScanOverlap() const override;
+
 protected:
     bool            DoNext(FileLineMap& map, const BYTE* line, unsigned length, Error& e) override;
 
+private:
+    bool            PrepareBytes(UINT cp);
+    const BYTE*     FindBytes(const BYTE* data, size_t length) const;
+    bool            MatchBytes(const BYTE* line, unsigned length);
+    bool            MatchText(const WCHAR* line, unsigned length);
+
 private:
     const bool      m_caseless;
     const StrW      m_find;
+    StrW            m_find_folded;
+
+    // For matching the raw bytes in code pages where that's possible.
+    UINT            m_bytes_cp = 0;             // Code page the fields below are for.
+    bool            m_bytes_ok = false;
+    ByteMatchEncoding m_encoding;
+    std::vector<BYTE> m_needle;                 // Folded needle in m_bytes_cp.
+    BYTE            m_first[2];                 // Both cases of the needle's first byte.
+    BYTE            m_last[2];                  // Both cases of the needle's last byte.
+    size_t          m_skip[256];
 };
 
 Searcher_Literal::Searcher_Literal(const WCHAR* s, bool caseless, Error& e)
 : m_caseless(caseless)
 , m_find(s)
 {
+    m_find_folded = m_find;
+    if (m_caseless)
+    {
+        WCHAR* p = m_find_folded.Reserve();
+        for (unsigned i = 0; i < m_find_folded.Length(); ++i)
+            p[i] = FoldChar(p[i]);
+    }
 }
 
-bool Searcher_Literal::DoNext(FileLineMap& map, const BYTE* _line, unsigned _length, Error& e)
+bool Searcher_Literal::PrepareBytes(UINT cp)
 {
-    // FUTURE:  Boyer-Moore?
+    if (cp == m_bytes_cp)
+        return m_bytes_ok;
 
-    map.GetLineText(_line, _length, m_tmp);
-    TrimLineEnding(m_tmp);
+    m_bytes_cp = cp;
+    m_bytes_ok = false;
+    m_needle.clear();
 
-    const WCHAR* const line = m_tmp.Text();
-    const unsigned length = m_tmp.Length();
+    if (!m_encoding.Init(cp, m_caseless) || !m_encoding.EncodeNeedle(m_find, m_needle))
+        return false;
+
+    m_first[0] = m_needle.front();
+    m_first[1] = m_encoding.other[m_needle.front()];
+    m_last[0] = m_needle.back();
+    m_last[1] = m_encoding.other[m_needle.back()];
+
+    const size_t len = m_needle.size();
+    for (auto& skip : m_skip)
+        skip = len;
+    for (size_t i = 0; i + 1 < len; ++i)
+        m_skip[m_needle[i]] = len - 1 - i;
+
+    m_bytes_ok = true;
+    return true;
+}
+
+const BYTE* Searcher_Literal::FindBytes(const BYTE* data, size_t length) const
+{
+    assert(m_bytes_ok);
+
+    const size_t n = m_needle.size();
+    if (length < n)
+        return nullptr;
+
+    const BYTE* const verify_fold = m_caseless ? m_encoding.fold : nullptr;
+    return ((n >= c_horspool_min_needle) ?
+            FindHorspool(data, length, m_needle.data(), n, m_encoding.fold, verify_fold, m_skip) :
+            FindFiltered(data, length, m_needle.data(), n, verify_fold, m_first, m_last));
+}
+
+bool Searcher_Literal::MatchBytes(const BYTE* line, unsigned length)
+{
+    // Ignore the line ending, the same as when matching decoded text.
+    while (length && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        --length;
+
+    const BYTE* const found = FindBytes(line, length);
+    if (!found)
+        return false;
+
+    unsigned index = unsigned(found - line);
+    if (!m_encoding.one_to_one && index)
+        index = MultiByteToWideChar(m_bytes_cp, 0, reinterpret_cast<const char*>(line), index, nullptr, 0);
 
-    const WCHAR* const end = line + length - (m_find.Length() - 1);
-    for (const WCHAR* p = line; p < end; ++p)
+    SetMatch(index, m_find.Length());
+    return true;
+}
+
+bool Searcher_Literal::MatchText(const WCHAR* line, unsigned length)
+{
+    const unsigned n = m_find_folded.Length();
+    if (length < n)
+        return false;
+
+    const WCHAR* const find = m_find_folded.Text();
+    const WCHAR* const end = line + length - (n - 1);
+    if (!m_caseless)
+    {
+        for (const WCHAR* p = line; p < end; ++p)
+        {
+            p = wmemchr(p, find[0], end - p);
+            if (!p)
+                break;
+            if (!wmemcmp(p + 1, find + 1, n - 1))
+            {
+                SetMatch(unsigned(p - line), n);
+                return true;
+            }
+        }
+    }
+    else
     {
-        const int n = (m_caseless ?
-                       _wcsnicmp(p, m_find.Text(), m_find.Length()) :
-                       wcsncmp(p, m_find.Text(), m_find.Length()));
-        if (n == 0)
+        for (const WCHAR* p = line; p < end; ++p)
         {
-            SetMatch(unsigned(p - line), m_find.Length());
-            return true;
+            if (FoldChar(*p) != find[0])
+                continue;
+            unsigned i = 1;
+            while (i < n && FoldChar(p[i]) == find[i])
+                ++i;
+            if (i == n)
+            {
+                SetMatch(unsigned(p - line), n);
+                return true;
+            }
         }
     }
 
-    SetExhausted();
     return false;
 }
 
+bool Searcher_Literal::CanScan(const FileLineMap& map)
+{
+    return m_find.Length() && PrepareBytes(map.GetCodePage());
+}
+
+size_t Searcher_Literal::Scan(const BYTE* data, size_t length)
+{
+    const BYTE* const found = FindBytes(data, length);
+    return found ? size_t(found - data) : size_t(-1);
+}
+
+unsigned Searcher_Literal::GetScanOverlap() const
+{
+    assert(m_bytes_ok);
+    return unsigned(m_needle.size() - 1);
+}
+
+bool Searcher_Literal::DoNext(FileLineMap& map, const BYTE* line, unsigned length, Error& e)
+{
+    if (!m_find.Length())
+    {
+        SetMatch(0, 0);
+        return true;
+    }
+
+    bool found;
+    if (PrepareBytes(map.GetCodePage()))
+    {
+        found = MatchBytes(line, length);
+    }
+    else
+    {
+        map.GetLineText(line, length, m_tmp);
+        TrimLineEnding(m_tmp);
+        found = MatchText(m_tmp.Text(), m_tmp.Length());
+    }
+
+    if (!found)
+        SetExhausted();
+    return found;
+}
+
+// Aho-Corasick automaton for finding any of several byte strings in one
+// pass.  The transitions are fully expanded into a dense table, so each byte
+// costs a single lookup regardless of how many needles there are.
+class AhoCorasick
+{
+public:
+    void            Build(const std::vector<std::vector<BYTE>>& needles, const BYTE* fold);
+    const BYTE*     Find(const BYTE* data, size_t length, unsigned& which) const;
+    size_t          GetMaxLength() const { return m_max_length; }
+
+private:
+    std::vector<uint32> m_next;                 // 256 transitions per state.
+    std::vector<uint32> m_report;               // First state with an output along the suffix chain (or 0).
+    std::vector<uint32> m_dict;                 // Next state with an output along the suffix chain (or 0).
+    std::vector<uint32> m_depth;
+    std::vector<unsigned> m_output;             // Needle that ends at each state.
+    BYTE            m_fold[256];
+    size_t          m_max_length = 0;
+};
+
+void AhoCorasick::Build(const std::vector<std::vector<BYTE>>& needles, const BYTE* fold)
+{
+    memcpy(m_fold, fold, sizeof(m_fold));
+    m_max_length = 0;
+
+    m_next.assign(256, 0);
+    m_depth.assign(1, 0);
+    m_output.assign(1, unsigned(-1));
+
+    // Build the trie.  State 0 is the root, so a 0 transition means there's
+    // no child yet.
+    for (size_t ii = 0; ii < needles.size(); ++ii)
+    {
+        uint32 state = 0;
+        for (const BYTE b : needles[ii])
+        {
+            uint32& next = m_next[state * 256 + b];
+            if (!next)
+            {
+                next = uint32(m_depth.size());
+                m_next.resize(m_next.size() + 256, 0);
+                m_depth.emplace_back(m_depth[state] + 1);
+                m_output.emplace_back(unsigned(-1));
+            }
+            state = m_next[state * 256 + b];
+        }
+        if (m_output[state] == unsigned(-1))
+            m_output[state] = unsigned(ii);
+        m_max_length = std::max<size_t>(m_max_length, needles[ii].size());
+    }
+
+    // Compute failure links breadth first, and fill in the missing
+    // transitions from the failure states (which are always shallower and
+    // therefore already complete).
+    const size_t num_states = m_depth.size();
+    std::vector<uint32> fail(num_states, 0);
+    std::vector<uint32> queue;
+    queue.reserve(num_states);
+    m_dict.assign(num_states, 0);
+    m_report.assign(num_states, 0);
+
+    for (unsigned b = 0; b < 256; ++b)
+    {
+        if (m_next[b])
+            queue.emplace_back(m_next[b]);
+    }
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+        const uint32 state = queue[head];
+        const uint32 f = fail[state];
+        m_dict[state] = (m_output[f] != unsigned(-1)) ? f : m_dict[f];
+        m_report[state] = (m_output[state] != unsigned(-1)) ? state : m_dict[state];
+
+        for (unsigned b = 0; b < 256; ++b)
+        {
+            uint32& next = m_next[state * 256 + b];
+            if (next)
+            {
+                fail[next] = m_next[f * 256 + b];
+                queue.emplace_back(next);
+            }
+            else
+            {
+                next = m_next[f * 256 + b];
+            }
+        }
+    }
+}
+
+const BYTE* AhoCorasick::Find(const BYTE* data, size_t length, unsigned& which) const
+{
+    const BYTE* best = nullptr;
+    size_t best_length = 0;
+
+    const BYTE* const end = data + length;
+    uint32 state = 0;
+    for (const BYTE* p = data; p < end; ++p)
+    {
+        state = m_next[state * 256 + m_fold[*p]];
+        for (uint32 out = m_report[state]; out; out = m_dict[out])
+        {
+            // Prefer the leftmost match, and then the longest.
+            const size_t len = m_depth[out];
+            const BYTE* const start = p + 1 - len;
+            if (!best || start < best || (start == best && len > best_length))
+            {
+                best = start;
+                best_length = len;
+                which = m_output[out];
+            }
+        }
+
+        // No match that ends later can start earlier than best.
+        if (best && size_t(p + 1 - best) >= m_max_length)
+            break;
+    }
+
+    return best;
+}
+
+// Matches any of several literal strings, separated by spaces.
+class Searcher_MultiLiteral : public Searcher
+{
+public:
+                    Searcher_MultiLiteral(const WCHAR* s, bool caseless, Error& e);
+                    ~Searcher_MultiLiteral() = default;
+
+    SearcherType    GetSearcherType() const override { return SearcherType::MultiLiteral; }
+    unsigned        GetNeedleDelta() const override { return m_max_find_length; }
+    const WCHAR*    GetMatchedPattern() const override { return (m_matched < m_finds.size()) ? m_finds[m_matched].Text() : nullptr; }
+
+    bool            CanScan(const FileLineMap& map) override;
+    size_t          Scan(const BYTE* data, size_t length) override;
+    unsigned        GetScanOverlap() const override;
+
+protected:
+    bool            DoNext(FileLineMap& map, const BYTE* line, unsigned length, Error& e) override;
+
+private:
+    bool            Prepare(UINT cp);
+    bool            MatchBytes(const BYTE* line, unsigned length, UINT cp, bool one_to_one);
+
+private:
+    const bool      m_caseless;
+    std::vector<StrW> m_finds;
+    unsigned        m_max_find_length = 0;
+    unsigned        m_matched = unsigned(-1);
+
+    UINT            m_bytes_cp = 0;             // Code page the automaton is for.
+    bool            m_bytes_ok = false;
+    ByteMatchEncoding m_encoding;
+    AhoCorasick     m_automaton;
+
+    // For code pages that can't be matched as raw bytes, the line text is
+    // converted to UTF8 and matched with a separate automaton.
+    bool            m_utf8_ok = false;
+    AhoCorasick     m_utf8_automaton;
+    StrUtf8         m_line;
+};
+
+Searcher_MultiLiteral::Searcher_MultiLiteral(const WCHAR* s, bool caseless, Error& e)
+: m_caseless(caseless)
+{
+    std::vector<StrW> folded;
+    while (*s)
+    {
+        while (*s == ' ' || *s == '\t')
+            ++s;
+        const WCHAR* const begin = s;
+        while (*s && *s != ' ' && *s != '\t')
+            ++s;
+        if (s == begin)
+            continue;
+
+        StrW find;
+        find.Set(begin, s - begin);
+        StrW key(find);
+        if (m_caseless)
+        {
+            WCHAR* p = key.Reserve();
+            for (unsigned i = 0; i < key.Length(); ++i)
+                p[i] = FoldChar(p[i]);
+        }
+
+        // Ignore duplicates.
+        bool dup = false;
+        for (const auto& other : folded)
+            dup = dup || other.Equal(key);
+        if (dup)
+            continue;
+
+        m_max_find_length = std::max<unsigned>(m_max_find_length, find.Length());
+        folded.emplace_back(std::move(key));
+        m_finds.emplace_back(std::move(find));
+    }
+
+    if (m_finds.empty())
+    {
+        e.Set(L"No search text.");
+        return;
+    }
+
+    // UTF8 can represent anything, so the fallback automaton always exists
+    // (unless a string contains an unpaired surrogate).
+    ByteMatchEncoding utf8;
+    std::vector<std::vector<BYTE>> needles(m_finds.size());
+    m_utf8_ok = utf8.Init(CP_UTF8, m_caseless);
+    for (size_t ii = 0; m_utf8_ok && ii < m_finds.size(); ++ii)
+        m_utf8_ok = utf8.EncodeNeedle(m_finds[ii], needles[ii]);
+    if (m_utf8_ok)
+        m_utf8_automaton.Build(needles, utf8.fold);
+    else
+        e.Set(L"Search text contains invalid characters.");
+}
+
+bool Searcher_MultiLiteral::Prepare(UINT cp)
+{
+    if (cp == m_bytes_cp)
+        return m_bytes_ok;
+
+    m_bytes_cp = cp;
+    m_bytes_ok = false;
+
+    if (cp == CP_UTF8)
+    {
+        m_bytes_ok = m_utf8_ok;
+        return m_bytes_ok;
+    }
+
+    // Every string must be representable, otherwise some could be missed.
+    std::vector<std::vector<BYTE>> needles(m_finds.size());
+    if (!m_encoding.Init(cp, m_caseless))
+        return false;
+    for (size_t ii = 0; ii < m_finds.size(); ++ii)
+    {
+        if (!m_encoding.EncodeNeedle(m_finds[ii], needles[ii]))
+            return false;
+    }
+
+    m_automaton.Build(needles, m_encoding.fold);
+    m_bytes_ok = true;
+    return true;
+}
+
+bool Searcher_MultiLiteral::MatchBytes(const BYTE* line, unsigned length, UINT cp, bool one_to_one)
+{
+    const AhoCorasick& automaton = (cp == CP_UTF8) ? m_utf8_automaton : m_automaton;
+
+    unsigned which;
+    const BYTE* const found = automaton.Find(line, length, which);
+    if (!found)
+        return false;
+
+    unsigned index = unsigned(found - line);
+    if (!one_to_one && index)
+        index = MultiByteToWideChar(cp, 0, reinterpret_cast<const char*>(line), index, nullptr, 0);
+
+    m_matched = which;
+    SetMatch(index, m_finds[which].Length());
+    return true;
+}
+
+bool Searcher_MultiLiteral::CanScan(const FileLineMap& map)
+{
+    return Prepare(map.GetCodePage());
+}
+
+size_t Searcher_MultiLiteral::Scan(const BYTE* data, size_t length)
+{
+    assert(m_bytes_ok);
+
+    unsigned which;
+    const AhoCorasick& automaton = (m_bytes_cp == CP_UTF8) ? m_utf8_automaton : m_automaton;
+    const BYTE* const found = automaton.Find(data, length, which);
+    return found ? size_t(found - data) : size_t(-1);
+}
+
+unsigned Searcher_MultiLiteral::GetScanOverlap() const
+{
+    assert(m_bytes_ok);
+    const AhoCorasick& automaton = (m_bytes_cp == CP_UTF8) ? m_utf8_automaton : m_automaton;
+    return unsigned(automaton.GetMaxLength() - 1);
+}
+
+bool Searcher_MultiLiteral::DoNext(FileLineMap& map, const BYTE* line, unsigned length, Error& e)
+{
+    m_matched = unsigned(-1);
+
+    bool found;
+    if (Prepare(map.GetCodePage()))
+    {
+        // Ignore the line ending, the same as when matching decoded text.
+        while (length && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            --length;
+        found = MatchBytes(line, length, m_bytes_cp, m_bytes_cp != CP_UTF8);
+    }
+    else
+    {
+        map.GetLineText(line, length, m_tmp);
+        TrimLineEnding(m_tmp);
+        m_line.SetW(m_tmp);
+        found = m_utf8_ok && MatchBytes(reinterpret_cast<const BYTE*>(m_line.Text()), m_line.Length(), CP_UTF8, false);
+    }
+
+    if (!found)
+        SetExhausted();
+    return found;
+}
+
+// Matches a sequence of raw bytes given as hex, where ?? matches any byte.
+// The bytes are matched as-is, regardless of the file's encoding, so this is
+// mainly for hex mode.
+class Searcher_Bytes : public Searcher
+{
+public:
+                    Searcher_Bytes(const WCHAR* s, Error& e);
+                    ~Searcher_Bytes() = default;
+
+    SearcherType    GetSearcherType() const override { return SearcherType::Bytes; }
+    unsigned        GetNeedleDelta() const override { return unsigned(m_needle.size()); }
+
+    // Only hex mode scans for byte matches directly (see ContentCache's hex
+    // Find()); elsewhere they're matched row by row, one per row.
+    bool            CanScan(const FileLineMap& /*map*/) override { return false; }
+    size_t          Scan(const BYTE* data, size_t length) override;
+    unsigned        GetScanOverlap() const override { return unsigned(m_needle.size() - 1); }
+
+protected:
+    bool            DoNext(FileLineMap& map, const BYTE* line, unsigned length, Error& e) override;
+
+private:
+    bool            Verify(const BYTE* p) const;
+    const BYTE*     FindBytes(const BYTE* data, size_t length) const;
+
+private:
+    std::vector<BYTE> m_needle;                 // Wildcards are 0.
+    std::vector<BYTE> m_mask;                   // 0xff for literal bytes, 0 for wildcards.
+    size_t          m_first = 0;                // Index of the first literal byte.
+    size_t          m_last = 0;                 // Index of the last literal byte.
+};
+
+static int HexDigitValue(WCHAR c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+Searcher_Bytes::Searcher_Bytes(const WCHAR* s, Error& e)
+{
+    // Accepts pairs of hex digits, optionally separated by spaces, commas,
+    // or "0x" prefixes; "??" (or a lone "?" between separators) is a
+    // wildcard byte.
+    while (*s)
+    {
+        if (*s == ' ' || *s == '\t' || *s == ',')
+        {
+            ++s;
+            continue;
+        }
+        if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+        {
+            s += 2;
+            continue;
+        }
+        if (*s == '?')
+        {
+            ++s;
+            if (*s == '?')
+                ++s;
+            m_needle.push_back(0);
+            m_mask.push_back(0);
+            continue;
+        }
+
+        const int hi = HexDigitValue(s[0]);
+        const int lo = (hi >= 0) ? HexDigitValue(s[1]) : -1;
+        if (lo < 0)
+        {
+            e.Set(L"Search bytes must be pairs of hex digits (?? matches any byte).");
+            return;
+        }
+        s += 2;
+        m_needle.push_back(BYTE((hi << 4) | lo));
+        m_mask.push_back(0xff);
+    }
+
+    m_first = 0;
+    while (m_first < m_mask.size() && !m_mask[m_first])
+        ++m_first;
+    if (m_first >= m_mask.size())
+    {
+        e.Set(L"Search bytes must include at least one byte that isn't a wildcard.");
+        return;
+    }
+    m_last = m_mask.size() - 1;
+    while (!m_mask[m_last])
+        --m_last;
+}
+
+bool Searcher_Bytes::Verify(const BYTE* p) const
+{
+    for (size_t i = m_first + 1; i < m_last; ++i)
+    {
+        if ((p[i] & m_mask[i]) != m_needle[i])
+            return false;
+    }
+    return true;
+}
+
+const BYTE* Searcher_Bytes::FindBytes(const BYTE* data, size_t length) const
+{
+    const size_t n = m_needle.size();
+    if (length < n)
+        return nullptr;
+
+    const size_t positions = length - n + 1;
+    const BYTE first = m_needle[m_first];
+
+    // With only one literal byte, memchr() finds it at full speed and there
+    // is nothing else to verify.
+    if (m_first == m_last)
+    {
+        const BYTE* const found = static_cast<const BYTE*>(memchr(data + m_first, first, positions));
+        return found ? found - m_first : nullptr;
+    }
+
+    // Otherwise each position is a candidate only if both its first and last
+    // literal bytes match, which rejects nearly all positions 16 at a time.
+    const BYTE last = m_needle[m_last];
+    const __m128i f = _mm_set1_epi8(char(first));
+    const __m128i l = _mm_set1_epi8(char(last));
+    size_t pos = 0;
+    for (; pos + 16 <= positions; pos += 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + m_first));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + m_last));
+        unsigned mask = unsigned(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l))));
+        while (mask)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            if (Verify(data + pos + bit))
+                return data + pos + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    for (; pos < positions; ++pos)
+    {
+        if (data[pos + m_first] == first && data[pos + m_last] == last && Verify(data + pos))
+            return data + pos;
+    }
+
+    return nullptr;
+}
+
+size_t Searcher_Bytes::Scan(const BYTE* data, size_t length)
+{
+    const BYTE* const found = FindBytes(data, length);
+    return found ? size_t(found - data) : size_t(-1);
+}
+
+bool Searcher_Bytes::DoNext(FileLineMap& /*map*/, const BYTE* line, unsigned length, Error& /*e*/)
+{
+    // The line ending is part of the bytes, so it isn't ignored.
+    const BYTE* const found = FindBytes(line, length);
+    if (!found)
+    {
+        SetExhausted();
+        return false;
+    }
+
+    SetMatch(unsigned(found - line), unsigned(m_needle.size()));
+    return true;
+}
+
+// Finds literal strings that every match of a regex must contain, so lines
+// (or whole buffers) without them can be rejected by the literal engine
+// before the regex engine ever sees them.  The analysis is conservative:
+// anything it doesn't understand ends the current literal, and constructs
+// that could make a literal optional (alternation, inline flags) give up
+// entirely.  Returns false if there's nothing usable.
+static bool ExtractRequiredLiterals(const WCHAR* pattern, bool caseless, std::vector<StrW>& literals)
+{
+    literals.clear();
+
+    StrW run;
+    bool last_in_run = false;           // Whether the last atom is the last char of run.
+
+    auto flush = [&]()
+    {
+        // Single characters filter too little to be worth checking.
+        if (run.Length() >= 2)
+            literals.emplace_back(run);
+        run.Clear();
+        last_in_run = false;
+    };
+
+    // Skips the lazy or possessive suffix of a quantifier.
+    auto skip_suffix = [](const WCHAR*& p)
+    {
+        if (*p == '?' || *p == '+')
+            ++p;
+    };
+
+    // Skips a character class; p is just past the '['.
+    auto skip_class = [](const WCHAR*& p) -> bool
+    {
+        if (*p == '^')
+            ++p;
+        if (*p == ']')
+            ++p;
+        while (*p && *p != ']')
+        {
+            if (*p == '\\' && p[1])
+                ++p;
+            ++p;
+        }
+        if (!*p)
+            return false;
+        ++p;
+        return true;
+    };
+
+    const WCHAR* p = pattern;
+    while (*p)
+    {
+        const WCHAR c = *(p++);
+        switch (c)
+        {
+        case '|':
+            return false;
+
+        case '(':
+            {
+                // Inline flags such as (?i) change how the rest matches.
+                if (*p == '?' && p[1] != ':' && p[1] != '=' && p[1] != '!')
+                    return false;
+                flush();
+                unsigned depth = 1;
+                while (*p && depth)
+                {
+                    if (*p == '\\' && p[1])
+                        p += 2;
+                    else if (*p == '[')
+                    {
+                        ++p;
+                        if (!skip_class(p))
+                            return false;
+                    }
+                    else
+                    {
+                        if (*p == '(')
+                            ++depth;
+                        else if (*p == ')')
+                            --depth;
+                        ++p;
+                    }
+                }
+                if (depth)
+                    return false;
+            }
+            break;
+
+        case ')':
+            return false;
+
+        case '[':
+            flush();
+            if (!skip_class(p))
+                return false;
+            break;
+
+        case '*':
+        case '?':
+            // The preceding atom is optional.
+            if (last_in_run)
+                run.SetLength(run.Length() - 1);
+            flush();
+            skip_suffix(p);
+            break;
+
+        case '+':
+            flush();
+            skip_suffix(p);
+            break;
+
+        case '{':
+            {
+                if (!iswdigit(*p))
+                    return false;
+                unsigned min = 0;
+                while (iswdigit(*p))
+                    min = min * 10 + (*(p++) - '0');
+                if (*p == ',')
+                {
+                    ++p;
+                    while (iswdigit(*p))
+                        ++p;
+                }
+                if (*p != '}')
+                    return false;
+                ++p;
+                if (!min && last_in_run)
+                    run.SetLength(run.Length() - 1);
+                flush();
+                skip_suffix(p);
+            }
+            break;
+
+        case '\\':
+            {
+                const WCHAR d = *(p++);
+                if (!d || d == 'Q')
+                    return false;
+                if (d < 0x80 && iswalnum(d))
+                {
+                    // Classes, assertions, and control characters end the
+                    // run.  Other escapes take operands (\x41, \u00e9, \101,
+                    // \pL, \cM, \k<name>, backreferences, ...) which must
+                    // not be mistaken for literals, so give up on those.
+                    if (!wcschr(L"dDwWsSbBAznrtfv", d))
+                        return false;
+                    flush();
+                    break;
+                }
+                goto literal;
+            }
+
+        case '.':
+        case '^':
+        case '$':
+            flush();
+            break;
+
+        default:
+literal:
+            {
+                const WCHAR ch = p[-1];
+                if (ch >= 0xd800 && ch <= 0xdfff)
+                    return false;
+                // Caseless regexes fold Unicode case, but the literal engine
+                // only folds ASCII letters.  K and S also match the Kelvin
+                // sign and long s.
+                if (caseless && (ch >= 0x80 || wcschr(L"KkSs", ch)))
+                {
+                    flush();
+                    break;
+                }
+                run.Append(ch);
+                last_in_run = true;
+            }
+            break;
+        }
+    }
+    flush();
+
+    return !literals.empty();
+}
+
+// Rejects lines and buffers that can't contain a match of a regex, using the
+// literal engine to look for the literals that every match must contain.
+class RegexPrefilter
+{
+public:
+    void            Init(const WCHAR* pattern, bool caseless);
+    bool            Empty() const { return m_literals.empty(); }
+
+    // Returns false if the line can't match.
+    bool            MayMatch(FileLineMap& map, const BYTE* line, unsigned length, Error& e);
+
+    // Scanning looks for the longest literal.
+    bool            CanScan(const FileLineMap& map) { return !Empty() && m_literals[0]->CanScan(map); }
+    size_t          Scan(const BYTE* data, size_t length) { return m_literals[0]->Scan(data, length); }
+    unsigned        GetScanOverlap() const { return m_literals[0]->GetScanOverlap(); }
+
+private:
+    std::vector<std::unique_ptr<Searcher_Literal>> m_literals;
+};
+
+const size_t c_max_prefilter_literals = 4;
+
+void RegexPrefilter::Init(const WCHAR* pattern, bool caseless)
+{
+    m_literals.clear();
+
+    std::vector<StrW> literals;
+    if (!ExtractRequiredLiterals(pattern, caseless, literals))
+        return;
+
+    // The longest literals are usually the rarest.
+    std::stable_sort(literals.begin(), literals.end(), [](const StrW& a, const StrW& b) { return a.Length() > b.Length(); });
+    if (literals.size() > c_max_prefilter_literals)
+        literals.resize(c_max_prefilter_literals);
+
+    Error e;
+    for (const auto& literal : literals)
+    {
+        auto searcher = std::make_unique<Searcher_Literal>(literal.Text(), caseless, e);
+        if (e.Test())
+        {
+            m_literals.clear();
+            return;
+        }
+        m_literals.emplace_back(std::move(searcher));
+    }
+}
+
+bool RegexPrefilter::MayMatch(FileLineMap& map, const BYTE* line, unsigned length, Error& e)
+{
+    for (auto& literal : m_literals)
+    {
+        if (!literal->Match(map, line, length, e))
+            return false;
+    }
+    return true;
+}
+
 #ifndef INCLUDE_RE2
 class Searcher_ECMAScriptRegex : public Searcher
 {
@@ -77,12 +1128,17 @@ public:
 
     SearcherType    GetSearcherType() const override { return SearcherType::Regex; }
 
+    bool            CanScan(const FileLineMap& map) override { return m_prefilter.CanScan(map); }
+    size_t          Scan(const BYTE* data, size_t length) override { return m_prefilter.Scan(data, length); }
+    unsigned        GetScanOverlap() const override { return m_prefilter.GetScanOverlap(); }
+
 protected:
     bool            DoNext(FileLineMap& map, const BYTE* line, unsigned length, Error& e) override;
 
 private:
     std::regex_constants::syntax_option_type m_syntax;
     std::unique_ptr<std::wregex> m_wregex;
+    RegexPrefilter  m_prefilter;
 };
 
 Searcher_ECMAScriptRegex::Searcher_ECMAScriptRegex(const WCHAR* s, bool caseless, Error& e)
@@ -96,6 +1152,7 @@ Searcher_ECMAScriptRegex::Searcher_ECMAScriptRegex(const WCHAR* s, bool caseless
     {
         std::unique_ptr<std::wregex> r = std::make_unique<std::wregex>(s, flags);
         m_wregex = std::move(r);
+        m_prefilter.Init(s, caseless);
     }
     catch (std::regex_error ex)
     {
@@ -107,6 +1164,14 @@ Searcher_ECMAScriptRegex::Searcher_ECMAScriptRegex(const WCHAR* s, bool caseless
 
 bool Searcher_ECMAScriptRegex::DoNext(FileLineMap& map, const BYTE* _line, unsigned _length, Error& e)
 {
+    // Lines without the required literals don't need to be decoded or given
+    // to std::regex, which is slow.
+    if (!IsStarted() && !m_prefilter.MayMatch(map, _line, _length, e))
+    {
+        SetExhausted();
+        return false;
+    }
+
     map.GetLineText(_line, _length, m_tmp);
     TrimLineEnding(m_tmp);
 
@@ -140,24 +1205,207 @@ bool Searcher_ECMAScriptRegex::DoNext(FileLineMap& map, const BYTE* _line, unsig
 #endif
 
 #ifdef INCLUDE_RE2
+// Counts the UTF16 code units in a run of UTF8 text.  Returns false if the
+// text isn't well formed, since then the count depends on how the converter
+// substitutes invalid sequences.
+static bool CountUtf16Units(const BYTE* p, size_t len, size_t& units)
+{
+    const BYTE* const end = p + len;
+    size_t n = 0;
+    while (p < end)
+    {
+        while (end - p >= 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            if (_mm_movemask_epi8(chunk))
+                break;
+            p += 16;
+            n += 16;
+        }
+        if (p >= end)
+            break;
+
+        const BYTE c = *p;
+        if (c < 0x80)
+        {
+            ++p;
+            ++n;
+            continue;
+        }
+
+        // Well formed sequences per Table 3-7 in the Unicode standard.
+        unsigned trail;
+        BYTE lo = 0x80;
+        BYTE hi = 0xbf;
+        if (c >= 0xc2 && c <= 0xdf)
+            trail = 1;
+        else if (c >= 0xe0 && c <= 0xef)
+        {
+            trail = 2;
+            if (c == 0xe0)
+                lo = 0xa0;
+            else if (c == 0xed)
+                hi = 0x9f;
+        }
+        else if (c >= 0xf0 && c <= 0xf4)
+        {
+            trail = 3;
+            if (c == 0xf0)
+                lo = 0x90;
+            else if (c == 0xf4)
+                hi = 0x8f;
+        }
+        else
+            return false;
+
+        if (size_t(end - p) <= trail || p[1] < lo || p[1] > hi)
+            return false;
+        for (unsigned i = 2; i <= trail; ++i)
+        {
+            if ((p[i] & 0xc0) != 0x80)
+                return false;
+        }
+
+        p += trail + 1;
+        n += (trail == 3) ? 2 : 1;
+    }
+
+    units = n;
+    return true;
+}
+
+// Appends UTF16 text as UTF8.  Unpaired surrogates become U+FFFD, so the
+// output is always well formed and has one code point per UTF16 character
+// (or surrogate pair).
+static char* AppendUtf8(char* out, const WCHAR* p, size_t len)
+{
+    const WCHAR* const end = p + len;
+    while (p < end)
+    {
+        unsigned c = *(p++);
+        if (c < 0x80)
+        {
+            *(out++) = char(c);
+            continue;
+        }
+        if (c >= 0xd800 && c <= 0xdfff)
+        {
+            if (c <= 0xdbff && p < end && *p >= 0xdc00 && *p <= 0xdfff)
+                c = 0x10000 + ((c - 0xd800) << 10) + (*(p++) - 0xdc00);
+            else
+                c = 0xfffd;
+        }
+        if (c < 0x800)
+        {
+            *(out++) = char(0xc0 | (c >> 6));
+        }
+        else
+        {
+            if (c < 0x10000)
+            {
+                *(out++) = char(0xe0 | (c >> 12));
+            }
+            else
+            {
+                *(out++) = char(0xf0 | (c >> 18));
+                *(out++) = char(0x80 | ((c >> 12) & 0x3f));
+            }
+            *(out++) = char(0x80 | ((c >> 6) & 0x3f));
+        }
+        *(out++) = char(0x80 | (c & 0x3f));
+    }
+    return out;
+}
+
+// RE2's Latin1 mode matches one byte per character, with each byte meaning
+// the Latin1 character of the same value.  That's exact for any single byte
+// code page as long as the pattern only uses characters that mean the same
+// thing in both, and doesn't use Unicode classes or code point escapes.
+static bool IsLatin1Compatible(UINT cp, const WCHAR* pattern)
+{
+    CPINFO info;
+    if (cp == CP_UTF7 || cp == CP_UTF8 || cp == CP_WINUNICODE || cp == 1201 || !GetCPInfo(cp, &info) || info.MaxCharSize != 1)
+        return false;
+
+    bool ascii = true;
+    for (const WCHAR* p = pattern; *p; ++p)
+    {
+        if (*p >= 0x80)
+            ascii = false;
+        if (p[0] == '\\' && p[1])
+        {
+            // Unicode classes and code point escapes mean characters, not
+            // bytes.
+            if (p[1] == 'p' || p[1] == 'P' || p[1] == 'x')
+                return false;
+            ++p;
+            if (*p >= 0x80)
+                ascii = false;
+        }
+    }
+    if (ascii)
+        return true;
+
+    // Non-ASCII characters (and their other cases) must map to the same
+    // byte values as in Latin1.
+    char bytes[0x80];
+    WCHAR decoded[0x80];
+    for (unsigned b = 0; b < 0x80; ++b)
+        bytes[b] = char(0x80 + b);
+    if (MultiByteToWideChar(cp, 0, bytes, 0x80, decoded, 0x80) != 0x80)
+        return false;
+    for (unsigned b = 0xa0; b < 0x100; ++b)
+    {
+        if (decoded[b - 0x80] != b)
+            return false;
+    }
+    for (const WCHAR* p = pattern; *p; ++p)
+    {
+        if (*p >= 0x80 && *p < 0xa0)
+            return false;
+        if (*p >= 0x100)
+            return false;
+    }
+    return true;
+}
+
 class Searcher_RE2 : public Searcher
 {
 public:
                     Searcher_RE2(const WCHAR* s, bool caseless, Error& e);
-                    ~Searcher_RE2() { delete m_re2; }
+                    ~Searcher_RE2() { delete m_re2; delete m_re2_latin1; }
 
     SearcherType    GetSearcherType() const override { return SearcherType::Regex; }
 
+    bool            CanScan(const FileLineMap& map) override { return m_re2 && m_prefilter.CanScan(map); }
+    size_t          Scan(const BYTE* data, size_t length) override { return m_prefilter.Scan(data, length); }
+    unsigned        GetScanOverlap() const override { return m_prefilter.GetScanOverlap(); }
+
 protected:
     bool            DoNext(FileLineMap& map, const BYTE* line, unsigned length, Error& e) override;
 
 private:
+    RE2*            GetLatin1(UINT cp);
+    const char*     ConvertLine(FileLineMap& map, const BYTE* line, unsigned& length);
+
+private:
+    const StrW      m_pattern;
+    const bool      m_caseless;
     RE2*            m_re2 = nullptr;
-    StrW            m_tmp;
-    StrUtf8         m_line;
+
+    // Compiled in Latin1 mode for single byte code pages, when compatible.
+    RE2*            m_re2_latin1 = nullptr;
+    UINT            m_latin1_cp = 0;            // Code page m_re2_latin1 is for.
+
+    // Reused for converting lines to UTF8, so it only grows.
+    std::vector<char> m_utf8;
+
+    RegexPrefilter  m_prefilter;
 };
 
 Searcher_RE2::Searcher_RE2(const WCHAR* _s, bool caseless, Error& e)
+: m_pattern(_s)
+, m_caseless(caseless)
 {
     StrUtf8 s;
     s.SetW(_s);
@@ -174,6 +1422,75 @@ Searcher_RE2::Searcher_RE2(const WCHAR* _s, bool caseless, Error& e)
         err.TrimRight();
         e.Set(err.Text());
     }
+    else
+    {
+        m_prefilter.Init(_s, caseless);
+    }
+}
+
+RE2* Searcher_RE2::GetLatin1(UINT cp)
+{
+    if (cp == m_latin1_cp)
+        return m_re2_latin1;
+
+    delete m_re2_latin1;
+    m_re2_latin1 = nullptr;
+    m_latin1_cp = cp;
+
+    if (!IsLatin1Compatible(cp, m_pattern.Text()))
+        return nullptr;
+
+    std::string s;
+    s.reserve(m_pattern.Length());
+    for (const WCHAR* p = m_pattern.Text(); *p; ++p)
+        s.push_back(char(BYTE(*p)));
+
+    RE2::Options options;
+    options.set_case_sensitive(!m_caseless);
+    options.set_encoding(RE2::Options::EncodingLatin1);
+
+    m_re2_latin1 = new RE2(s, options);
+    if (!m_re2_latin1->ok())
+    {
+        delete m_re2_latin1;
+        m_re2_latin1 = nullptr;
+    }
+    return m_re2_latin1;
+}
+
+const char* Searcher_RE2::ConvertLine(FileLineMap& map, const BYTE* line, unsigned& length)
+{
+    const UINT cp = map.GetCodePage();
+    const WCHAR* text;
+    size_t num_chars;
+    if (cp == CP_WINUNICODE || cp == 1201)
+    {
+        // Decode UTF16 straight from the file data; the same as
+        // GetLineText(), an odd trailing byte becomes U+FFFD.
+        num_chars = (length + 1) / 2;
+        WCHAR* const o = m_tmp.Reserve(num_chars + 1);
+        memcpy(o, line, length & ~1);
+        if (cp == 1201)
+        {
+            for (size_t i = 0; i < (length >> 1); ++i)
+                o[i] = WCHAR((o[i] << 8) | (o[i] >> 8));
+        }
+        if (length & 1)
+            o[num_chars - 1] = 0xfffd;
+        text = o;
+    }
+    else
+    {
+        map.GetLineText(line, length, m_tmp);
+        text = m_tmp.Text();
+        num_chars = m_tmp.Length();
+    }
+
+    // Each UTF16 character becomes at most 3 bytes of UTF8.
+    if (m_utf8.size() < num_chars * 3 + 1)
+        m_utf8.resize(num_chars * 3 + 1);
+    length = unsigned(AppendUtf8(m_utf8.data(), text, num_chars) - m_utf8.data());
+    return m_utf8.data();
 }
 
 bool Searcher_RE2::DoNext(FileLineMap& map, const BYTE* _line, unsigned length, Error& e)
@@ -185,36 +1502,60 @@ exhausted:
         return false;
     }
 
+    // Lines without the required literals can't match, and don't need to be
+    // converted.
+    if (!IsStarted() && !m_prefilter.MayMatch(map, _line, length, e))
+        goto exhausted;
+
     const UINT cp = map.GetCodePage();
+    RE2* re2 = m_re2;
+    bool one_to_one = false;
     const char* line;
     if (cp == CP_USASCII || cp == CP_UTF8)
     {
         // If the content is natively UTF8, then use it as-is.
         line = reinterpret_cast<const char*>(_line);
     }
+    else if (RE2* latin1 = GetLatin1(cp))
+    {
+        // Single byte code pages can be matched as-is in Latin1 mode.
+        re2 = latin1;
+        one_to_one = true;
+        line = reinterpret_cast<const char*>(_line);
+    }
     else
     {
-        // Get the content as UTF16 and convert it to UTF8 for RE2.
-        map.GetLineText(_line, length, m_tmp);
-        m_line.SetW(m_tmp.Text());
-        line = m_line.Text();
-        length = m_line.Length();
+        // Convert the content to UTF8 for RE2.
+        line = ConvertLine(map, _line, length);
     }
 
     absl::string_view match;
     absl::string_view sv(line, length);
-    if (!m_re2->Match(sv, 0, length, RE2::UNANCHORED, &match, 1))
+    if (!re2->Match(sv, 0, length, RE2::UNANCHORED, &match, 1))
         goto exhausted;
 
     const size_t mpos = match.data() - sv.data();
     const size_t mlen = match.size();
+    if (one_to_one)
+    {
+        SetMatch(unsigned(mpos), unsigned(mlen));
+        return true;
+    }
 
-    // Translate mpos and mlen from UTF8 to WCHAR.
-    // TODO:  MB_ERR_INVALID_CHARS?
-    const size_t mpos_begin = MultiByteToWideChar(cp, 0, line, unsigned(mpos), nullptr, 0);
-    const size_t mpos_end = MultiByteToWideChar(cp, 0, line, unsigned(mpos + mlen), nullptr, 0);
+    // Translate mpos and mlen from UTF8 to WCHAR.  Converted lines are
+    // always well formed, so the fallback is only for invalid UTF8 files.
+    size_t mpos_begin;
+    size_t mlen_units;
+    const BYTE* const bytes = reinterpret_cast<const BYTE*>(line);
+    if (!CountUtf16Units(bytes, mpos, mpos_begin) ||
+        !CountUtf16Units(bytes + mpos, mlen, mlen_units))
+    {
+        // TODO:  MB_ERR_INVALID_CHARS?
+        mpos_begin = MultiByteToWideChar(CP_UTF8, 0, line, unsigned(mpos), nullptr, 0);
+        mlen_units = MultiByteToWideChar(CP_UTF8, 0, line, unsigned(mpos + mlen), nullptr, 0) - mpos_begin;
+    }
 
-    SetMatch(unsigned(mpos_begin), unsigned(mpos_end - mpos_begin));
+    SetMatch(unsigned(mpos_begin), unsigned(mlen_units));
     return true;
 }
 #endif
@@ -229,6 +1570,12 @@ std::shared_ptr<Searcher> Searcher::Create(SearcherType type, const WCHAR* s, bo
     case SearcherType::Literal:
         searcher = std::make_shared<Searcher_Literal>(s, caseless, e);
         break;
+    case SearcherType::MultiLiteral:
+        searcher = std::make_shared<Searcher_MultiLiteral>(s, caseless, e);
+        break;
+    case SearcherType::Bytes:
+        searcher = std::make_shared<Searcher_Bytes>(s, e);
+        break;
     case SearcherType::Regex:
 #ifdef INCLUDE_RE2
         searcher = std::make_shared<Searcher_RE2>(s, caseless, e);
@@ -240,9 +1587,19 @@ std::shared_ptr<Searcher> Searcher::Create(SearcherType type, const WCHAR* s, bo
 
     if (e.Test())
         searcher.reset();
+    else
+    {
+        searcher->m_source.Set(s);
+        searcher->m_source_caseless = caseless;
+    }
     return searcher;
 }
 
+std::shared_ptr<Searcher> Searcher::Clone(Error& e) const
+{
+    return Create(GetSearcherType(), m_source.Text(), m_source_caseless, e);
+}
+
 bool Searcher::Match(FileLineMap& map, const BYTE* line, unsigned length, Error& e)
 {
     m_started = false;
@@ -302,7 +1659,11 @@ std::shared_ptr<Searcher> ReadSearchInput(unsigned row, unsigned terminal_width,
         cr.Add(nullptr, 2, 79, true);
         cr.AddKeyName(L"^I", ColorElement::Footer, caseless ? L"IgnoreCase" : L"ExactCase ", ID_IGNORECASE, 99, true);
         cr.Add(nullptr, 2, 89, true);
-        cr.AddKeyName(L"^X", ColorElement::Footer, s_regex ? L"RegExp " : L"Literal", ID_REGEXP, 89, true);
+        const WCHAR* const type_name = ((s_type == SearcherType::Regex) ? L"RegExp " :
+                                        (s_type == SearcherType::MultiLiteral) ? L"AnyOf  " :
+                                        (s_type == SearcherType::Bytes) ? L"Hex    " :
+                                        L"Literal");
+        cr.AddKeyName(L"^X", ColorElement::Footer, type_name, ID_REGEXP, 89, true);
 
         tmp.Set(L"\r");
         cr.BuildOutput(tmp, GetColor(ColorElement::Footer));
@@ -318,9 +1679,13 @@ std::shared_ptr<Searcher> ReadSearchInput(unsigned row, unsigned terminal_width,
             switch (input.key_char)
             {
             case 'X'-'@':
-                // 'Ctrl-X' toggles regex mode.
+                // 'Ctrl-X' cycles through literal, regex, any-of, and hex
+                // bytes modes.
 toggle_regex:
-                s_regex = !s_regex;
+                s_type = ((s_type == SearcherType::Literal) ? SearcherType::Regex :
+                          (s_type == SearcherType::Regex) ? SearcherType::MultiLiteral :
+                          (s_type == SearcherType::MultiLiteral) ? SearcherType::Bytes :
+                          SearcherType::Literal);
                 printcontext();
                 return 1;
             }
@@ -375,6 +1740,6 @@ toggle_caseless:
 
     std::shared_ptr<Searcher> searcher;
     if (s.Length())
-        searcher = Searcher::Create(s_regex ? SearcherType::Regex : SearcherType::Literal, s.Text(), caseless, e);
+        searcher = Searcher::Create(s_type, s.Text(), caseless, e);
     return searcher;
 }
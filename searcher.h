@@ -14,6 +14,8 @@ enum class SearcherType
 {
     Literal,
     Regex,
+    MultiLiteral,       // Any of several space separated literal strings.
+    Bytes,              // Raw bytes given as hex pairs; ?? matches any byte.
 };
 
 class Searcher : public std::enable_shared_from_this<Searcher>
@@ -21,9 +23,13 @@ class Searcher : public std::enable_shared_from_this<Searcher>
 public:
     static std::shared_ptr<Searcher> Create(SearcherType type, const WCHAR* s, bool caseless, Error& e);
 
+    // Match() keeps state in the searcher, so each thread needs its own.
+    std::shared_ptr<Searcher> Clone(Error& e) const;
+
                     ~Searcher() = default;
 
     bool            Match(FileLineMap& map, const BYTE* line, unsigned len, Error& e);
+    bool            Next(FileLineMap& map, Error& e);   // Next match in the same line.
 
     unsigned        GetMatchStart() const { return m_match_index; }
     unsigned        GetMatchLength() const { return m_match_length; }
@@ -31,6 +37,18 @@ public:
     virtual SearcherType GetSearcherType() const = 0;
     virtual unsigned GetNeedleDelta() const { return 0; }
 
+    // Which of several strings the most recent match was for, if applicable.
+    virtual const WCHAR* GetMatchedPattern() const { return nullptr; }
+
+    // Optional fast path for finding candidate matches directly in a buffer
+    // of raw file data, regardless of where rows begin and end.  Scan()
+    // returns the offset of a candidate within data, or -1 if there isn't
+    // one.  The caller confirms a candidate by using Match() on its row, and
+    // overlaps consecutive buffers by GetScanOverlap() bytes.
+    virtual bool    CanScan(const FileLineMap& /*map*/) { return false; }
+    virtual size_t  Scan(const BYTE* /*data*/, size_t /*length*/) { return size_t(-1); }
+    virtual unsigned GetScanOverlap() const { return 0; }
+
 protected:
                     Searcher() { SetExhausted(); }
 
@@ -41,9 +59,6 @@ protected:
 
     void            SetMatch(unsigned index, unsigned length) { m_match_index = index + m_consumed; m_match_length = length; }
 
-private:
-    bool            Next(FileLineMap& map, Error& e);
-
 private:
     bool            m_started;
     bool            m_exhausted;
@@ -53,6 +68,9 @@ private:
     unsigned        m_match_length;
     unsigned        m_consumed;
 
+    StrW            m_source;
+    bool            m_source_caseless = false;
+
 protected:
     StrW            m_tmp;
 };
@@ -7,7 +7,11 @@
 #include "signaled.h"
 #include "output.h"
 
-static bool s_signaled = false;
+#include <atomic>
+
+// The break handler runs on its own thread.
+static std::atomic<bool> s_signaled = false;
+static std::atomic<uint32> s_signal_count = 0;
 
 class CRestoreConsole
 {
@@ -44,6 +48,11 @@ void ClearSignaled()
     s_signaled = false;
 }
 
+uint32 GetSignalCount()
+{
+    return s_signal_count.load(std::memory_order_relaxed);
+}
+
 CRestoreConsole::CRestoreConsole()
 {
     HANDLE hout = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -86,6 +95,7 @@ BOOL CRestoreConsole::BreakHandler(DWORD CtrlType)
     {
         // Do not terminate on Ctrl-C or Ctrl-Break.
         s_signaled = true;
+        ++s_signal_count;
         return true;
     }
     return false;
@@ -13,3 +13,6 @@ void SetGracefulExit();
 
 bool IsSignaled();
 void ClearSignaled();
+
+// Counts Ctrl-C and Ctrl-Break presses; not affected by ClearSignaled().
+uint32 GetSignalCount();
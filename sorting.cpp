@@ -6,12 +6,19 @@
 #include "pch.h"
 #include "sorting.h"
 
+#include <algorithm>
+#include <execution>
+#include <vector>
+
 static DWORD s_dwCmpStrFlags = SORT_DIGITSASNUMBERS;
 
 // Longest possible sort order string is "-d-e-g-n-s".
 static const WCHAR s_sort_order[16] = L"g";
 static const bool s_explicit_extension = false;
 
+// Sort this many files or more in parallel.
+static const size_t c_parallel_sort_threshold = 16384;
+
 static LONG ParseNum(const WCHAR*& p)
 {
     LONG num = 0;
@@ -48,32 +55,56 @@ int Sorting::CmpStrNI(const WCHAR* p1, int len1, const WCHAR* p2, int len2)
     return n - 2;
 }
 
-class NameSplitter
+// Sorting by name or extension compares precomputed locale sort keys rather
+// than calling CompareStringW for every comparison.  The keys for all of the
+// files are packed in one buffer.
+struct SortKeyRange
 {
-public:
-    NameSplitter(const WCHAR* p, unsigned index) : m_p(const_cast<WCHAR*>(p) + index), m_ch(p[index]) { *m_p = 0; }
-    ~NameSplitter() { *m_p = m_ch; }
+    uint32          offset = 0;
+    uint32          len = 0;
+};
 
+class SortKeyArena
+{
+public:
+    SortKeyRange    Add(const WCHAR* p, int len);
+    int             Cmp(const SortKeyRange& a, const SortKeyRange& b) const;
 private:
-    WCHAR* const    m_p;
-    const WCHAR     m_ch;
+    std::vector<BYTE> m_bytes;
 };
 
-bool CmpFileInfo(const FileInfo& fi1, const FileInfo& fi2)
+SortKeyRange SortKeyArena::Add(const WCHAR* p, int len)
+{
+    const DWORD flags = LCMAP_SORTKEY|NORM_IGNORECASE|s_dwCmpStrFlags;
+    SortKeyRange range;
+    range.offset = uint32(m_bytes.size());
+    const int needed = LCMapStringEx(LOCALE_NAME_USER_DEFAULT, flags, p, len, nullptr, 0, nullptr, nullptr, 0);
+    if (needed > 0)
+    {
+        m_bytes.resize(m_bytes.size() + needed);
+        const int used = LCMapStringEx(LOCALE_NAME_USER_DEFAULT, flags, p, len, reinterpret_cast<WCHAR*>(m_bytes.data() + range.offset), needed, nullptr, nullptr, 0);
+        range.len = uint32(used > 0 ? used : 0);
+        m_bytes.resize(range.offset + range.len);
+    }
+    return range;
+}
+
+int SortKeyArena::Cmp(const SortKeyRange& a, const SortKeyRange& b) const
 {
-    const FileInfo* const pfi1 = &fi1;
-    const FileInfo* const pfi2 = &fi2;
-    const bool is_file1 = !(pfi1->GetAttributes() & FILE_ATTRIBUTE_DIRECTORY);
-    const bool is_file2 = !(pfi2->GetAttributes() & FILE_ATTRIBUTE_DIRECTORY);
-
-    const WCHAR* const name1 = pfi1->GetName().Text();
-    const WCHAR* const name2 = pfi2->GetName().Text();
-    const WCHAR* const _ext1 = FindExtension(name1);
-    const WCHAR* const _ext2 = FindExtension(name2);
-    const unsigned name_len1 = _ext1 ? unsigned(_ext1 - name1) : unsigned(pfi1->GetName().Length());
-    const unsigned name_len2 = _ext2 ? unsigned(_ext2 - name2) : unsigned(pfi2->GetName().Length());
-    const WCHAR* const ext1 = _ext1 ? _ext1 : L"";
-    const WCHAR* const ext2 = _ext2 ? _ext2 : L"";
+    // Sort keys compare correctly as plain bytes.
+    const int n = memcmp(m_bytes.data() + a.offset, m_bytes.data() + b.offset, std::min<uint32>(a.len, b.len));
+    if (n)
+        return n;
+    return (a.len < b.len) ? -1 : (a.len > b.len) ? 1 : 0;
+}
+
+// Compares file infos by the sort order.  The name and extension compares
+// are supplied by the caller.
+template <class NameCmp, class ExtCmp>
+static bool CmpFileInfoBy(const FileInfo& fi1, const FileInfo& fi2, NameCmp&& cmp_name, ExtCmp&& cmp_ext)
+{
+    const bool is_file1 = !(fi1.GetAttributes() & FILE_ATTRIBUTE_DIRECTORY);
+    const bool is_file2 = !(fi2.GetAttributes() & FILE_ATTRIBUTE_DIRECTORY);
 
     int n = 0;
     for (const WCHAR* order = s_sort_order; !n && *order; order++)
@@ -94,24 +125,15 @@ bool CmpFileInfo(const FileInfo& fi1, const FileInfo& fi2)
                 n = is_file1 ? 1 : -1;
             break;
         case 'n':
-            if (s_explicit_extension)
-            {
-                NameSplitter split1(name1, name_len1);
-                NameSplitter split2(name2, name_len2);
-                n = Sorting::CmpStrI(name1, name2);
-            }
-            else
-            {
-                n = Sorting::CmpStrI(name1, name2);
-            }
+            n = cmp_name();
             break;
         case 'e':
-            n = Sorting::CmpStrI(ext1, ext2);
+            n = cmp_ext();
             break;
         case 's':
             {
-                const auto cb1 = pfi1->GetSize();
-                const auto cb2 = pfi2->GetSize();
+                const auto cb1 = fi1.GetSize();
+                const auto cb2 = fi2.GetSize();
                 if (cb1 < cb2)
                     n = -1;
                 else if (cb1 > cb2)
@@ -120,8 +142,8 @@ bool CmpFileInfo(const FileInfo& fi1, const FileInfo& fi2)
             break;
         case 'd':
             {
-                const FILETIME* const pft1 = &pfi1->GetModifiedTime();
-                const FILETIME* const pft2 = &pfi2->GetModifiedTime();
+                const FILETIME* const pft1 = &fi1.GetModifiedTime();
+                const FILETIME* const pft2 = &fi2.GetModifiedTime();
                 n = CompareFileTime(pft1, pft2);
             }
             break;
@@ -134,3 +156,76 @@ bool CmpFileInfo(const FileInfo& fi1, const FileInfo& fi2)
     return n < 0;
 }
 
+// Returns the length of the part of the name that's compared when sorting
+// by name, and the extension.
+static unsigned SplitSortName(const FileInfo& fi, const WCHAR*& ext)
+{
+    const WCHAR* const name = fi.GetName();
+    const WCHAR* const _ext = FindExtension(name);
+    ext = _ext ? _ext : L"";
+    if (s_explicit_extension && _ext)
+        return unsigned(_ext - name);
+    return fi.GetNameLength();
+}
+
+bool CmpFileInfo(const FileInfo& fi1, const FileInfo& fi2)
+{
+    const WCHAR* ext1;
+    const WCHAR* ext2;
+    const unsigned name_len1 = SplitSortName(fi1, ext1);
+    const unsigned name_len2 = SplitSortName(fi2, ext2);
+
+    return CmpFileInfoBy(fi1, fi2,
+        [&]() { return Sorting::CmpStrNI(fi1.GetName(), name_len1, fi2.GetName(), name_len2); },
+        [&]() { return Sorting::CmpStrI(ext1, ext2); });
+}
+
+void SortFileInfos(std::vector<FileInfo>& files)
+{
+    const bool need_name = !!wcschr(s_sort_order, 'n');
+    const bool need_ext = !!wcschr(s_sort_order, 'e');
+
+    struct Entry
+    {
+        FileInfo*       info;
+        SortKeyRange    name;
+        SortKeyRange    ext;
+    };
+
+    // Do all of the locale work up front, once per file.
+    SortKeyArena arena;
+    std::vector<Entry> entries;
+    entries.reserve(files.size());
+    for (auto& fi : files)
+    {
+        Entry entry;
+        entry.info = &fi;
+        if (need_name || need_ext)
+        {
+            const WCHAR* ext;
+            const unsigned name_len = SplitSortName(fi, ext);
+            if (need_name)
+                entry.name = arena.Add(fi.GetName(), int(name_len));
+            if (need_ext)
+                entry.ext = arena.Add(ext, -1);
+        }
+        entries.emplace_back(entry);
+    }
+
+    const auto cmp = [&arena](const Entry& a, const Entry& b)
+    {
+        return CmpFileInfoBy(*a.info, *b.info,
+            [&]() { return arena.Cmp(a.name, b.name); },
+            [&]() { return arena.Cmp(a.ext, b.ext); });
+    };
+    if (entries.size() >= c_parallel_sort_threshold)
+        std::stable_sort(std::execution::par, entries.begin(), entries.end(), cmp);
+    else
+        std::stable_sort(entries.begin(), entries.end(), cmp);
+
+    std::vector<FileInfo> sorted;
+    sorted.reserve(files.size());
+    for (auto& entry : entries)
+        sorted.emplace_back(std::move(*entry.info));
+    files = std::move(sorted);
+}
@@ -9,6 +9,7 @@
 #include "fileinfo.h"
 
 #include <memory>
+#include <vector>
 
 namespace Sorting
 {
@@ -19,4 +20,5 @@ inline int CmpStrI(const WCHAR* p1, const WCHAR* p2) { return CmpStrNI(p1, -1, p
 };
 
 bool CmpFileInfo(const FileInfo& fi1, const FileInfo& fi2);
+void SortFileInfos(std::vector<FileInfo>& files);
 
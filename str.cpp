@@ -6,6 +6,7 @@
 #include "pch.h"
 #include <stdio.h>
 #include <stdarg.h>
+#include <atomic>
 #include "str.h"
 #include "wcwidth.h"
 #include "wcwidth_iter.h"
@@ -22,6 +23,19 @@ int __vsnprintf(WCHAR* const buffer, size_t const len, const WCHAR* const format
     return _vsnwprintf_s(buffer, len, _TRUNCATE, format, args);
 }
 
+static std::atomic<unsigned __int64> s_str_allocs = 0;
+
+void* StrRealloc(void* p, size_t bytes)
+{
+    s_str_allocs.fetch_add(1, std::memory_order_relaxed);
+    return realloc(p, bytes);
+}
+
+unsigned __int64 CountStrAllocations()
+{
+    return s_str_allocs.load();
+}
+
 char Str<char>::s_empty[1] = "";
 WCHAR Str<WCHAR>::s_empty[1] = L"";
 
@@ -31,6 +45,71 @@ const WCHAR Str<WCHAR>::c_spaces[33] = L"                                ";
 const char Str<char>::c_quote_chars[16] = " +=;,<>|&";
 const WCHAR Str<WCHAR>::c_quote_chars[16] = L" +=;,<>|&";
 
+// Buffers released by StrWScratch, kept for the next StrWScratch on the same
+// thread.  Huge buffers aren't kept, so one long line can't pin memory.
+class ScratchPool
+{
+public:
+                        ~ScratchPool();
+    bool                Take(WCHAR*& p, unsigned& capacity);
+    bool                Give(WCHAR* p, unsigned capacity);
+private:
+    struct Buffer { WCHAR* p; unsigned capacity; };
+    Buffer              m_buffers[8];
+    unsigned            m_count = 0;
+};
+
+const unsigned c_max_scratch_capacity = 128 * 1024;
+
+ScratchPool::~ScratchPool()
+{
+    while (m_count)
+        free(m_buffers[--m_count].p);
+}
+
+bool ScratchPool::Take(WCHAR*& p, unsigned& capacity)
+{
+    if (!m_count)
+        return false;
+    --m_count;
+    p = m_buffers[m_count].p;
+    capacity = m_buffers[m_count].capacity;
+    return true;
+}
+
+bool ScratchPool::Give(WCHAR* p, unsigned capacity)
+{
+    if (m_count >= _countof(m_buffers) || capacity > c_max_scratch_capacity)
+        return false;
+    m_buffers[m_count].p = p;
+    m_buffers[m_count].capacity = capacity;
+    ++m_count;
+    return true;
+}
+
+static thread_local ScratchPool s_scratch_pool;
+
+StrWScratch::StrWScratch()
+{
+    WCHAR* p;
+    unsigned capacity;
+    if (s_scratch_pool.Take(p, capacity))
+    {
+        m_p = p;
+        m_p[0] = '\0';
+        m_capacity = capacity;
+    }
+}
+
+StrWScratch::~StrWScratch()
+{
+    if (m_capacity && !m_borrowed && s_scratch_pool.Give(m_p, m_capacity))
+    {
+        m_p = s_empty;
+        m_capacity = 0;
+    }
+}
+
 void StrA::SetW(const WCHAR* p, size_t len)
 {
     Clear();
@@ -84,15 +84,19 @@ inline WCHAR ToLower(WCHAR wch) { return towlower(wch); }
 // assembly instructions in the debugger.
 inline unsigned MaxPath() { return 32743; }
 
+// Str allocations go through here, so they can be counted.
+void* StrRealloc(void* p, size_t bytes);
+unsigned __int64 CountStrAllocations();
+
 template <class T>
 class Str
 {
 public:
-                        Str<T>() : m_p(s_empty) {}
-                        Str<T>(const T* p) { Set(p); }
-                        Str<T>(const Str<T>& s) { Set(s); }
-                        Str<T>(Str<T>&& s) { Set(std::move(s)); }
-                        ~Str<T>() { if (m_capacity) free(m_p); }
+                        Str<T>() : m_p(s_empty), m_capacity(0), m_borrowed(false) {}
+                        Str<T>(const T* p) : Str<T>() { Set(p); }
+                        Str<T>(const Str<T>& s) : Str<T>() { Set(s); }
+                        Str<T>(Str<T>&& s) : Str<T>() { Set(std::move(s)); }
+                        ~Str<T>() { if (m_capacity && !m_borrowed) free(m_p); }
 
     Str<T>&             operator=(const T* p) { Set(p); return *this; }
     Str<T>&             operator=(const Str<T>& s) { Set(s); return *this; }
@@ -156,13 +160,15 @@ public:
     void                Swap(Str<T>& s);
 
 protected:
+    void                Borrow(T* p, unsigned capacity);
     void                Transform(DWORD dwMapFlags);
     static int          IsSpace(T ch);
 
 protected:
     T*                  m_p;
     mutable unsigned    m_length = 0;
-    unsigned            m_capacity = 0;
+    unsigned            m_capacity : 31;
+    unsigned            m_borrowed : 1;     // m_p isn't owned (e.g. StrWInline).
 
     static T            s_empty[1];
     static const T      c_spaces[33];
@@ -225,6 +231,39 @@ public:
     void                SetW(const StrW& s) { SetW(s.Text(), s.Length()); }
 };
 
+// A StrW with inline storage for N characters, for temporaries that are
+// usually short (colors, escape sequences, small fields).  Text that
+// outgrows the inline storage moves to the heap, as usual.
+template <unsigned N>
+class StrWInline : public StrW
+{
+public:
+                        StrWInline() { Borrow(m_inline, N); }
+                        StrWInline(const WCHAR* p) : StrWInline() { Set(p); }
+                        StrWInline(const StrW& s) : StrWInline() { Set(s); }
+                        StrWInline(const StrWInline& s) : StrWInline() { Set(s); }
+
+    StrWInline&         operator=(const WCHAR* p) { Set(p); return *this; }
+    StrWInline&         operator=(const StrW& s) { Set(s); return *this; }
+    StrWInline&         operator=(const StrWInline& s) { Set(s); return *this; }
+
+private:
+    WCHAR               m_inline[N];
+};
+
+// A StrW whose heap buffer is recycled through a small per-thread pool, for
+// temporaries in loops that run per row or per frame (formatted rows, the
+// screen text).  Constructing one reuses a buffer released by an earlier
+// one, so after the first few rows there are no more allocations.
+class StrWScratch : public StrW
+{
+public:
+                        StrWScratch();
+                        ~StrWScratch();
+                        StrWScratch(const StrWScratch&) = delete;
+    StrWScratch&        operator=(const StrWScratch&) = delete;
+};
+
 template <class T>
 unsigned Str<T>::Length() const
 {
@@ -244,22 +283,45 @@ void Str<T>::Clear()
 template <class T>
 void Str<T>::Free()
 {
-    if (m_capacity)
+    if (m_capacity && !m_borrowed)
         free(m_p);
     m_p = s_empty;
     m_length = 0;
     m_capacity = 0;
+    m_borrowed = false;
 }
 
 template <class T>
 WCHAR* Str<T>::Detach()
 {
+    if (m_borrowed)
+    {
+        T* const p = static_cast<T*>(StrRealloc(nullptr, m_capacity * sizeof(T)));
+        if (!p)
+            return nullptr;
+        memcpy(p, m_p, m_capacity * sizeof(T));
+        m_p = p;
+        m_borrowed = false;
+    }
+
     WCHAR* p = Capacity() ? m_p : nullptr;
     m_p = nullptr;
+    m_capacity = 0;
     Free();
     return p;
 }
 
+template <class T>
+void Str<T>::Borrow(T* p, unsigned capacity)
+{
+    assert(capacity);
+    Free();
+    m_p = p;
+    m_p[0] = '\0';
+    m_capacity = capacity;
+    m_borrowed = true;
+}
+
 template <class T>
 bool Str<T>::Equal(const Str<T>* s) const
 {
@@ -310,6 +372,20 @@ void Str<T>::Set(const T* p, size_t len)
 template <class T>
 void Str<T>::Set(Str<T>&& s)
 {
+    if (this == &s)
+        return;
+
+    // A borrowed buffer can't change hands, so it's copied instead.  And
+    // text that fits in this string's own borrowed buffer is copied, to keep
+    // using the buffer.
+    if (s.m_borrowed || (m_borrowed && s.Length() < m_capacity))
+    {
+        Set(s.Text(), s.Length());
+        s.Clear();
+        return;
+    }
+
+    Free();
     m_p = s.m_p;
     m_length = s.m_length;
     m_capacity = s.m_capacity;
@@ -428,10 +504,16 @@ T* Str<T>::Reserve(size_t capacity)
 {
     if (capacity > m_capacity)
     {
-        T* const old = m_capacity ? m_p : nullptr;
-        T* const p = static_cast<T*>(realloc(old, capacity * sizeof(T)));
+        T* const old = (m_capacity && !m_borrowed) ? m_p : nullptr;
+        T* const p = static_cast<T*>(StrRealloc(old, capacity * sizeof(T)));
         if (p)
         {
+            // Outgrowing a borrowed buffer moves the text to the heap.
+            if (m_borrowed)
+            {
+                memcpy(p, m_p, m_capacity * sizeof(T));
+                m_borrowed = false;
+            }
             m_p = p;
             m_capacity = unsigned(capacity);
         }
@@ -590,15 +672,23 @@ inline void Str<WCHAR>::Transform(DWORD dwMapFlags)
         p = tmp.Reserve(len + 1);
         len = LCMapStringW(LOCALE_USER_DEFAULT, dwMapFlags, Text(), int(Length()), p, int(tmp.Capacity()));
     }
+    tmp.m_length = len;
+    tmp.m_p[len] = '\0';
+    assert(tmp.m_length < tmp.m_capacity);
     Swap(tmp);
-    m_length = len;
-    m_p[len] = '\0';
-    assert(m_length < m_capacity);
 }
 
 template <class T>
 void Str<T>::Swap(Str<T>& s)
 {
+    if (m_borrowed || s.m_borrowed)
+    {
+        Str<T> tmp(std::move(s));
+        s.Set(std::move(*this));
+        Set(std::move(tmp));
+        return;
+    }
+
     T* p = m_p;
     m_p = s.m_p;
     s.m_p = p;
@@ -0,0 +1,291 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "sweep.h"
+#include "signaled.h"
+#include "os.h"
+
+// How often to check for Ctrl-Break while waiting for commands.
+static const DWORD c_sweep_poll = 100;
+
+// How much captured output to convert and show at a time.
+static const DWORD c_sweep_output_piece = 64 * 1024;
+
+struct SweepCommand
+{
+    SHBasic         process;
+    SHFile          output;
+    bool            done = false;
+    SweepResult     result;
+};
+
+static bool LaunchCommand(const StrW& comspec, const StrW& command, HANDLE job, SweepCommand& cmd)
+{
+    // Capture output in a temporary file rather than a pipe, so a command
+    // that writes a lot never blocks waiting for it to be read.
+    WCHAR temp_dir[MAX_PATH];
+    WCHAR temp_name[MAX_PATH];
+    if (!GetTempPathW(_countof(temp_dir), temp_dir) ||
+        !GetTempFileNameW(temp_dir, L"lst", 0, temp_name))
+    {
+        cmd.result.error.Set(L"Unable to create a temporary file for the output.");
+        return false;
+    }
+
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, true/*bInheritHandle*/ };
+    cmd.output = CreateFileW(temp_name, GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, &sa,
+                             CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY|FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (cmd.output.Empty())
+    {
+        cmd.result.error.Set(L"Unable to create a temporary file for the output.");
+        return false;
+    }
+
+    SHFile input = CreateFileW(L"NUL", GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+
+    StrW cmdline;
+    cmdline.AppendMaybeQuoted(comspec.Text());
+    cmdline.Append(L" /c ");
+    cmdline.Append(command);
+
+    STARTUPINFOW si = { sizeof(si) };
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = input.Empty() ? nullptr : input.Get();
+    si.hStdOutput = cmd.output;
+    si.hStdError = cmd.output;
+
+    // Start suspended so it's in the job before it can start any children.
+    // Its own process group keeps Ctrl-Break from reaching it; the sweep
+    // terminates it instead.  It only inherits its standard handles.
+    const HANDLE inherit[] = { si.hStdInput, si.hStdOutput };
+    PROCESS_INFORMATION pi = {};
+    if (!OS::CreateProcessInheriting(cmdline.Reserve(0), CREATE_SUSPENDED|CREATE_NEW_PROCESS_GROUP, si, inherit, _countof(inherit), pi))
+    {
+        Error e;
+        e.Sys();
+        e.Format(cmd.result.error);
+        return false;
+    }
+
+    if (job)
+        AssignProcessToJobObject(job, pi.hProcess);
+    ResumeThread(pi.hThread);
+    CloseHandle(pi.hThread);
+
+    cmd.process = pi.hProcess;
+    cmd.result.started = true;
+    return true;
+}
+
+static void FinishCommand(SweepCommand& cmd)
+{
+    if (!GetExitCodeProcess(cmd.process, &cmd.result.exit_code))
+        cmd.result.exit_code = DWORD(-1);
+    cmd.process.Close();
+
+    // The output stays in the temp file until it's reported.
+    cmd.result.output = std::move(cmd.output);
+
+    cmd.done = true;
+}
+
+static bool ReadCtrlC()
+{
+    // While processed input is off, Ctrl-C arrives as a key instead of as a
+    // signal.
+    const HANDLE hin = GetStdHandle(STD_INPUT_HANDLE);
+    bool ctrl_c = false;
+    DWORD count;
+    while (GetNumberOfConsoleInputEvents(hin, &count) && count)
+    {
+        INPUT_RECORD records[16];
+        DWORD read;
+        if (!ReadConsoleInputW(hin, records, _countof(records), &read) || !read)
+            break;
+        for (DWORD ii = 0; ii < read; ++ii)
+        {
+            if (records[ii].EventType != KEY_EVENT)
+                continue;
+            const KEY_EVENT_RECORD& key = records[ii].Event.KeyEvent;
+            if (key.bKeyDown &&
+                (key.uChar.UnicodeChar == 3 ||
+                 (key.wVirtualKeyCode == 'C' && (key.dwControlKeyState & (LEFT_CTRL_PRESSED|RIGHT_CTRL_PRESSED)))))
+                ctrl_c = true;
+        }
+    }
+    return ctrl_c;
+}
+
+void StreamSweepOutput(SweepResult& result, UINT cp, const std::function<void(const WCHAR*, unsigned)>& emit)
+{
+    if (result.output.Empty())
+        return;
+
+    LARGE_INTEGER zero = {};
+    if (!SetFilePointerEx(result.output, zero, nullptr, FILE_BEGIN))
+        return;
+
+    std::vector<char> buffer(c_sweep_output_piece);
+    StrW text;
+    DWORD carry = 0;
+    while (true)
+    {
+        DWORD read = 0;
+        if (!ReadFile(result.output, buffer.data() + carry, DWORD(buffer.size()) - carry, &read, nullptr))
+            read = 0;
+        DWORD len = carry + read;
+        if (!len)
+            break;
+
+        // Hold back an incomplete character at the end, unless the output
+        // ended.
+        DWORD complete = len;
+        if (read)
+        {
+            if (cp == CP_UTF8)
+            {
+                // Back up over (at most 3) continuation bytes to the last
+                // lead byte, and see whether its sequence is complete.
+                DWORD lead = len;
+                while (lead > 0 && len - lead < 3 && (buffer[lead - 1] & 0xc0) == 0x80)
+                    --lead;
+                if (lead > 0)
+                {
+                    const BYTE b = BYTE(buffer[lead - 1]);
+                    const DWORD need = (b >= 0xf0) ? 4 : (b >= 0xe0) ? 3 : (b >= 0xc0) ? 2 : 1;
+                    if (len - (lead - 1) < need)
+                        complete = lead - 1;
+                }
+            }
+            else
+            {
+                complete = 0;
+                while (complete < len)
+                {
+                    const DWORD size = IsDBCSLeadByteEx(cp, BYTE(buffer[complete])) ? 2 : 1;
+                    if (complete + size > len)
+                        break;
+                    complete += size;
+                }
+            }
+        }
+
+        if (complete)
+        {
+            text.SetFromCodepage(cp, buffer.data(), complete);
+            if (text.Length())
+                emit(text.Text(), text.Length());
+        }
+
+        carry = len - complete;
+        memmove(buffer.data(), buffer.data() + complete, carry);
+        if (!read)
+            break;
+    }
+}
+
+bool RunSweepCommands(const std::vector<StrW>& commands, unsigned concurrency,
+                      const std::function<void(size_t, SweepResult&)>& report,
+                      const std::function<void(size_t, size_t)>& progress)
+{
+    concurrency = clamp<unsigned>(concurrency, 1, MAXIMUM_WAIT_OBJECTS);
+
+    StrW comspec;
+    if (!OS::GetEnv(L"COMSPEC", comspec))
+        comspec.Set(L"cmd.exe");
+
+    // A job object lets canceling terminate the commands' children, too.
+    SHBasic job = CreateJobObjectW(nullptr, nullptr);
+
+    std::vector<SweepCommand> cmds(commands.size());
+    std::vector<size_t> running;
+    std::vector<HANDLE> handles;
+    size_t next = 0;
+    size_t reported = 0;
+    size_t finished = 0;
+    bool canceled = false;
+    const uint32 signals = GetSignalCount();
+
+    while (reported < cmds.size())
+    {
+        canceled = canceled || (GetSignalCount() != signals) || ReadCtrlC();
+
+        // Start commands in order, up to the concurrency limit.
+        bool changed = false;
+        while (!canceled && next < cmds.size() && running.size() < concurrency)
+        {
+            SweepCommand& cmd = cmds[next];
+            if (LaunchCommand(comspec, commands[next], job, cmd))
+                running.emplace_back(next);
+            else
+            {
+                cmd.done = true;
+                ++finished;
+            }
+            ++next;
+            changed = true;
+        }
+
+        // Cancel whatever is outstanding.
+        if (canceled)
+        {
+            if (!job.Empty())
+                TerminateJobObject(job, ERROR_CANCELLED);
+            for (const size_t index : running)
+            {
+                SweepCommand& cmd = cmds[index];
+                TerminateProcess(cmd.process, ERROR_CANCELLED);
+                WaitForSingleObject(cmd.process, INFINITE);
+                FinishCommand(cmd);
+                cmd.result.canceled = true;
+                ++finished;
+            }
+            running.clear();
+            for (; next < cmds.size(); ++next)
+            {
+                cmds[next].done = true;
+                cmds[next].result.canceled = true;
+            }
+            changed = true;
+        }
+
+        // Report finished commands in order.
+        while (reported < cmds.size() && cmds[reported].done)
+        {
+            report(reported, cmds[reported].result);
+            cmds[reported].result.output.Close();   // Deletes the temp file.
+            cmds[reported].result = SweepResult();
+            ++reported;
+        }
+
+        if (changed)
+            progress(finished, running.size());
+
+        if (running.empty())
+            continue;
+
+        // Wait for a command to finish.
+        handles.clear();
+        for (const size_t index : running)
+            handles.emplace_back(cmds[index].process.Get());
+        const DWORD waited = WaitForMultipleObjects(DWORD(handles.size()), handles.data(), false, c_sweep_poll);
+        if (waited >= WAIT_OBJECT_0 && waited < WAIT_OBJECT_0 + handles.size())
+        {
+            const size_t which = waited - WAIT_OBJECT_0;
+            FinishCommand(cmds[running[which]]);
+            running.erase(running.begin() + which);
+            ++finished;
+            progress(finished, running.size());
+        }
+        else if (waited == WAIT_FAILED)
+        {
+            // Shouldn't happen; avoid spinning.
+            Sleep(c_sweep_poll);
+        }
+    }
+
+    return !canceled;
+}
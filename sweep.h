@@ -0,0 +1,44 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "str.h"
+#include "handle.h"
+
+#include <functional>
+#include <vector>
+
+struct SweepResult
+{
+    bool            started = false;
+    bool            canceled = false;
+    DWORD           exit_code = 0;
+    SHFile          output;                 // Temp file with what it wrote to stdout and stderr.
+    StrW            error;                  // Why it couldn't be started.
+};
+
+// Runs each command line with %COMSPEC% /c, up to concurrency at once, in
+// order, capturing what each one writes to stdout and stderr.
+//
+// report(index, result) is called for each command in order, as soon as it
+// and all of the commands before it have finished.  progress(finished,
+// running) is called whenever a command starts or finishes.  Both are called
+// on the calling thread.
+//
+// Ctrl-Break or Ctrl-C cancels outstanding commands:  running ones are
+// terminated, and ones that haven't started are reported as canceled.
+// Ctrl-C is read from the console input, since it isn't a signal while
+// processed input is off; other keys typed meanwhile are discarded.
+// Returns false if canceled.
+bool RunSweepCommands(const std::vector<StrW>& commands, unsigned concurrency,
+                      const std::function<void(size_t, SweepResult&)>& report,
+                      const std::function<void(size_t, size_t)>& progress);
+
+// Streams a command's captured output to emit(text, len) in pieces, so the
+// output doesn't need to fit in memory.  Pieces don't split the multibyte
+// characters of codepage cp.
+void StreamSweepOutput(SweepResult& result, UINT cp, const std::function<void(const WCHAR*, unsigned)>& emit);
@@ -6,6 +6,7 @@
 
 #include "terminal.h"
 #include "output.h"
+#include "wcwidth.h"
 
 #ifndef INCLUDE_TERMINAL_EMULATOR
 
@@ -22,6 +23,7 @@ void Terminal::WriteConsole(const WCHAR* chars, unsigned length)
 {
     DWORD written;
     WriteConsoleW(m_hout, chars, length, &written, nullptr);
+    ++m_write_count;
 }
 
 #else // INCLUDE_TERMINAL_EMULATOR
@@ -391,6 +393,7 @@ void Terminal::WriteConsole(const WCHAR* chars, unsigned length)
     if (m_emulate)
     {
         int32 need_next = (length == 1 || (chars[0] && !chars[1]));
+        begin_compose();
         ecma48_iter iter(chars, m_state, length);
         while (const ecma48_code& code = iter.next())
         {
@@ -413,6 +416,8 @@ void Terminal::WriteConsole(const WCHAR* chars, unsigned length)
                 break;
             }
         }
+        if (m_composing)
+            end_compose();
     }
     else
     {
@@ -691,6 +696,12 @@ void Terminal::set_cursor(const ecma48_code::csi_base& csi)
 void Terminal::save_cursor()
 {
     /* CSI s : Save Current Cursor Position (SCP, SCOSC). */
+    if (m_composing)
+    {
+        m_saved_cursor = m_compose_cursor;
+        return;
+    }
+
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (GetConsoleScreenBufferInfo(m_hout, &csbi))
     {
@@ -769,12 +780,30 @@ void Terminal::reset_private_mode(const ecma48_code::csi_base& csi)
 
 void Terminal::do_write(const WCHAR* chars, unsigned length)
 {
+    if (m_composing)
+    {
+        compose_write(chars, length);
+        if (!length)
+            return;
+        end_compose();
+    }
+
     DWORD written;
     WriteConsoleW(m_hout, chars, length, &written, nullptr);
+    ++m_write_count;
 }
 
 bool Terminal::do_cursor_style(int /*style*/, int visible)
 {
+    // Showing the cursor waits until the composed output is written, so the
+    // cursor doesn't flash at the old position.
+    if (m_composing && visible >= 0)
+    {
+        m_compose_show_cursor = !!visible;
+        if (visible)
+            return false;
+    }
+
     CONSOLE_CURSOR_INFO ci;
     GetConsoleCursorInfo(m_hout, &ci);
     const bool was_visible = !!ci.bVisible;
@@ -797,6 +826,9 @@ bool Terminal::do_alternate_screen(bool alternate)
     if (was_alternate == alternate)
         return was_alternate;
 
+    if (m_composing)
+        end_compose();
+
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (!GetConsoleScreenBufferInfo(m_hout, &csbi))
         return was_alternate;
@@ -850,6 +882,14 @@ bool Terminal::do_alternate_screen(bool alternate)
 
 void Terminal::do_set_cursor(int column, int row)
 {
+    if (m_composing)
+    {
+        const SMALL_RECT& window = m_compose_window;
+        m_compose_cursor.X = short(clamp(column, 0, window.Right - window.Left));
+        m_compose_cursor.Y = short(clamp(row, 0, window.Bottom - window.Top));
+        return;
+    }
+
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (!GetConsoleScreenBufferInfo(m_hout, &csbi))
         return;
@@ -867,6 +907,13 @@ void Terminal::do_set_cursor(int column, int row)
 
 void Terminal::do_set_horiz_cursor(int column)
 {
+    if (m_composing)
+    {
+        const SMALL_RECT& window = m_compose_window;
+        m_compose_cursor.X = short(clamp(column, 0, window.Right - window.Left));
+        return;
+    }
+
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (!GetConsoleScreenBufferInfo(m_hout, &csbi))
         return;
@@ -883,6 +930,21 @@ void Terminal::do_set_horiz_cursor(int column)
 
 void Terminal::do_move_cursor(int dx, int dy)
 {
+    if (m_composing)
+    {
+        // Moving out of the window can scroll it, so stop composing then.
+        const SMALL_RECT& window = m_compose_window;
+        const int y = m_compose_cursor.Y + dy;
+        if (y >= 0 && y <= window.Bottom - window.Top)
+        {
+            const int x = (dx == INT_MIN) ? 0 : m_compose_cursor.X + dx;
+            m_compose_cursor.X = short(clamp(x, 0, window.Right - window.Left));
+            m_compose_cursor.Y = short(y);
+            return;
+        }
+        end_compose();
+    }
+
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (!GetConsoleScreenBufferInfo(m_hout, &csbi))
         return;
@@ -896,6 +958,30 @@ void Terminal::do_move_cursor(int dx, int dy)
 
 void Terminal::do_clear(clear mode)
 {
+    if (m_composing && load_compose())
+    {
+        const int right = m_compose_window.Right - m_compose_window.Left;
+        const int bottom = m_compose_window.Bottom - m_compose_window.Top;
+        const COORD& xy = m_compose_cursor;
+        switch (mode)
+        {
+        case clear::below:
+            compose_fill(xy.X, xy.Y, right, xy.Y);
+            if (xy.Y < bottom)
+                compose_fill(0, xy.Y + 1, right, bottom);
+            break;
+        case clear::above:
+            if (xy.Y > 0)
+                compose_fill(0, 0, right, xy.Y - 1);
+            compose_fill(0, xy.Y, xy.X, xy.Y);
+            break;
+        case clear::all:
+            compose_fill(0, 0, right, bottom);
+            break;
+        }
+        return;
+    }
+
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (GetConsoleScreenBufferInfo(m_hout, &csbi))
     {
@@ -933,6 +1019,19 @@ void Terminal::do_clear(clear mode)
 
 void Terminal::do_clear_line(clear_line mode)
 {
+    if (m_composing && load_compose())
+    {
+        const int right = m_compose_window.Right - m_compose_window.Left;
+        const COORD& xy = m_compose_cursor;
+        switch (mode)
+        {
+        case clear_line::right: compose_fill(xy.X, xy.Y, right, xy.Y); break;
+        case clear_line::left:  compose_fill(0, xy.Y, xy.X, xy.Y); break;
+        case clear_line::all:   compose_fill(0, xy.Y, right, xy.Y); break;
+        }
+        return;
+    }
+
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (GetConsoleScreenBufferInfo(m_hout, &csbi))
     {
@@ -965,6 +1064,9 @@ void Terminal::do_insert_chars(int count)
     if (count <= 0)
         return;
 
+    if (m_composing)
+        end_compose();
+
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (!GetConsoleScreenBufferInfo(m_hout, &csbi))
         return;
@@ -988,6 +1090,9 @@ void Terminal::do_delete_chars(int count)
     if (count <= 0)
         return;
 
+    if (m_composing)
+        end_compose();
+
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (!GetConsoleScreenBufferInfo(m_hout, &csbi))
         return;
@@ -1019,11 +1124,16 @@ void Terminal::do_delete_chars(int count)
 
 void Terminal::do_set_attributes(attributes attr)
 {
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (!GetConsoleScreenBufferInfo(m_hout, &csbi))
-        return;
+    WORD cur_attr = m_compose_attr;
+    if (!m_composing)
+    {
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (!GetConsoleScreenBufferInfo(m_hout, &csbi))
+            return;
+        cur_attr = csbi.wAttributes;
+    }
 
-    int32 out_attr = csbi.wAttributes & attr_mask_all;
+    int32 out_attr = cur_attr & attr_mask_all;
 
     // Un-reverse so processing can operate on normalized attributes.
     if (m_reverse)
@@ -1114,11 +1224,175 @@ void Terminal::do_set_attributes(attributes attr)
         out_attr = (fg << 4) | (bg >> 4);
     }
 
-    out_attr |= csbi.wAttributes & ~attr_mask_all;
-    SetConsoleTextAttribute(m_hout, short(out_attr));
+    out_attr |= cur_attr & ~attr_mask_all;
+    if (m_composing)
+        m_compose_attr = WORD(out_attr);
+    else
+        SetConsoleTextAttribute(m_hout, short(out_attr));
 }
 
 #pragma endregion Screen Methods
+#pragma region Compose Methods
+
+void Terminal::begin_compose()
+{
+    assert(!m_composing);
+
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo(m_hout, &csbi))
+        return;
+
+    // Only compose when the window spans the whole width of the screen
+    // buffer and contains the cursor; otherwise cursor movement and wrapping
+    // can't be tracked within the window.
+    const SMALL_RECT& window = csbi.srWindow;
+    const COORD& cursor = csbi.dwCursorPosition;
+    if (window.Left != 0 || window.Right != csbi.dwSize.X - 1)
+        return;
+    if (cursor.Y < window.Top || cursor.Y > window.Bottom)
+        return;
+
+    DWORD mode;
+    m_compose_wrap = !GetConsoleMode(m_hout, &mode) || (mode & ENABLE_WRAP_AT_EOL_OUTPUT);
+    m_compose_window = window;
+    m_compose_cursor = { cursor.X, short(cursor.Y - window.Top) };
+    m_compose_begin_cursor = m_compose_cursor;
+    m_compose_attr = csbi.wAttributes;
+    m_compose_begin_attr = csbi.wAttributes;
+    m_compose_dirty = { SHRT_MAX, SHRT_MAX, -1, -1 };
+    m_compose_show_cursor = false;
+    m_compose_loaded = false;
+    m_composing = true;
+}
+
+// Reads the window contents the first time they're needed.
+bool Terminal::load_compose()
+{
+    assert(m_composing);
+    if (m_compose_loaded)
+        return true;
+
+    const SMALL_RECT& window = m_compose_window;
+    const COORD size = { short(window.Right - window.Left + 1), short(window.Bottom - window.Top + 1) };
+    m_compose.resize(size.X * size.Y);
+
+    SMALL_RECT region = window;
+    if (!ReadConsoleOutputW(m_hout, m_compose.data(), size, COORD(), &region))
+    {
+        end_compose();
+        return false;
+    }
+
+    m_compose_loaded = true;
+    return true;
+}
+
+void Terminal::end_compose()
+{
+    assert(m_composing);
+    m_composing = false;
+
+    const SMALL_RECT& window = m_compose_window;
+    SMALL_RECT& dirty = m_compose_dirty;
+    if (m_compose_loaded && dirty.Left <= dirty.Right)
+    {
+        const COORD size = { short(window.Right - window.Left + 1), short(window.Bottom - window.Top + 1) };
+        SMALL_RECT region = { short(window.Left + dirty.Left), short(window.Top + dirty.Top),
+                              short(window.Left + dirty.Right), short(window.Top + dirty.Bottom) };
+        WriteConsoleOutputW(m_hout, m_compose.data(), size, { dirty.Left, dirty.Top }, &region);
+        ++m_write_count;
+    }
+
+    if (m_compose_cursor.X != m_compose_begin_cursor.X || m_compose_cursor.Y != m_compose_begin_cursor.Y)
+    {
+        const COORD xy = { short(window.Left + m_compose_cursor.X), short(window.Top + m_compose_cursor.Y) };
+        SetConsoleCursorPosition(m_hout, xy);
+    }
+
+    if (m_compose_attr != m_compose_begin_attr)
+        SetConsoleTextAttribute(m_hout, m_compose_attr);
+
+    if (m_compose_show_cursor)
+        do_cursor_style(-1, 1);
+}
+
+// Fills cells with spaces in the current attributes; the coordinates are
+// inclusive and relative to the window.
+void Terminal::compose_fill(int left, int top, int right, int bottom)
+{
+    const int width = m_compose_window.Right - m_compose_window.Left + 1;
+    for (int y = top; y <= bottom; ++y)
+    {
+        CHAR_INFO* cell = m_compose.data() + y * width + left;
+        for (int x = left; x <= right; ++x, ++cell)
+        {
+            cell->Char.UnicodeChar = ' ';
+            cell->Attributes = m_compose_attr;
+        }
+    }
+
+    SMALL_RECT& dirty = m_compose_dirty;
+    dirty.Left = min<short>(dirty.Left, short(left));
+    dirty.Top = min<short>(dirty.Top, short(top));
+    dirty.Right = max<short>(dirty.Right, short(right));
+    dirty.Bottom = max<short>(dirty.Bottom, short(bottom));
+}
+
+// Applies as many characters as it can to the window snapshot, and advances
+// chars and length past them.  Stops at anything whose effect on the console
+// can't be reproduced exactly (tabs, characters wider or narrower than one
+// cell, or a line feed that would scroll the window).
+void Terminal::compose_write(const WCHAR*& chars, unsigned& length)
+{
+    if (!load_compose())
+        return;
+
+    const int width = m_compose_window.Right - m_compose_window.Left + 1;
+    const int height = m_compose_window.Bottom - m_compose_window.Top + 1;
+    COORD& xy = m_compose_cursor;
+    SMALL_RECT& dirty = m_compose_dirty;
+
+    for (; length; ++chars, --length)
+    {
+        const WCHAR c = *chars;
+        if (c == '\n')
+        {
+            // Processed output treats a line feed as a new line.
+            if (xy.Y + 1 >= height)
+                break;
+            ++xy.Y;
+            xy.X = 0;
+        }
+        else if (c == '\r')
+        {
+            xy.X = 0;
+        }
+        else if (c < ' ' || (c >= 0xd800 && c <= 0xdfff) || wcwidth(c) != 1)
+        {
+            break;
+        }
+        else
+        {
+            CHAR_INFO& cell = m_compose[xy.Y * width + xy.X];
+            cell.Char.UnicodeChar = c;
+            cell.Attributes = m_compose_attr;
+
+            dirty.Left = min<short>(dirty.Left, xy.X);
+            dirty.Top = min<short>(dirty.Top, xy.Y);
+            dirty.Right = max<short>(dirty.Right, xy.X);
+            dirty.Bottom = max<short>(dirty.Bottom, xy.Y);
+
+            if (xy.X + 1 < width)
+                ++xy.X;
+            else if (m_compose_wrap && xy.Y + 1 < height)
+                xy = { 0, short(xy.Y + 1) };
+            // Otherwise stay in the last column rather than scroll the
+            // window.
+        }
+    }
+}
+
+#pragma endregion Compose Methods
 
 #pragma endregion Terminal
 
@@ -25,13 +25,16 @@ public:
                         ~Terminal();
 
     void                WriteConsole(const WCHAR* chars, unsigned length);
+    unsigned            GetWriteCount() const { return m_write_count; }
 
 private:
     const HANDLE        m_hout;
+    unsigned            m_write_count = 0;  // Number of console write calls.
 
 #ifdef INCLUDE_TERMINAL_EMULATOR
 public:
     void                SetEmulation(int emulate=-1);
+    bool                IsEmulating() const { return m_emulate; }
 
 private:
 #pragma region Emulation Methods
@@ -63,6 +66,13 @@ private:
     void                do_delete_chars(int count);
     void                do_set_attributes(attributes attr);
 #pragma endregion Screen Methods
+#pragma region Compose Methods
+    void                begin_compose();
+    void                end_compose();
+    bool                load_compose();
+    void                compose_write(const WCHAR*& chars, unsigned& length);
+    void                compose_fill(int left, int top, int right, int bottom);
+#pragma endregion Compose Methods
 
 private:
     CRITICAL_SECTION    m_cs;
@@ -90,5 +100,22 @@ private:
     COORD               m_screen_dimensions = {};
     COORD               m_screen_cursor = {};
 #pragma endregion Emulation State
+
+#pragma region Compose State
+    // While composing, output is applied to a snapshot of the console window
+    // instead of the console, and the changed rectangle is written back at
+    // the end with a single WriteConsoleOutputW.
+    bool                m_composing = false;
+    bool                m_compose_loaded = false;
+    bool                m_compose_wrap = true;
+    bool                m_compose_show_cursor = false;
+    std::vector<CHAR_INFO> m_compose;
+    SMALL_RECT          m_compose_window = {};
+    SMALL_RECT          m_compose_dirty = {};
+    COORD               m_compose_cursor = {};  // Relative to the window.
+    COORD               m_compose_begin_cursor = {};
+    WORD                m_compose_attr = 0;
+    WORD                m_compose_begin_attr = 0;
+#pragma endregion Compose State
 #endif
 };
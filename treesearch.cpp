@@ -0,0 +1,398 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#include "pch.h"
+#include "treesearch.h"
+#include "contentcache.h"
+#include "searcher.h"
+#include "os.h"
+#include "error.h"
+
+#include <shlwapi.h>
+
+// When this many files are waiting, a worker walking a directory searches
+// some of them before queuing more, so a huge directory can't fill memory.
+static const size_t c_max_queued_files = 16384;
+static const size_t c_queue_batch = 256;
+
+// There's no use in showing more hits than anyone would read, and each one
+// holds a copy of its row.
+static const size_t c_max_tree_hits = 10000;
+static const unsigned c_max_hit_text = 512;
+
+static const DWORD c_max_tree_threads = 16;
+
+// Milliseconds to wait for stopped workers before abandoning them.
+static const DWORD c_worker_stop_wait = 250;
+
+struct TreeSearch::Worker
+{
+    std::shared_ptr<Searcher> searcher;
+    ProgressChannel progress;
+    ContentCache*   ctx = nullptr;          // Owned by WorkerProc.
+    SHBasic         thread;
+};
+
+// What each worker thread gets; it keeps the state alive until it exits.
+struct TreeSearch::WorkerRef
+{
+    std::shared_ptr<State> state;
+    Worker*         worker;
+};
+
+TreeSearch::State::State()
+{
+    InitializeCriticalSection(&cs);
+}
+
+TreeSearch::State::~State()
+{
+    DeleteCriticalSection(&cs);
+}
+
+TreeSearch::TreeSearch()
+: m_state(std::make_shared<State>())
+{
+}
+
+TreeSearch::~TreeSearch()
+{
+    Stop();
+}
+
+bool TreeSearch::Start(const WCHAR* dir, const WCHAR* mask, const std::shared_ptr<Searcher>& searcher, Error& e)
+{
+    Stop();
+
+    // A fresh state, since stopping may have left the old one to workers
+    // that haven't exited yet.
+    m_state = std::make_shared<State>();
+    State& state = *m_state;
+
+    state.root.ReserveMaxPath();
+    if (!OS::GetFullPathName(dir, state.root, e))
+        return false;
+    state.mask.Set((mask && (mask[0] != '*' || mask[1])) ? mask : L"");
+
+    state.work = CreateEvent(nullptr, true, false, nullptr);
+    if (state.work.Empty())
+    {
+        e.Sys();
+        return false;
+    }
+
+    state.dirs.emplace_back(state.root);
+    SetEvent(state.work);
+
+    // Each worker uses its own clone of the searcher, and its own progress
+    // channel so Stop() can cancel a search that's in the middle of a file.
+    const DWORD num_cpus = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    const size_t num_threads = std::min<size_t>(std::max<DWORD>(1, num_cpus), c_max_tree_threads);
+    state.workers.reserve(num_threads);
+    for (size_t ii = 0; ii < num_threads; ++ii)
+    {
+        auto worker = std::make_unique<Worker>();
+        worker->searcher = ii ? searcher->Clone(e) : searcher;
+        if (!worker->searcher)
+            break;
+        worker->progress.Reset();
+        WorkerRef* ref = new WorkerRef { m_state, worker.get() };
+        worker->thread = CreateThread(nullptr, 0, WorkerProc, ref, 0, nullptr);
+        if (worker->thread.Empty())
+        {
+            e.Sys();
+            delete ref;
+            break;
+        }
+        m_threads.emplace_back(worker->thread);
+        state.workers.emplace_back(std::move(worker));
+    }
+
+    if (state.workers.empty())
+        return false;
+    e.Clear();
+    return true;
+}
+
+void TreeSearch::Cancel()
+{
+    m_state->Cancel();
+}
+
+void TreeSearch::State::Cancel()
+{
+    canceled = true;
+    RequestStop();
+}
+
+void TreeSearch::State::RequestStop()
+{
+    stop = true;
+    for (auto& worker : workers)
+        worker->progress.Cancel();
+    SetEvent(work);
+}
+
+void TreeSearch::Stop()
+{
+    if (!m_threads.empty())
+    {
+        // A worker can be stuck in synchronous I/O (e.g. on an unresponsive
+        // network share), so don't wait for long.  Workers that haven't
+        // exited by then are abandoned; they hold the state until they exit.
+        m_state->RequestStop();
+        const DWORD start = GetTickCount();
+        for (const HANDLE thread : m_threads)
+        {
+            const DWORD elapsed = GetTickCount() - start;
+            OS::StopThreadIo(thread, (elapsed < c_worker_stop_wait) ? c_worker_stop_wait - elapsed : 0);
+        }
+        m_threads.clear();
+    }
+}
+
+bool TreeSearch::TakeHits(std::vector<Hit>& hits)
+{
+    State& state = *m_state;
+    const bool done = (m_threads.empty() || WaitForMultipleObjects(DWORD(m_threads.size()), m_threads.data(), true, 0) != WAIT_TIMEOUT);
+
+    EnterCriticalSection(&state.cs);
+    if (hits.empty())
+        hits.swap(state.hits);
+    else
+    {
+        for (auto& hit : state.hits)
+            hits.emplace_back(std::move(hit));
+        state.hits.clear();
+    }
+    LeaveCriticalSection(&state.cs);
+
+    return done;
+}
+
+void TreeSearch::GetCurrentFile(StrW& file)
+{
+    EnterCriticalSection(&m_state->cs);
+    file.Set(m_state->current);
+    LeaveCriticalSection(&m_state->cs);
+}
+
+bool TreeSearch::State::AddHit(Hit&& hit)
+{
+    bool more = true;
+    EnterCriticalSection(&cs);
+    if (num_hits < c_max_tree_hits)
+    {
+        hits.emplace_back(std::move(hit));
+        more = (++num_hits < c_max_tree_hits);
+    }
+    else
+    {
+        more = false;
+    }
+    LeaveCriticalSection(&cs);
+
+    if (!more)
+    {
+        truncated = true;
+        RequestStop();
+    }
+    return more;
+}
+
+DWORD WINAPI TreeSearch::WorkerProc(void* param)
+{
+    const std::unique_ptr<WorkerRef> ref(static_cast<WorkerRef*>(param));
+    Worker* const worker = ref->worker;
+    State* const self = ref->state.get();
+
+    ContentCache ctx(g_options);
+    BulkReadScope bulk(ctx);
+    ctx.SetProgress(&worker->progress);
+    worker->ctx = &ctx;
+
+    StrW item;
+    while (!self->stop)
+    {
+        // Files come first, so the queue of files drains before another
+        // directory adds to it.
+        bool is_file = false;
+        bool got = false;
+        EnterCriticalSection(&self->cs);
+        if (!self->files.empty())
+        {
+            item = std::move(self->files.front());
+            self->files.pop_front();
+            is_file = true;
+            got = true;
+        }
+        else if (!self->dirs.empty())
+        {
+            item = std::move(self->dirs.back());
+            self->dirs.pop_back();
+            got = true;
+        }
+        else if (!self->busy)
+        {
+            // Nothing queued and nobody can queue more:  all done.
+            LeaveCriticalSection(&self->cs);
+            SetEvent(self->work);
+            break;
+        }
+        if (got)
+            ++self->busy;
+        else
+            ResetEvent(self->work);
+        LeaveCriticalSection(&self->cs);
+
+        if (!got)
+        {
+            WaitForSingleObject(self->work, INFINITE);
+            continue;
+        }
+
+        if (is_file)
+            self->SearchFile(*worker, item);
+        else
+            self->WalkDirectory(*worker, item);
+
+        EnterCriticalSection(&self->cs);
+        if (!--self->busy && self->files.empty() && self->dirs.empty())
+            SetEvent(self->work);
+        LeaveCriticalSection(&self->cs);
+    }
+
+    worker->ctx = nullptr;
+    ctx.Close();
+    return 0;
+}
+
+void TreeSearch::State::WalkDirectory(Worker& worker, const StrW& dir)
+{
+    PathW pattern;
+    pattern.Set(dir);
+    pattern.JoinComponent(L"*");
+
+    // Same as scanning a directory for the chooser.
+    WIN32_FIND_DATA fd;
+    SHFind shFind = FindFirstFileExW(pattern.Text(), FindExInfoBasic, &fd, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (shFind.Empty())
+    {
+        if (GetLastError() != ERROR_FILE_NOT_FOUND)
+            ++skipped;
+        return;
+    }
+
+    std::vector<StrW> new_dirs;
+    std::vector<StrW> new_files;
+    PathW path;
+
+    auto flush = [&]()
+    {
+        bool full = false;
+        EnterCriticalSection(&cs);
+        for (auto& d : new_dirs)
+            dirs.emplace_back(std::move(d));
+        for (auto& f : new_files)
+            files.emplace_back(std::move(f));
+        if (!new_dirs.empty() || !new_files.empty())
+            SetEvent(work);
+        full = (files.size() >= c_max_queued_files);
+        LeaveCriticalSection(&cs);
+        new_dirs.clear();
+        new_files.clear();
+
+        // Help drain the queue rather than growing it further.
+        StrW file;
+        while (full && !stop)
+        {
+            EnterCriticalSection(&cs);
+            full = (files.size() >= c_max_queued_files);
+            if (full)
+            {
+                file = std::move(files.front());
+                files.pop_front();
+            }
+            LeaveCriticalSection(&cs);
+            if (full)
+                SearchFile(worker, file);
+        }
+    };
+
+    do
+    {
+        if (stop)
+            return;
+        if (fd.cFileName[0] == '.' && (!fd.cFileName[1] || (fd.cFileName[1] == '.' && !fd.cFileName[2])))
+            continue;
+
+        const bool is_dir = !!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+        if (is_dir && (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            continue;
+        if (!is_dir && !mask.Empty() && !PathMatchSpecW(fd.cFileName, mask.Text()))
+            continue;
+
+        path.Set(dir);
+        path.JoinComponent(fd.cFileName);
+        if (is_dir)
+            new_dirs.emplace_back(std::move(path));
+        else
+            new_files.emplace_back(std::move(path));
+
+        if (new_dirs.size() + new_files.size() >= c_queue_batch)
+            flush();
+    }
+    while (FindNextFile(shFind, &fd));
+
+    const DWORD dwErr = GetLastError();
+    if (dwErr && dwErr != ERROR_NO_MORE_FILES)
+        ++skipped;
+
+    flush();
+}
+
+void TreeSearch::State::SearchFile(Worker& worker, const StrW& file)
+{
+    ContentCache& ctx = *worker.ctx;
+
+    EnterCriticalSection(&cs);
+    current.Set(file);
+    LeaveCriticalSection(&cs);
+
+    Error e;
+    if (!ctx.Open(file.Text(), e))
+    {
+        ++skipped;
+        return;
+    }
+    ++searched;
+
+    FoundOffset found;
+    unsigned left_offset = 0;
+    bool first = true;
+    while (!stop && ctx.Find(true, worker.searcher, 999, found, left_offset, e, first))
+    {
+        first = false;
+
+        Hit hit;
+        const size_t index = ctx.OffsetToIndex(found.offset);
+        hit.file.Set(file);
+        hit.offset = found.offset;
+        hit.line = ctx.GetLineNunber(index);
+        hit.approx_line = ctx.IsApproximate(index);
+
+        Error dummy;
+        ctx.GetLineText(index, hit.text, dummy);
+        if (hit.text.Length() > c_max_hit_text)
+            hit.text.SetLength(c_max_hit_text);
+
+        if (!AddHit(std::move(hit)))
+            break;
+    }
+
+    // Ctrl-Break cancels the channel too, and then it's the user canceling.
+    if (e.Code() == E_ABORT && !stop)
+        Cancel();
+}
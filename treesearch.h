@@ -0,0 +1,100 @@
+// Copyright (c) 2025 by Christopher Antos
+// License: http://opensource.org/licenses/MIT
+
+// vim: set et ts=4 sw=4 cino={0s:
+
+#pragma once
+
+#include <windows.h>
+#include "str.h"
+#include "progress.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class Error;
+class Searcher;
+typedef unsigned __int64 FileOffset;
+
+// Searches every file under a directory tree on a pool of worker threads,
+// and hands over the hits as they arrive.  The workers walk directories and
+// search files from shared queues; they prefer searching files, and walk
+// another directory only when no files are waiting, so the queues stay
+// small even in trees with millions of files.  Directories and files that
+// can't be read are skipped and counted.
+class TreeSearch
+{
+public:
+    struct Hit
+    {
+        StrW        file;
+        FileOffset  offset;
+        size_t      line;
+        bool        approx_line;            // In a sparse window of a big file.
+        StrW        text;                   // The row containing the hit.
+    };
+
+                    TreeSearch();
+                    ~TreeSearch();
+
+    // The mask applies to files; all subdirectories are searched, except
+    // links (which could lead outside the tree or into a cycle).
+    bool            Start(const WCHAR* dir, const WCHAR* mask, const std::shared_ptr<Searcher>& searcher, Error& e);
+    void            Stop();                 // Abandons workers that don't stop promptly.
+    void            Cancel();               // Stops, and counts as canceled.
+    const WCHAR*    GetDirectory() const { return m_state->root.Text(); }
+
+    // Appends the hits that arrived since the last call.  Returns true once
+    // the search is done (finished, canceled, or hit the limit).
+    bool            TakeHits(std::vector<Hit>& hits);
+    void            GetCurrentFile(StrW& file);
+    size_t          CountSearched() const { return m_state->searched; }
+    size_t          CountSkipped() const { return m_state->skipped; }
+    bool            IsCanceled() const { return m_state->canceled; }
+    bool            IsTruncated() const { return m_state->truncated; }
+
+private:
+    struct Worker;
+    struct WorkerRef;
+
+    // Shared with the workers, so that Stop() can abandon workers stuck in
+    // I/O without waiting for them; the last one out frees it.
+    struct State
+    {
+                    State();
+                    ~State();
+
+        void        WalkDirectory(Worker& worker, const StrW& dir);
+        void        SearchFile(Worker& worker, const StrW& file);
+        bool        AddHit(Hit&& hit);
+        void        RequestStop();
+        void        Cancel();
+
+        StrW        root;
+        StrW        mask;                   // Empty means all files.
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        CRITICAL_SECTION cs;
+        SHBasic     work;                   // Set when work is queued, or all done.
+        std::vector<StrW> dirs;             // Protected by cs.  LIFO, for depth first.
+        std::deque<StrW> files;             // Protected by cs.
+        std::vector<Hit> hits;              // Protected by cs.
+        StrW        current;                // Protected by cs.
+        size_t      busy = 0;               // Protected by cs.
+        size_t      num_hits = 0;           // Protected by cs.
+
+        std::atomic<size_t> searched = 0;
+        std::atomic<size_t> skipped = 0;
+        std::atomic<bool> stop = false;
+        std::atomic<bool> canceled = false;
+        std::atomic<bool> truncated = false;
+    };
+
+    static DWORD WINAPI WorkerProc(void* param);
+
+private:
+    std::shared_ptr<State> m_state;
+    std::vector<HANDLE> m_threads;          // Owned by the workers.
+};
@@ -21,6 +21,18 @@
 #include "filetypeconfig.h"
 #include "help.h"
 #include "os.h"
+#include "screenbuffer.h"
+#include "fields.h"
+#include "perf.h"
+#include "memorybudget.h"
+#include "filecompare.h"
+#include "exporter.h"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <list>
+#include <map>
 
 constexpr bool c_floating = false;
 constexpr scroll_bar_style c_sbstyle = scroll_bar_style::eighths_block_chars;
@@ -42,6 +54,12 @@ static int8 s_force_hex_edit = -1;
 ViewerOptions g_options;
 
 constexpr unsigned c_horiz_scroll_amount = 10;
+constexpr size_t c_max_recent_contexts = 32;     // Files to keep open after switching away from them.
+constexpr DWORD c_bg_indexing_refresh = 250;    // Milliseconds between progress updates while indexing in the background.
+constexpr DWORD c_worker_stop_wait = 250;       // Milliseconds to wait for a canceled worker before abandoning it.
+constexpr unsigned c_min_split_width = 60;      // Narrower terminals show compared files one at a time.
+constexpr DWORD c_export_refresh = 250;         // Milliseconds between progress updates while exporting.
+constexpr FileOffset c_export_piece = 64 * 1024 * 1024; // Bytes to export between progress updates.
 
 enum
 {
@@ -193,6 +211,41 @@ static bool ConfirmDiscardBytes()
     return false;
 }
 
+static bool ConfirmOverwrite()
+{
+    const WCHAR* const msg = L"The file already exists.  Do you want to replace it?";
+    const WCHAR* const directive = L"Press Y to replace it, or any other key to cancel...";
+    // TODO:  ColorElement::Footer might not be the most appropriate color.
+    const StrW s = MakeMsgBoxText(msg, directive, ColorElement::Footer);
+    OutputConsole(s.Text(), s.Length());
+
+    while (true)
+    {
+        const InputRecord input = SelectInput();
+        switch (input.type)
+        {
+        case InputType::None:
+        case InputType::Error:
+            continue;
+        // InputType::Resize falls through to the break and return false.
+        }
+
+        if (input.type == InputType::Char)
+        {
+            switch (input.key_char)
+            {
+            case 'y':
+            case 'Y':
+                return true;
+            }
+        }
+
+        break;
+    }
+
+    return false;
+}
+
 static bool ConfirmUndoSave()
 {
     const WCHAR* const msg = L"Do you want to undo all saved changes to this file?";
@@ -228,6 +281,146 @@ static bool ConfirmUndoSave()
     return false;
 }
 
+// Collects every hit for a searcher in a file on a background thread, so
+// that Find Next/Prev can be lookups instead of rescans, and so the hits can
+// be listed.  There's at most one hit per row, the same as Find Next visits.
+// The hits found so far can be read while the worker is still running (the
+// filtered view grows as they arrive).
+class SearchHits
+{
+public:
+    struct Hit
+    {
+        FileOffset  offset;
+        unsigned    len;
+    };
+
+                    SearchHits() { InitializeCriticalSection(&m_cs); }
+                    ~SearchHits() { Clear(); DeleteCriticalSection(&m_cs); }
+
+    bool            Start(const WCHAR* name, const ContentCache& context, const std::shared_ptr<Searcher>& searcher, unsigned wrap);
+    void            Clear();
+    bool            Poll();
+    bool            IsRunning() const { return !m_thread.Empty(); }
+    HANDLE          GetThread() const { return m_thread; }
+    bool            IsComplete() const { return m_complete; }
+    bool            IsValidFor(const Searcher* searcher, const ContentCache& context, unsigned wrap) const;
+
+    size_t          Count() const;
+    Hit             operator[](size_t index) const;
+    size_t          Next(const FoundOffset& from) const;
+    size_t          Prev(const FoundOffset& from) const;
+    size_t          Find(FileOffset offset) const;
+
+private:
+    static DWORD WINAPI WorkerProc(void* param);
+
+private:
+    StrW            m_name;
+    std::shared_ptr<Searcher> m_searcher;       // Clone used by the worker.
+    const Searcher* m_source = nullptr;         // Searcher the hits are for.
+    UINT            m_codepage = 0;
+    bool            m_binary = false;
+    bool            m_override_encoding = false;
+    uint32          m_content_generation = 0;
+    unsigned        m_wrap = 0;
+
+    std::vector<Hit> m_hits;                    // Sorted by offset.
+    MemoryCharge    m_memory = MemoryCharge(MemoryUse::SearchHits);
+    mutable CRITICAL_SECTION m_cs;              // Guards m_hits while running.
+    ProgressChannel m_progress;                 // Progress while running.
+    bool            m_canceled = false;         // Set by the worker.
+    bool            m_complete = false;
+    SHBasic         m_thread;
+};
+
+// Every match in the rows on screen, for highlighting them all.  The matches
+// are remembered per row (by the row's offset and length), so scrolling only
+// has to match the rows that scroll into view.
+class VisibleMatches
+{
+public:
+    void            Clear();
+    const std::vector<FoundOffset>* GetRowMatches(ContentCache& context, Searcher& searcher, size_t index, Error& e);
+
+private:
+    struct RowMatches
+    {
+        unsigned    length;
+        std::vector<FoundOffset> spans;         // Sorted by offset.
+    };
+
+    const Searcher* m_source = nullptr;         // Searcher the matches are for.
+    UINT            m_codepage = 0;
+    bool            m_binary = false;
+    uint32          m_content_generation = 0;
+    std::map<FileOffset, RowMatches> m_rows;
+};
+
+// Samples rows spread across a delimited file on a background thread, to
+// refine the column widths that were estimated from the rows in view.
+class FieldSampler
+{
+public:
+                    ~FieldSampler() { Clear(); }
+
+    bool            Start(const WCHAR* name, const ContentCache& context, WCHAR delimiter);
+    void            Clear();
+    bool            Poll(std::vector<unsigned>& widths);
+    bool            IsRunning() const { return !m_thread.Empty(); }
+    HANDLE          GetThread() const { return m_thread; }
+
+private:
+    static DWORD WINAPI WorkerProc(void* param);
+
+private:
+    StrW            m_name;
+    UINT            m_codepage = 0;
+    bool            m_binary = false;
+    bool            m_override_encoding = false;
+    FieldLayout     m_layout;                   // Written by the worker.
+    ProgressChannel m_progress;                 // Canceling it stops the worker.
+    SHBasic         m_thread;
+};
+
+// Opens the files next to the one being viewed on a background thread, and
+// indexes their first few screens, so that moving to them shows them right
+// away even when opening and reading them is slow (e.g. on a network share).
+// The contexts are handed over suspended, like recently viewed files.
+//
+// Finishing never waits long for the worker:  if it doesn't stop promptly
+// (e.g. it's stuck opening a file on an unresponsive share), it's abandoned
+// along with what it preloaded.  The worker shares ownership of its job, so
+// it can still finish safely on its own.
+class FilePreloader
+{
+public:
+                    ~FilePreloader() { Clear(); }
+
+    bool            Start(std::vector<StrW>&& names, unsigned wrap, size_t rows);
+    void            Clear();
+    bool            Poll(std::vector<std::unique_ptr<ContentCache>>& contexts);
+    void            Finish(std::vector<std::unique_ptr<ContentCache>>& contexts);
+    bool            IsRunning() const { return !m_thread.Empty(); }
+    HANDLE          GetThread() const { return m_thread; }
+
+private:
+    struct Job
+    {
+        std::vector<StrW> names;
+        unsigned    wrap = 0;
+        size_t      rows = 0;
+        std::vector<std::unique_ptr<ContentCache>> contexts;  // Written by the worker.
+        ProgressChannel progress;               // Canceling it stops the worker.
+    };
+
+    static DWORD WINAPI WorkerProc(void* param);
+
+private:
+    std::shared_ptr<Job> m_job;
+    SHBasic         m_thread;
+};
+
 class Viewer;
 class ScopedWorkingIndicator;
 
@@ -280,6 +473,14 @@ private:
     ViewerOutcome   OnLeftClick(const InputRecord& input, Error &e);
     void            EnsureAltFiles();
     void            SetFile(intptr_t index, ContentCache* context=nullptr, bool force=false);
+    void            KeepRecentContext();
+    void            TrimRecentContexts();
+    std::unique_ptr<ContentCache> TakeRecentContext(const WCHAR* name);
+    size_t          ReclaimRecentContexts(size_t excess);
+    void            StartPreloading();
+    void            AdoptPreloaded(bool finish);
+    size_t          CountRows() const;
+    bool            GetDisplayRow(size_t row, size_t& index, FoundOffset& hit_line, Error& e);
     size_t          CountForDisplay() const;
     size_t          GetFoundLineIndex(const FoundOffset& found_line);
     FileOffset      GetFoundOffset(const FoundOffset& found_line, unsigned* offset_highlight=nullptr);
@@ -291,7 +492,19 @@ private:
     // Command functions.
     void            DoSearch(bool next, bool caseless);
     void            FindNext(bool next=true);
+    void            FindAll();
+    void            JumpToHit(size_t hit);
+    void            ShowHitList();
+    void            ToggleFilter();
+    void            LeaveFilter();
+    void            ToggleFields();
+    void            SelectField(size_t column);
     void            JumpNextEdit(bool next=true);
+    void            ToggleCompare();
+    void            SyncComparePane();
+    bool            IsSplitCompare() const;
+    size_t          GetComparePaneTop();
+    void            JumpDifference(bool next=true);
     void            ClearBookmarks();
     void            SetBookmark();
     void            JumpBookmark(bool next=true);
@@ -301,6 +514,8 @@ private:
     void            ChooseEncoding();
     void            ChooseTabWidth();
     void            OpenNewFile(Error& e);
+    void            ExportContent(Error& e);
+    bool            LineNumberToOffset(size_t line, FileOffset& offset, Error& e);
     ViewerOutcome   CloseCurrentFile(Error& e);
     ViewerOutcome   DoHelp();
     void            ShowOriginalScreen();
@@ -315,6 +530,9 @@ private:
     void            ToggleFileOffsets();
     void            ToggleShowWhitespace();
     void            ToggleWrap();
+    void            ToggleFollow();
+    void            FollowEnd();
+    void            PollGrowth();
     void            ToggleExpandTabs();
     void            ToggleCtrlMode();
     void            ToggleShowRuler();
@@ -339,11 +557,17 @@ private:
     intptr_t        m_index = -1;
 
     ContentCache     m_context;
+    std::list<std::unique_ptr<ContentCache>> m_recent_contexts; // Most recent first.
+    FilePreloader   m_preloader;
+    bool            m_preload_pending = false;  // Preload the neighbors once the file is shown.
     WIN32_FIND_DATAW m_fd = {};
     size_t          m_top = 0;
     unsigned        m_left = 0;
     StrW            m_feedback;
     bool            m_wrap = false;
+    bool            m_follow = false;       // Keep the end in view as the input grows.
+    bool            m_filtered = false;     // Only show rows with hits; m_top indexes m_hits.
+    size_t          m_filter_saved_top = 0;
 
     bool            m_hex_mode = false;
     unsigned        m_hex_width = 0;
@@ -364,6 +588,7 @@ private:
     ClickableRow    m_clickable_menu;
 #endif
     ClickableRow    m_clickable_footer;
+    ScreenBuffer    m_screen;
 
     intptr_t        m_last_index = -1;
     size_t          m_last_top = 0;
@@ -377,6 +602,11 @@ private:
     bool            m_last_hex_characters = false;
     FileOffset      m_last_processed = FileOffset(-1);
     bool            m_last_completed = false;
+    unsigned        m_last_margin_width = 0;
+    unsigned        m_last_content_width = 0;
+    size_t          m_last_count = 0;
+    size_t          m_last_bookmark_count = 0;
+    FoundOffset     m_last_found_line;
 #ifdef INCLUDE_MENU_ROW
     StrW            m_last_menu;
 #endif
@@ -392,9 +622,24 @@ private:
 
     bool            m_multifile_search = false;
     FoundOffset     m_found_line;
+    SearchHits      m_hits;
+    std::map<FileOffset, size_t> m_hit_rows;    // Resolved indices of hits near the screen, by offset.
+    uint32          m_hit_rows_generation = 0;
+    uint32          m_hit_rows_content_generation = 0;
+    bool            m_highlight_all = false;
+    VisibleMatches  m_visible_matches;
+
+    bool            m_fields_mode = false;  // Show delimited fields in aligned columns.
+    FieldLayout     m_fields;
+    size_t          m_field_column = 0;     // Selected column.
+    FieldSampler    m_field_sampler;
 
     size_t          m_cur_bookmark = -1;
     std::vector<FoundOffset> m_bookmarks;
+
+    FileCompare     m_compare;              // Differences between two of the files.
+    ContentCache    m_compare_pane;         // The other compared file, shown beside this one.
+    size_t          m_compare_line = size_t(-1); // Line to show after switching to the other file.
 };
 
 void ScopedWorkingIndicator::ShowFeedback(bool completed, unsigned __int64 processed, unsigned __int64 target, Viewer* viewer, bool bytes)
@@ -415,6 +660,7 @@ Viewer::Viewer(const char* text, const WCHAR* title)
 : m_title(title)
 , m_text(text)
 , m_context(g_options)
+, m_compare_pane(g_options)
 {
     Error e;
     m_context.SetTextContent(m_text, e);
@@ -430,6 +676,7 @@ Viewer::Viewer(const char* text, const WCHAR* title)
 Viewer::Viewer(const std::vector<StrW>& files)
 : m_files(&files)
 , m_context(g_options)
+, m_compare_pane(g_options)
 {
     m_wrap = g_options.wrapping;
     m_hex_mode = g_options.hex_mode;
@@ -441,16 +688,70 @@ ViewerOutcome Viewer::Go(Error& e, bool do_search)
 
     AutoMouseConsoleMode mouse(g_options.allow_mouse);
 
+    // The memory that can give way to stay within the memory budget.
+    // Background indexing is stopped whenever the loop runs the reclaimers.
+    RegisterMemoryReclaimer(this, MemoryReclaimPriority::RecentFiles, [this](size_t excess){ return ReclaimRecentContexts(excess); });
+    RegisterMemoryReclaimer(this, MemoryReclaimPriority::PipeChunks, [this](size_t excess){ return m_context.ReclaimMemory(excess); });
+    AutoCleanup unregister([this](){ UnregisterMemoryReclaimer(this); });
+
     while (true)
     {
         e.Clear();
         ClearSignaled();
 
+        if (m_context.IsPipeLive() || m_follow)
+            PollGrowth();
+        TrimToMemoryBudget();
+
+        std::vector<unsigned> sampled_widths;
+        if (m_field_sampler.Poll(sampled_widths) && m_fields_mode && m_fields.Merge(sampled_widths))
+            m_force_update = true;
+
+        if (m_hits.Poll())
+        {
+            if (m_filtered)
+                m_force_update = true;  // For the end of file marker.
+            if (!m_hits.IsComplete())
+                m_feedback = c_canceled;
+            else if (!m_hits.Count())
+                m_feedback = c_text_not_found;
+            else if (m_filtered)
+                m_feedback.Printf(L"*** Found %zu matching rows ***", m_hits.Count());
+            else
+                m_feedback.Printf(L"*** Found %zu hits; Ctrl-F3 to list them ***", m_hits.Count());
+        }
+        else if (m_hits.IsRunning() && m_feedback.Empty())
+        {
+            m_feedback.Printf(m_filtered ? L"*** Filtering: %zu matching rows ***" : L"*** Finding all: %zu hits ***", m_hits.Count());
+        }
+
+        if (m_compare.Poll())
+        {
+            m_force_update = true;
+            m_feedback.Clear();
+            if (m_compare.IsCanceled())
+                m_feedback = c_canceled;
+            else if (!m_compare.IsComplete())
+                m_feedback = L"*** Unable to compare the files ***";
+            else if (!m_compare.Count())
+                m_feedback = L"*** The files have no differences ***";
+            else
+                m_feedback.Printf(L"*** %zu difference(s); F7/F8 to jump, Ctrl-N/Ctrl-P to switch files ***", m_compare.Count());
+            if (!m_compare.IsComplete())
+                m_compare.Clear();
+        }
+
 #ifdef INCLUDE_MENU_ROW
         m_command_mode = true;
 #endif
         UpdateDisplay();
 
+        // Poll before starting, so what's already preloaded isn't preloaded
+        // again.
+        AdoptPreloaded(false/*finish*/);
+        if (m_preload_pending)
+            StartPreloading();
+
         if (do_search)
         {
             do_search = false;
@@ -463,7 +764,42 @@ ViewerOutcome Viewer::Go(Error& e, bool do_search)
             }
         }
 
-        const InputRecord input = SelectInput(INFINITE, &mouse);
+        // Let the line map keep growing while waiting for input.  Waking up
+        // periodically lets the header and scrollbar show the progress, and
+        // waking up when a worker finishes shows the outcome right away.
+        // Hex mode only needs the line map for showing line numbers.  Over
+        // the memory budget, the rest of the file is only indexed on demand
+        // (big files can still use sparse windows).
+        const bool within_budget = (!GetMemoryBudget() || GetTotalMemoryUsage() < GetMemoryBudget());
+        const bool bg_indexing = ((!m_hex_mode || g_options.show_line_numbers) && within_budget && m_context.StartBackgroundIndexing());
+        const bool refresh = (bg_indexing || m_hits.IsRunning() || m_context.IsPipeLive() || m_follow);
+        HANDLE wake[5];
+        uint32 wake_count = 0;
+        if (bg_indexing)
+            wake[wake_count++] = m_context.GetBackgroundIndexingThread();
+        if (m_hits.IsRunning())
+            wake[wake_count++] = m_hits.GetThread();
+        if (m_field_sampler.IsRunning())
+            wake[wake_count++] = m_field_sampler.GetThread();
+        if (m_preloader.IsRunning())
+            wake[wake_count++] = m_preloader.GetThread();
+        if (m_compare.IsRunning())
+            wake[wake_count++] = m_compare.GetThread();
+        // Don't hold a memory mapped file while waiting, so other programs
+        // can truncate or replace it (e.g. rotating a log being followed).
+        if (!bg_indexing)
+            m_context.ReleaseMapping();
+        m_compare_pane.ReleaseMapping();
+        const InputRecord input = SelectInput(refresh ? c_bg_indexing_refresh : INFINITE, &mouse, wake, wake_count);
+        m_context.StopBackgroundIndexing();
+        if (bg_indexing && !m_hex_mode && !m_filtered)
+        {
+            // Background indexing can shift the indices of rows in a sparse
+            // window, so resync m_top before handling input.
+            Error dummy;
+            m_top = m_context.SyncIndex(m_top, dummy);
+        }
+
         switch (input.type)
         {
         case InputType::None:
@@ -472,6 +808,7 @@ ViewerOutcome Viewer::Go(Error& e, bool do_search)
 
         case InputType::Resize:
             m_force_update = true;
+            m_screen.Invalidate();
             continue;
 
         case InputType::Key:
@@ -516,7 +853,7 @@ static void PadToWidth(StrW& s, unsigned min_width)
 
 unsigned Viewer::CalcContentHeight() const
 {
-    const unsigned debug_row = !!g_options.show_debug_info;
+    const unsigned debug_row = g_options.show_debug_info ? 2 : 0;
 #ifdef INCLUDE_MENU_ROW
     const unsigned menu_row = (g_options.show_menu || m_searching);
 #else
@@ -532,12 +869,15 @@ void Viewer::UpdateDisplay(StrW* last_screen)
     static bool s_no_accumulate = false;
 #endif
 
+    EnablePerf(g_options.show_debug_info);
+    PerfScope perf(PerfTimer::UpdateDisplay);
+
     bool update_command_line = false;
 
     // Decide terminal dimensions and content height.  Content width can't be
     // decided yet because it may depend on the margin width (which depends on
     // the highest, i.e. widest, file number or file offset).
-    const unsigned debug_row = !!g_options.show_debug_info;
+    const unsigned debug_row = g_options.show_debug_info ? 2 : 0;
     const bool show_searching_file = (m_searching && !m_searching_file.Empty());
 #ifdef INCLUDE_MENU_ROW
     const unsigned menu_row = !!g_options.show_menu || show_searching_file;
@@ -549,12 +889,19 @@ void Viewer::UpdateDisplay(StrW* last_screen)
     m_terminal_width = LOWORD(colsrows);
     m_terminal_height = HIWORD(colsrows);
     m_content_height = CalcContentHeight();
+    m_screen.SetSize(m_terminal_width, m_terminal_height);
     const bool show_scrollbar = (g_options.show_scrollbar &&
                                  m_content_height >= 4 &&
                                  !(m_errmsg.Length() || !m_context.HasContent()) &&
                                  m_context.GetFileSize() > 0);
     m_vert_scroll_column = (show_scrollbar ? m_terminal_width - 1 : 0);
 
+    // When comparing, the other file is shown in the right half, and the
+    // current file in the left half.
+    SyncComparePane();
+    const bool split = (IsSplitCompare() && !m_errmsg.Length() && m_context.HasContent());
+    const unsigned split_width = split ? (m_terminal_width - show_scrollbar - 1/*divider*/) / 2 : 0;
+
     // Decide how many hex bytes fit per line.
     InitHexWidth();
 
@@ -562,7 +909,13 @@ void Viewer::UpdateDisplay(StrW* last_screen)
     if (s_goto_line != size_t(-1))
     {
         Error dummy;
-        if (m_context.ProcessThrough(s_goto_line, dummy))
+        FileOffset offset;
+        if (m_context.NewlineNumberToOffset(s_goto_line, offset))
+        {
+            m_found_line.MarkOffset(offset);
+            Center(m_found_line);
+        }
+        else if (m_context.ProcessThrough(s_goto_line, dummy))
         {
             const size_t index = m_context.FriendlyLineNumberToIndex(s_goto_line);
             m_found_line.MarkOffset(m_context.GetOffset(index));
@@ -574,8 +927,25 @@ void Viewer::UpdateDisplay(StrW* last_screen)
         m_found_line.MarkOffset(s_goto_offset);
         Center(m_found_line);
     }
+    else if (m_compare_line != size_t(-1) && !m_hex_mode)
+    {
+        // Show the same place as in the other compared file.
+        Error dummy;
+        FileOffset offset;
+        if (m_context.NewlineNumberToOffset(m_compare_line, offset))
+        {
+            FoundOffset found;
+            found.MarkOffset(offset);
+            m_top = GetFoundLineIndex(found);
+        }
+        else if (m_context.ProcessThrough(m_compare_line, dummy))
+        {
+            m_top = m_context.FriendlyLineNumberToIndex(m_compare_line);
+        }
+    }
     s_goto_line = size_t(-1);
     s_goto_offset = FileOffset(-1);
+    m_compare_line = size_t(-1);
 
     // Process enough lines to display the current screenful of lines.  If
     // processing lines causes the margin width to change, then wrapping and
@@ -586,26 +956,17 @@ LAutoFitContentWidth:
     assert(autofit_retries != 2); // Should be impossible to occur...
     const unsigned margin_width = m_context.CalcMarginWidth(m_hex_mode);
     m_content_width = m_terminal_width - show_scrollbar;
+    if (split)
+        m_content_width = unsigned(std::max<int32>(int32(split_width) - int32(margin_width), 1));
     {
         Error e;
-        m_context.SetWrapWidth(m_wrap ? m_content_width : 0);
+        m_context.SetWrapWidth(m_wrap ? m_content_width : 0, (!m_hex_mode && !m_filtered) ? m_top : size_t(-1));
         working.ShowFeedback(m_context.Completed(), m_context.Count(), m_top + m_content_height, this, false/*bytes*/);
-        if (!m_hex_mode)
-        {
-            m_context.ProcessThrough(m_top + m_content_height, e);
-        }
-        else if (g_options.show_line_numbers)
+        if (!m_hex_mode && !m_filtered)
         {
-            const FileOffset offset_end = min(m_hex_top + (m_hex_width * m_content_height), m_context.GetFileSize());
-            size_t index = m_top;
-            while (!m_context.Completed())
-            {
-                const FileOffset offset_line = m_context.GetOffset(index);
-                if (offset_line >= offset_end)
-                    break;
-                ++index;
-                m_context.ProcessThrough(index, e);
-            }
+            m_top = m_context.SyncIndex(m_top, e);
+            if (!e.Test())
+                m_context.ProcessThrough(m_top + m_content_height, e);
         }
         const unsigned new_margin_width = m_context.CalcMarginWidth(m_hex_mode);
         if (new_margin_width != margin_width)
@@ -649,8 +1010,8 @@ LAutoFitContentWidth:
         {
             // When the ruler is shown, allow the last line to go all the way
             // to the top, to allow easy measuring.
-            if (m_top >= m_context.Count())
-                m_top = m_context.Count() ? m_context.Count() - 1 : 0;
+            if (m_top >= CountRows())
+                m_top = CountRows() ? CountRows() - 1 : 0;
         }
         else
         {
@@ -666,6 +1027,26 @@ LAutoFitContentWidth:
 
     const unsigned mark_row = GetMarkRow(); // Must happen after fixing top offset.
 
+    // Line up the other compared file with the top row.  Its margin can
+    // change while processing, the same as above.
+    size_t pane_top = 0;
+    unsigned pane_width = 0;
+    if (split)
+    {
+        Error e;
+        const unsigned pane_cells = m_terminal_width - show_scrollbar - split_width - 1/*divider*/;
+        for (unsigned retries = 0; retries < 2; ++retries)
+        {
+            const unsigned pane_margin = m_compare_pane.CalcMarginWidth(false/*hex_mode*/);
+            pane_width = unsigned(std::max<int32>(int32(pane_cells) - int32(pane_margin), 1));
+            m_compare_pane.SetWrapWidth(m_wrap ? pane_width : 0);
+            pane_top = GetComparePaneTop();
+            m_compare_pane.ProcessThrough(pane_top + m_content_height, e);
+            if (m_compare_pane.CalcMarginWidth(false/*hex_mode*/) == pane_margin)
+                break;
+        }
+    }
+
 #ifdef INCLUDE_MENU_ROW
     StrW menu;
     {
@@ -719,6 +1100,7 @@ LAutoFitContentWidth:
     const bool top_changed = (m_hex_mode ? (m_last_hex_top != m_hex_top) : (m_last_top != m_top || m_last_left != m_left));
     const bool pos_changed = (m_hex_edit && m_last_hex_pos != m_hex_pos);
     const bool processed_changed = (m_last_processed != m_context.Processed() || m_last_completed != m_context.Completed());
+    const bool filter_grew = (m_filtered && m_last_count != CountRows());
     const bool feedback_changed = (!m_last_feedback.Equal(m_feedback));
     const bool hex_meta_pos_changed = (m_last_hex_characters != m_hex_characters || m_last_hex_high_nybble != m_hex_high_nybble);
 #ifdef INCLUDE_MENU_ROW
@@ -726,13 +1108,22 @@ LAutoFitContentWidth:
 #endif
 
     // Decide what needs to be updated.
-    const bool update_header = (m_force_update || m_force_update_header || file_changed || top_changed || pos_changed || processed_changed);
+    const bool update_header = (m_force_update || m_force_update_header || file_changed || top_changed || pos_changed || processed_changed || filter_grew);
 #ifdef INCLUDE_MENU_ROW
     const bool update_menu_row = (menu_row && (m_force_update || m_force_update_menu));
 #else
     const bool update_menu_row = false;
 #endif
-    const bool update_content = (m_force_update || top_changed);
+    // Hex mode works purely from byte offsets and doesn't wait for the line
+    // map to reach the visible rows; line numbers fill in as background
+    // indexing reaches them.
+    const bool hex_line_numbers_changed = (m_hex_mode && g_options.show_line_numbers &&
+                                           (margin_width != m_last_margin_width ||
+                                            (processed_changed && m_last_processed < m_hex_top + FileOffset(m_hex_width) * m_content_height)));
+    // The filtered view grows as hits arrive, and the end of file marker
+    // moves until the last hit arrives.
+    const bool filter_rows_changed = (filter_grew && m_last_count <= m_top + m_content_height);
+    const bool update_content = (m_force_update || top_changed || hex_line_numbers_changed || filter_rows_changed);
     const bool update_hex_edit = (m_force_update_hex_edit_offset != FileOffset(-1));
     const bool update_mark_row = (!update_content && !update_hex_edit && mark_row != m_last_mark_row);
     const FileOffset update_hex_edit_offset = m_force_update_hex_edit_offset;
@@ -741,7 +1132,49 @@ LAutoFitContentWidth:
         return;
     const bool update_debug_row = debug_row;
 
-    StrW s;
+    // Everything since the previous frame, including input handling and
+    // background work.
+    PerfFrame perf_frame;
+    if (update_debug_row)
+        TakePerfFrame(perf_frame);
+
+    // When only the top moved, let the screen buffer scroll the content rows
+    // instead of redrawing them.  In text mode, the rows that stay on the
+    // screen can be reused as well, so only the rows scrolled into view need
+    // to be formatted.  That requires that nothing else that affects how the
+    // rows look has changed, and that the end of file marker (if any) isn't
+    // left in the wrong place by new lines.
+    int reuse_delta = 0;
+    if (!last_screen && !m_force_update && !file_changed && top_changed && !split && !m_errmsg.Length() && m_context.HasContent())
+    {
+        if (m_hex_mode)
+        {
+            const FileOffset distance = (m_hex_top > m_last_hex_top) ? m_hex_top - m_last_hex_top : m_last_hex_top - m_hex_top;
+            if (!(distance % m_hex_width) && distance / m_hex_width < m_content_height)
+            {
+                const int delta = int(distance / m_hex_width);
+                m_screen.Scroll(2, 2 + m_content_height, (m_hex_top > m_last_hex_top) ? delta : -delta);
+            }
+        }
+        else if (m_last_left == m_left)
+        {
+            const size_t distance = (m_top > m_last_top) ? m_top - m_last_top : m_last_top - m_top;
+            if (distance < m_content_height)
+            {
+                const int delta = (m_top > m_last_top) ? int(distance) : -int(distance);
+                const bool retain = (margin_width == m_last_margin_width &&
+                                     m_content_width == m_last_content_width &&
+                                     m_bookmarks.size() == m_last_bookmark_count &&
+                                     m_found_line.Equals(m_last_found_line) &&
+                                     (CountRows() == m_last_count || m_last_top + m_content_height <= m_last_count));
+                m_screen.Scroll(1, 1 + m_content_height, delta, retain);
+                if (retain)
+                    reuse_delta = delta;
+            }
+        }
+    }
+
+    StrWScratch s;
 
     // Remember states that influence optimizing what to redraw.
     const unsigned last_mark_row = m_last_mark_row;
@@ -757,6 +1190,11 @@ LAutoFitContentWidth:
     m_last_mark_row = mark_row;
     m_last_processed = m_context.Processed();
     m_last_completed = m_context.Completed();
+    m_last_margin_width = margin_width;
+    m_last_content_width = m_content_width;
+    m_last_count = CountRows();
+    m_last_bookmark_count = m_bookmarks.size();
+    m_last_found_line = m_found_line;
 #ifdef INCLUDE_MENU_ROW
     m_last_menu.Set(menu);
 #endif
@@ -766,6 +1204,8 @@ LAutoFitContentWidth:
     m_force_update_footer = false;
 
     // Compute scrollbar metrics.
+    const int32 last_car_top = m_vert_scroll_car.get_car_top();
+    const int32 last_car_size = m_vert_scroll_car.get_car_size();
     if (show_scrollbar)
     {
         m_vert_scroll_car.set_style(c_sbstyle);
@@ -775,7 +1215,7 @@ LAutoFitContentWidth:
             m_vert_scroll_car.set_extents(m_content_height, ((m_context.GetFileSize() - 1) / m_hex_width) + 1);
             m_vert_scroll_car.set_position(m_hex_top / m_hex_width);
         }
-        else if (m_context.Completed())
+        else if (m_filtered || m_context.Completed())
         {
             // Use line based metrics.
             m_vert_scroll_car.set_extents(m_content_height, CountForDisplay());
@@ -783,16 +1223,20 @@ LAutoFitContentWidth:
         }
         else
         {
-            // Otherwise approximate with percentage.
-            const double total = double(m_context.GetFileSize());
-            const intptr_t i_bottom = m_top + m_content_height - 1;
-            const FileOffset offset_bottom = m_context.GetOffset(i_bottom) + m_context.GetLength(i_bottom);
-            const FileOffset bytes_per_line = max<FileOffset>(1, offset_bottom / (i_bottom + 1));
-            m_vert_scroll_car.set_extents(m_content_height, intptr_t(total / bytes_per_line));
+            // Otherwise use the estimated number of rows, so the car's size
+            // and position are roughly right before indexing completes.
+            const size_t estimate = m_context.EstimateRowCount() + g_options.show_endoffile_line;
+            m_vert_scroll_car.set_extents(m_content_height, max<intptr_t>(estimate, m_top + m_content_height));
             m_vert_scroll_car.set_position(m_top);
         }
     }
 
+    // The scrollbar car can move as processing progresses (e.g. by the
+    // background indexing), even when nothing else in the content changed.
+    const bool update_scrollbar = (show_scrollbar && !m_hex_mode && !update_content &&
+                                   (last_car_top != m_vert_scroll_car.get_car_top() ||
+                                    last_car_size != m_vert_scroll_car.get_car_size()));
+
     // Header.
     StrW tmp;
     if (update_header)
@@ -827,6 +1271,11 @@ LAutoFitContentWidth:
         {
             m_clickable_header.Add(L"LIST - ", -1, 999, false);
             m_clickable_header.Add(GetCurrentFile().Text(), ID_FILENAME, 999, false, ellipsify_mode::PATH, c_min_filename_width);
+            if (split)
+            {
+                m_clickable_header.Add(L" \u2502 ", -1, 999, false);
+                m_clickable_header.Add(m_compare_pane.GetName(), -1, 998, false, ellipsify_mode::PATH, c_min_filename_width);
+            }
 
             size_t bottom_line_plusone;
             FileOffset bottom_offset;
@@ -854,11 +1303,17 @@ LAutoFitContentWidth:
             tmp.Clear();
             if (m_hex_mode)
                 tmp.Printf(L"Offset: %06lx-%06lx", m_hex_top, bottom_offset);
+            else if (m_filtered)
+                tmp.Printf(L"Match: %lu", m_top + 1);
             else if (g_options.show_file_offsets)
                 tmp.Printf(L"Offset: %06lx-%06lx", m_context.GetOffset(m_top), bottom_offset);
+            else if (m_context.IsApproximate(m_top))
+                tmp.Printf(L"Line: ~%lu", m_top + 1);
             else
                 tmp.Printf(L"Line: %lu", m_top + 1);
-            if (g_options.show_file_offsets || m_hex_mode)
+            if (m_filtered)
+                tmp.Printf(L" of %lu%s", CountRows(), m_hits.IsRunning() ? L"+" : L"");
+            else if (g_options.show_file_offsets || m_hex_mode)
                 tmp.Printf(L" of %06lx", m_context.GetFileSize());
             else if (!m_context.Completed())
                 tmp.Printf(L"   (%u%%)", LinePercent(bottom_line_plusone));
@@ -873,10 +1328,13 @@ LAutoFitContentWidth:
                 details_width = FormatFileData(details, m_fd, false/*include_size*/);
                 PadToWidth(details, 16);
             }
-            if (m_left && !m_hex_mode)
+            if ((m_left || m_fields_mode) && !m_hex_mode)
             {
                 tmp.Clear();
-                tmp.Printf(L"  Col: %u-%u", m_left + 1, m_left + m_content_width);
+                if (m_fields_mode)
+                    tmp.Printf(L"  Field: %u of %zu", m_fields.GetField(m_field_column) + 1, m_fields.CountFields());
+                else
+                    tmp.Printf(L"  Col: %u-%u", m_left + 1, m_left + m_content_width);
                 PadToWidth(tmp, 16);
                 details.Clear();
                 if (details_width + 4 > tmp.Length())
@@ -911,8 +1369,8 @@ LAutoFitContentWidth:
     {
         s.Printf(L"\x1b[%uH", 2);
 
-        StrW scrollbar_color_car;
-        StrW scrollbar_color_back;
+        StrWInline<64> scrollbar_color_car;
+        StrWInline<64> scrollbar_color_back;
         scrollbar_color_car.Set(ConvertColorParams(ColorElement::ScrollBarCar, ColorConversion::TextOnly));
         scrollbar_color_back.Set(ConvertColorParams(ColorElement::ScrollBar, ColorConversion::TextAsBack));
 
@@ -973,7 +1431,7 @@ LAutoFitContentWidth:
         {
             if (update_content)
             {
-                StrW ruler;
+                StrWInline<256> ruler;
                 ruler.AppendColor(GetColor(ColorElement::Header));
                 ruler.AppendSpaces(margin_width);
                 for (unsigned ii = 0; ii < m_hex_width; ++ii)
@@ -1043,20 +1501,39 @@ LAutoFitContentWidth:
         else
         {
             const FoundOffset* found_line = m_found_line.Empty() ? nullptr : &m_found_line;
+            const int compare_side = m_compare.IsComplete() ? m_compare.GetSide((*m_files)[m_index].Text()) : -1;
+            FoundOffset hit_line;
+            size_t index;
+            StrWScratch line_text;
+            const size_t exposed_begin = (reuse_delta > 0) ? m_content_height - reuse_delta : 0;
+            const size_t exposed_end = (reuse_delta > 0) ? m_content_height : size_t(-reuse_delta);
             for (size_t row = 0; row < m_content_height; ++row)
             {
-                if (g_options.show_endoffile_line && m_top + row == m_context.Count())
+                // Rows that scrolled along with the screen are already there,
+                // except the rows that gain or lose the mark.  When only the
+                // mark moved, only its old and new rows are redrawn.
+                bool skip_row = false;
+                if (reuse_delta)
+                    skip_row = ((row < exposed_begin || row >= exposed_end) && row != mark_row && int(row) != int(last_mark_row) - reuse_delta);
+                else if (update_mark_row)
+                    skip_row = (row != mark_row && row != last_mark_row);
+
+                if (!skip_row && g_options.show_endoffile_line && m_top + row == CountRows() && !(m_filtered && m_hits.IsRunning()))
                 {
                     msg_text = c_endoffile_marker;
                     msg_color = GetColor(ColorElement::EndOfFileLine);
                 }
 
-                if (msg_text)
+                if (skip_row)
+                {
+                    // Nothing to draw, but the scrollbar may have moved.
+                }
+                else if (msg_text)
                 {
                     assert(!update_mark_row); // Performance issue if this ever happens.
 
                     s2.Clear();
-                    const uint32 content_width = m_terminal_width - !!show_scrollbar;
+                    const uint32 content_width = split ? split_width : m_terminal_width - !!show_scrollbar;
                     const unsigned cells = ellipsify_ex(msg_text, content_width, ellipsify_mode::RIGHT, s2, L"");
                     s.AppendColor(msg_color ? msg_color : norm);
                     s.Append(s2);
@@ -1067,23 +1544,34 @@ LAutoFitContentWidth:
                     msg_text = nullptr;
                     msg_color = nullptr;
                 }
-                else if (update_mark_row && row != mark_row && row != last_mark_row)
-                {
-                    s.Append(L"\n");
-                }
-                else if (m_top + row < m_context.Count())
+                else if (GetDisplayRow(m_top + row, index, hit_line, e))
                 {
                     const WCHAR* marked_color = nullptr;
-                    const FileOffset row_offset = m_context.GetOffset(m_top + row);
-                    const unsigned row_length = m_context.GetLength(m_top + row);
+                    const FileOffset row_offset = m_context.GetOffset(index);
+                    const unsigned row_length = m_context.GetLength(index);
 
                     assert(!found_line || !found_line->Empty());
                     if (found_line && row_offset <= found_line->offset && found_line->offset < row_offset + max<size_t>(1, row_length))
                         marked_color = GetColor(ColorElement::MarkedLine);
                     if ((!marked_color || !found_line || found_line->len) && IsBookmarked(row_offset, row_length))
                         marked_color = GetColor(ColorElement::BookmarkedLine);
+                    if (!marked_color && compare_side >= 0 && m_compare.IsDifferent(compare_side, row_offset, row_length))
+                        marked_color = GetColor(ColorElement::DifferentLine);
 
-                    const unsigned width = m_context.FormatLineData(m_top + row, row == mark_row, m_left, s, m_content_width, e, marked_color, found_line);
+                    // The filtered view highlights each row's hit.
+                    const FoundOffset* const row_found_line = m_filtered ? &hit_line : found_line;
+                    unsigned width;
+                    if (m_fields_mode && m_context.GetLineText(index, line_text, e))
+                    {
+                        width = m_fields.FormatRow(line_text.Text(), line_text.Length(), m_left, m_content_width, s, marked_color);
+                    }
+                    else
+                    {
+                        if (m_highlight_all && g_options.searcher)
+                            m_context.SetHighlights(m_visible_matches.GetRowMatches(m_context, *g_options.searcher, index, e));
+                        width = m_context.FormatLineData(index, row == mark_row, m_left, s, m_content_width, e, marked_color, row_found_line);
+                        m_context.SetHighlights(nullptr);
+                    }
                     if (width < m_content_width || show_scrollbar)
                     {
                         // WARNING:  Presumably this is actually defined VT
@@ -1102,6 +1590,40 @@ LAutoFitContentWidth:
                     s.Append(c_clreol);
                 }
 
+                if (split && !skip_row)
+                {
+                    // The other compared file, after a divider.
+                    s.Printf(L"\x1b[%u;%uH", 2 + row, split_width + 1);
+                    s.AppendColor(ConvertColorParams(ColorElement::PopupBorder, ColorConversion::TextOnly));
+                    s.Append(L"\u2502");                                 // │
+                    s.AppendColor(norm);
+
+                    const size_t pane_index = pane_top + row;
+                    if (pane_index < m_compare_pane.Count())
+                    {
+                        const FileOffset row_offset = m_compare_pane.GetOffset(pane_index);
+                        const unsigned row_length = m_compare_pane.GetLength(pane_index);
+                        const WCHAR* const marked_color = ((compare_side >= 0 && m_compare.IsDifferent(!compare_side, row_offset, row_length)) ?
+                                                           GetColor(ColorElement::DifferentLine) : nullptr);
+                        const unsigned width = m_compare_pane.FormatLineData(pane_index, false/*middle*/, m_left, s, pane_width, e, marked_color);
+                        if (width < pane_width || show_scrollbar)
+                            s.Append(c_clreol);
+                    }
+                    else if (g_options.show_endoffile_line && pane_index == m_compare_pane.Count() && m_compare_pane.Completed())
+                    {
+                        s2.Clear();
+                        ellipsify_ex(c_endoffile_marker, m_terminal_width - show_scrollbar - split_width - 1, ellipsify_mode::RIGHT, s2, L"");
+                        s.AppendColor(GetColor(ColorElement::EndOfFileLine));
+                        s.Append(s2);
+                        s.AppendColor(norm);
+                        s.Append(c_clreol);
+                    }
+                    else
+                    {
+                        s.Append(c_clreol);
+                    }
+                }
+
                 if (show_scrollbar)
                 {
                     const WCHAR* car;
@@ -1143,6 +1665,28 @@ LAutoFitContentWidth:
             }
         }
     }
+    else if (update_scrollbar && m_vert_scroll_car.has_car() && !m_errmsg.Length() && m_context.HasContent())
+    {
+        const WCHAR* norm = GetColor(ColorElement::Content);
+        StrWInline<64> scrollbar_color_car;
+        StrWInline<64> scrollbar_color_back;
+        scrollbar_color_car.Set(ConvertColorParams(ColorElement::ScrollBarCar, ColorConversion::TextOnly));
+        scrollbar_color_back.Set(ConvertColorParams(ColorElement::ScrollBar, ColorConversion::TextAsBack));
+
+        for (size_t row = 0; row < m_content_height; ++row)
+        {
+            const WCHAR* car = m_vert_scroll_car.get_char(int32(row), c_floating);
+            s.Printf(L"\x1b[%u;%uH", 2 + row, m_terminal_width);
+            if (c_floating)
+                s.AppendColor(GetColor(ColorElement::FloatingScrollBar));
+            else if (car)
+                s.AppendColorOverlay(scrollbar_color_car.Text(), scrollbar_color_back.Text());
+            else
+                s.AppendColor(scrollbar_color_back.Text());
+            s.Append(car ? car : L" ");
+        }
+        s.AppendColor(norm);
+    }
 
     // Debug row.
     if (g_options.show_debug_info && update_debug_row)
@@ -1164,6 +1708,10 @@ LAutoFitContentWidth:
         }
         if (m_context.GetCodePage())
             right.Printf(L"    Encoding: %u, %s", m_context.GetCodePage(), m_context.GetEncodingName());
+        unsigned writes;
+        unsigned usec;
+        GetOutputConsoleStats(writes, usec);
+        right.Printf(L"    Output: %u writes, %uus", writes, usec);
         if (left.Length() + right.Length() > m_terminal_width)
             right.Clear();
         if (left.Length() > m_terminal_width)
@@ -1175,6 +1723,38 @@ LAutoFitContentWidth:
         s.Append(left);
         s.AppendSpaces(m_terminal_width - (left.Length() + right.Length()));
         s.Append(right);
+
+        // Timings since the previous frame.  The UpdateDisplay time is for
+        // the previous frame, since this one isn't done yet.
+        s.Printf(L"\x1b[%uH", m_terminal_height - menu_row - debug_row + 1);
+        left.Clear();
+        left.Printf(L"Frame: %.1fms, format %.1fms (%I64u rows), out %.1fms (%I64u KB)",
+                    perf_frame.Msec(PerfTimer::UpdateDisplay),
+                    perf_frame.Msec(PerfTimer::FormatLine), perf_frame.Count(PerfCount::RowsFormatted),
+                    perf_frame.Msec(PerfTimer::ConsoleWrite), perf_frame.Count(PerfCount::ConsoleBytes) / 1024);
+        right.Clear();
+        right.Printf(L"    Read: %.1fms (%I64u KB), index %.1fms, find %.1fms",
+                     perf_frame.Msec(PerfTimer::LoadData), perf_frame.Count(PerfCount::BytesRead) / 1024,
+                     perf_frame.Msec(PerfTimer::ProcessLines), perf_frame.Msec(PerfTimer::Find));
+        tmp.Clear();
+        tmp.Printf(L"    Memory: %lu KB", GetTotalMemoryUsage() / 1024);
+        if (GetMemoryBudget())
+            tmp.Printf(L" of %u MB", g_options.memory_budget);
+        for (size_t use = 0; use < size_t(MemoryUse::MAX); ++use)
+        {
+            const size_t usage = GetMemoryUsage(MemoryUse(use));
+            if (usage)
+                tmp.Printf(L", %s %lu KB", GetMemoryUseName(MemoryUse(use)), usage / 1024);
+        }
+        if (left.Length() + right.Length() + tmp.Length() <= m_terminal_width)
+            right.Append(tmp);
+        if (left.Length() + right.Length() > m_terminal_width)
+            right.Clear();
+        if (left.Length() > m_terminal_width)
+            left.SetLength(m_terminal_width);
+        s.Append(left);
+        s.AppendSpaces(m_terminal_width - (left.Length() + right.Length()));
+        s.Append(right);
         s.Append(c_norm);
     }
 
@@ -1275,17 +1855,13 @@ LAutoFitContentWidth:
         s.Append(c_norm);
 
         if (last_screen)
-        {
             (*last_screen) = std::move(s);
-        }
         else
-        {
-            s.Append(c_show_cursor);
-            OutputConsole(c_hide_cursor);
-            OutputConsole(s.Text(), s.Length());
-        }
+            m_screen.Present(s.Text(), s.Length());
     }
 
+    MarkFirstFrame();
+
     m_feedback.Clear();
 }
 
@@ -1409,6 +1985,39 @@ ViewerOutcome Viewer::HandleInput(const InputRecord& input, Error& e)
     int amount = 1;
     AutoCleanup cleanup;
 
+    // The filtered view only scrolls.  Anything else goes back to the full
+    // view first (at the match on the middle row), so that commands apply
+    // to the full view.
+    if (m_filtered)
+    {
+        if (input.type == InputType::Key)
+        {
+            switch (input.key)
+            {
+            case Key::UP:
+            case Key::DOWN:
+            case Key::PGUP:
+            case Key::PGDN:
+            case Key::HOME:
+            case Key::END:
+            case Key::LEFT:
+            case Key::RIGHT:
+                break;
+            case Key::ESC:
+            case Key::ENTER:
+                LeaveFilter();
+                return ViewerOutcome::CONTINUE;
+            default:
+                LeaveFilter();
+                break;
+            }
+        }
+        else if (input.type == InputType::Char && input.key_char != '&')
+        {
+            LeaveFilter();
+        }
+    }
+
     if (input.type == InputType::Key)
     {
         cleanup.Set([&]() {
@@ -1470,11 +2079,16 @@ hex_top:
             }
             break;
         case Key::END:
-            if (!m_hex_mode)
+            if (m_filtered)
+            {
+                m_top = (CountForDisplay() > m_content_height) ? CountForDisplay() - m_content_height : 0;
+            }
+            else if (!m_hex_mode)
             {
                 ScopedWorkingIndicator working;
                 working.ShowFeedback(m_context.Completed(), m_context.Processed(), m_context.GetFileSize(), this, true/*bytes*/);
-                if (m_context.ProcessToEnd(e))
+                m_context.SeekOffset(m_context.GetFileSize(), e);
+                if (!e.Test())
                 {
                     m_top = CountForDisplay();
                     if (m_top > m_content_height)
@@ -1550,7 +2164,7 @@ key_down:
             {
                 if (!m_hex_mode)
                 {
-                    if (!m_context.Completed() || m_top + (g_options.show_ruler ? 0 : m_content_height) < CountForDisplay())
+                    if ((!m_filtered && !m_context.Completed()) || m_top + (g_options.show_ruler ? 0 : m_content_height) < CountForDisplay())
                         ++m_top;
                 }
                 else if (!m_hex_edit)
@@ -1624,7 +2238,7 @@ key_down:
             }
             else
             {
-                if (!m_context.Completed() || m_top + m_content_height + m_content_height - 1 < CountForDisplay())
+                if ((!m_filtered && !m_context.Completed()) || m_top + m_content_height + m_content_height - 1 < CountForDisplay())
                     m_top += m_content_height - 1;
                 else if (CountForDisplay() >= m_content_height)
                     m_top = CountForDisplay() - m_content_height;
@@ -1689,6 +2303,11 @@ hex_edit_right:
             }
             break;
         case Key::F3:
+            if (input.modifier == Modifier::CTRL)
+            {
+                FindAll();
+            }
+            else
             {
                 // F3 = forward, Shift-F3 = backward.
                 const bool next = !HasModifier(input.modifier, Modifier::SHIFT);
@@ -1736,6 +2355,13 @@ hex_edit_right:
                 m_hex_characters = !m_hex_characters;
                 m_hex_high_nybble = true;
             }
+            else if (m_fields_mode && !m_hex_mode)
+            {
+                if (HasModifier(input.modifier, Modifier::SHIFT))
+                    SelectField(m_field_column ? m_field_column - 1 : 0);
+                else
+                    SelectField(m_field_column + 1);
+            }
             break;
         case Key::BACK:
             if (input.modifier == Modifier::None)
@@ -1818,6 +2444,12 @@ hex_edit_right:
             }
             break;
 
+        case 'D'-'@':   // CTRL-D
+            if (input.modifier == Modifier::CTRL)
+            {
+                ToggleCompare();
+            }
+            break;
         case 'E'-'@':
             if (input.modifier == Modifier::CTRL)
             {
@@ -1875,6 +2507,53 @@ hex_edit_right:
                 ShowFileList();
             }
             break;
+        case '&':
+            if (!HasModifier(input.modifier, ~Modifier::SHIFT))
+            {
+                ToggleFilter();
+            }
+            break;
+        case '|':
+            if (!HasModifier(input.modifier, ~Modifier::SHIFT))
+            {
+                ToggleFields();
+            }
+            break;
+        case '<':
+        case '>':
+            if (m_fields_mode && !m_hex_mode && !HasModifier(input.modifier, ~Modifier::SHIFT))
+            {
+                const bool right = (input.key_char == '>');
+                m_fields.MoveColumn(m_field_column, right);
+                SelectField(right ? m_field_column + 1 : (m_field_column ? m_field_column - 1 : 0));
+                m_force_update = true;
+            }
+            break;
+        case '-':
+            if (m_fields_mode && !m_hex_mode && input.modifier == Modifier::None)
+            {
+                m_fields.HideColumn(m_field_column);
+                SelectField(m_field_column);
+                m_force_update = true;
+            }
+            break;
+        case '+':
+            if (m_fields_mode && !m_hex_mode && !HasModifier(input.modifier, ~Modifier::SHIFT))
+            {
+                m_fields.ShowAllColumns();
+                SelectField(0);
+                m_force_update = true;
+            }
+            break;
+        case '*':
+            if (!HasModifier(input.modifier, ~Modifier::SHIFT))
+            {
+                m_highlight_all = !m_highlight_all;
+                m_visible_matches.Clear();
+                m_feedback.Set(m_highlight_all ? L"*** Highlighting all matches ***" : L"*** Highlighting only the found match ***");
+                m_force_update = true;
+            }
+            break;
         case '1':
             if (input.modifier == Modifier::None)
             {
@@ -1927,6 +2606,12 @@ hex_edit_right:
                 ToggleLineEndings();
             }
             break;
+        case 'f':
+            if (input.modifier == Modifier::None)
+            {
+                ToggleFollow();
+            }
+            break;
         case 'g':
             if (!HasModifier(input.modifier, ~Modifier::ALT))
             {
@@ -2039,6 +2724,10 @@ hex_edit_right:
             {
                 ToggleWrap();
             }
+            else if (input.modifier == Modifier::ALT)
+            {
+                ExportContent(e);
+            }
             break;
         case 'x':
         case 'X':
@@ -2130,10 +2819,24 @@ ViewerOutcome Viewer::OnLeftClick(const InputRecord& input, Error& e)
             if (scroll_pos >= 0)
             {
                 FoundOffset found;
-                if (m_hex_mode)
+                if (m_filtered)
+                {
+                    m_top = (size_t(scroll_pos) >= m_content_height / 2) ? scroll_pos - m_content_height / 2 : 0;
+                    return ViewerOutcome::CONTINUE;
+                }
+                else if (m_hex_mode)
                 {
                     found.MarkOffset(scroll_pos * m_hex_width);
                 }
+                else if (!m_context.Completed() && size_t(scroll_pos) >= m_context.Count())
+                {
+                    // Past what's been indexed, the extent is an estimate,
+                    // so go to the proportional offset instead of indexing
+                    // all the way there.
+                    const double extent = double(m_context.EstimateRowCount() + g_options.show_endoffile_line);
+                    const double fraction = std::min(1.0, double(scroll_pos) / std::max(1.0, extent));
+                    found.MarkOffset(FileOffset(fraction * double(m_context.GetFileSize())));
+                }
                 else
                 {
                     if (!m_context.ProcessThrough(scroll_pos, e))
@@ -2221,6 +2924,8 @@ ViewerOutcome Viewer::OnLeftClick(const InputRecord& input, Error& e)
 #endif
     else if (input.mouse_pos.Y == m_terminal_height - 1)
         id = m_clickable_footer.InterpretInput(input);
+    if (id >= 0 && m_filtered)
+        LeaveFilter();
     switch (id)
     {
     case ID_HELP:
@@ -2349,6 +3054,20 @@ void Viewer::SetFile(intptr_t index, ContentCache* context, bool force)
     if (m_text)
         return;
 
+    // Switching between compared files keeps them aligned.
+    m_compare_line = size_t(-1);
+    if (m_compare.IsComplete() && !m_hex_mode && !m_filtered && m_index >= 0 && index != m_index && size_t(index) < m_files->size())
+    {
+        const int side = m_compare.GetSide((*m_files)[m_index].Text());
+        if (side >= 0 && m_compare.GetSide((*m_files)[index].Text()) == !side)
+            m_compare_line = m_compare.AlignLine(side, m_context.GetLineNunber(m_top));
+    }
+
+    m_filtered = false;
+    m_visible_matches.Clear();
+    m_fields_mode = false;
+    m_field_sampler.Clear();
+
     assert(m_files);
     if (index > 0 && size_t(index) >= m_files->size())
         index = m_files->size() - 1;
@@ -2358,6 +3077,10 @@ void Viewer::SetFile(intptr_t index, ContentCache* context, bool force)
     if (index == m_index && !force)
         return;
 
+    // The other compared file is already open beside this one.
+    if (!context && !force && m_compare_pane.IsOpen() && !wcsicmp(m_compare_pane.GetName(), (*m_files)[index].Text()))
+        context = &m_compare_pane;
+
     if (m_index >= 0)
     {
         auto& oldstate = m_file_state_map.find((*m_files)[m_index].Text());
@@ -2393,22 +3116,37 @@ void Viewer::SetFile(intptr_t index, ContentCache* context, bool force)
     m_errmsg.Clear();
     m_index = index;
     m_hex_edit = false;
+    m_follow = false;
     m_hex_high_nybble = true;
     m_can_drag = false;
     m_can_scrollbar = false;
     m_force_update = true;
 
     m_found_line.Clear();
+    m_hits.Clear();
+    m_hit_rows.clear();
 
+    KeepRecentContext();
     m_context.Close();
     ZeroMemory(&m_fd, sizeof(m_fd));
 
+    // Whatever was preloaded so far is better than starting over.
+    AdoptPreloaded(true/*finish*/);
+    m_preload_pending = true;
+
     if (m_files && size_t(m_index) < m_files->size())
     {
+        // Reloading (force) always reopens the file.
+        std::unique_ptr<ContentCache> recent = TakeRecentContext((*m_files)[m_index].Text());
+
         if (context)
         {
             m_context = std::move(*context);
         }
+        else if (!force && recent && recent->Resume())
+        {
+            m_context = std::move(*recent);
+        }
         else
         {
             Error e;
@@ -2446,9 +3184,159 @@ void Viewer::SetFile(intptr_t index, ContentCache* context, bool force)
     }
 }
 
+void Viewer::KeepRecentContext()
+{
+    if (!g_options.recent_files_limit || !m_context.IsOpen() || m_context.IsPipe() || m_context.IsDirty())
+        return;
+
+    auto context = std::make_unique<ContentCache>(g_options);
+    *context = std::move(m_context);
+    context->Suspend();
+    m_recent_contexts.emplace_front(std::move(context));
+    TrimRecentContexts();
+}
+
+void Viewer::TrimRecentContexts()
+{
+    // Evict the least recently viewed files beyond the limits.
+    const size_t limit = size_t(g_options.recent_files_limit) * 1024 * 1024;
+    size_t total = 0;
+    size_t count = 0;
+    for (auto it = m_recent_contexts.begin(); it != m_recent_contexts.end();)
+    {
+        total += (*it)->GetMemoryUsage();
+        if (++count > c_max_recent_contexts || (count > 1 && total > limit))
+            it = m_recent_contexts.erase(it);
+        else
+            ++it;
+    }
+}
+
+size_t Viewer::ReclaimRecentContexts(size_t excess)
+{
+    // Evict the least recently viewed files first.
+    size_t freed = 0;
+    while (freed < excess && !m_recent_contexts.empty())
+    {
+        freed += m_recent_contexts.back()->GetMemoryUsage();
+        m_recent_contexts.pop_back();
+    }
+    return freed;
+}
+
+void Viewer::StartPreloading()
+{
+    m_preload_pending = false;
+    if (!g_options.preload_files || !g_options.recent_files_limit || m_text || !m_files || m_files->size() < 2)
+        return;
+
+    // The next file first, since moving forward is more common.
+    std::vector<StrW> names;
+    for (const intptr_t index : { m_index + 1, m_index - 1 })
+    {
+        if (index < 0 || size_t(index) >= m_files->size())
+            continue;
+        const WCHAR* const name = (*m_files)[index].Text();
+        if (!wcscmp(name, L"<stdin>") || !wcsicmp(name, m_context.GetName()))
+            continue;
+
+        bool recent = false;
+        for (const auto& context : m_recent_contexts)
+            recent |= !wcsicmp(context->GetName(), name);
+        if (!recent)
+            names.emplace_back(name);
+    }
+
+    if (!names.empty())
+        m_preloader.Start(std::move(names), m_wrap ? m_content_width : 0, m_content_height * 2);
+}
+
+void Viewer::AdoptPreloaded(bool finish)
+{
+    std::vector<std::unique_ptr<ContentCache>> contexts;
+    if (finish)
+        m_preloader.Finish(contexts);
+    else if (!m_preloader.Poll(contexts))
+        return;
+
+    for (auto& context : contexts)
+        m_recent_contexts.emplace_front(std::move(context));
+    TrimRecentContexts();
+}
+
+std::unique_ptr<ContentCache> Viewer::TakeRecentContext(const WCHAR* name)
+{
+    for (auto it = m_recent_contexts.begin(); it != m_recent_contexts.end(); ++it)
+    {
+        if (!wcsicmp((*it)->GetName(), name))
+        {
+            std::unique_ptr<ContentCache> context = std::move(*it);
+            m_recent_contexts.erase(it);
+            return context;
+        }
+    }
+    return nullptr;
+}
+
+size_t Viewer::CountRows() const
+{
+    return m_filtered ? m_hits.Count() : m_context.Count();
+}
+
 size_t Viewer::CountForDisplay() const
 {
-    return m_context.Count() + g_options.show_endoffile_line;
+    return CountRows() + g_options.show_endoffile_line;
+}
+
+bool Viewer::GetDisplayRow(size_t row, size_t& index, FoundOffset& hit_line, Error& e)
+{
+    // In the filtered view, a row is the row in m_context that contains a
+    // hit, which is found by its offset since indices in m_context can
+    // shift (e.g. in a sparse window).
+    if (!m_filtered)
+    {
+        index = row;
+        return index < m_context.Count();
+    }
+
+    if (row >= m_hits.Count())
+        return false;
+    const SearchHits::Hit hit = m_hits[row];
+    hit_line.Found(hit.offset, hit.len);
+
+    // Remember the resolved indices, so redrawing doesn't seek to each row
+    // every time.  They're only valid until the indices shift (e.g. after
+    // rewrapping) or the rows are reprocessed (e.g. a different encoding).
+    // Only rows near the screen are worth remembering.
+    const size_t c_max_rows = 1024;
+    if (m_hit_rows_generation != m_context.GetGeneration() ||
+        m_hit_rows_content_generation != m_context.GetContentGeneration() ||
+        m_hit_rows.size() >= c_max_rows)
+    {
+        m_hit_rows.clear();
+        m_hit_rows_generation = m_context.GetGeneration();
+        m_hit_rows_content_generation = m_context.GetContentGeneration();
+    }
+
+    const auto it = m_hit_rows.find(hit.offset);
+    if (it != m_hit_rows.end() && it->second < m_context.Count())
+    {
+        index = it->second;
+        return true;
+    }
+
+    index = m_context.SeekOffset(hit.offset, e);
+    if (e.Test() || index >= m_context.Count())
+        return false;
+
+    // Seeking can shift the indices (e.g. adopting a sparse window).
+    if (m_hit_rows_generation != m_context.GetGeneration())
+    {
+        m_hit_rows.clear();
+        m_hit_rows_generation = m_context.GetGeneration();
+    }
+    m_hit_rows.emplace(hit.offset, index);
+    return true;
 }
 
 void Viewer::DoSearch(bool next, bool caseless)
@@ -2469,142 +3357,1151 @@ void Viewer::DoSearch(bool next, bool caseless)
     OutputConsole(c_norm);
     m_force_update = true;
 
-    if (e.Test())
+    if (e.Test())
+    {
+        ReportError(e);
+        return;
+    }
+
+    if (!searcher)
+        return;
+
+    g_options.searcher = searcher;
+    m_found_line.Clear();
+    m_hits.Clear();
+    FindNext(next);
+}
+
+bool SearchHits::Start(const WCHAR* name, const ContentCache& context, const std::shared_ptr<Searcher>& searcher, unsigned wrap)
+{
+    Clear();
+
+    Error e;
+    m_searcher = searcher->Clone(e);
+    if (!m_searcher)
+        return false;
+
+    m_name.Set(name);
+    m_source = searcher.get();
+    m_codepage = context.GetCodePage();
+    m_binary = context.IsBinaryFile();
+    m_override_encoding = (m_codepage != context.GetDetectedCodePage() || m_binary != context.IsDetectedBinaryFile());
+    m_content_generation = context.GetContentGeneration();
+    m_wrap = wrap;
+
+    m_thread = CreateThread(nullptr, 0, WorkerProc, this, 0, nullptr);
+    if (m_thread.Empty())
+    {
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+void SearchHits::Clear()
+{
+    if (!m_thread.Empty())
+    {
+        m_progress.Cancel();
+        WaitForSingleObject(m_thread, INFINITE);
+        m_thread.Close();
+    }
+
+    m_searcher.reset();
+    m_source = nullptr;
+    std::vector<Hit>().swap(m_hits);
+    m_memory.Set(0);
+    m_progress.Reset();
+    m_canceled = false;
+    m_complete = false;
+}
+
+bool SearchHits::Poll()
+{
+    if (m_thread.Empty() || WaitForSingleObject(m_thread, 0) != WAIT_OBJECT_0)
+        return false;
+
+    m_thread.Close();
+    m_complete = !m_canceled;
+    if (!m_complete)
+        Clear();
+    return true;
+}
+
+bool SearchHits::IsValidFor(const Searcher* searcher, const ContentCache& context, unsigned wrap) const
+{
+    return (m_source &&
+            m_source == searcher &&
+            m_codepage == context.GetCodePage() &&
+            m_binary == context.IsBinaryFile() &&
+            m_content_generation == context.GetContentGeneration() &&
+            m_wrap == wrap);
+}
+
+size_t SearchHits::Count() const
+{
+    EnterCriticalSection(&m_cs);
+    const size_t count = m_hits.size();
+    LeaveCriticalSection(&m_cs);
+    return count;
+}
+
+SearchHits::Hit SearchHits::operator[](size_t index) const
+{
+    EnterCriticalSection(&m_cs);
+    assert(index < m_hits.size());
+    const Hit hit = m_hits[index];
+    LeaveCriticalSection(&m_cs);
+    return hit;
+}
+
+size_t SearchHits::Next(const FoundOffset& from) const
+{
+    assert(IsComplete());
+    if (from.Empty())
+        return m_hits.empty() ? size_t(-1) : 0;
+
+    const auto it = std::upper_bound(m_hits.begin(), m_hits.end(), from.offset, [](FileOffset value, const Hit& hit) {
+        return value < hit.offset;
+    });
+    return (it == m_hits.end()) ? size_t(-1) : size_t(it - m_hits.begin());
+}
+
+size_t SearchHits::Prev(const FoundOffset& from) const
+{
+    assert(IsComplete());
+    if (from.Empty())
+        return m_hits.empty() ? size_t(-1) : m_hits.size() - 1;
+
+    const auto it = std::lower_bound(m_hits.begin(), m_hits.end(), from.offset, [](const Hit& hit, FileOffset offset) {
+        return hit.offset < offset;
+    });
+    return (it == m_hits.begin()) ? size_t(-1) : size_t(it - m_hits.begin()) - 1;
+}
+
+size_t SearchHits::Find(FileOffset offset) const
+{
+    // Returns the last hit at or before offset, or 0 if there isn't one.
+    EnterCriticalSection(&m_cs);
+    const auto it = std::upper_bound(m_hits.begin(), m_hits.end(), offset, [](FileOffset value, const Hit& hit) {
+        return value < hit.offset;
+    });
+    const size_t index = (it == m_hits.begin()) ? 0 : size_t(it - m_hits.begin()) - 1;
+    LeaveCriticalSection(&m_cs);
+    return index;
+}
+
+DWORD WINAPI SearchHits::WorkerProc(void* param)
+{
+    SearchHits* const hits = static_cast<SearchHits*>(param);
+
+    Error e;
+    ContentCache ctx(g_options);
+    ctx.SetProgress(&hits->m_progress);
+    if (!ctx.Open(hits->m_name.Text(), e))
+    {
+        hits->m_canceled = true;
+        return 0;
+    }
+
+    ctx.SetWrapWidth(hits->m_wrap);
+    if (hits->m_override_encoding)
+        ctx.SetEncoding(hits->m_binary ? 0 : hits->m_codepage);
+
+    // Keep the read window large from one hit to the next.
+    BulkReadScope bulk(ctx);
+
+    // The left offset isn't needed, so the width doesn't matter.
+    FoundOffset found_line;
+    unsigned left_offset;
+    bool first = true;
+    while (ctx.Find(true, hits->m_searcher, 999, found_line, left_offset, e, first))
+    {
+        EnterCriticalSection(&hits->m_cs);
+        hits->m_hits.push_back({ found_line.offset, found_line.len });
+        hits->m_memory.Set(hits->m_hits.capacity() * sizeof(Hit));
+        LeaveCriticalSection(&hits->m_cs);
+        hits->m_progress.AddHit();
+        first = false;
+    }
+
+    if (e.Test() && e.Code() != ERROR_HANDLE_EOF)
+        hits->m_canceled = true;
+    return 0;
+}
+
+bool FieldSampler::Start(const WCHAR* name, const ContentCache& context, WCHAR delimiter)
+{
+    Clear();
+
+    m_name.Set(name);
+    m_codepage = context.GetCodePage();
+    m_binary = context.IsBinaryFile();
+    m_override_encoding = (m_codepage != context.GetDetectedCodePage() || m_binary != context.IsDetectedBinaryFile());
+    m_layout.Init(delimiter);
+
+    m_thread = CreateThread(nullptr, 0, WorkerProc, this, 0, nullptr);
+    return !m_thread.Empty();
+}
+
+void FieldSampler::Clear()
+{
+    if (!m_thread.Empty())
+    {
+        m_progress.Cancel();
+        WaitForSingleObject(m_thread, INFINITE);
+        m_thread.Close();
+    }
+
+    m_layout.Clear();
+    m_progress.Reset();
+}
+
+bool FieldSampler::Poll(std::vector<unsigned>& widths)
+{
+    if (m_thread.Empty() || WaitForSingleObject(m_thread, 0) != WAIT_OBJECT_0)
+        return false;
+
+    m_thread.Close();
+    widths = m_layout.GetWidths();
+    return true;
+}
+
+DWORD WINAPI FieldSampler::WorkerProc(void* param)
+{
+    FieldSampler* const sampler = static_cast<FieldSampler*>(param);
+
+    // Probes spread evenly across the file, each measuring a few lines.
+    // SeekOffset() can use a sparse window for each probe, so this doesn't
+    // need to index the whole file.
+    const unsigned c_probes = 64;
+    const unsigned c_lines_per_probe = 16;
+
+    Error e;
+    ContentCache ctx(g_options);
+    ctx.SetProgress(&sampler->m_progress);
+    if (!ctx.Open(sampler->m_name.Text(), e))
+        return 0;
+    if (sampler->m_override_encoding)
+        ctx.SetEncoding(sampler->m_binary ? 0 : sampler->m_codepage);
+
+    StrW text;
+    const FileOffset size = ctx.GetFileSize();
+    for (unsigned probe = 0; probe < c_probes && !sampler->m_progress.IsCanceled(); ++probe)
+    {
+        size_t index = ctx.SeekOffset(size / c_probes * probe, e, true/*cancelable*/);
+        if (e.Test())
+            break;
+
+        // Skip the line the probe landed in; it may be the middle of a
+        // multi-line quoted field.
+        if (probe)
+            ++index;
+        for (unsigned ii = 0; ii < c_lines_per_probe; ++ii, ++index)
+        {
+            if (!ctx.ProcessThrough(index, e, true/*cancelable*/) || index >= ctx.Count())
+                break;
+            if (!ctx.GetLineText(index, text, e))
+                break;
+            sampler->m_layout.Measure(text.Text(), text.Length());
+        }
+        if (e.Test() && e.Code() != ERROR_HANDLE_EOF)
+            break;
+        e.Clear();
+    }
+
+    return 0;
+}
+
+bool FilePreloader::Start(std::vector<StrW>&& names, unsigned wrap, size_t rows)
+{
+    Clear();
+
+    m_job = std::make_shared<Job>();
+    m_job->names = std::move(names);
+    m_job->wrap = wrap;
+    m_job->rows = rows;
+
+    // The worker owns a reference to the job, and releases it when it's done.
+    auto* const ref = new std::shared_ptr<Job>(m_job);
+    m_thread = CreateThread(nullptr, 0, WorkerProc, ref, 0, nullptr);
+    if (m_thread.Empty())
+    {
+        delete ref;
+        m_job.reset();
+        return false;
+    }
+    return true;
+}
+
+void FilePreloader::Clear()
+{
+    std::vector<std::unique_ptr<ContentCache>> discard;
+    Finish(discard);
+}
+
+bool FilePreloader::Poll(std::vector<std::unique_ptr<ContentCache>>& contexts)
+{
+    if (m_thread.Empty() || WaitForSingleObject(m_thread, 0) != WAIT_OBJECT_0)
+        return false;
+
+    Finish(contexts);
+    return true;
+}
+
+void FilePreloader::Finish(std::vector<std::unique_ptr<ContentCache>>& contexts)
+{
+    contexts.clear();
+
+    if (!m_thread.Empty())
+    {
+        m_job->progress.Cancel();
+        const bool stopped = OS::StopThreadIo(m_thread, c_worker_stop_wait);
+        m_thread.Close();
+        if (!stopped)
+        {
+            // Abandon it; the worker releases the job when it finishes.
+            m_job.reset();
+            return;
+        }
+    }
+
+    if (m_job)
+    {
+        contexts = std::move(m_job->contexts);
+        m_job.reset();
+    }
+}
+
+DWORD WINAPI FilePreloader::WorkerProc(void* param)
+{
+    const std::unique_ptr<std::shared_ptr<Job>> ref(static_cast<std::shared_ptr<Job>*>(param));
+    Job* const job = ref->get();
+
+    for (const auto& name : job->names)
+    {
+        if (job->progress.IsCanceled())
+            break;
+
+        Error e;
+        auto ctx = std::make_unique<ContentCache>(g_options);
+        if (!ctx->Open(name.Text(), e) || ctx->IsPipe())
+            continue;
+
+        // Processing the first screens reads the first window and detects
+        // the encoding.  Canceling stops it early, but what's been done so
+        // far is still worth keeping.
+        ctx->SetProgress(&job->progress);
+        ctx->SetWrapWidth(job->wrap);
+        ctx->ProcessThrough(job->rows, e, true/*cancelable*/);
+        ctx->SetProgress(nullptr);
+        ctx->Suspend();
+        job->contexts.emplace_back(std::move(ctx));
+    }
+
+    return 0;
+}
+
+void VisibleMatches::Clear()
+{
+    m_source = nullptr;
+    m_rows.clear();
+}
+
+const std::vector<FoundOffset>* VisibleMatches::GetRowMatches(ContentCache& context, Searcher& searcher, size_t index, Error& e)
+{
+    // Only rows near the screen are worth remembering, so when too many
+    // accumulate (e.g. after jumping around), start over.
+    const size_t c_max_rows = 1024;
+
+    if (m_source != &searcher ||
+        m_codepage != context.GetCodePage() ||
+        m_binary != context.IsBinaryFile() ||
+        m_content_generation != context.GetContentGeneration() ||
+        m_rows.size() >= c_max_rows)
+    {
+        m_rows.clear();
+        m_source = &searcher;
+        m_codepage = context.GetCodePage();
+        m_binary = context.IsBinaryFile();
+        m_content_generation = context.GetContentGeneration();
+    }
+
+    const FileOffset offset = context.GetOffset(index);
+    const unsigned length = context.GetLength(index);
+    auto it = m_rows.find(offset);
+    if (it == m_rows.end() || it->second.length != length)
+    {
+        RowMatches row;
+        row.length = length;
+        if (!context.FindAllInLine(index, searcher, row.spans, e))
+            return nullptr;
+        it = m_rows.insert_or_assign(offset, std::move(row)).first;
+    }
+
+    return it->second.spans.empty() ? nullptr : &it->second.spans;
+}
+
+struct MultiFileSearchResult
+{
+    enum : BYTE { Pending, NotFound, Done };
+
+    std::atomic<BYTE> state = Pending;
+    size_t          index = 0;
+    std::unique_ptr<ContentCache> context;  // When found or canceled.
+    FoundOffset     found_line;
+    unsigned        left_offset = 0;
+    StrW            pattern;                // Which string matched, for AnyOf searches.
+    DWORD           error_code = 0;
+    bool            canceled = false;
+};
+
+// Searches the files after (or before) the current file concurrently.  The
+// earliest hit in traversal order wins, and work on later files is canceled
+// once the winner is known.
+class MultiFileSearch
+{
+    struct Worker
+    {
+        MultiFileSearch* search = nullptr;
+        std::shared_ptr<Searcher> searcher;
+        std::atomic<size_t> position = size_t(-1);
+        ProgressChannel progress;       // Canceled when a file earlier in traversal order has a hit.
+        SHBasic     thread;
+    };
+
+public:
+                    MultiFileSearch(const std::vector<StrW>& files, intptr_t current, bool next, bool hex_mode, unsigned hex_width, unsigned content_width, unsigned wrap);
+                    ~MultiFileSearch() { Stop(); }
+
+    bool            Start(const std::shared_ptr<Searcher>& searcher);
+    bool            Wait(DWORD timeout);
+    void            Cancel() { m_canceled = true; Stop(); }
+    size_t          GetWaitingIndex() const { return IndexAt(m_waiting); }
+    MultiFileSearchResult* GetResult() { return (m_winner < m_results.size()) ? m_results[m_winner].get() : nullptr; }
+    bool            WasCanceled() const { return m_canceled; }
+
+private:
+    size_t          IndexAt(size_t position) const { return m_next ? m_current + 1 + position : m_current - 1 - position; }
+    void            Stop();
+    void            CancelAfter(size_t position);
+    static DWORD WINAPI WorkerProc(void* param);
+
+private:
+    const std::vector<StrW>& m_files;
+    const size_t    m_current;
+    const bool      m_next;
+    const bool      m_hex_mode;
+    const unsigned  m_hex_width;
+    const unsigned  m_content_width;
+    const unsigned  m_wrap;
+    std::vector<std::unique_ptr<MultiFileSearchResult>> m_results;  // By traversal position.
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<size_t> m_queue = 0;
+    std::atomic<size_t> m_limit = size_t(-1);   // Don't start positions past this.
+    SHBasic         m_progress;                 // Signaled when a result is ready.
+    size_t          m_waiting = 0;
+    size_t          m_winner = size_t(-1);
+    bool            m_canceled = false;
+};
+
+MultiFileSearch::MultiFileSearch(const std::vector<StrW>& files, intptr_t current, bool next, bool hex_mode, unsigned hex_width, unsigned content_width, unsigned wrap)
+: m_files(files)
+, m_current(size_t(current))
+, m_next(next)
+, m_hex_mode(hex_mode)
+, m_hex_width(hex_width)
+, m_content_width(content_width)
+, m_wrap(wrap)
+{
+    const size_t count = (next ?
+                          ((m_current + 1 < files.size()) ? files.size() - m_current - 1 : 0) :
+                          std::min<size_t>(m_current, files.size()));
+    for (size_t ii = 0; ii < count; ++ii)
+    {
+        m_results.emplace_back(std::make_unique<MultiFileSearchResult>());
+        m_results.back()->index = IndexAt(ii);
+    }
+}
+
+bool MultiFileSearch::Start(const std::shared_ptr<Searcher>& searcher)
+{
+    const DWORD c_max_search_threads = 8;
+
+    if (m_results.empty())
+        return false;
+
+    m_progress = CreateEvent(nullptr, false, false, nullptr);
+    if (!m_progress)
+        return false;
+
+    const DWORD num_cpus = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    const size_t num_threads = std::min<size_t>(std::min<size_t>(std::max<DWORD>(1, num_cpus), c_max_search_threads), m_results.size());
+    for (size_t ii = 0; ii < num_threads; ++ii)
+    {
+        Error e;
+        auto worker = std::make_unique<Worker>();
+        worker->search = this;
+        worker->searcher = searcher->Clone(e);
+        if (!worker->searcher)
+            break;
+        m_workers.emplace_back(std::move(worker));
+    }
+
+    // Workers read m_workers (to cancel each other), so it must not change
+    // once they're running.
+    bool any = false;
+    for (auto& worker : m_workers)
+    {
+        worker->thread = CreateThread(nullptr, 0, WorkerProc, worker.get(), 0, nullptr);
+        any |= !worker->thread.Empty();
+    }
+
+    return any;
+}
+
+DWORD WINAPI MultiFileSearch::WorkerProc(void* param)
+{
+    Worker* const worker = static_cast<Worker*>(param);
+    MultiFileSearch* const search = worker->search;
+
+    while (!worker->progress.IsCanceled())
+    {
+        const size_t position = search->m_queue++;
+        if (position >= search->m_results.size() || position > search->m_limit)
+            break;
+
+        worker->position = position;
+        MultiFileSearchResult& result = *search->m_results[position];
+
+        Error e;
+        auto ctx = std::make_unique<ContentCache>(g_options);
+        ctx->SetProgress(&worker->progress);
+        if (!ctx->Open(search->m_files[result.index].Text(), e))
+        {
+            result.error_code = e.Code() ? e.Code() : ERROR_OPEN_FAILED;
+            result.state = MultiFileSearchResult::Done;
+            search->CancelAfter(position);
+            SetEvent(search->m_progress);
+            continue;
+        }
+
+        ctx->SetWrapWidth(search->m_wrap);
+        const bool found = (search->m_hex_mode ?
+                ctx->Find(search->m_next, worker->searcher, search->m_hex_width, result.found_line, e, true/*first*/) :
+                ctx->Find(search->m_next, worker->searcher, search->m_content_width, result.found_line, result.left_offset, e, true/*first*/));
+        if (e.Code() == E_ABORT)
+        {
+            // Either Ctrl-Break, or a file earlier in traversal order found
+            // a hit.  Either way, stop.
+            result.canceled = true;
+            result.context = std::move(ctx);
+            result.state = MultiFileSearchResult::Done;
+            SetEvent(search->m_progress);
+            break;
+        }
+
+        if (found)
+        {
+            if (const WCHAR* pattern = worker->searcher->GetMatchedPattern())
+                result.pattern.Set(pattern);
+            result.context = std::move(ctx);
+            result.state = MultiFileSearchResult::Done;
+            search->CancelAfter(position);
+        }
+        else
+        {
+            result.state = MultiFileSearchResult::NotFound;
+        }
+        SetEvent(search->m_progress);
+    }
+
+    worker->position = size_t(-1);
+    SetEvent(search->m_progress);
+    return 0;
+}
+
+void MultiFileSearch::CancelAfter(size_t position)
+{
+    // Lower the limit atomically, in case two workers find hits at once.
+    size_t limit = m_limit;
+    while (position < limit && !m_limit.compare_exchange_weak(limit, position))
+        ;
+
+    for (auto& worker : m_workers)
+    {
+        const size_t worker_position = worker->position;
+        if (worker_position != size_t(-1) && worker_position > m_limit)
+            worker->progress.Cancel();
+    }
+}
+
+bool MultiFileSearch::Wait(DWORD timeout)
+{
+    // Returns true once the outcome is known.
+    if (IsSignaled())
+        m_canceled = true;
+
+    // Skip past the files with no hits; the first file that's done and not
+    // "not found" wins.
+    while (m_waiting < m_results.size() && m_results[m_waiting]->state == MultiFileSearchResult::NotFound)
+        ++m_waiting;
+
+    if (m_waiting >= m_results.size())
+    {
+        Stop();
+        return true;
+    }
+
+    if (m_results[m_waiting]->state == MultiFileSearchResult::Done)
+    {
+        m_winner = m_waiting;
+        Stop();
+        return true;
+    }
+
+    // If every worker has exited, then the rest were never started, which
+    // means the search was canceled.
+    std::vector<HANDLE> handles;
+    for (const auto& worker : m_workers)
+    {
+        if (!worker->thread.Empty())
+            handles.emplace_back(worker->thread);
+    }
+    if (handles.empty() || WaitForMultipleObjects(DWORD(handles.size()), handles.data(), true, 0) != WAIT_TIMEOUT)
+    {
+        while (m_waiting < m_results.size() && m_results[m_waiting]->state == MultiFileSearchResult::NotFound)
+            ++m_waiting;
+        if (m_waiting < m_results.size() && m_results[m_waiting]->state == MultiFileSearchResult::Done)
+            m_winner = m_waiting;
+        else
+            m_canceled = true;
+        Stop();
+        return true;
+    }
+
+    WaitForSingleObject(m_progress, timeout);
+    return false;
+}
+
+void MultiFileSearch::Stop()
+{
+    for (auto& worker : m_workers)
+        worker->progress.Cancel();
+    for (auto& worker : m_workers)
+    {
+        if (!worker->thread.Empty())
+            WaitForSingleObject(worker->thread, INFINITE);
+    }
+    m_workers.clear();
+}
+
+void Viewer::FindNext(bool next)
+{
+    // TODO:  When should a search start over at the top of the file?
+
+    if (!g_options.searcher)
+    {
+        if (!next && m_found_line.Empty())
+        {
+            // Mark where to start searching.
+            m_found_line.MarkOffset(m_context.GetFileSize());
+        }
+        DoSearch(next, true/*caseless*/);
+        return;
+    }
+
+    // Use the hits from Find All, when they're available.
+    if (!m_hex_mode &&
+        m_hits.IsComplete() &&
+        m_hits.IsValidFor(g_options.searcher.get(), m_context, m_wrap ? m_content_width : 0))
+    {
+        const size_t hit = next ? m_hits.Next(m_found_line) : m_hits.Prev(m_found_line);
+        if (hit < m_hits.Count())
+        {
+            JumpToHit(hit);
+            return;
+        }
+        if (m_text || !m_multifile_search || !m_files)
+        {
+            m_feedback = c_text_not_found;
+            return;
+        }
+    }
+
+    assert(!m_searching);
+    m_searching = true;
+    m_searching_file.Clear();
+    m_force_update_footer = true;
+    UpdateDisplay();
+
+    // ESC cancels the search the same as Ctrl-Break, and other keys wait
+    // in the input queue until the search is done.
+    ProgressChannel progress;
+    std::optional<ScopedEscapeWatcher> escape(std::in_place, progress);
+
+    Error e;
+    unsigned left_offset = m_left;
+    m_context.SetProgress(&progress);
+    bool found = (m_hex_mode ?
+            m_context.Find(next, g_options.searcher, m_hex_width, m_found_line, e, m_found_line.Empty()/*first*/) :
+            m_context.Find(next, g_options.searcher, m_content_width, m_found_line, left_offset, e, m_found_line.Empty()/*first*/));
+    m_context.SetProgress(nullptr);
+    bool canceled = (e.Code() == E_ABORT);
+
+    StrW pattern;
+    if (found && g_options.searcher->GetMatchedPattern())
+        pattern.Set(g_options.searcher->GetMatchedPattern());
+
+    if (!found && !canceled && !m_text && m_multifile_search && m_files)
+    {
+        MultiFileSearch search(*m_files, m_index, next, m_hex_mode, m_hex_width, m_content_width, m_wrap ? m_content_width : 0);
+        if (search.Start(g_options.searcher))
+        {
+            // Wait for the earliest file in traversal order that has a hit,
+            // refreshing the footer with the file that's holding things up.
+            const DWORD c_search_refresh = 100;
+            while (!search.Wait(c_search_refresh))
+            {
+                if (progress.IsCanceled())
+                {
+                    search.Cancel();
+                    continue;
+                }
+                m_searching_file = (*m_files)[search.GetWaitingIndex()].Text();
+                m_force_update_footer = true;
+                UpdateDisplay();
+            }
+        }
+        escape.reset();
+
+        MultiFileSearchResult* const result = search.GetResult();
+        if (result)
+        {
+            const size_t index = result->index;
+            if (result->context)
+            {
+                SetFile(index, result->context.get());
+                if (result->canceled)
+                {
+                    Center(result->found_line);
+                    if (!m_hex_mode)
+                        m_left = result->left_offset;
+                    canceled = true;
+                }
+                else
+                {
+                    m_found_line = result->found_line;
+                    left_offset = result->left_offset;
+                    pattern = std::move(result->pattern);
+                    found = true;
+                }
+            }
+            else if (result->error_code)
+            {
+                // Reproduce the error here so it can be reported normally.
+                ContentCache ctx(g_options);
+                ctx.Open((*m_files)[index].Text(), e);
+                if (!e.Test())
+                    e.Sys(result->error_code);
+                SetFile(index, &ctx);
+                e.Format(m_errmsg);
+                ReportError(e);
+                m_force_update = true;
+            }
+            else
+            {
+                canceled = true;
+            }
+        }
+        else if (search.WasCanceled())
+        {
+            canceled = true;
+        }
+    }
+
+    m_searching = false;
+    m_searching_file.Clear();
+    m_force_update_footer = true;
+    m_feedback.Clear();
+
+    if (!found)
+    {
+        m_feedback.Set(canceled ? c_canceled : c_text_not_found);
+    }
+    else
+    {
+        Center(m_found_line);
+        if (!m_hex_mode)
+            m_left = left_offset;
+        if (pattern.Length())
+            m_feedback.Printf(L"*** Found \"%s\" ***", pattern.Text());
+        m_force_update = true;
+    }
+}
+
+void Viewer::FindAll()
+{
+    if (m_text || !m_files || m_context.IsPipe() || !m_context.IsOpen())
+        return;
+
+    if (!g_options.searcher)
+    {
+        DoSearch(true, true/*caseless*/);
+        if (!g_options.searcher)
+            return;
+    }
+
+    // Pressing Ctrl-F3 again lists the hits.
+    const unsigned wrap = m_wrap ? m_content_width : 0;
+    if (m_hits.IsValidFor(g_options.searcher.get(), m_context, wrap))
+    {
+        if (m_hits.IsComplete())
+            ShowHitList();
+        return;
+    }
+
+    if (!m_hits.Start((*m_files)[m_index].Text(), m_context, g_options.searcher, wrap))
+        m_feedback = c_canceled;
+}
+
+void Viewer::ToggleFilter()
+{
+    if (m_filtered)
+    {
+        LeaveFilter();
+        return;
+    }
+
+    if (m_hex_mode || m_text || !m_files || m_context.IsPipe() || !m_context.IsOpen())
+        return;
+
+    if (!g_options.searcher)
+    {
+        DoSearch(true, true/*caseless*/);
+        if (!g_options.searcher)
+            return;
+    }
+
+    // The filtered rows are the search hits, which keep arriving from the
+    // background scan while the filtered view is showing.
+    const unsigned wrap = m_wrap ? m_content_width : 0;
+    if (!m_hits.IsValidFor(g_options.searcher.get(), m_context, wrap))
+    {
+        if (!m_hits.Start((*m_files)[m_index].Text(), m_context, g_options.searcher, wrap))
+        {
+            m_feedback = c_canceled;
+            return;
+        }
+    }
+
+    const size_t mark = m_top + GetMarkRow();
+    const FileOffset offset = (mark < m_context.Count()) ? m_context.GetOffset(mark) : 0;
+
+    m_filter_saved_top = m_top;
+    m_follow = false;
+    m_filtered = true;
+    const size_t hit = m_hits.Find(offset);
+    const unsigned mark_row = GetMarkRow();
+    m_top = (hit > mark_row) ? hit - mark_row : 0;
+    m_force_update = true;
+}
+
+void Viewer::LeaveFilter()
+{
+    if (!m_filtered)
+        return;
+
+    // Return to the full view at the hit on the middle row.
+    const size_t mark = m_top + GetMarkRow();
+    const bool has_hit = (mark < m_hits.Count());
+    const SearchHits::Hit hit = has_hit ? m_hits[mark] : SearchHits::Hit();
+
+    m_filtered = false;
+    if (has_hit)
+    {
+        m_found_line.Found(hit.offset, hit.len);
+        Center(m_found_line);
+    }
+    else
+    {
+        m_top = m_filter_saved_top;
+    }
+    m_force_update = true;
+}
+
+void Viewer::ToggleFields()
+{
+    if (m_fields_mode)
+    {
+        m_fields_mode = false;
+        m_field_sampler.Clear();
+        m_left = 0;
+        m_force_update = true;
+        return;
+    }
+
+    if (m_hex_mode || !m_context.HasContent())
+        return;
+
+    if (m_wrap)
+        ToggleWrap();
+
+    // Estimate the column widths from the lines in view; the sampler refines
+    // them from lines spread across the whole file.
+    const size_t c_sample_rows = 256;
+    Error e;
+    m_context.SetWrapWidth(0, m_top);
+    m_top = m_context.SyncIndex(m_top, e);
+    if (!e.Test())
+        m_context.ProcessThrough(m_top + c_sample_rows, e, true/*cancelable*/);
+
+    std::vector<StrW> rows;
+    const size_t end = std::min(m_top + c_sample_rows, m_context.Count());
+    for (size_t index = m_top; index < end && !e.Test(); ++index)
+    {
+        rows.emplace_back();
+        m_context.GetLineText(index, rows.back(), e);
+    }
+    if (e.Test())
+    {
+        m_feedback = (e.Code() == E_ABORT) ? c_canceled : L"*** Unable to read the lines in view ***";
+        return;
+    }
+
+    const WCHAR delimiter = DetectDelimiter(rows);
+    if (!delimiter)
+    {
+        m_feedback.Set(L"*** The lines in view don't look like delimited fields ***");
+        return;
+    }
+
+    m_fields.Init(delimiter);
+    for (const auto& row : rows)
+        m_fields.Measure(row.Text(), row.Length());
+
+    m_fields_mode = true;
+    m_field_column = 0;
+    m_left = 0;
+    if (!m_text && m_files && !m_context.IsPipe())
+        m_field_sampler.Start((*m_files)[m_index].Text(), m_context, delimiter);
+    m_feedback.Printf(L"*** Fields delimited by %s ***", (delimiter == '\t') ? L"tabs" : (delimiter == ',') ? L"commas" : (delimiter == ';') ? L"semicolons" : L"bars");
+    m_force_update = true;
+}
+
+void Viewer::SelectField(size_t column)
+{
+    if (!m_fields.CountColumns())
+        return;
+
+    m_field_column = std::min(column, m_fields.CountColumns() - 1);
+
+    // Scroll so the whole column is in view, preferring its left edge.
+    const unsigned left = m_fields.GetColumnLeft(m_field_column);
+    const unsigned right = m_fields.GetColumnLeft(m_field_column + 1);
+    if (left < m_left)
+        m_left = left;
+    else if (right > m_left + m_content_width)
+        m_left = (right - left > m_content_width) ? left : right - m_content_width;
+    m_force_update = true;
+}
+
+void Viewer::JumpToHit(size_t hit)
+{
+    m_found_line.Found(m_hits[hit].offset, m_hits[hit].len);
+    Center(m_found_line);
+    if (!m_hex_mode)
+    {
+        Error e;
+        m_left = m_context.GetFoundLeftOffset(m_found_line, m_content_width, e);
+    }
+
+    m_feedback.Printf(L"*** Hit %zu of %zu ***", hit + 1, m_hits.Count());
+    m_force_update = true;
+}
+
+void Viewer::ShowHitList()
+{
+    // Listing needs each hit's row, so don't let a huge list take forever.
+    const size_t c_max_listed_hits = 10000;
+
+    Error e;
+    StrW text;
+    std::vector<StrW> items;
+    intptr_t index = 0;
+    const size_t count = std::min<size_t>(m_hits.Count(), c_max_listed_hits);
+    for (size_t ii = 0; ii < count; ++ii)
+    {
+        const SearchHits::Hit& hit = m_hits[ii];
+        if (!m_found_line.Empty() && hit.offset <= m_found_line.offset)
+            index = intptr_t(ii);
+
+        const size_t line = m_context.SeekOffset(hit.offset, e, true/*cancelable*/);
+        if (e.Test() || !m_context.GetLineText(line, text, e))
+            break;
+
+        StrW item;
+        if (m_context.IsApproximate(line))
+            item.Printf(L"%08I64x:  ", hit.offset);
+        else
+            item.Printf(L"%8zu:  ", m_context.GetLineNunber(line));
+        for (unsigned jj = 0; jj < text.Length(); ++jj)
+        {
+            const WCHAR c = text.Text()[jj];
+            item.Append((c < ' ') ? WCHAR(' ') : c);
+        }
+        items.emplace_back(std::move(item));
+    }
+
+    // Finding rows may have shifted indices in a sparse window.
+    Error dummy;
+    m_top = m_context.SyncIndex(m_top, dummy);
+    m_force_update = true;
+
+    if (e.Test())
+    {
+        if (e.Code() != E_ABORT)
+            ReportError(e);
+        return;
+    }
+
+    StrW title;
+    if (count < m_hits.Count())
+        title.Printf(L"First %zu of %zu Hits", count, m_hits.Count());
+    else
+        title.Printf(L"%zu Hits", count);
+
+    const PopupResult result = ShowPopupList(items, title.Text(), index);
+    if (!result.canceled && size_t(result.selected) < items.size())
+        JumpToHit(size_t(result.selected));
+}
+
+void Viewer::JumpNextEdit(bool next)
+{
+    if (!m_hex_mode)
+    {
+        JumpDifference(next);
+    }
+    else
+    {
+        FileOffset offset;
+        if (m_context.NextEditedByteRow(m_hex_pos, offset, m_hex_width, next))
+        {
+            m_hex_pos = offset;
+            m_hex_high_nybble = next;
+
+            FoundOffset found;
+            found.MarkOffset(offset);
+            Center(found);
+        }
+    }
+}
+
+void Viewer::ToggleCompare()
+{
+    if (m_compare.IsActive())
     {
-        ReportError(e);
+        m_compare.Clear();
+        m_feedback = L"*** Compare off ***";
+        m_force_update = true;
         return;
     }
 
-    if (!searcher)
+    // Compare with the other file, or with the next one if there are more.
+    if (m_text || !m_files || m_files->size() < 2 || m_context.IsPipe())
+    {
+        m_feedback = L"*** Comparing needs two files ***";
         return;
+    }
 
-    g_options.searcher = searcher;
-    m_found_line.Clear();
-    FindNext(next);
+    const size_t other = (size_t(m_index) + 1) % m_files->size();
+    if (m_compare.Start((*m_files)[m_index].Text(), m_context, (*m_files)[other].Text()))
+        m_feedback.Printf(L"*** Comparing with %s... ***", FindName((*m_files)[other].Text()));
 }
 
-void Viewer::FindNext(bool next)
+void Viewer::SyncComparePane()
 {
-    // TODO:  When should a search start over at the top of the file?
-
-    if (!g_options.searcher)
+    // The pane shows whichever compared file isn't the current one.
+    const int side = (m_compare.IsActive() && m_files && m_index >= 0) ? m_compare.GetSide((*m_files)[m_index].Text()) : -1;
+    if (side < 0)
     {
-        if (!next && m_found_line.Empty())
+        if (m_compare_pane.IsOpen())
         {
-            // Mark where to start searching.
-            m_found_line.MarkOffset(m_context.GetFileSize());
+            m_compare_pane.Close();
+            m_force_update = true;
         }
-        DoSearch(next, true/*caseless*/);
         return;
     }
 
-    assert(!m_searching);
-    m_searching = true;
-    m_searching_file.Clear();
-    m_force_update_footer = true;
-    UpdateDisplay();
-
-    Error e;
-    unsigned left_offset = m_left;
-    bool found = (m_hex_mode ?
-            m_context.Find(next, g_options.searcher, m_hex_width, m_found_line, e, m_found_line.Empty()/*first*/) :
-            m_context.Find(next, g_options.searcher, m_content_width, m_found_line, left_offset, e, m_found_line.Empty()/*first*/));
-    bool canceled = (e.Code() == E_ABORT);
+    const WCHAR* const other = m_compare.GetName(!side);
+    if (m_compare_pane.IsOpen() && !wcsicmp(m_compare_pane.GetName(), other))
+        return;
 
-    if (!found && !canceled && !m_text && m_multifile_search && m_files)
+    m_force_update = true;
+    std::unique_ptr<ContentCache> recent = TakeRecentContext(other);
+    if (recent && recent->Resume())
     {
-        size_t index = m_index;
-        ContentCache ctx(g_options);
-        while (!found)
-        {
-            if (next)
-                ++index;
-            else
-                --index;
-            if (index >= m_files->size())
-                break;
+        m_compare_pane = std::move(*recent);
+    }
+    else
+    {
+        // Without the pane, the files are compared one at a time.
+        Error e;
+        m_compare_pane.Open(other, e);
+    }
+}
 
-            m_searching_file = (*m_files)[index].Text();
-            m_force_update_footer = true;
-            UpdateDisplay();
-            Sleep(250);
+bool Viewer::IsSplitCompare() const
+{
+    return (m_compare_pane.IsOpen() && !m_hex_mode && !m_filtered && !m_fields_mode && m_terminal_width >= c_min_split_width);
+}
 
-            Error e;
-            ctx.Open((*m_files)[index].Text(), e);
+size_t Viewer::GetComparePaneTop()
+{
+    if (m_top >= m_context.Count())
+        return 0;
 
-            if (e.Test())
-            {
-                SetFile(index, &ctx);
-                e.Format(m_errmsg);
-                ReportError(e);
-                m_force_update = true;
-                break;
-            }
+    // Until the differences are known, line numbers line up one to one.
+    const int side = m_compare.GetSide((*m_files)[m_index].Text());
+    const size_t line = m_compare.AlignLine(side, m_context.GetLineNunber(m_top));
 
-            FoundOffset found_line;
-            ctx.SetWrapWidth(m_wrap ? m_content_width : 0);
-            found = (m_hex_mode ?
-                    ctx.Find(next, g_options.searcher, m_hex_width, found_line, e, true/*first*/) :
-                    ctx.Find(next, g_options.searcher, m_content_width, found_line, left_offset, e, true/*first*/));
-            if (e.Code() == E_ABORT)
-            {
-                SetFile(index, &ctx);
-                Center(found_line);
-                if (!m_hex_mode)
-                    m_left = left_offset;
-                canceled = true;
-                assert(!found);
-                found = false;
-                break;
-            }
+    Error e;
+    FileOffset offset;
+    if (m_compare_pane.NewlineNumberToOffset(line, offset))
+        return m_compare_pane.SeekOffset(offset, e);
+    if (m_compare_pane.ProcessThrough(line, e))
+        return m_compare_pane.FriendlyLineNumberToIndex(line);
+    return m_compare_pane.Count();
+}
 
-            if (found)
-            {
-                SetFile(index, &ctx);
-                m_found_line = found_line;
-            }
-        }
-    }
+void Viewer::JumpDifference(bool next)
+{
+    if (m_filtered)
+        return;
 
-    m_searching = false;
-    m_searching_file.Clear();
-    m_force_update_footer = true;
-    m_feedback.Clear();
+    const int side = m_compare.IsComplete() ? m_compare.GetSide((*m_files)[m_index].Text()) : -1;
+    if (side < 0)
+        return;
 
-    if (!found)
+    // From the middle row, where the jumps land.
+    FileOffset offset;
+    const FileOffset from = m_context.GetOffset(m_top + GetMarkRow());
+    if (m_compare.NextDifference(side, from, next, offset))
     {
-        m_feedback.Set(canceled ? c_canceled : c_text_not_found);
+        FoundOffset found;
+        found.MarkOffset(offset);
+        Center(found);
     }
     else
     {
-        Center(m_found_line);
-        if (!m_hex_mode)
-            m_left = left_offset;
-        m_force_update = true;
-    }
-}
-
-void Viewer::JumpNextEdit(bool next)
-{
-    if (m_hex_mode)
-    {
-        FileOffset offset;
-        if (m_context.NextEditedByteRow(m_hex_pos, offset, m_hex_width, next))
-        {
-            m_hex_pos = offset;
-            m_hex_high_nybble = next;
-
-            FoundOffset found;
-            found.MarkOffset(offset);
-            Center(found);
-        }
+        m_feedback = next ? L"*** No more differences ***" : L"*** No previous differences ***";
     }
 }
 
 unsigned Viewer::GetMarkRow() const
 {
     if (!m_hex_mode)
-        return unsigned(std::min<size_t>(m_content_height, m_context.Count()) / 2);
+        return unsigned(std::min<size_t>(m_content_height, CountRows()) / 2);
     else if (!m_hex_edit)
         return unsigned(std::min<size_t>(m_content_height / 2, (m_context.GetFileSize() + m_hex_width - 1) / m_hex_width / 2));
     else
@@ -2639,7 +4536,7 @@ bool Viewer::IsBookmarked(FileOffset row_offset, unsigned row_length) const
 
 bool Viewer::CanUseHexEditMode() const
 {
-    return m_hex_mode && !m_text && !m_context.IsPipe();
+    return m_hex_mode && !m_text && !m_context.IsPipe() && !m_context.IsCompressed();
 }
 
 void Viewer::ClearBookmarks()
@@ -2771,12 +4668,21 @@ void Viewer::GoTo(Error& e)
         const unsigned radix = lineno ? 10 : 16;
         if (ParseULongLong(s.Text(), n, radix))
         {
+            FileOffset offset;
             if (!lineno)
             {
                 m_found_line.MarkOffset(n);
             }
+            else if (m_context.NewlineNumberToOffset(size_t(n), offset))
+            {
+                // The newline index finds the line without processing the
+                // rows before it.
+                m_found_line.MarkOffset(offset);
+            }
             else
             {
+                // Line numbers in a sparse window are only estimates.
+                m_context.DiscardSparse();
                 m_context.ProcessThrough(n, e);
                 if (e.Test())
                     return;
@@ -2792,24 +4698,9 @@ void Viewer::GoTo(Error& e)
 size_t Viewer::GetFoundLineIndex(const FoundOffset& found_line)
 {
     assert(!found_line.Empty());
-    size_t line = 0;
-// TODO:  Use binary search over the lines processed so far.
-    for (size_t ii = 0; true; ++ii)
-    {
-        if (ii >= m_context.Count())
-        {
-            Error e;
-            m_context.ProcessThrough(ii + 1, e);
-            // TODO:  Do something with the error?
-            if (ii >= m_context.Count())
-                break;
-        }
-        if (m_context.GetOffset(ii) <= found_line.offset)
-            line = ii;
-        else
-            break;
-    }
-    return line;
+    Error e;
+    // TODO:  Do something with the error?
+    return m_context.SeekOffset(found_line.offset, e);
 }
 
 FileOffset Viewer::GetFoundOffset(const FoundOffset& found_line, unsigned* offset_highlight)
@@ -2829,7 +4720,7 @@ void Viewer::ShowFileList()
     if (!m_files || g_options.internal_help_mode)
         return;
 
-    const PopupResult result = ShowPopupList(*m_files, L"Jump to Chosen File", m_index, PopupListFlags::DimPaths);
+    const PopupResult result = ShowPopupList(*m_files, L"Jump to Chosen File", m_index, PopupListFlags::DimPaths|PopupListFlags::FuzzyFilter);
     m_force_update = true;
     if (!result.canceled)
         SetFile(result.selected);
@@ -2951,6 +4842,215 @@ void Viewer::OpenNewFile(Error& e)
     SetFile(m_index + 1);
 }
 
+bool Viewer::LineNumberToOffset(size_t line, FileOffset& offset, Error& e)
+{
+    // Same as GoTo(), except past the last line is the end of the content.
+    if (m_context.NewlineNumberToOffset(line, offset))
+        return true;
+
+    m_context.DiscardSparse();
+    m_context.ProcessThrough(line, e, true/*cancelable*/);
+    if (e.Test())
+        return false;
+    const size_t index = m_context.FriendlyLineNumberToIndex(line);
+    offset = (index < m_context.Count()) ? m_context.GetOffset(index) : m_context.GetFileSize();
+    return true;
+}
+
+void Viewer::ExportContent(Error& e)
+{
+    if (!m_context.HasContent())
+        return;
+
+#ifdef INCLUDE_MENU_ROW
+    UpdateDisplay();
+#endif
+
+    // The filtered view exports the lines with hits; otherwise it's a range
+    // of lines (or of offsets in hex mode).
+    StrW s;
+    StrW right;
+    StrW range;
+    if (!m_filtered)
+    {
+        right = m_hex_mode ? L"Begin[-End] (base 16, End excluded), or blank for all" : L"First[-Last], or blank for all";
+        s.AppendColor(GetColor(ColorElement::Footer));
+        s.Printf(L"\r%s\x1b[%uG%s\rExport %s%s ", c_clreol, m_terminal_width + 1 - right.Length(), right.Text(), m_hex_mode ? L"offsets" : L"lines", c_prompt_char);
+        OutputConsole(s.Text(), s.Length());
+
+        ReadInput(range, History::MAX, 40, 40);
+
+        OutputConsole(c_norm);
+        m_force_update = true;
+        range.TrimRight();
+    }
+
+    // Parse the range.
+    FileOffset begin = 0;
+    FileOffset end = m_context.GetFileSize();
+    if (!range.Empty())
+    {
+        const unsigned radix = m_hex_mode ? 16 : 10;
+        const WCHAR* const dash = wcschr(range.Text(), '-');
+        StrW first;
+        StrW last;
+        first.Set(range.Text(), dash ? size_t(dash - range.Text()) : range.Length());
+        first.TrimRight();
+        // A single line number is just that line, but a single offset is
+        // where to begin (a range of offsets excludes its end).
+        if (dash)
+            last.Set(dash + 1);
+        else if (!m_hex_mode)
+            last.Set(first.Text());
+
+        ULONGLONG a = m_hex_mode ? 0 : 1;
+        ULONGLONG b = ULONGLONG(-1);
+        if ((!first.Empty() && !ParseULongLong(first.Text(), a, radix)) ||
+            (!last.Empty() && !ParseULongLong(last.Text(), b, radix)) ||
+            b < a || (!m_hex_mode && !a))
+        {
+            m_feedback = L"*** Invalid Range ***";
+            return;
+        }
+
+        if (m_hex_mode)
+        {
+            begin = std::min<FileOffset>(a, end);
+            end = std::min<FileOffset>(b, end);
+        }
+        else
+        {
+            FileOffset offset;
+            if (!LineNumberToOffset(size_t(a), begin, e))
+                return;
+            if (b != ULONGLONG(-1))
+            {
+                if (!LineNumberToOffset(size_t(b + 1), offset, e))
+                    return;
+                end = offset;
+            }
+        }
+    }
+
+    // Choose where to write it.
+    StrW tmp;
+    tmp.Printf(L"Export to file (or |command)%s ", c_prompt_char);
+    s.Clear();
+    s.AppendColor(GetColor(ColorElement::Footer));
+    s.Printf(L"\r%s%s", c_clreol, tmp.Text());
+    OutputConsole(s.Text(), s.Length());
+
+    StrW target;
+    ReadInput(target, History::Export, m_terminal_width - 1 - tmp.Length());
+
+    OutputConsole(c_norm);
+    m_force_update = true;
+
+    target.TrimRight();
+    if (target.Empty())
+        return;
+
+    const bool command = (target.Text()[0] == '|');
+    StrW full;
+    if (!command)
+    {
+        if (!OS::GetFullPathName(target.Text(), full, e))
+            return;
+        if (!m_context.IsPipe() && full.EqualI(m_context.GetName()))
+        {
+            e.Set(L"Can't export a file onto itself.");
+            return;
+        }
+        if (GetFileAttributesW(full.Text()) != INVALID_FILE_ATTRIBUTES)
+        {
+            const bool overwrite = ConfirmOverwrite();
+            m_force_update = true;
+            if (!overwrite)
+                return;
+        }
+    }
+
+    // ESC cancels the same as Ctrl-Break, and the footer shows how much has
+    // been written so far.
+    ProgressChannel progress;
+    std::optional<ScopedEscapeWatcher> escape(std::in_place, progress);
+    Exporter out(progress);
+
+    DWORD last_refresh = GetTickCount();
+    auto refresh = [&]()
+    {
+        const DWORD now = GetTickCount();
+        if (now - last_refresh >= c_export_refresh)
+        {
+            last_refresh = now;
+            m_feedback.Clear();
+            m_feedback.Printf(L"*** Exporting... %I64u KB ***", progress.Bytes() / 1024);
+            m_force_update_footer = true;
+            UpdateDisplay();
+        }
+    };
+
+    if (command ? !out.OpenCommand(target.Text() + 1, e) : !out.OpenFile(full.Text(), e))
+        return;
+
+    size_t lines = 0;
+    m_context.SetProgress(&progress);
+    if (m_filtered)
+    {
+        // A line with several hits is only exported once.
+        FileOffset done = 0;
+        const size_t count = m_hits.Count();
+        for (size_t ii = 0; ii < count; ++ii)
+        {
+            const SearchHits::Hit hit = m_hits[ii];
+            if (hit.offset < done)
+                continue;
+            FileOffset line_begin;
+            FileOffset line_end;
+            if (!m_context.GetLineExtent(hit.offset, line_begin, line_end, e) ||
+                !m_context.ExportBytes(std::max(line_begin, done), line_end, out, e))
+                break;
+            done = line_end;
+            ++lines;
+            refresh();
+        }
+    }
+    else
+    {
+        // In pieces, to show progress.
+        for (FileOffset pos = begin; pos < end;)
+        {
+            const FileOffset piece = std::min<FileOffset>(end - pos, c_export_piece);
+            if (!m_context.ExportBytes(pos, pos + piece, out, e))
+                break;
+            pos += piece;
+            refresh();
+        }
+    }
+    if (!e.Test())
+        out.Close(e);
+    m_context.SetProgress(nullptr);
+    escape.reset();
+
+    m_force_update = true;
+    m_feedback.Clear();
+    if (e.Code() == E_ABORT)
+    {
+        e.Clear();
+        m_feedback = c_canceled;
+    }
+    else if (!e.Test())
+    {
+        if (m_filtered)
+            m_feedback.Printf(L"*** Exported %zu lines (%I64u bytes)", lines, out.GetWritten());
+        else
+            m_feedback.Printf(L"*** Exported %I64u bytes", out.GetWritten());
+        if (out.IsCommand())
+            m_feedback.Printf(L"; command exited with code %d", int(out.GetExitCode()));
+        m_feedback.Append(L" ***");
+    }
+}
+
 ViewerOutcome Viewer::CloseCurrentFile(Error& e)
 {
     if (m_hex_edit && !ToggleHexEditMode(e))
@@ -3104,12 +5204,101 @@ void Viewer::ToggleWrap()
 {
     if (!m_hex_mode && !g_options.internal_help_mode)
     {
+        // Fields can only line up in columns when lines aren't wrapped.
+        if (m_fields_mode && !g_options.wrapping)
+            ToggleFields();
         g_options.wrapping = !g_options.wrapping;
         m_wrap = g_options.wrapping;
         m_force_update = true;
     }
 }
 
+void Viewer::ToggleFollow()
+{
+    if (m_follow)
+    {
+        m_follow = false;
+        m_feedback.Set(L"*** Stopped following ***");
+    }
+    else if (m_context.IsPipeLive() || m_context.IsOpen())
+    {
+        m_follow = true;
+        m_feedback.Set(L"*** Following the end of the file (press F to stop) ***");
+        FollowEnd();
+    }
+}
+
+void Viewer::FollowEnd()
+{
+    if (m_hex_mode)
+    {
+        const FileOffset partial = (m_context.GetFileSize() % m_hex_width);
+        m_hex_top = m_context.GetFileSize() + (partial ? m_hex_width - partial : 0);
+        if (m_hex_top >= m_content_height * m_hex_width)
+            m_hex_top -= m_content_height * m_hex_width;
+        else
+            m_hex_top = 0;
+    }
+    else
+    {
+        Error e;
+        m_context.SeekOffset(m_context.GetFileSize(), e);
+        if (e.Test())
+            return;
+        m_top = CountForDisplay();
+        if (m_top > m_content_height)
+            m_top -= m_content_height;
+        else
+            m_top = 0;
+    }
+    m_force_update = true;
+}
+
+void Viewer::PollGrowth()
+{
+    const size_t count = CountForDisplay();
+    const FileOffset size = m_context.GetFileSize();
+
+    Error e;
+    bool replaced = false;
+    const bool grew = (m_context.IsPipe() ? m_context.PollPipe(e) : m_context.CheckForGrowth(replaced, e));
+    if (replaced)
+    {
+        // The file was truncated or rotated, so start over with whatever is
+        // at the name now.
+        SetFile(m_index, nullptr, true/*force*/);
+        m_follow = m_context.IsOpen();
+        if (m_follow)
+            FollowEnd();
+        m_feedback.Set(L"*** File was truncated or replaced; reloaded ***");
+        return;
+    }
+    if (!grew)
+        return;
+    if (e.Test())
+    {
+        ReportError(e);
+        m_force_update = true;
+    }
+
+    // The header shows the size so far, but the content only needs to be
+    // redrawn if the new input can be visible.
+    m_force_update_header = true;
+    if (m_follow)
+        FollowEnd();
+    else if (m_hex_mode ? (m_hex_top + FileOffset(m_hex_width) * m_content_height > size) : (m_top + m_content_height >= count))
+        m_force_update = true;
+    if (m_context.IsPipe() && !m_context.IsPipeLive())
+        m_follow = false;
+
+    if (m_context.IsOpen())
+    {
+        SHFind sh = FindFirstFileW((*m_files)[m_index].Text(), &m_fd);
+        if (sh.Empty())
+            ZeroMemory(&m_fd, sizeof(m_fd));
+    }
+}
+
 void Viewer::ToggleExpandTabs()
 {
     if (!m_hex_mode && !m_text)
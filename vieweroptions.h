@@ -15,13 +15,16 @@ const DWORD c_default_tab_width = 8;
 #ifdef USE_SMALL_DATA_BUFFER
 const DWORD c_data_buffer_slop = 256;
 const DWORD c_data_buffer_main = 256;
+const DWORD c_data_buffer_bulk = 256 * 8;
 const DWORD c_default_max_line_length = 256;
 #else
 const DWORD c_data_buffer_slop = 4096 * 16;
 const DWORD c_data_buffer_main = 4096 * 24;
+const DWORD c_data_buffer_bulk = 4096 * 1024;
 const DWORD c_default_max_line_length = 2048;
 #endif
 static_assert(c_data_buffer_slop >= c_default_max_line_length);
+static_assert(c_data_buffer_bulk >= c_data_buffer_main);
 
 enum class CtrlMode
 {
@@ -55,6 +58,15 @@ struct ViewerOptions
     bool show_endoffile_line = true;
     bool show_ruler = false;
     bool show_scrollbar = true;
+    bool memory_map_files = false;      // Read local files through a mapped view instead of ReadFile.
+    bool index_cache = false;           // Save line indexes for big files in %LOCALAPPDATA%.
+    bool directory_sizes = false;       // Compute directory sizes in the background in the file chooser.
+    bool preload_files = true;          // Open the next and previous files in the background when viewing several.
+    unsigned block_cache_limit = 64;    // MB of blocks read with ReadFile to keep for revisiting (0 disables).
+    unsigned recent_files_limit = 256;  // MB of state to keep for files viewed recently, to switch back quickly (0 disables).
+    unsigned pipe_memory_limit = 1024;  // MB of piped input to keep in memory; the rest spills to a temp file (0 is no limit).
+    unsigned memory_budget = 0;         // MB for everything together; caches are evicted to stay within it (0 is no budget).
+    unsigned sweep_jobs = 0;            // Programs to run at once in a parallel sweep (0 uses the number of cores).
     uint8 hex_grouping = 0;             // Power of 2.
     WCHAR filter_byte_char = '.';
     unsigned hanging_extra = 8;         // How much to add to leading indent to create hanging indent.
@@ -74,6 +74,26 @@ static bool s_win11 = false;
 
 static int32 resolve_ambiguous_wcwidth(char32_t ucs);
 
+// The mk_wcwidth functions return this for combining marks; wcwidth()
+// resolves it to the current combining mark width.
+static const int32 c_combining_width = 0x100;
+
+// Packed width and property flags; see width_table.
+enum : BYTE
+{
+  WP_WIDTH_MASK       = 0x03,   // 0, 1, 2, or 3 for -1.
+  WP_COMBINING_WIDTH  = 0x04,   // Width is s_combining_mark_width.
+  WP_COMBINING        = 0x08,
+  WP_AMBIGUOUS        = 0x10,
+  WP_EMOJI            = 0x20,
+  WP_UNQUALIFIED_HALF = 0x40,
+};
+
+static const char32_t c_max_codepoint = 0x10ffff;
+static const unsigned c_width_page_bits = 8;
+static const unsigned c_width_page_size = 1 << c_width_page_bits;
+static const unsigned c_width_num_pages = (c_max_codepoint + 1) >> c_width_page_bits;
+
 struct interval {
   char32_t first;
   char32_t last;
@@ -163,9 +183,13 @@ static const struct interval combining[] = {
   { 0xE0020, 0xE007F }, { 0xE0100, 0xE01EF }
 };
 
+static BYTE width_props(char32_t ucs);
+
 bool is_combining(char32_t ucs)
 {
-  return !!bisearch(ucs, combining, _countof(combining) - 1);
+  if (ucs > c_max_codepoint)
+    return false;
+  return !!(width_props(ucs) & WP_COMBINING);
 }
 
 /* The following two functions define the column width of an ISO 10646
@@ -224,7 +248,7 @@ static int32 mk_wcwidth(char32_t ucs)
 
   /* binary search in table of non-spacing characters */
   if (bisearch(ucs, combining, _countof(combining) - 1))
-    return s_combining_mark_width;
+    return c_combining_width;
 
   /* if we arrive here, ucs is not a combining or C0/C1 control character */
   if (ucs < 0x1100)
@@ -298,7 +322,7 @@ static int32 mk_wcwidth_ucs2(char32_t ucs)
 
   /* binary search in table of non-spacing characters */
   if (bisearch(ucs, combining, _countof(combining) - 1))
-    return s_combining_mark_width;
+    return c_combining_width;
 
   /* if we arrive here, ucs is not a combining or C0/C1 control character */
   if (ucs < 0x1100)
@@ -407,7 +431,9 @@ static const struct interval ambiguous[] = {
 
 bool is_east_asian_ambiguous(char32_t ucs)
 {
-  return !!bisearch(ucs, ambiguous, _countof(ambiguous) - 1);
+  if (ucs > c_max_codepoint)
+    return false;
+  return !!(width_props(ucs) & WP_AMBIGUOUS);
 }
 
 /*
@@ -438,10 +464,104 @@ static int32 mk_wcwidth_cjk_ucs2(char32_t ucs)
 }
 
 
+//------------------------------------------------------------------------------
+// wcwidth() and the classification functions are called for each codepoint
+// while indexing and drawing, so the widths and properties are looked up in a
+// two-level table:  a page per 256 codepoints, pointing to a leaf with a byte
+// of packed width and property flags per codepoint.  Each leaf is built the
+// first time its page is used.  The widths depend on the width mode, so each
+// mode has its own table; the property flags are the same in every table.
+
+struct width_table
+{
+  int32 (*impl)(char32_t);
+  BYTE* volatile pages[c_width_num_pages];
+};
+
+static width_table s_default_table = { mk_wcwidth };
+static width_table* s_tables[8] = { &s_default_table };
+static width_table* s_table = &s_default_table;
+
+static void select_width_table(int32 (*impl)(char32_t), unsigned index)
+{
+  assert(index < _countof(s_tables));
+  if (!s_tables[index])
+  {
+    s_tables[index] = new width_table {};
+    s_tables[index]->impl = impl;
+  }
+  assert(s_tables[index]->impl == impl);
+  s_table = s_tables[index];
+}
+
+static const BYTE* build_width_page(width_table* table, unsigned page)
+{
+  BYTE* const leaf = new BYTE[c_width_page_size];
+  const char32_t base = char32_t(page) << c_width_page_bits;
+  for (unsigned i = 0; i < c_width_page_size; ++i)
+  {
+    const char32_t ucs = base + i;
+    const int32 w = table->impl(ucs);
+    assert(w == c_combining_width || (w >= -1 && w <= 2));
+
+    BYTE props = (w == c_combining_width) ? WP_COMBINING_WIDTH : BYTE(w & WP_WIDTH_MASK);
+    if (bisearch(ucs, combining, _countof(combining) - 1))
+      props |= WP_COMBINING;
+    if (bisearch(ucs, ambiguous, _countof(ambiguous) - 1))
+      props |= WP_AMBIGUOUS;
+    if (bisearch(ucs, emojis, _countof(emojis) - 1))
+      props |= WP_EMOJI;
+    if (bisearch(ucs, possible_unqualified_half_width, _countof(possible_unqualified_half_width) - 1))
+      props |= WP_UNQUALIFIED_HALF;
+    leaf[i] = props;
+  }
+
+  // Another thread may have built the same page meanwhile.
+  PVOID prev = InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&table->pages[page]), leaf, nullptr);
+  if (prev)
+  {
+    delete [] leaf;
+    return static_cast<const BYTE*>(prev);
+  }
+  return leaf;
+}
+
+static BYTE width_props(char32_t ucs)
+{
+  assert(ucs <= c_max_codepoint);
+  width_table* const table = s_table;
+  const BYTE* leaf = table->pages[ucs >> c_width_page_bits];
+  if (!leaf)
+    leaf = build_width_page(table, unsigned(ucs >> c_width_page_bits));
+  return leaf[ucs & (c_width_page_size - 1)];
+}
+
+static int32 table_wcwidth(char32_t ucs)
+{
+  if (ucs - 0x20 < 0x5f)
+    return 1;
+
+  int32 w;
+  if (ucs > c_max_codepoint)
+  {
+    w = s_table->impl(ucs);
+  }
+  else
+  {
+    const BYTE props = width_props(ucs);
+    if (props & WP_COMBINING_WIDTH)
+      return s_combining_mark_width;
+    w = props & WP_WIDTH_MASK;
+    if (w == 3)
+      w = -1;
+  }
+  return (w == c_combining_width) ? s_combining_mark_width : w;
+}
+
 
 //------------------------------------------------------------------------------
 typedef int32 wcwidth_t (char32_t);
-wcwidth_t *wcwidth = mk_wcwidth;
+wcwidth_t *wcwidth = table_wcwidth;
 
 #if 0
 typedef int32 wcswidth_t (const char32_t*, size_t);
@@ -490,10 +610,12 @@ void initialize_wcwidth(const wcwidth_modes* modes)
 
     static UINT s_cp = 0; // Static so that it's visible in heap dumps.
     s_cp = GetConsoleOutputCP();
-    if (is_CJK_codepage(s_cp))
-        wcwidth = s_only_ucs2 ? mk_wcwidth_cjk_ucs2 : mk_wcwidth_cjk;
+    const bool cjk = is_CJK_codepage(s_cp);
+    const unsigned index = (cjk ? 4 : 0) + (s_only_ucs2 ? 2 : 0) + (s_color_emoji ? 1 : 0);
+    if (cjk)
+        select_width_table(s_only_ucs2 ? mk_wcwidth_cjk_ucs2 : mk_wcwidth_cjk, index);
     else
-        wcwidth = s_only_ucs2 ? mk_wcwidth_ucs2 : mk_wcwidth;
+        select_width_table(s_only_ucs2 ? mk_wcwidth_ucs2 : mk_wcwidth, index);
 }
 
 bool get_color_emoji()
@@ -536,7 +658,9 @@ bool is_variant_selector(char32_t ucs)
 bool is_possible_unqualified_half_width(char32_t ucs)
 {
     assert(s_color_emoji);
-    return !!bisearch(ucs, possible_unqualified_half_width, _countof(possible_unqualified_half_width) - 1);
+    if (ucs > c_max_codepoint)
+        return false;
+    return !!(width_props(ucs) & WP_UNQUALIFIED_HALF);
 }
 
 /*
@@ -545,7 +669,9 @@ bool is_possible_unqualified_half_width(char32_t ucs)
 bool is_emoji(char32_t ucs)
 {
     assert(s_color_emoji);
-    return !!bisearch(ucs, emojis, _countof(emojis) - 1);
+    if (ucs > c_max_codepoint)
+        return false;
+    return !!(width_props(ucs) & WP_EMOJI);
 }
 
 // vim: ts=2 expandtab sw=2
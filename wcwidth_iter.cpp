@@ -5,12 +5,54 @@
 #include "wcwidth.h"
 #include "wcwidth_iter.h"
 
+#include <emmintrin.h>
+
 //------------------------------------------------------------------------------
+uint32 __printable_ascii_prefix(const WCHAR* s, uint32 len)
+{
+    uint32 i = 0;
+
+    // Eight characters at a time.  The signed compares also reject anything
+    // at or above 0x8000.
+    const __m128i below = _mm_set1_epi16(0x20);
+    const __m128i above = _mm_set1_epi16(0x7e);
+    for (; i + 8 <= len; i += 8)
+    {
+        const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        const __m128i bad = _mm_or_si128(_mm_cmplt_epi16(chars, below), _mm_cmpgt_epi16(chars, above));
+        const int mask = _mm_movemask_epi8(bad);
+        if (mask)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return i + bit / 2;
+        }
+    }
+
+    for (; i < len; ++i)
+    {
+        if (s[i] < 0x20 || s[i] > 0x7e)
+            break;
+    }
+    return i;
+}
+
 uint32 __wcswidth(const WCHAR* s, uint32 len)
 {
-    uint32 count = 0;
+    if (len == uint32(-1))
+        len = uint32(wcslen(s));
+
+    // Printable ASCII is one cell per character, so only use the iterator
+    // for what follows it.  The last ASCII character goes to the iterator
+    // too, in case it begins a sequence (e.g. a keycap emoji).
+    const uint32 ascii = __printable_ascii_prefix(s, len);
+    if (ascii == len)
+        return len;
+
+    const uint32 skip = ascii ? ascii - 1 : 0;
+    uint32 count = skip;
 
-    wcwidth_iter iter(s, len);
+    wcwidth_iter iter(s + skip, int32(len - skip));
     while (iter.next())
         count += iter.character_wcwidth_onectrl();
 
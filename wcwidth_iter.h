@@ -8,6 +8,10 @@
 //------------------------------------------------------------------------------
 uint32 __wcswidth(const WCHAR* s, uint32 len=-1);
 
+// Returns the number of leading printable ASCII characters (each of which is
+// one cell wide), up to len.
+uint32 __printable_ascii_prefix(const WCHAR* s, uint32 len);
+
 //------------------------------------------------------------------------------
 class wcwidth_iter
 {